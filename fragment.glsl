@@ -1,23 +1,114 @@
 #version 330 core
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
 
 in vec3 vNormal;
 in vec2 vUV;
 in vec3 vWorldPos;
+flat in int vDrawID;
 
+// материалы текущего батча, по одному на draw внутри glMultiDrawElements (Model::DrawMaterial)
+struct Material {
+    vec4 color;
+    uvec4 texture;          // TEXTURE_ARRAY: x = слой; BINDLESS: xy = handle
+};
+layout(std140) uniform Materials {
+    Material uMaterials[256];
+};
+
+// вариант TEXTURED берёт цвет из текстуры, иначе из uMaterials[].color
+#if defined(TEXTURED) && defined(TEXTURE_ARRAY)
+uniform sampler2DArray uAlbedo; // слои одного размера и формата, слой — на draw
+#elif defined(TEXTURED) && !defined(BINDLESS)
 uniform sampler2D uAlbedo;
-uniform int uUseTex;        // 0 = use uColor, 1 = use texture
-uniform vec3 uColor;        // если нет текстуры
-uniform vec3 uLightDir;     // направление света (в мировых координатах)
-uniform vec3 uAmbient;      // ambient
+#endif
+// FrameUniforms::FrameBlock, как в vertex.glsl
+layout(std140) uniform Frame {
+    mat4 uView;
+    mat4 uProjection;
+    mat4 uViewProj;
+    vec4 uLightDir;         // направление света (в мировых координатах)
+    vec4 uAmbient;          // ambient
+};
+
+// ClusteredLights: froxel-сетка по фрустуму, у каждой ячейки свой список точечных ламп
+layout(std140) uniform Lights {
+    vec4 uLightTileScale;   // тайл = gl_FragCoord.xy * xy + zw
+    vec4 uLightDepth;       // срез = log(глубина в виде) * x + y
+    uvec4 uLightGrid;       // тайлов по x, по y, срезов, видимых ламп
+};
+uniform samplerBuffer uLightData;       // на лампу два texel'а: позиция + радиус, цвет
+uniform usamplerBuffer uLightCells;     // на ячейку: первый индекс, число ламп
+uniform usamplerBuffer uLightIndices;
+
+// ShadowCascades: каскады тени от солнца, слой массива на каскад
+layout(std140) uniform Shadows {
+    mat4 uShadowMatrix[4];  // мир -> uv слоя + глубина, всё в [0, 1]
+    vec4 uShadowSplits;     // дальняя глубина (в виде) каждого каскада
+    vec4 uShadowTexel;      // размер texel'а каскада в мировых единицах
+    vec4 uShadowParams;     // x = число каскадов (0 = теней нет), y = 1 / размер слоя
+};
+uniform sampler2DArrayShadow uShadowMap;
 
 out vec4 fragColor;
 
+// только лампы своей ячейки: цена зависит от плотности ламп вокруг, а не от их числа
+vec3 pointLights(vec3 N) {
+    float depth = -(uView * vec4(vWorldPos, 1.0)).z;
+    uvec2 tile = uvec2(clamp(gl_FragCoord.xy * uLightTileScale.xy + uLightTileScale.zw, vec2(0.0),
+                             vec2(uLightGrid.xy - 1u)));
+    uint slice = uint(clamp(log(max(depth, 1e-4)) * uLightDepth.x + uLightDepth.y, 0.0, float(uLightGrid.z - 1u)));
+    uvec2 cell = texelFetch(uLightCells, int((slice * uLightGrid.y + tile.y) * uLightGrid.x + tile.x)).xy;
+
+    vec3 sum = vec3(0.0);
+    for (uint i = 0u; i < cell.y; ++i) {
+        int light = int(texelFetch(uLightIndices, int(cell.x + i)).x);
+        vec4 posRadius = texelFetch(uLightData, 2 * light);
+        vec3 toLight = posRadius.xyz - vWorldPos;
+        float dist = length(toLight);
+        // гаснет к радиусу плавно и до нуля
+        float falloff = clamp(1.0 - dist / posRadius.w, 0.0, 1.0);
+        float diff = max(dot(N, toLight / max(dist, 1e-4)), 0.0);
+        sum += texelFetch(uLightData, 2 * light + 1).rgb * (falloff * falloff * diff);
+    }
+    return sum;
+}
+
+// доля солнечного света: 1 = освещено; дальше последнего каскада теней нет
+float sunShadow(vec3 N, float NdotL) {
+    int count = int(uShadowParams.x);
+    float depth = -(uView * vec4(vWorldPos, 1.0)).z;
+    if (count == 0 || depth > uShadowSplits[count - 1]) return 1.0;
+    int c = 0;
+    while (c < count - 1 && depth > uShadowSplits[c]) ++c;
+    // сдвиг по нормали на texel'ы каскада, сильнее под скользящим светом: без acne на склонах
+    vec3 p = vWorldPos + N * (uShadowTexel[c] * (0.5 + 1.5 * (1.0 - NdotL)));
+    vec3 s = (uShadowMatrix[c] * vec4(p, 1.0)).xyz;
+    // 4 выборки со сравнением, каждая сама — билинейный 2x2 PCF
+    float d = 0.5 * uShadowParams.y;
+    float lit = texture(uShadowMap, vec4(s.xy + vec2(-d, -d), float(c), s.z)) +
+                texture(uShadowMap, vec4(s.xy + vec2( d, -d), float(c), s.z)) +
+                texture(uShadowMap, vec4(s.xy + vec2(-d,  d), float(c), s.z)) +
+                texture(uShadowMap, vec4(s.xy + vec2( d,  d), float(c), s.z));
+    return lit * 0.25;
+}
+
 void main(){
     vec3 N = normalize(vNormal);
-    vec3 L = normalize(-uLightDir);
-    float diff = max(dot(N, L), 0.0);
+    vec3 L = normalize(-uLightDir.xyz);
+    float NdotL = max(dot(N, L), 0.0);
+    float diff = NdotL > 0.0 ? NdotL * sunShadow(N, NdotL) : 0.0;
 
-    vec3 baseCol = (uUseTex == 1) ? texture(uAlbedo, vUV).rgb : uColor;
-    vec3 col = uAmbient * baseCol + diff * baseCol;
+#if defined(TEXTURED) && defined(BINDLESS)
+    vec3 baseCol = texture(sampler2D(uMaterials[vDrawID].texture.xy), vUV).rgb;
+#elif defined(TEXTURED) && defined(TEXTURE_ARRAY)
+    vec3 baseCol = texture(uAlbedo, vec3(vUV, float(uMaterials[vDrawID].texture.x))).rgb;
+#elif defined(TEXTURED)
+    vec3 baseCol = texture(uAlbedo, vUV).rgb;
+#else
+    vec3 baseCol = uMaterials[vDrawID].color.rgb;
+#endif
+    vec3 col = (uAmbient.rgb + diff + pointLights(N)) * baseCol;
     fragColor = vec4(col, 1.0);
 }
@@ -0,0 +1,19 @@
+#version 330 core
+// коробка кластера для запроса окклюзии: 36 вершин из gl_VertexID, без буферов
+
+uniform mat4 MVP;
+uniform vec3 uMin;
+uniform vec3 uMax;
+
+// углы: бит 0 — x, бит 1 — y, бит 2 — z; грани против часовой снаружи
+const int kCorners[36] = int[36](0, 4, 6, 0, 6, 2,  1, 3, 7, 1, 7, 5,
+                                 0, 1, 5, 0, 5, 4,  2, 6, 7, 2, 7, 3,
+                                 0, 2, 3, 0, 3, 1,  4, 5, 7, 4, 7, 6);
+
+void main() {
+    int c = kCorners[gl_VertexID];
+    vec3 p = vec3((c & 1) != 0 ? uMax.x : uMin.x,
+                  (c & 2) != 0 ? uMax.y : uMin.y,
+                  (c & 4) != 0 ? uMax.z : uMin.z);
+    gl_Position = MVP * vec4(p, 1.0);
+}
@@ -0,0 +1,5 @@
+#version 330 core
+
+// depth only: the Hi-Z and shadow targets have no colour attachment
+void main() {
+}
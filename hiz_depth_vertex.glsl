@@ -0,0 +1,10 @@
+#version 330 core
+layout(location = 0) in vec3 inPos;
+
+uniform mat4 MVP;
+
+// только глубина окклюдеров для Hi-Z, атрибуты те же, что у vertex.glsl;
+// распаковку квантованной позиции Model уже вшил в MVP
+void main() {
+    gl_Position = MVP * vec4(inPos, 1.0);
+}
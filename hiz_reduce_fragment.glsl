@@ -0,0 +1,23 @@
+#version 330 core
+
+// previous mip level; base = max level, so it's the only one visible here
+uniform sampler2D uDepth;
+uniform ivec2 uSrcSize;
+
+float fetch(ivec2 p) {
+    return texelFetch(uDepth, min(p, uSrcSize - 1), 0).r;
+}
+
+// max of the 2x2 texels under this one; with an odd source size the last
+// row/column of the smaller level covers the leftover texels too
+void main() {
+    ivec2 src = ivec2(gl_FragCoord.xy) * 2;
+    float d = max(max(fetch(src), fetch(src + ivec2(1, 0))),
+                  max(fetch(src + ivec2(0, 1)), fetch(src + ivec2(1, 1))));
+    bool extraX = src.x + 3 == uSrcSize.x;
+    bool extraY = src.y + 3 == uSrcSize.y;
+    if (extraX) d = max(d, max(fetch(src + ivec2(2, 0)), fetch(src + ivec2(2, 1))));
+    if (extraY) d = max(d, max(fetch(src + ivec2(0, 2)), fetch(src + ivec2(1, 2))));
+    if (extraX && extraY) d = max(d, fetch(src + ivec2(2, 2)));
+    gl_FragDepth = d;
+}
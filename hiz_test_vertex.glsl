@@ -0,0 +1,46 @@
+#version 330 core
+// одна точка на кластер, результат уходит в transform feedback
+layout(location = 0) in vec3 inMin;
+layout(location = 1) in vec3 inMax;
+
+uniform mat4 MVP;
+uniform sampler2D uHiZ;     // max-depth pyramid, level 0 at uSize
+uniform ivec2 uSize;
+uniform int uLevels;
+
+flat out uint vVisible;
+
+uint occlusionTest() {
+    vec2 lo = vec2(1e30), hi = vec2(-1e30);
+    float nearZ = 1e30;
+    for (int i = 0; i < 8; ++i) {
+        vec3 c = vec3((i & 1) != 0 ? inMax.x : inMin.x,
+                      (i & 2) != 0 ? inMax.y : inMin.y,
+                      (i & 4) != 0 ? inMax.z : inMin.z);
+        vec4 clip = MVP * vec4(c, 1.0);
+        if (clip.z < -clip.w || clip.w <= 1e-6) return 1u;  // crosses the near plane
+        vec3 ndc = clip.xyz / clip.w;
+        lo = min(lo, ndc.xy);
+        hi = max(hi, ndc.xy);
+        nearZ = min(nearZ, ndc.z);
+    }
+    vec2 p0 = (lo * 0.5 + 0.5) * vec2(uSize);
+    vec2 p1 = (hi * 0.5 + 0.5) * vec2(uSize);
+    if (p1.x < 0.0 || p1.y < 0.0 || p0.x > float(uSize.x) || p0.y > float(uSize.y)) return 0u;
+    ivec2 i0 = clamp(ivec2(floor(p0)), ivec2(0), uSize - 1);
+    ivec2 i1 = clamp(ivec2(floor(p1)), ivec2(0), uSize - 1);
+
+    // coarsest level where the rect spans at most two texels a side
+    int level = 0;
+    while (level + 1 < uLevels && any(greaterThanEqual((i1 >> level) - (i0 >> level), ivec2(2)))) ++level;
+    ivec2 last = textureSize(uHiZ, level) - 1;
+    ivec2 a = min(i0 >> level, last), b = min(i1 >> level, last);
+    float d = max(max(texelFetch(uHiZ, a, level).r, texelFetch(uHiZ, ivec2(b.x, a.y), level).r),
+                  max(texelFetch(uHiZ, ivec2(a.x, b.y), level).r, texelFetch(uHiZ, b, level).r));
+    return nearZ * 0.5 + 0.5 <= d ? 1u : 0u;
+}
+
+void main() {
+    vVisible = occlusionTest();
+    gl_Position = vec4(0.0);
+}
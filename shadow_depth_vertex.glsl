@@ -0,0 +1,24 @@
+#version 330 core
+layout(location = 0) in vec3 inPos;
+
+// ShadowCascades: только позиция, из отдельного потока Model (position-only VBO)
+#ifdef INSTANCED
+layout(location = 3) in uint inInstance; // слот копии в uInstances, как в vertex.glsl
+
+uniform samplerBuffer uInstances;
+uniform mat4 MVP;           // view-projection каскада
+uniform mat4 uDequant;      // распаковка квантованной позиции (единичная для float)
+
+void main() {
+    int base = int(inInstance) * 7;     // матрица, за ней матрица нормалей (здесь не нужна)
+    mat4 M = mat4(texelFetch(uInstances, base), texelFetch(uInstances, base + 1),
+                  texelFetch(uInstances, base + 2), texelFetch(uInstances, base + 3));
+    gl_Position = MVP * (M * (uDequant * vec4(inPos, 1.0)));
+}
+#else
+uniform mat4 MVP;           // каскад * model * распаковка, собрано в Model
+
+void main() {
+    gl_Position = MVP * vec4(inPos, 1.0);
+}
+#endif
@@ -0,0 +1,480 @@
+#include "benchmark.hpp"
+#include "bvh.hpp"
+#include "clusteredLights.hpp"
+#include "meshCache.hpp"
+#include "objImporter.hpp"
+#include "sceneGraph.hpp"
+#include "threadPool.hpp"
+#include "vertexFormat.hpp"
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void report(const char* name, std::vector<double>& samples) {
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (double s : samples) sum += s;
+    std::cout << "[*] " << name << ": min " << samples.front() << " ms, median "
+              << samples[samples.size() / 2] << " ms, mean " << sum / samples.size()
+              << " ms, max " << samples.back() << " ms\n";
+}
+
+bool sameMesh(const MeshData& a, const MeshData& b) {
+    if (a.vertices.size() != b.vertices.size() || a.indices != b.indices || a.ranges.size() != b.ranges.size() ||
+        a.clusters.size() != b.clusters.size())
+        return false;
+    if (std::memcmp(a.clusters.data(), b.clusters.data(), a.clusters.size() * sizeof(MeshCluster)) != 0)
+        return false;
+    if (std::memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(MeshVertex)) != 0)
+        return false;
+    for (size_t i = 0; i < a.ranges.size(); ++i) {
+        const MeshRange& x = a.ranges[i];
+        const MeshRange& y = b.ranges[i];
+        if (x.start != y.start || x.count != y.count || x.color != y.color || x.texPath != y.texPath)
+            return false;
+    }
+    if (a.lods.size() != b.lods.size()) return false;
+    for (size_t i = 0; i < a.lods.size(); ++i) {
+        const MeshLod& x = a.lods[i];
+        const MeshLod& y = b.lods[i];
+        if (x.error != y.error || x.ranges.size() != y.ranges.size() || x.clusters.size() != y.clusters.size())
+            return false;
+        if (std::memcmp(x.ranges.data(), y.ranges.data(), x.ranges.size() * sizeof(MeshSpan)) != 0 ||
+            std::memcmp(x.clusters.data(), y.clusters.data(), x.clusters.size() * sizeof(MeshCluster)) != 0)
+            return false;
+    }
+    return true;
+}
+
+// exact decoder of an IEEE half, the reference for floatToHalf
+double halfToDouble(uint16_t h) {
+    const int exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+    const double sign = (h & 0x8000) ? -1.0 : 1.0;
+    if (exponent == 0x1f) return mantissa ? NAN : sign * INFINITY;
+    if (exponent == 0) return sign * std::ldexp(mantissa, -24);
+    return sign * std::ldexp(1024 + mantissa, exponent - 25);
+}
+
+// packVertices over 1M random vertices: every uv half is the nearest one (ties
+// to even, overflow to infinity), every normal comes back from its octahedral
+// snorm16 pair as vertex.glsl decodes it within kNormalError radians
+bool packingRoundTrips(std::mt19937& rng) {
+    const size_t kVertices = 1000000;
+    const float kNormalError = 1e-4f;
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::normal_distribution<float> gauss;
+    std::vector<MeshVertex> vertices(kVertices);
+    auto randomHalfInput = [&](size_t i) {
+        // texture-sized values, then magnitudes from under the denormals to past the largest half
+        static const float special[] = {0.0f, -0.0f, INFINITY, -INFINITY, NAN, 65504.0f, 65519.99f, 65520.0f,
+                                        5.9604645e-8f, 2.9802322e-8f, 2.9802326e-8f, 6.1035156e-5f, 1.0f + 1.0f / 2048.0f};
+        if (i < sizeof(special) / sizeof(special[0])) return special[i];
+        const float sign = unit(rng) < 0.5f ? -1.0f : 1.0f;
+        if (i % 2) return sign * unit(rng) * 4.0f;
+        return sign * std::ldexp(1.0f + unit(rng), static_cast<int>(unit(rng) * 48.0f) - 30);
+    };
+    for (size_t i = 0; i < kVertices; ++i) {
+        MeshVertex& v = vertices[i];
+        v.pos = glm::vec3(0.0f);
+        glm::vec3 n(gauss(rng), gauss(rng), gauss(rng));
+        v.normal = glm::length(n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f, 0.0f, 1.0f);
+        v.uv = glm::vec2(randomHalfInput(2 * i), randomHalfInput(2 * i + 1));
+    }
+    std::vector<PackedVertex> packed;
+    packVertices(vertices.data(), vertices.size(), glm::vec3(0.0f), glm::vec3(1.0f), packed);
+
+    auto nearestHalf = [](float value, uint16_t h) {
+        const double back = halfToDouble(h);
+        if (std::isnan(value)) return std::isnan(back);
+        if (std::signbit(back) != std::signbit(value)) return false;
+        const double v = std::fabs(static_cast<double>(value)), got = std::fabs(back);
+        const uint16_t magnitude = h & 0x7fff;
+        // 65520 and up round to infinity, as the next half past 65504 would be 65536
+        if (v >= 65520.0) return magnitude == 0x7c00;
+        if (magnitude >= 0x7c00) return false;
+        const double below = magnitude ? std::fabs(halfToDouble(magnitude - 1)) : -1.0;
+        const double above = std::fabs(halfToDouble(magnitude + 1));
+        const double error = std::fabs(got - v);
+        if (error > std::fabs(above - v) || (magnitude && error > std::fabs(below - v))) return false;
+        const bool tie = error == std::fabs(above - v) || (magnitude && error == std::fabs(below - v));
+        return !tie || (magnitude & 1) == 0;
+    };
+    for (size_t i = 0; i < kVertices; ++i) {
+        const MeshVertex& v = vertices[i];
+        const PackedVertex& p = packed[i];
+        for (int k = 0; k < 2; ++k) {
+            if (!nearestHalf(v.uv[k], p.uv[k])) {
+                std::cerr << "floatToHalf(" << v.uv[k] << ") = 0x" << std::hex << p.uv[k] << std::dec
+                          << " is not the nearest half\n";
+                return false;
+            }
+        }
+        // vertex.glsl: snorm16 to [-1, 1], then octDecode
+        const glm::vec2 e(std::max(p.normal[0] / 32767.0f, -1.0f), std::max(p.normal[1] / 32767.0f, -1.0f));
+        glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+        if (n.z < 0.0f) {
+            const float sx = n.x >= 0.0f ? 1.0f : -1.0f, sy = n.y >= 0.0f ? 1.0f : -1.0f;
+            n = glm::vec3((1.0f - std::fabs(n.y)) * sx, (1.0f - std::fabs(n.x)) * sy, n.z);
+        }
+        n = glm::normalize(n);
+        // the chord, as good as the angle this close and without acos' rounding near 1
+        if (glm::length(n - v.normal) > kNormalError) {
+            std::cerr << "Normal (" << v.normal.x << ", " << v.normal.y << ", " << v.normal.z
+                      << ") comes back as (" << n.x << ", " << n.y << ", " << n.z << ")\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Brute force against ClusteredLights: random points of the frustum, and every
+// light whose sphere holds a point must be in the list of the point's froxel.
+// The assignment may be loose, never short.
+bool lightsCoverFroxels(std::mt19937& rng) {
+    const int kLights = 4096, kPoints = 200000;
+    const float zNear = 0.1f, zFar = 100.0f;
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 1.5f, -4.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, zNear, zFar);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // around the camera and past both planes, small lights and big ones; view
+    // space as plain arrays, the inner loop below runs 800M times
+    ClusteredLights clustered;
+    std::vector<float> lx(kLights), ly(kLights), lz(kLights), lr2(kLights);
+    for (int i = 0; i < kLights; ++i) {
+        const glm::vec3 position(unit(rng) * 160.0f - 80.0f, unit(rng) * 20.0f - 8.0f, unit(rng) * 120.0f - 110.0f);
+        const float radius = 0.05f + 8.0f * unit(rng) * unit(rng);
+        clustered.lights().push_back({position, radius, glm::vec3(1.0f)});
+        const glm::vec4 c = view * glm::vec4(position, 1.0f);
+        lx[i] = c.x;
+        ly[i] = c.y;
+        lz[i] = c.z;
+        // a hair inside the sphere, rounding on the surface isn't a miss
+        lr2[i] = radius * radius * 0.9998f;
+    }
+    clustered.assign(view, projection);
+
+    std::vector<uint32_t> list;
+    std::vector<uint8_t> inside(kLights);
+    for (int k = 0; k < kPoints; ++k) {
+        const float depth = zNear * std::pow(zFar / zNear, unit(rng));
+        const glm::vec3 p((unit(rng) * 2.0f - 1.0f) * depth / projection[0][0],
+                          (unit(rng) * 2.0f - 1.0f) * depth / projection[1][1], -depth);
+        clustered.lightsAt(p, projection, list);
+        // distances first without a branch, then the rare hits
+        for (int i = 0; i < kLights; ++i) {
+            const float dx = p.x - lx[i], dy = p.y - ly[i], dz = p.z - lz[i];
+            inside[i] = dx * dx + dy * dy + dz * dz < lr2[i];
+        }
+        for (int i = 0; i < kLights; ++i) {
+            if (inside[i] && !std::binary_search(list.begin(), list.end(), uint32_t(i))) {
+                std::cerr << "Light " << i << " is missing from the froxel of (" << p.x << ", " << p.y << ", "
+                          << p.z << ")\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// a JSON string literal, quotes included; driver strings may hold anything
+std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+int runImportBenchmark(const std::string& objPath, int iterations) {
+    iterations = std::max(iterations, 1);
+    const std::string cachePath = MeshCache::pathFor(objPath);
+
+    // stands in for glBufferData: the driver copies the whole buffer either way
+    std::vector<char> upload;
+    auto fakeUpload = [&upload](const void* verts, size_t vbytes, const void* idx, size_t ibytes) {
+        upload.resize(vbytes + ibytes);
+        if (vbytes) std::memcpy(upload.data(), verts, vbytes);
+        if (ibytes) std::memcpy(upload.data() + vbytes, idx, ibytes);
+    };
+
+    std::vector<double> serial, cold, bake, cached;
+    MeshData reference, mesh;
+    MeshOptimizeReport vertexCache;
+    for (int i = 0; i < iterations; ++i) {
+        auto t0 = Clock::now();
+        if (!importObj(objPath, reference, false)) {
+            std::cerr << "Import failed: " << objPath << "\n";
+            return 1;
+        }
+        serial.push_back(msSince(t0));
+
+        t0 = Clock::now();
+        uint64_t hash = MeshCache::hashSource(objPath);
+        if (!importObj(objPath, mesh, true, &vertexCache)) {
+            std::cerr << "Import failed: " << objPath << "\n";
+            return 1;
+        }
+        fakeUpload(mesh.vertices.data(), mesh.vertices.size() * sizeof(MeshVertex),
+                   mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+        cold.push_back(msSince(t0));
+
+        if (!sameMesh(reference, mesh)) {
+            std::cerr << "Parallel import differs from the serial one: " << objPath << "\n";
+            return 1;
+        }
+
+        t0 = Clock::now();
+        if (!MeshCache::write(cachePath, hash, mesh)) return 1;
+        bake.push_back(msSince(t0));
+    }
+
+    for (int i = 0; i < iterations; ++i) {
+        auto t0 = Clock::now();
+        MeshCache cache;
+        if (!cache.open(cachePath, MeshCache::hashSource(objPath))) {
+            std::cerr << "Failed to open mesh cache: " << cachePath << "\n";
+            return 1;
+        }
+        fakeUpload(cache.vertices(), cache.vertexCount() * sizeof(MeshVertex),
+                   cache.indices(), cache.indexCount() * sizeof(unsigned int));
+        cached.push_back(msSince(t0));
+    }
+
+    // full resolution only, the LODs are for drawing
+    const size_t baseIndices = baseIndexCount(mesh.ranges);
+    std::vector<double> bvhBuild;
+    Bvh bvh;
+    for (int i = 0; i < iterations; ++i) {
+        auto t0 = Clock::now();
+        bvh.build(mesh.vertices.data(), mesh.vertices.size(), mesh.indices.data(), baseIndices);
+        bvhBuild.push_back(msSince(t0));
+    }
+
+    // segments between random points of the bounding box, a mix of hits and misses
+    const int kRays = 100000;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const glm::vec3 lo = bvh.boundsMin(), extent = bvh.boundsMax() - lo;
+    auto randomPoint = [&] { return lo + extent * glm::vec3(unit(rng), unit(rng), unit(rng)); };
+    std::vector<glm::vec3> ends(kRays * 2);
+    for (glm::vec3& p : ends) p = randomPoint();
+    int hits = 0;
+    auto t0 = Clock::now();
+    for (int i = 0; i < kRays; ++i) {
+        BvhHit hit;
+        hits += bvh.segment(ends[i * 2], ends[i * 2 + 1], hit);
+    }
+    const double rayUs = msSince(t0) * 1000.0 / kRays;
+
+    // scene graph: a random forest of kNodes, all of it dirty, then 1% of it (and the subtrees)
+    const int kNodes = 100000, kRoots = 100, kTouched = kNodes / 100;
+    SceneGraph graph;
+    std::vector<SceneGraph::Node> graphNodes;
+    graphNodes.reserve(kNodes);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    auto randomLocal = [&] {
+        glm::mat4 m(1.0f);
+        m[3] = glm::vec4(offset(rng), offset(rng), offset(rng), 1.0f);
+        return m;
+    };
+    for (int i = 0; i < kNodes; ++i) {
+        const SceneGraph::Node parent = i < kRoots ? SceneGraph::kNone : graphNodes[rng() % i];
+        graphNodes.push_back(graph.create(randomLocal(), parent));
+    }
+    graph.update();
+    std::vector<double> graphFull, graphPartial;
+    size_t partialCount = 0;
+    for (int i = 0; i < iterations; ++i) {
+        for (SceneGraph::Node n : graphNodes) graph.setLocal(n, randomLocal());
+        t0 = Clock::now();
+        graph.update();
+        graphFull.push_back(msSince(t0));
+
+        for (int k = 0; k < kTouched; ++k) graph.setLocal(graphNodes[rng() % kNodes], randomLocal());
+        t0 = Clock::now();
+        partialCount += graph.update();
+        graphPartial.push_back(msSince(t0));
+    }
+
+    std::cout << "[*] " << objPath << ": " << mesh.vertices.size() << " vertices, "
+              << baseIndices / 3 << " triangles, " << mesh.ranges.size() << " ranges, "
+              << mesh.clusters.size() << " clusters, " << mesh.lods.size() << " lods, "
+              << ThreadPool::shared().size() + 1 << " import threads\n";
+    report("serial import", serial);
+    report("cold import ", cold);
+    report("cache bake ", bake);
+    report("cached load", cached);
+    report("bvh build  ", bvhBuild);
+    std::cout << "[*] bvh: " << bvh.nodes().size() << " nodes, segment query " << rayUs << " us ("
+              << hits * 100 / kRays << "% hit)\n";
+    std::cout << "[*] vertex cache (FIFO " << kVertexCacheSize << "): ACMR " << vertexCache.before.acmr << " -> "
+              << vertexCache.after.acmr << ", ATVR " << vertexCache.before.atvr << " -> " << vertexCache.after.atvr << "\n";
+    std::cout << "[*] scene graph: " << kNodes << " nodes, " << kTouched << " touched -> "
+              << partialCount / iterations << " recomputed\n";
+    report("graph full ", graphFull);
+    report("graph part ", graphPartial);
+    for (size_t i = 0; i < mesh.lods.size(); ++i) {
+        size_t indices = 0;
+        for (const MeshSpan& span : mesh.lods[i].ranges) indices += span.count;
+        std::cout << "[*] lod " << i + 1 << ": " << indices / 3 << " triangles, error " << mesh.lods[i].error << "\n";
+    }
+    return 0;
+}
+
+int runSelfTest() {
+    std::mt19937 rng(1234);
+    int result = 0;
+
+    // the packed vertex format must round-trip what it claims to
+    auto t0 = Clock::now();
+    if (packingRoundTrips(rng)) {
+        std::cout << "[*] vertex packing: halves and octahedral normals round-trip over 1000000 vertices ("
+                  << msSince(t0) << " ms)\n";
+    } else {
+        std::cerr << "Packed vertex format round trip failed\n";
+        result = 1;
+    }
+
+    // light assignment must be conservative: a light left out of a froxel it reaches pops at the border
+    t0 = Clock::now();
+    if (lightsCoverFroxels(rng)) {
+        std::cout << "[*] light assignment: conservative over 200000 points, 4096 lights (" << msSince(t0)
+                  << " ms)\n";
+    } else {
+        std::cerr << "Clustered light assignment misses lights\n";
+        result = 1;
+    }
+    return result;
+}
+
+bool CameraPath::load(const std::string& path) {
+    std::ifstream ifs(path);
+    if (!ifs) {
+        std::cerr << "Failed to open camera path: " << path << "\n";
+        return false;
+    }
+    eyes_.clear();
+    fronts_.clear();
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::istringstream ss(line);
+        glm::vec3 e, f;
+        if (ss >> e.x >> e.y >> e.z >> f.x >> f.y >> f.z) {
+            eyes_.push_back(e);
+            fronts_.push_back(f);
+        }
+    }
+    if (empty()) {
+        std::cerr << "Camera path needs at least two keys: " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+void CameraPath::makeOrbit(const glm::vec3& boundsMin, const glm::vec3& boundsMax, int keys) {
+    eyes_.clear();
+    fronts_.clear();
+    const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    const glm::vec3 radius = (boundsMax - boundsMin) * 0.35f;
+    const float eyeY = std::min(boundsMin.y + 1.0f, center.y);
+    for (int i = 0; i < keys; ++i) {
+        float a = glm::two_pi<float>() * i / keys;
+        // alternate between two radii so the path crosses walls instead of circling them
+        float r = (i % 2) ? 0.5f : 1.0f;
+        glm::vec3 eye(center.x + std::cos(a) * radius.x * r, eyeY, center.z + std::sin(a) * radius.z * r);
+        glm::vec3 look(center.x, eyeY, center.z);
+        glm::vec3 f = look - eye;
+        eyes_.push_back(eye);
+        fronts_.push_back(glm::length(f) > 1e-4f ? glm::normalize(f) : glm::vec3(0.0f, 0.0f, -1.0f));
+    }
+}
+
+void CameraPath::sample(float t, glm::vec3& eye, glm::vec3& front) const {
+    const int n = static_cast<int>(eyes_.size());
+    float u = (t - std::floor(t)) * n;
+    int i = static_cast<int>(u) % n;
+    float s = u - std::floor(u);
+    auto at = [n](const std::vector<glm::vec3>& v, int k) { return v[((k % n) + n) % n]; };
+    auto catmull = [s](glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3) {
+        float s2 = s * s, s3 = s2 * s;
+        return 0.5f * ((2.0f * p1) + (p2 - p0) * s + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * s2 +
+                       (3.0f * p1 - p0 - 3.0f * p2 + p3) * s3);
+    };
+    eye = catmull(at(eyes_, i - 1), at(eyes_, i), at(eyes_, i + 1), at(eyes_, i + 2));
+    front = catmull(at(fronts_, i - 1), at(fronts_, i), at(fronts_, i + 1), at(fronts_, i + 2));
+    front = glm::length(front) > 1e-4f ? glm::normalize(front) : glm::vec3(0.0f, 0.0f, -1.0f);
+}
+
+void writeBenchReport(std::ostream& os, const BenchResult& result) {
+    std::vector<double> ms = result.frameMs;
+    std::sort(ms.begin(), ms.end());
+    double sum = 0.0;
+    for (double v : ms) sum += v;
+    const size_t n = ms.size();
+    auto pct = [&](double p) { return n ? ms[static_cast<size_t>(p / 100.0 * (n - 1) + 0.5)] : 0.0; };
+
+    os << "{\n"
+       << "  \"renderer\": " << jsonString(result.renderer) << ",\n"
+       << "  \"occlusion\": " << jsonString(result.occlusion) << ",\n"
+       << "  \"vertex_format\": " << jsonString(result.vertexFormat) << ",\n"
+       << "  \"mesh_bytes\": " << result.meshBytes << ",\n"
+       << "  \"texture_format\": " << jsonString(result.textureFormat) << ",\n"
+       << "  \"texture_bytes\": " << result.textureBytes << ",\n"
+       << "  \"texture_binding\": " << jsonString(result.textureBinding) << ",\n"
+       << "  \"resolution\": [" << result.width << ", " << result.height << "],\n"
+       << "  \"frames\": " << n << ",\n"
+       << "  \"frame_ms\": { \"min\": " << (n ? ms.front() : 0.0) << ", \"mean\": " << (n ? sum / n : 0.0)
+       << ", \"p50\": " << pct(50) << ", \"p99\": " << pct(99) << ", \"max\": " << (n ? ms.back() : 0.0) << " },\n"
+       << "  \"draw_calls\": " << result.drawCalls << ",\n"
+       << "  \"draws\": " << result.draws << ",\n"
+       << "  \"state_changes\": " << result.stateChanges << ",\n"
+       << "  \"state_changes_skipped\": " << result.stateChangesSkipped << ",\n"
+       << "  \"texture_binds\": " << result.textureBinds << ",\n"
+       << "  \"triangles\": " << result.triangles << ",\n"
+       << "  \"clusters_visible\": " << result.clustersVisible << ",\n"
+       << "  \"clusters_culled\": " << result.clustersCulled << ",\n"
+       << "  \"clusters_occluded\": " << result.clustersOccluded << ",\n"
+       << "  \"instances\": " << result.instances << ",\n"
+       << "  \"instances_visible\": " << result.instancesVisible << ",\n"
+       << "  \"instance_bytes\": " << result.instanceBytes << ",\n"
+       << "  \"lights\": " << result.lights << ",\n"
+       << "  \"lights_visible\": " << result.lightsVisible << ",\n"
+       << "  \"light_indices\": " << result.lightIndices << ",\n"
+       << "  \"shadow_size\": " << result.shadowSize << ",\n"
+       << "  \"shadow_cascades\": " << result.shadowCascades << "\n"
+       << "}\n";
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Startup benchmark: serial vs. parallel .obj import vs. mapped mesh cache,
+// no window/GL needed, plus the BVH and a 100k-node scene graph update. Fails if
+// the parallel import differs from the serial one.
+// Returns a process exit code.
+int runImportBenchmark(const std::string &objPath, int iterations);
+
+// Self-test (--self-test): brute-force checks of what the benchmarks only time,
+// no window/GL needed. Runs all of them, reports each; returns a process exit code.
+// - the packed vertex format: uv halves are the nearest ones, octahedral normals come back
+// - the clustered light assignment is conservative for random points of a frustum
+int runSelfTest();
+
+// Render benchmark (Game::runBenchmark): hidden window, offscreen FBO,
+// scripted camera, fixed frame count, JSON report.
+struct BenchOptions {
+    int frames = 600;
+    int warmupFrames = 30;
+    int width = 1280;
+    int height = 720;
+    std::string pathFile;   // recorded camera path; empty = orbit spline through the model bounds
+    std::string outFile;    // JSON report; empty = stdout
+};
+
+// Closed Catmull-Rom spline over camera keys.
+// File format, one key per line: "eye.x eye.y eye.z front.x front.y front.z";
+// Game writes it with --record-path.
+class CameraPath {
+public:
+    bool load(const std::string &path);
+    // loop through the inside of a box at eye height, looking at its centre
+    void makeOrbit(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, int keys = 8);
+    // t in [0, 1) covers the whole loop
+    void sample(float t, glm::vec3 &eye, glm::vec3 &front) const;
+    bool empty() const { return eyes_.size() < 2; }
+
+private:
+    std::vector<glm::vec3> eyes_, fronts_;
+};
+
+struct BenchResult {
+    std::vector<double> frameMs;
+    double drawCalls = 0.0, draws = 0.0, stateChanges = 0.0, triangles = 0.0; // per-frame means
+    double stateChangesSkipped = 0.0, textureBinds = 0.0;
+    double clustersVisible = 0.0, clustersCulled = 0.0, clustersOccluded = 0.0;
+    double instancesVisible = 0.0, instanceBytes = 0.0;
+    double lightsVisible = 0.0, lightIndices = 0.0;
+    double shadowCascades = 0.0;    // cascades drawn again per frame, the rest cached
+    int width = 0, height = 0;
+    std::string renderer;
+    std::string occlusion;
+    std::string vertexFormat;
+    size_t meshBytes = 0;           // vertex + index buffers
+    std::string textureFormat;
+    size_t textureBytes = 0;        // resident textures, mips included
+    std::string textureBinding;
+    size_t instances = 0;           // instanced copies besides the model itself
+    size_t lights = 0;              // point lights in the scene
+    int shadowSize = 0;             // texels per cascade side, 0 = no shadows
+};
+
+void writeBenchReport(std::ostream &os, const BenchResult &result);
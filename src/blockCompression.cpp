@@ -0,0 +1,323 @@
+#include "blockCompression.hpp"
+#include "threadPool.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// BC7 4-bit index weights (out of 64)
+constexpr int kBc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+void loadBlock(const uint8_t rgba[64], glm::vec4 px[16]){
+    for(int i = 0; i < 16; ++i)
+        px[i] = glm::vec4(rgba[4*i+0], rgba[4*i+1], rgba[4*i+2], rgba[4*i+3]);
+}
+
+// mean and dominant direction of the block, channels beyond `channels` ignored
+void principalAxis(const glm::vec4 px[16], int channels, glm::vec4 &mean, glm::vec4 &axis){
+    const glm::vec4 mask(1.0f, 1.0f, 1.0f, channels > 3 ? 1.0f : 0.0f);
+    mean = glm::vec4(0.0f);
+    for(int i = 0; i < 16; ++i) mean += px[i] * mask;
+    mean /= 16.0f;
+    float cov[4][4] = {};
+    for(int i = 0; i < 16; ++i){
+        const glm::vec4 d = (px[i] - mean) * mask;
+        for(int r = 0; r < 4; ++r)
+            for(int c = 0; c < 4; ++c) cov[r][c] += d[r] * d[c];
+    }
+    // power iteration, seeded with the widest channel
+    int widest = 0;
+    for(int c = 1; c < channels; ++c) if(cov[c][c] > cov[widest][widest]) widest = c;
+    axis = glm::vec4(0.0f);
+    axis[widest] = 1.0f;
+    for(int it = 0; it < 8; ++it){
+        glm::vec4 next(0.0f);
+        for(int r = 0; r < 4; ++r)
+            for(int c = 0; c < 4; ++c) next[r] += cov[r][c] * axis[c];
+        const float len = glm::length(next);
+        if(len < 1e-6f) break;
+        axis = next / len;
+    }
+}
+
+// the block's extremes along the axis
+void axisEndpoints(const glm::vec4 px[16], const glm::vec4 &mean, const glm::vec4 &axis,
+                   glm::vec4 &lo, glm::vec4 &hi){
+    float tmin = 0.0f, tmax = 0.0f;
+    for(int i = 0; i < 16; ++i){
+        const float t = glm::dot(px[i] - mean, axis);
+        tmin = std::min(tmin, t);
+        tmax = std::max(tmax, t);
+    }
+    lo = glm::clamp(mean + axis * tmin, glm::vec4(0.0f), glm::vec4(255.0f));
+    hi = glm::clamp(mean + axis * tmax, glm::vec4(0.0f), glm::vec4(255.0f));
+}
+
+// least squares endpoints for fixed indices: pixel i = a * (1 - w[i]) + b * w[i]
+bool refitEndpoints(const glm::vec4 px[16], const float w[16], glm::vec4 &a, glm::vec4 &b){
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    glm::vec4 ax(0.0f), bx(0.0f);
+    for(int i = 0; i < 16; ++i){
+        const float wb = w[i], wa = 1.0f - wb;
+        aa += wa * wa;
+        ab += wa * wb;
+        bb += wb * wb;
+        ax += px[i] * wa;
+        bx += px[i] * wb;
+    }
+    const float det = aa * bb - ab * ab;
+    if(std::fabs(det) < 1e-6f) return false;
+    a = glm::clamp((ax * bb - bx * ab) / det, glm::vec4(0.0f), glm::vec4(255.0f));
+    b = glm::clamp((bx * aa - ax * ab) / det, glm::vec4(0.0f), glm::vec4(255.0f));
+    return true;
+}
+
+float distance2(const glm::vec4 &a, const glm::vec4 &b, int channels){
+    glm::vec4 d = a - b;
+    if(channels < 4) d.w = 0.0f;
+    return glm::dot(d, d);
+}
+
+// ---- BC1 colour block ----
+
+uint16_t to565(const glm::vec4 &c){
+    const int r = std::clamp(int(std::lround(c.x * 31.0f / 255.0f)), 0, 31);
+    const int g = std::clamp(int(std::lround(c.y * 63.0f / 255.0f)), 0, 63);
+    const int b = std::clamp(int(std::lround(c.z * 31.0f / 255.0f)), 0, 31);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+glm::vec4 from565(uint16_t v){
+    const int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    return glm::vec4((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 255.0f);
+}
+
+// 4-colour mode palette order: c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+constexpr float kBc1Weight[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+float bc1Indices(const glm::vec4 px[16], uint16_t c0, uint16_t c1, uint8_t idx[16]){
+    const glm::vec4 e0 = from565(c0), e1 = from565(c1);
+    glm::vec4 palette[4];
+    for(int k = 0; k < 4; ++k) palette[k] = glm::mix(e0, e1, kBc1Weight[k]);
+    float err = 0.0f;
+    for(int i = 0; i < 16; ++i){
+        float best = 1e30f;
+        for(int k = 0; k < 4; ++k){
+            const float d = distance2(px[i], palette[k], 3);
+            if(d < best){ best = d; idx[i] = static_cast<uint8_t>(k); }
+        }
+        err += best;
+    }
+    return err;
+}
+
+void encodeColor(const glm::vec4 px[16], uint8_t out[8]){
+    glm::vec4 mean, axis, lo, hi;
+    principalAxis(px, 3, mean, axis);
+    axisEndpoints(px, mean, axis, lo, hi);
+
+    uint16_t c0 = to565(hi), c1 = to565(lo);
+    uint8_t idx[16];
+    float err = bc1Indices(px, c0, c1, idx);
+
+    float w[16];
+    for(int i = 0; i < 16; ++i) w[i] = kBc1Weight[idx[i]];
+    glm::vec4 a = hi, b = lo;
+    if(refitEndpoints(px, w, a, b)){
+        const uint16_t r0 = to565(a), r1 = to565(b);
+        uint8_t ridx[16];
+        const float rerr = bc1Indices(px, r0, r1, ridx);
+        if(rerr < err){
+            c0 = r0; c1 = r1;
+            std::memcpy(idx, ridx, 16);
+        }
+    }
+
+    // c0 > c1 selects the 4-colour mode; swapping endpoints swaps 0<->1 and 2<->3
+    if(c0 < c1){
+        std::swap(c0, c1);
+        for(uint8_t &i : idx) i ^= 1;
+    }else if(c0 == c1){
+        std::memset(idx, 0, 16);
+    }
+    uint32_t bits = 0;
+    for(int i = 0; i < 16; ++i) bits |= uint32_t(idx[i]) << (2 * i);
+    out[0] = uint8_t(c0); out[1] = uint8_t(c0 >> 8);
+    out[2] = uint8_t(c1); out[3] = uint8_t(c1 >> 8);
+    for(int k = 0; k < 4; ++k) out[4 + k] = uint8_t(bits >> (8 * k));
+}
+
+// ---- BC3 alpha block: a0 > a1, eight levels ----
+
+void encodeAlpha(const glm::vec4 px[16], uint8_t out[8]){
+    int a0 = 0, a1 = 255;
+    for(int i = 0; i < 16; ++i){
+        const int a = int(px[i].w);
+        a0 = std::max(a0, a);
+        a1 = std::min(a1, a);
+    }
+    int palette[8] = {a0, a1};
+    for(int k = 2; k < 8; ++k) palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+    uint64_t bits = 0;
+    for(int i = 0; i < 16; ++i){
+        const int a = int(px[i].w);
+        int best = 0;
+        for(int k = 1; k < 8; ++k)
+            if(std::abs(palette[k] - a) < std::abs(palette[best] - a)) best = k;
+        bits |= uint64_t(a0 == a1 ? 0 : best) << (3 * i);
+    }
+    out[0] = uint8_t(a0);
+    out[1] = uint8_t(a1);
+    for(int k = 0; k < 6; ++k) out[2 + k] = uint8_t(bits >> (8 * k));
+}
+
+// ---- BC7 mode 6 ----
+
+struct Bc7Endpoint {
+    int q[4];   // 7 bits per channel
+    int p;      // shared lowest bit
+    glm::vec4 value() const {
+        return glm::vec4((q[0] << 1) | p, (q[1] << 1) | p, (q[2] << 1) | p, (q[3] << 1) | p);
+    }
+};
+
+Bc7Endpoint quantizeBc7(const glm::vec4 &e){
+    Bc7Endpoint best{};
+    float bestErr = 1e30f;
+    for(int p = 0; p < 2; ++p){
+        Bc7Endpoint cand;
+        cand.p = p;
+        for(int c = 0; c < 4; ++c) cand.q[c] = std::clamp(int(std::lround((e[c] - p) * 0.5f)), 0, 127);
+        const float err = distance2(cand.value(), e, 4);
+        if(err < bestErr){ bestErr = err; best = cand; }
+    }
+    return best;
+}
+
+float bc7Indices(const glm::vec4 px[16], const Bc7Endpoint &e0, const Bc7Endpoint &e1, uint8_t idx[16]){
+    const glm::vec4 v0 = e0.value(), v1 = e1.value();
+    glm::vec4 palette[16];
+    for(int k = 0; k < 16; ++k){
+        const float w = float(kBc7Weights[k]);
+        for(int c = 0; c < 4; ++c) palette[k][c] = float((int(64.0f - w) * int(v0[c]) + int(w) * int(v1[c]) + 32) >> 6);
+    }
+    float err = 0.0f;
+    for(int i = 0; i < 16; ++i){
+        float best = 1e30f;
+        for(int k = 0; k < 16; ++k){
+            const float d = distance2(px[i], palette[k], 4);
+            if(d < best){ best = d; idx[i] = static_cast<uint8_t>(k); }
+        }
+        err += best;
+    }
+    return err;
+}
+
+struct BitWriter {
+    uint8_t *out;
+    int pos = 0;
+    void put(uint32_t value, int bits){
+        for(int b = 0; b < bits; ++b, ++pos)
+            if(value & (1u << b)) out[pos >> 3] |= uint8_t(1u << (pos & 7));
+    }
+};
+
+} // namespace
+
+size_t blockBytes(BlockFormat format){
+    return format == BlockFormat::Bc1 ? 8 : 16;
+}
+
+void encodeBc1Block(const uint8_t rgba[64], uint8_t out[8]){
+    glm::vec4 px[16];
+    loadBlock(rgba, px);
+    encodeColor(px, out);
+}
+
+void encodeBc3Block(const uint8_t rgba[64], uint8_t out[16]){
+    glm::vec4 px[16];
+    loadBlock(rgba, px);
+    encodeAlpha(px, out);
+    encodeColor(px, out + 8);
+}
+
+void encodeBc7Block(const uint8_t rgba[64], uint8_t out[16]){
+    glm::vec4 px[16];
+    loadBlock(rgba, px);
+    glm::vec4 mean, axis, lo, hi;
+    principalAxis(px, 4, mean, axis);
+    axisEndpoints(px, mean, axis, lo, hi);
+
+    Bc7Endpoint e0 = quantizeBc7(lo), e1 = quantizeBc7(hi);
+    uint8_t idx[16];
+    float err = bc7Indices(px, e0, e1, idx);
+
+    float w[16];
+    for(int i = 0; i < 16; ++i) w[i] = kBc7Weights[idx[i]] / 64.0f;
+    glm::vec4 a = lo, b = hi;
+    if(refitEndpoints(px, w, a, b)){
+        const Bc7Endpoint r0 = quantizeBc7(a), r1 = quantizeBc7(b);
+        uint8_t ridx[16];
+        const float rerr = bc7Indices(px, r0, r1, ridx);
+        if(rerr < err){
+            e0 = r0; e1 = r1;
+            std::memcpy(idx, ridx, 16);
+        }
+    }
+
+    // the first index is stored with 3 bits: its top bit has to be 0
+    if(idx[0] & 8){
+        std::swap(e0, e1);
+        for(uint8_t &i : idx) i = uint8_t(15 - i);
+    }
+
+    std::memset(out, 0, 16);
+    BitWriter bits{out};
+    bits.put(1u << 6, 7);                   // mode 6
+    for(int c = 0; c < 4; ++c){
+        bits.put(uint32_t(e0.q[c]), 7);
+        bits.put(uint32_t(e1.q[c]), 7);
+    }
+    bits.put(uint32_t(e0.p), 1);
+    bits.put(uint32_t(e1.p), 1);
+    bits.put(idx[0], 3);
+    for(int i = 1; i < 16; ++i) bits.put(idx[i], 4);
+}
+
+void compressImage(BlockFormat format, const uint8_t *rgba, int width, int height,
+                   std::vector<uint8_t> &out, bool parallel){
+    const int bw = (width + 3) / 4, bh = (height + 3) / 4;
+    const size_t bytes = blockBytes(format);
+    out.assign(size_t(bw) * bh * bytes, 0);
+
+    auto encodeRow = [&](size_t by){
+        uint8_t block[64];
+        for(int bx = 0; bx < bw; ++bx){
+            for(int y = 0; y < 4; ++y){
+                const int sy = std::min(int(by) * 4 + y, height - 1);
+                for(int x = 0; x < 4; ++x){
+                    const int sx = std::min(bx * 4 + x, width - 1);
+                    std::memcpy(block + 4 * (4 * y + x), rgba + 4 * (size_t(sy) * width + sx), 4);
+                }
+            }
+            uint8_t *dst = out.data() + (by * bw + bx) * bytes;
+            switch(format){
+            case BlockFormat::Bc1: encodeBc1Block(block, dst); break;
+            case BlockFormat::Bc3: encodeBc3Block(block, dst); break;
+            case BlockFormat::Bc7: encodeBc7Block(block, dst); break;
+            }
+        }
+    };
+
+    ThreadPool &pool = ThreadPool::shared();
+    const size_t slices = parallel ? std::min<size_t>(pool.size() + 1, size_t(bh)) : 1;
+    if(slices > 1){
+        pool.parallelFor(slices, [&](size_t s){
+            for(size_t by = bh * s / slices; by < bh * (s + 1) / slices; ++by) encodeRow(by);
+        });
+    }else{
+        for(int by = 0; by < bh; ++by) encodeRow(size_t(by));
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CPU encoders for the GPU block formats, one 4x4 block of RGBA8 pixels
+// (row-major, 64 bytes) at a time:
+//   BC1  8 bytes, RGB 5:6:5 endpoints, 2-bit indices, always the 4-colour mode
+//   BC3  16 bytes, BC4-style 8-bit alpha block followed by a BC1 colour block
+//   BC7  16 bytes, mode 6 only: RGBA 7-bit + p-bit endpoints, 4-bit indices
+// Endpoints come from the principal axis of the block and are refined once by
+// least squares over the chosen indices. Quality is close to the reference
+// encoders' fast settings, speed is what an import step can afford.
+enum class BlockFormat { Bc1, Bc3, Bc7 };
+
+size_t blockBytes(BlockFormat format);
+void encodeBc1Block(const uint8_t rgba[64], uint8_t out[8]);
+void encodeBc3Block(const uint8_t rgba[64], uint8_t out[16]);
+void encodeBc7Block(const uint8_t rgba[64], uint8_t out[16]);
+
+// whole image, rows in the given order; edges of sizes that aren't a multiple
+// of four are padded by repeating the last row/column. out is resized
+void compressImage(BlockFormat format, const uint8_t *rgba, int width, int height,
+                   std::vector<uint8_t> &out, bool parallel = true);
@@ -0,0 +1,529 @@
+#include "bvh.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+
+constexpr int kBins = 16;                  // fewer for nodes with fewer triangles
+constexpr uint32_t kMaxLeaf = 4;           // a leaf may be bigger only if no split exists
+constexpr int kMaxDepth = 60;              // queries keep a 64-entry stack
+constexpr float kTraversalCost = 1.0f;     // relative to one triangle test
+constexpr size_t kParallelBinning = 1u << 16;
+
+struct Aabb {
+    glm::vec3 bmin{FLT_MAX}, bmax{-FLT_MAX};
+    void grow(const glm::vec3 &p){ bmin = glm::min(bmin, p); bmax = glm::max(bmax, p); }
+    void grow(const Aabb &b){ bmin = glm::min(bmin, b.bmin); bmax = glm::max(bmax, b.bmax); }
+    float area() const {
+        glm::vec3 e = bmax - bmin;
+        return (e.x < 0.0f) ? 0.0f : e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+struct Bin { Aabb bounds; uint32_t count = 0; };
+
+struct Split {
+    int axis = -1;
+    int bin = 0;                // centroids in bins [0, bin] go left
+    int bins = kBins;
+    float cost = FLT_MAX;
+};
+
+// everything the build needs, shared read-only by the subtree tasks
+// (apart from their own slice of ids)
+struct Builder {
+    std::vector<Aabb> primBounds;
+    std::vector<glm::vec3> centroids;
+    std::vector<uint32_t> ids;
+};
+
+struct Range { Aabb bounds, centroidBounds; };
+
+Range measure(const Builder &b, uint32_t first, uint32_t count){
+    auto pass = [&b](uint32_t from, uint32_t to){
+        Range r;
+        for(uint32_t i = from; i < to; ++i){
+            const uint32_t id = b.ids[i];
+            r.bounds.grow(b.primBounds[id]);
+            r.centroidBounds.grow(b.centroids[id]);
+        }
+        return r;
+    };
+    if(count < kParallelBinning) return pass(first, first + count);
+
+    ThreadPool &pool = ThreadPool::shared();
+    const size_t slices = pool.size() + 1;
+    std::vector<Range> parts(slices);
+    pool.parallelFor(slices, [&](size_t s){
+        parts[s] = pass(first + static_cast<uint32_t>(count * s / slices),
+                        first + static_cast<uint32_t>(count * (s + 1) / slices));
+    });
+    Range r;
+    for(const Range &p : parts){ r.bounds.grow(p.bounds); r.centroidBounds.grow(p.centroidBounds); }
+    return r;
+}
+
+inline int binOf(float c, float lo, float scale, int bins){
+    return std::min(bins - 1, static_cast<int>((c - lo) * scale));
+}
+
+Split findSplit(const Builder &b, uint32_t first, uint32_t count, const Range &range){
+    Split best;
+    const int nb = static_cast<int>(std::min<uint32_t>(kBins, std::max<uint32_t>(count, 2)));
+    best.bins = nb;
+    const glm::vec3 extent = range.centroidBounds.bmax - range.centroidBounds.bmin;
+
+    // a flat axis gets scale 0, so everything lands in bin 0 and the sweep finds no split there
+    glm::vec3 scale(0.0f);
+    for(int a = 0; a < 3; ++a) if(extent[a] > 0.0f) scale[a] = nb / extent[a];
+    const glm::vec3 lo = range.centroidBounds.bmin;
+
+    using Bins = Bin[3][kBins];
+    auto fill = [&](Bins &bins, uint32_t from, uint32_t to){
+        for(uint32_t i = from; i < to; ++i){
+            const uint32_t id = b.ids[i];
+            const glm::vec3 &c = b.centroids[id];
+            const Aabb &box = b.primBounds[id];
+            for(int a = 0; a < 3; ++a){
+                Bin &bin = bins[a][binOf(c[a], lo[a], scale[a], nb)];
+                bin.bounds.grow(box);
+                ++bin.count;
+            }
+        }
+    };
+
+    Bins bins;
+    if(count < kParallelBinning){
+        fill(bins, first, first + count);
+    }else{
+        ThreadPool &pool = ThreadPool::shared();
+        const size_t slices = pool.size() + 1;
+        std::vector<Bin> parts(slices * 3 * kBins);
+        pool.parallelFor(slices, [&](size_t s){
+            Bins local;
+            fill(local, first + static_cast<uint32_t>(count * s / slices),
+                 first + static_cast<uint32_t>(count * (s + 1) / slices));
+            std::copy(&local[0][0], &local[0][0] + 3 * kBins, parts.begin() + s * 3 * kBins);
+        });
+        for(size_t s = 0; s < slices; ++s)
+            for(int k = 0; k < 3 * kBins; ++k){
+                Bin &dst = (&bins[0][0])[k];
+                const Bin &src = parts[s * 3 * kBins + k];
+                dst.bounds.grow(src.bounds);
+                dst.count += src.count;
+            }
+    }
+
+    // sweep from the right to get the area/count of every right side, then from the left
+    for(int a = 0; a < 3; ++a){
+        if(scale[a] == 0.0f) continue;
+        float rightArea[kBins];
+        uint32_t rightCount[kBins];
+        Aabb acc;
+        uint32_t n = 0;
+        for(int i = nb - 1; i > 0; --i){
+            acc.grow(bins[a][i].bounds);
+            n += bins[a][i].count;
+            rightArea[i] = acc.area();
+            rightCount[i] = n;
+        }
+        acc = Aabb();
+        n = 0;
+        for(int i = 0; i < nb - 1; ++i){
+            acc.grow(bins[a][i].bounds);
+            n += bins[a][i].count;
+            if(n == 0 || rightCount[i + 1] == 0) continue;
+            const float cost = n * acc.area() + rightCount[i + 1] * rightArea[i + 1];
+            if(cost < best.cost){ best.axis = a; best.bin = i; best.cost = cost; }
+        }
+    }
+    return best;
+}
+
+uint32_t partition(Builder &b, uint32_t first, uint32_t count, const Range &range, const Split &split){
+    const int a = split.axis;
+    const float lo = range.centroidBounds.bmin[a];
+    const float scale = split.bins / (range.centroidBounds.bmax[a] - lo);
+    auto mid = std::partition(b.ids.begin() + first, b.ids.begin() + first + count, [&](uint32_t id){
+        return binOf(b.centroids[id][a], lo, scale, split.bins) <= split.bin;
+    });
+    return static_cast<uint32_t>(mid - b.ids.begin());
+}
+
+inline void setBounds(BvhNode &n, const Aabb &b){ n.bmin = b.bmin; n.bmax = b.bmax; }
+
+// false = make a leaf out of [first, first + count)
+bool shouldSplit(const Builder &b, uint32_t first, uint32_t count, int depth, const Range &range, Split &split){
+    if(count <= 1 || depth >= kMaxDepth) return false;
+    split = findSplit(b, first, count, range);
+    if(split.axis < 0) return false;            // all centroids in one point
+    // SAH: cost of the split, in units of the parent area, against testing every triangle
+    const float splitCost = kTraversalCost + split.cost / range.bounds.area();
+    return count > kMaxLeaf || splitCost < static_cast<float>(count);
+}
+
+// depth-first, so a left child always follows its parent; indices are local to out
+void buildSubtree(Builder &b, uint32_t first, uint32_t count, int depth, std::vector<BvhNode> &out){
+    const Range range = measure(b, first, count);
+    const uint32_t at = static_cast<uint32_t>(out.size());
+    out.push_back({});
+    setBounds(out[at], range.bounds);
+
+    Split split;
+    if(!shouldSplit(b, first, count, depth, range, split)){
+        out[at].rightOrFirst = first;
+        out[at].count = count;
+        return;
+    }
+    const uint32_t mid = partition(b, first, count, range, split);
+    buildSubtree(b, first, mid - first, depth + 1, out);
+    out[at].rightOrFirst = static_cast<uint32_t>(out.size());
+    out[at].count = 0;
+    buildSubtree(b, mid, first + count - mid, depth + 1, out);
+}
+
+// The top of the tree is split on this thread (binning itself goes parallel
+// for big nodes); once a node is small enough it becomes a task and its
+// subtree is built on the pool into its own array.
+struct TopNode {
+    BvhNode node{};
+    int left = -1, right = -1;
+    int task = -1;
+};
+struct Task {
+    uint32_t first, count;
+    int depth;
+    std::vector<BvhNode> nodes;
+};
+
+int splitTop(Builder &b, uint32_t first, uint32_t count, int depth, uint32_t taskSize,
+             std::vector<TopNode> &top, std::vector<Task> &tasks){
+    const int at = static_cast<int>(top.size());
+    top.push_back({});
+    if(count <= taskSize){
+        top[at].task = static_cast<int>(tasks.size());
+        tasks.push_back({first, count, depth, {}});
+        return at;
+    }
+
+    const Range range = measure(b, first, count);
+    setBounds(top[at].node, range.bounds);
+    Split split;
+    if(!shouldSplit(b, first, count, depth, range, split)){
+        top[at].node.rightOrFirst = first;
+        top[at].node.count = count;
+        return at;
+    }
+    const uint32_t mid = partition(b, first, count, range, split);
+    const int left = splitTop(b, first, mid - first, depth + 1, taskSize, top, tasks);
+    const int right = splitTop(b, mid, first + count - mid, depth + 1, taskSize, top, tasks);
+    top[at].left = left;
+    top[at].right = right;
+    return at;
+}
+
+void emit(const std::vector<TopNode> &top, int i, std::vector<Task> &tasks, std::vector<BvhNode> &out){
+    const TopNode &t = top[i];
+    if(t.task >= 0){
+        // subtree indices are relative to its own root
+        const uint32_t base = static_cast<uint32_t>(out.size());
+        for(BvhNode n : tasks[t.task].nodes){
+            if(!n.leaf()) n.rightOrFirst += base;
+            out.push_back(n);
+        }
+        std::vector<BvhNode>().swap(tasks[t.task].nodes);
+        return;
+    }
+    const size_t at = out.size();
+    out.push_back(t.node);
+    if(t.node.leaf()) return;
+    emit(top, t.left, tasks, out);
+    out[at].rightOrFirst = static_cast<uint32_t>(out.size());
+    emit(top, t.right, tasks, out);
+}
+
+inline float slab(const BvhNode &n, const glm::vec3 &origin, const glm::vec3 &invDir, float maxT){
+    const glm::vec3 t0 = (n.bmin - origin) * invDir;
+    const glm::vec3 t1 = (n.bmax - origin) * invDir;
+    const glm::vec3 lo = glm::min(t0, t1), hi = glm::max(t0, t1);
+    const float tNear = std::max(std::max(lo.x, lo.y), std::max(lo.z, 0.0f));
+    const float tFar = std::min(std::min(hi.x, hi.y), std::min(hi.z, maxT));
+    return tNear <= tFar ? tNear : FLT_MAX;
+}
+
+inline bool sphereTouchesBox(const glm::vec3 &c, float r2, const glm::vec3 &bmin, const glm::vec3 &bmax){
+    const glm::vec3 d = c - glm::clamp(c, bmin, bmax);
+    return glm::dot(d, d) <= r2;
+}
+
+inline bool boxesOverlap(const glm::vec3 &amin, const glm::vec3 &amax, const glm::vec3 &bmin, const glm::vec3 &bmax){
+    return amin.x <= bmax.x && amax.x >= bmin.x && amin.y <= bmax.y && amax.y >= bmin.y &&
+           amin.z <= bmax.z && amax.z >= bmin.z;
+}
+
+} // namespace
+
+bool Bvh::build(const MeshVertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount){
+    clear();
+    const size_t triCount = indexCount / 3;
+    if(!vertices || !indices || vertexCount == 0 || triCount == 0) return false;
+
+    Builder b;
+    b.primBounds.resize(triCount);
+    b.centroids.resize(triCount);
+    b.ids.resize(triCount);
+
+    ThreadPool &pool = ThreadPool::shared();
+    const size_t slices = std::min<size_t>(pool.size() + 1, (triCount + 4095) / 4096);
+    pool.parallelFor(slices, [&](size_t s){
+        for(size_t t = triCount * s / slices, end = triCount * (s + 1) / slices; t < end; ++t){
+            Aabb box;
+            for(int k = 0; k < 3; ++k){
+                const unsigned int vi = indices[t * 3 + k];
+                box.grow(vi < vertexCount ? vertices[vi].pos : glm::vec3(0.0f));
+            }
+            b.primBounds[t] = box;
+            b.centroids[t] = (box.bmin + box.bmax) * 0.5f;
+            b.ids[t] = static_cast<uint32_t>(t);
+        }
+    });
+
+    // a few tasks per thread keeps the pool busy while the sizes come out uneven
+    const uint32_t taskSize = static_cast<uint32_t>(
+        std::max<size_t>(triCount / ((pool.size() + 1) * 4), 4096));
+    std::vector<TopNode> top;
+    std::vector<Task> tasks;
+    splitTop(b, 0, static_cast<uint32_t>(triCount), 0, taskSize, top, tasks);
+    pool.parallelFor(tasks.size(), [&](size_t i){
+        Task &t = tasks[i];
+        t.nodes.reserve(t.count * 2 / kMaxLeaf + 1);
+        buildSubtree(b, t.first, t.count, t.depth, t.nodes);
+    });
+
+    nodes_.reserve(top.size() + triCount * 2 / kMaxLeaf);
+    emit(top, 0, tasks, nodes_);
+
+    // triangles in leaf order, so a leaf reads one contiguous block
+    tris_.resize(triCount);
+    ids_ = std::move(b.ids);
+    slots_.resize(triCount);
+    pool.parallelFor(slices, [&](size_t s){
+        for(size_t i = triCount * s / slices, end = triCount * (s + 1) / slices; i < end; ++i){
+            const uint32_t id = ids_[i];
+            glm::vec3 p[3];
+            for(int k = 0; k < 3; ++k){
+                const unsigned int vi = indices[id * 3 + k];
+                p[k] = vi < vertexCount ? vertices[vi].pos : glm::vec3(0.0f);
+            }
+            tris_[i] = {p[0], p[1] - p[0], p[2] - p[0]};
+            slots_[id] = static_cast<uint32_t>(i);
+        }
+    });
+    return true;
+}
+
+void Bvh::clear(){
+    nodes_.clear(); nodes_.shrink_to_fit();
+    tris_.clear(); tris_.shrink_to_fit();
+    ids_.clear(); ids_.shrink_to_fit();
+    slots_.clear(); slots_.shrink_to_fit();
+}
+
+bool Bvh::trace(const glm::vec3 &origin, const glm::vec3 &dir, float maxT, bool anyHit, BvhHit *hit) const {
+    if(nodes_.empty()) return false;
+
+    glm::vec3 invDir;
+    for(int a = 0; a < 3; ++a)
+        invDir[a] = 1.0f / (std::fabs(dir[a]) > 1e-20f ? dir[a] : std::copysign(1e-20f, dir[a]));
+
+    struct Entry { uint32_t node; float t; };
+    Entry stack[64];
+    int sp = 0;
+    float best = maxT;
+    uint32_t bestSlot = UINT32_MAX;
+    float bestU = 0.0f, bestV = 0.0f;
+
+    if(slab(nodes_[0], origin, invDir, best) == FLT_MAX) return false;
+    uint32_t node = 0;
+    for(;;){
+        const BvhNode &n = nodes_[node];
+        if(n.leaf()){
+            for(uint32_t i = n.rightOrFirst, end = n.rightOrFirst + n.count; i < end; ++i){
+                // Möller–Trumbore, both sides
+                const Tri &tri = tris_[i];
+                const glm::vec3 p = glm::cross(dir, tri.e2);
+                const float det = glm::dot(tri.e1, p);
+                if(std::fabs(det) < 1e-12f) continue;
+                const float inv = 1.0f / det;
+                const glm::vec3 s = origin - tri.v0;
+                const float u = glm::dot(s, p) * inv;
+                if(u < 0.0f || u > 1.0f) continue;
+                const glm::vec3 q = glm::cross(s, tri.e1);
+                const float v = glm::dot(dir, q) * inv;
+                if(v < 0.0f || u + v > 1.0f) continue;
+                const float t = glm::dot(tri.e2, q) * inv;
+                if(t < 0.0f || t > best) continue;
+                if(anyHit) return true;
+                best = t; bestSlot = i; bestU = u; bestV = v;
+            }
+        }else{
+            uint32_t nearNode = node + 1, farNode = n.rightOrFirst;
+            float tNear = slab(nodes_[nearNode], origin, invDir, best);
+            float tFar = slab(nodes_[farNode], origin, invDir, best);
+            if(tFar < tNear){ std::swap(tNear, tFar); std::swap(nearNode, farNode); }
+            if(tNear != FLT_MAX){
+                if(tFar != FLT_MAX) stack[sp++] = {farNode, tFar};
+                node = nearNode;
+                continue;
+            }
+        }
+        // next subtree that can still beat the closest hit
+        for(;;){
+            if(sp == 0) goto done;
+            const Entry e = stack[--sp];
+            if(e.t <= best){ node = e.node; break; }
+        }
+    }
+done:
+    if(bestSlot == UINT32_MAX) return false;
+    if(hit){
+        const Tri &tri = tris_[bestSlot];
+        hit->t = best;
+        hit->triangle = ids_[bestSlot];
+        hit->u = bestU;
+        hit->v = bestV;
+        glm::vec3 nrm = glm::cross(tri.e1, tri.e2);
+        const float len = glm::length(nrm);
+        nrm = len > 0.0f ? nrm / len : glm::vec3(0.0f, 1.0f, 0.0f);
+        hit->normal = glm::dot(nrm, dir) > 0.0f ? -nrm : nrm;
+    }
+    return true;
+}
+
+bool Bvh::raycast(const glm::vec3 &origin, const glm::vec3 &dir, float maxT, BvhHit &hit) const {
+    return trace(origin, dir, maxT, false, &hit);
+}
+
+bool Bvh::segment(const glm::vec3 &a, const glm::vec3 &b, BvhHit &hit) const {
+    return trace(a, b - a, 1.0f, false, &hit);
+}
+
+bool Bvh::occluded(const glm::vec3 &a, const glm::vec3 &b) const {
+    return trace(a, b - a, 1.0f, true, nullptr);
+}
+
+template <class NodeTest, class TriFn>
+void Bvh::traverse(NodeTest nodeTest, TriFn triFn) const {
+    if(nodes_.empty() || !nodeTest(nodes_[0])) return;
+    uint32_t stack[64];
+    int sp = 0;
+    uint32_t node = 0;
+    for(;;){
+        const BvhNode &n = nodes_[node];
+        if(n.leaf()){
+            for(uint32_t i = n.rightOrFirst, end = n.rightOrFirst + n.count; i < end; ++i) triFn(i);
+        }else{
+            const bool left = nodeTest(nodes_[node + 1]);
+            const bool right = nodeTest(nodes_[n.rightOrFirst]);
+            if(left){
+                if(right) stack[sp++] = n.rightOrFirst;
+                node = node + 1;
+                continue;
+            }
+            if(right){ node = n.rightOrFirst; continue; }
+        }
+        if(sp == 0) return;
+        node = stack[--sp];
+    }
+}
+
+void Bvh::overlapSphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &out) const {
+    const float r2 = radius * radius;
+    traverse([&](const BvhNode &n){ return sphereTouchesBox(center, r2, n.bmin, n.bmax); },
+             [&](uint32_t slot){
+                 const Tri &t = tris_[slot];
+                 const glm::vec3 d = center - closestPointOnTriangle(center, t.v0, t.v0 + t.e1, t.v0 + t.e2);
+                 if(glm::dot(d, d) <= r2) out.push_back(ids_[slot]);
+             });
+}
+
+void Bvh::overlapAabb(const glm::vec3 &bmin, const glm::vec3 &bmax, std::vector<uint32_t> &out) const {
+    traverse([&](const BvhNode &n){ return boxesOverlap(n.bmin, n.bmax, bmin, bmax); },
+             [&](uint32_t slot){
+                 const Tri &t = tris_[slot];
+                 if(triangleIntersectsAabb(t.v0, t.v0 + t.e1, t.v0 + t.e2, bmin, bmax)) out.push_back(ids_[slot]);
+             });
+}
+
+void Bvh::overlapAabbCoarse(const glm::vec3 &bmin, const glm::vec3 &bmax, std::vector<uint32_t> &out) const {
+    traverse([&](const BvhNode &n){ return boxesOverlap(n.bmin, n.bmax, bmin, bmax); },
+             [&](uint32_t slot){
+                 const Tri &t = tris_[slot];
+                 const glm::vec3 v1 = t.v0 + t.e1, v2 = t.v0 + t.e2;
+                 if(boxesOverlap(glm::min(t.v0, glm::min(v1, v2)), glm::max(t.v0, glm::max(v1, v2)), bmin, bmax))
+                     out.push_back(ids_[slot]);
+             });
+}
+
+void Bvh::triangle(uint32_t id, glm::vec3 &a, glm::vec3 &b, glm::vec3 &c) const {
+    const Tri &t = tris_[slots_[id]];
+    a = t.v0;
+    b = t.v0 + t.e1;
+    c = t.v0 + t.e2;
+}
+
+// Ericson, Real-Time Collision Detection 5.1.5
+glm::vec3 closestPointOnTriangle(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c){
+    const glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    const float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if(d1 <= 0.0f && d2 <= 0.0f) return a;
+
+    const glm::vec3 bp = p - b;
+    const float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if(d3 >= 0.0f && d4 <= d3) return b;
+
+    const float vc = d1 * d4 - d3 * d2;
+    if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+    const glm::vec3 cp = p - c;
+    const float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if(d6 >= 0.0f && d5 <= d6) return c;
+
+    const float vb = d5 * d2 - d1 * d6;
+    if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+    const float va = d3 * d6 - d5 * d4;
+    if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    const float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// separating axis test: box normals, triangle normal, and the nine edge cross products
+bool triangleIntersectsAabb(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c,
+                            const glm::vec3 &bmin, const glm::vec3 &bmax){
+    const glm::vec3 center = (bmin + bmax) * 0.5f, h = (bmax - bmin) * 0.5f;
+    const glm::vec3 v0 = a - center, v1 = b - center, v2 = c - center;
+
+    if(std::max({v0.x, v1.x, v2.x}) < -h.x || std::min({v0.x, v1.x, v2.x}) > h.x) return false;
+    if(std::max({v0.y, v1.y, v2.y}) < -h.y || std::min({v0.y, v1.y, v2.y}) > h.y) return false;
+    if(std::max({v0.z, v1.z, v2.z}) < -h.z || std::min({v0.z, v1.z, v2.z}) > h.z) return false;
+
+    const glm::vec3 e[3] = {v1 - v0, v2 - v1, v0 - v2};
+    const glm::vec3 n = glm::cross(e[0], e[1]);
+    if(std::fabs(glm::dot(n, v0)) > h.x * std::fabs(n.x) + h.y * std::fabs(n.y) + h.z * std::fabs(n.z)) return false;
+
+    for(const glm::vec3 &edge : e){
+        const glm::vec3 axes[3] = {
+            glm::vec3(0.0f, -edge.z, edge.y), glm::vec3(edge.z, 0.0f, -edge.x), glm::vec3(-edge.y, edge.x, 0.0f)};
+        for(const glm::vec3 &axis : axes){
+            const float p0 = glm::dot(v0, axis), p1 = glm::dot(v1, axis), p2 = glm::dot(v2, axis);
+            const float r = h.x * std::fabs(axis.x) + h.y * std::fabs(axis.y) + h.z * std::fabs(axis.z);
+            if(std::max({p0, p1, p2}) < -r || std::min({p0, p1, p2}) > r) return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "mesh.hpp"
+
+// CPU-side bounding volume hierarchy over a triangle mesh, for picking,
+// line-of-sight and collision. Binned SAH build, subtrees built in parallel on
+// ThreadPool::shared(). Nodes sit in one depth-first array: an inner node's
+// left child is the next node, so the hot path of a query walks memory forward.
+//
+// Triangle ids are the ones of the source index buffer (triangle i is
+// indices[3i .. 3i+2]); everything is in the space of the given vertices.
+
+struct BvhNode {
+    glm::vec3 bmin;
+    uint32_t rightOrFirst;      // inner: index of the right child, leaf: first triangle slot
+    glm::vec3 bmax;
+    uint32_t count;             // 0 = inner node
+    bool leaf() const { return count != 0; }
+};
+static_assert(sizeof(BvhNode) == 32, "two nodes per cache line");
+
+struct BvhHit {
+    float t = 0.0f;             // raycast: distance in units of dir; segment: fraction of a->b
+    uint32_t triangle = 0;
+    float u = 0.0f, v = 0.0f;   // barycentrics of vertices 1 and 2
+    glm::vec3 normal{0.0f};     // geometric, unit length, facing against the ray
+};
+
+class Bvh {
+public:
+    // false if there's nothing to build from; the old tree is dropped either way
+    bool build(const MeshVertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount);
+    void clear();
+    bool empty() const { return nodes_.empty(); }
+
+    // closest hit with t in [0, maxT]; dir doesn't have to be normalized
+    bool raycast(const glm::vec3 &origin, const glm::vec3 &dir, float maxT, BvhHit &hit) const;
+    bool segment(const glm::vec3 &a, const glm::vec3 &b, BvhHit &hit) const;
+    // any hit between a and b; stops at the first one (line of sight)
+    bool occluded(const glm::vec3 &a, const glm::vec3 &b) const;
+
+    // ids of the triangles touching the sphere / box, appended to out
+    void overlapSphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &out) const;
+    void overlapAabb(const glm::vec3 &bmin, const glm::vec3 &bmax, std::vector<uint32_t> &out) const;
+    // only the triangle's bounds have to touch the box; for callers running their own exact test
+    void overlapAabbCoarse(const glm::vec3 &bmin, const glm::vec3 &bmax, std::vector<uint32_t> &out) const;
+
+    void triangle(uint32_t id, glm::vec3 &a, glm::vec3 &b, glm::vec3 &c) const;
+    size_t triangleCount() const { return ids_.size(); }
+    const std::vector<BvhNode> &nodes() const { return nodes_; }
+    glm::vec3 boundsMin() const { return empty() ? glm::vec3(0.0f) : nodes_[0].bmin; }
+    glm::vec3 boundsMax() const { return empty() ? glm::vec3(0.0f) : nodes_[0].bmax; }
+
+private:
+    // stored in leaf order as v0 + two edges, which is what the ray test wants
+    struct Tri { glm::vec3 v0, e1, e2; };
+
+    bool trace(const glm::vec3 &origin, const glm::vec3 &dir, float maxT, bool anyHit, BvhHit *hit) const;
+    template <class NodeTest, class TriFn>
+    void traverse(NodeTest nodeTest, TriFn triFn) const;
+
+    std::vector<BvhNode> nodes_;
+    std::vector<Tri> tris_;
+    std::vector<uint32_t> ids_;     // slot -> triangle id
+    std::vector<uint32_t> slots_;   // triangle id -> slot
+};
+
+glm::vec3 closestPointOnTriangle(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c);
+bool triangleIntersectsAabb(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c,
+                            const glm::vec3 &bmin, const glm::vec3 &bmax);
@@ -0,0 +1,68 @@
+#include "cacheFile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+uint64_t fnv1a(uint64_t h, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, bytes + i, 8);
+        h ^= w;
+        h *= kFnvPrime;
+        h ^= h >> 32;
+    }
+    for (; i < size; ++i) {
+        h ^= static_cast<unsigned char>(bytes[i]);
+        h *= kFnvPrime;
+    }
+    return h;
+}
+
+bool writeFileAtomically(const std::string& path, const std::function<void(std::ostream&)>& write) {
+    const std::string tmpPath = path + ".tmp";
+    std::error_code ec;
+    {
+        std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            std::cerr << "Failed to write " << tmpPath << "\n";
+            return false;
+        }
+        write(ofs);
+        if (!ofs) {
+            std::cerr << "Failed to write " << tmpPath << "\n";
+            ofs.close();
+            fs::remove(tmpPath, ec);
+            return false;
+        }
+    }
+    fs::rename(tmpPath, path, ec);
+    if (ec) {
+        std::cerr << "Failed to write " << path << " (" << ec.message() << ")\n";
+        fs::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
+
+bool writeFileAtomically(const std::string& path, const void* data, size_t size) {
+    return writeFileAtomically(path, [&](std::ostream& os) {
+        os.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    });
+}
+
+void writeAt(std::ostream& os, uint64_t offset, const void* data, size_t size) {
+    static const char zeros[16] = {};
+    uint64_t pos = static_cast<uint64_t>(os.tellp());
+    while (offset > pos) {
+        const uint64_t pad = std::min<uint64_t>(offset - pos, sizeof(zeros));
+        os.write(zeros, static_cast<std::streamsize>(pad));
+        pos += pad;
+    }
+    if (size) os.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+}
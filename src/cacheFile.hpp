@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+// Helpers shared by the on-disk caches (mesh, texture, program binaries).
+
+constexpr uint64_t kFnvOffset = 1469598103934665603ull;
+constexpr uint64_t kFnvPrime  = 1099511628211ull;
+
+// FNV-1a over 8-byte words instead of bytes: the source hashes run on every
+// launch, byte-wise FNV would cost more than reading the caches themselves.
+// Chain calls by passing the last result as h; start from kFnvOffset.
+uint64_t fnv1a(uint64_t h, const void *data, size_t size);
+
+// Writes to path + ".tmp" and renames it over path, so a crash never leaves a
+// torn file behind. write fills the stream; false (and the reason on stderr)
+// if anything failed, the temporary is removed then.
+bool writeFileAtomically(const std::string &path, const std::function<void(std::ostream&)> &write);
+bool writeFileAtomically(const std::string &path, const void *data, size_t size);
+
+// writes bytes at offset, zero-padding from the current position: sections of
+// a cache file are aligned, the stream must not be past offset yet
+void writeAt(std::ostream &os, uint64_t offset, const void *data, size_t size);
@@ -0,0 +1,257 @@
+#include "clusteredLights.hpp"
+#include "frameUniforms.hpp"
+#include "frustum.hpp"
+#include "glState.hpp"
+#include "profiler.hpp"
+#include "renderStats.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FW_LIGHTS_SSE 1
+#endif
+
+namespace {
+
+// with fewer visible lights the slices are filled on the calling thread
+constexpr size_t kParallelMin = 256;
+constexpr int kTiles = ClusteredLights::kTilesX * ClusteredLights::kTilesY;
+
+// std140 layout of the Lights block in fragment.glsl
+struct LightsBlock {
+    glm::vec4 tileScale;        // tile = gl_FragCoord.xy * xy + zw
+    glm::vec4 depth;            // slice = log(view depth) * x + y
+    glm::uvec4 grid;            // tiles in x, tiles in y, slices, visible lights
+};
+
+} // namespace
+
+ClusteredLights::~ClusteredLights(){ clear(); }
+
+void ClusteredLights::clear(){
+    if(buffers_[0]){
+        glDeleteTextures(3, textures_);
+        glDeleteBuffers(3, buffers_);
+        for(int i = 0; i < 3; ++i) textures_[i] = buffers_[i] = 0;
+        GlState::shared().invalidate();
+    }
+}
+
+void ClusteredLights::cullLights(const glm::mat4 &view, const glm::mat4 &projection){
+    visible_.clear();
+    viewSpace_.clear();
+    firstSlice_.clear();
+    lastSlice_.clear();
+    const size_t count = std::min(lights_.size(), kMaxLights);
+    const float zNear = sliceDepth_[0], zFar = sliceDepth_[kSlices];
+    // planes of the projection alone are in view space
+    const Frustum frustum(projection);
+
+    auto slice = [&](float depth){
+        return (uint8_t)std::clamp((int)(std::log(depth) * depthScale_ + depthBias_), 0, kSlices - 1);
+    };
+    auto accept = [&](size_t i, const glm::vec4 &c){
+        const float depth = -c.z;
+        visible_.push_back((uint32_t)i);
+        viewSpace_.push_back(c);
+        firstSlice_.push_back(slice(std::max(depth - c.w, zNear)));
+        lastSlice_.push_back(slice(std::min(depth + c.w, zFar)));
+    };
+
+    size_t i = 0;
+#ifdef FW_LIGHTS_SSE
+    // four lights per pass: view transform, then the sphere against the four side planes and the depth range
+    __m128 m[4][4];
+    for(int c = 0; c < 4; ++c) for(int r = 0; r < 4; ++r) m[c][r] = _mm_set1_ps(view[c][r]);
+    __m128 planes[4][4];
+    for(int p = 0; p < 4; ++p) for(int k = 0; k < 4; ++k) planes[p][k] = _mm_set1_ps(frustum.planes[p][k]);
+    const __m128 nearZ = _mm_set1_ps(zNear), farZ = _mm_set1_ps(zFar);
+    alignas(16) float vx[4], vy[4], vz[4];
+    for(; i + 4 <= count; i += 4){
+        const PointLight *l = &lights_[i];
+        const __m128 x = _mm_setr_ps(l[0].position.x, l[1].position.x, l[2].position.x, l[3].position.x);
+        const __m128 y = _mm_setr_ps(l[0].position.y, l[1].position.y, l[2].position.y, l[3].position.y);
+        const __m128 z = _mm_setr_ps(l[0].position.z, l[1].position.z, l[2].position.z, l[3].position.z);
+        const __m128 r = _mm_setr_ps(l[0].radius, l[1].radius, l[2].radius, l[3].radius);
+        __m128 v[3];
+        for(int row = 0; row < 3; ++row)
+            v[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][row], x), _mm_mul_ps(m[1][row], y)),
+                                _mm_add_ps(_mm_mul_ps(m[2][row], z), m[3][row]));
+        const __m128 negR = _mm_sub_ps(_mm_setzero_ps(), r);
+        const __m128 depth = _mm_sub_ps(_mm_setzero_ps(), v[2]);
+        __m128 inside = _mm_and_ps(_mm_cmpgt_ps(_mm_add_ps(depth, r), nearZ), _mm_cmplt_ps(_mm_sub_ps(depth, r), farZ));
+        for(int p = 0; p < 4; ++p){
+            const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], v[0]), _mm_mul_ps(planes[p][1], v[1])),
+                                        _mm_add_ps(_mm_mul_ps(planes[p][2], v[2]), planes[p][3]));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(d, negR));
+        }
+        const int mask = _mm_movemask_ps(inside);
+        if(!mask) continue;
+        _mm_store_ps(vx, v[0]);
+        _mm_store_ps(vy, v[1]);
+        _mm_store_ps(vz, v[2]);
+        for(int k = 0; k < 4; ++k)
+            if(mask & (1 << k)) accept(i + k, glm::vec4(vx[k], vy[k], vz[k], l[k].radius));
+    }
+#endif
+    for(; i < count; ++i){
+        const PointLight &l = lights_[i];
+        const glm::vec4 c(glm::vec3(view * glm::vec4(l.position, 1.0f)), l.radius);
+        const float depth = -c.z;
+        bool inside = depth + c.w > zNear && depth - c.w < zFar;
+        for(int p = 0; p < 4 && inside; ++p)
+            inside = glm::dot(glm::vec3(frustum.planes[p]), glm::vec3(c)) + frustum.planes[p].w > -c.w;
+        if(inside) accept(i, c);
+    }
+}
+
+void ClusteredLights::assignSlice(int s, const glm::mat4 &projection){
+    Slice &out = slices_[s];
+    out.rects.clear();
+    out.counts.assign(kTiles, 0);
+    const float zn = sliceDepth_[s], zf = sliceDepth_[s + 1];
+    // ndc.x = p00 * x / depth - p20 for a view-space point at that depth, likewise y
+    const float p00 = projection[0][0], p11 = projection[1][1], p20 = projection[2][0], p21 = projection[2][1];
+    auto tile = [](float ndc, int tiles){ return (uint8_t)std::clamp((int)((ndc * 0.5f + 0.5f) * tiles), 0, tiles - 1); };
+
+    for(uint32_t k = sliceStart_[s]; k < sliceStart_[s + 1]; ++k){
+        const uint32_t v = sliceLights_[k];
+        const glm::vec4 &c = viewSpace_[v];
+        const float depth = -c.z, r = c.w;
+        // inside the slab the sphere is a disc of radius rs at most, between depths a and b
+        const float gap = std::max(0.0f, std::max(zn - depth, depth - zf));
+        if(gap >= r) continue;
+        const float rs = std::sqrt(r * r - gap * gap);
+        const float a = std::max(zn, depth - r), b = std::min(zf, depth + r);
+        // x / depth over that box is extreme at its corners
+        const float x0 = c.x - rs, x1 = c.x + rs, y0 = c.y - rs, y1 = c.y + rs;
+        const float nx0 = p00 * std::min(x0 / a, x0 / b) - p20, nx1 = p00 * std::max(x1 / a, x1 / b) - p20;
+        const float ny0 = p11 * std::min(y0 / a, y0 / b) - p21, ny1 = p11 * std::max(y1 / a, y1 / b) - p21;
+        if(nx1 < -1.0f || nx0 > 1.0f || ny1 < -1.0f || ny0 > 1.0f) continue;
+        const Rect rect{(uint16_t)v, tile(nx0, kTilesX), tile(nx1, kTilesX), tile(ny0, kTilesY), tile(ny1, kTilesY)};
+        out.rects.push_back(rect);
+        for(int y = rect.y0; y <= rect.y1; ++y)
+            for(int x = rect.x0; x <= rect.x1; ++x) ++out.counts[y * kTilesX + x];
+    }
+
+    // counts -> starts, then fill; a tile keeps its lights in visible order and counts end up as ends
+    uint32_t total = 0;
+    for(uint32_t &n : out.counts){
+        const uint32_t tileCount = n;
+        n = total;
+        total += tileCount;
+    }
+    out.indices.resize(total);
+    for(const Rect &rect : out.rects)
+        for(int y = rect.y0; y <= rect.y1; ++y)
+            for(int x = rect.x0; x <= rect.x1; ++x) out.indices[out.counts[y * kTilesX + x]++] = rect.light;
+}
+
+void ClusteredLights::build(const glm::mat4 &view, const glm::mat4 &projection){
+    PROFILE_ZONE("light assignment");
+    assign(view, projection);
+    upload();
+
+    RenderStats &stats = RenderStats::frame();
+    stats.lightsVisible += visible_.size();
+    stats.lightIndices += indices_.size();
+}
+
+void ClusteredLights::assign(const glm::mat4 &view, const glm::mat4 &projection){
+    // near and far back out of a GL perspective matrix
+    const float zNear = projection[3][2] / (projection[2][2] - 1.0f);
+    const float zFar = projection[3][2] / (projection[2][2] + 1.0f);
+    for(int s = 0; s <= kSlices; ++s) sliceDepth_[s] = zNear * std::pow(zFar / zNear, float(s) / kSlices);
+    depthScale_ = kSlices / std::log(zFar / zNear);
+    depthBias_ = -std::log(zNear) * depthScale_;
+
+    cullLights(view, projection);
+
+    // counting sort of the visible lights into the slices they span
+    sliceStart_.assign(kSlices + 1, 0);
+    for(size_t v = 0; v < visible_.size(); ++v)
+        for(int s = firstSlice_[v]; s <= lastSlice_[v]; ++s) ++sliceStart_[s + 1];
+    for(int s = 0; s < kSlices; ++s) sliceStart_[s + 1] += sliceStart_[s];
+    sliceLights_.resize(sliceStart_[kSlices]);
+    {
+        std::vector<uint32_t> cursor(sliceStart_.begin(), sliceStart_.end() - 1);
+        for(size_t v = 0; v < visible_.size(); ++v)
+            for(int s = firstSlice_[v]; s <= lastSlice_[v]; ++s) sliceLights_[cursor[s]++] = (uint32_t)v;
+    }
+
+    // slices share nothing but the inputs
+    ThreadPool &pool = ThreadPool::shared();
+    if(visible_.size() >= kParallelMin && pool.size() > 0)
+        pool.parallelFor(kSlices, [&](size_t s){ assignSlice((int)s, projection); });
+    else
+        for(int s = 0; s < kSlices; ++s) assignSlice(s, projection);
+
+    // slices back to back; cell = (slice * tilesY + y) * tilesX + x
+    cells_.resize(kCells * 2);
+    indices_.clear();
+    for(int s = 0; s < kSlices; ++s){
+        const Slice &slice = slices_[s];
+        const uint32_t base = (uint32_t)indices_.size();
+        for(int t = 0; t < kTiles; ++t){
+            const uint32_t start = t ? slice.counts[t - 1] : 0;
+            const size_t cell = size_t(s) * kTiles + t;
+            cells_[2 * cell] = base + start;
+            cells_[2 * cell + 1] = slice.counts[t] - start;
+        }
+        indices_.insert(indices_.end(), slice.indices.begin(), slice.indices.end());
+    }
+}
+
+void ClusteredLights::lightsAt(const glm::vec3 &viewPos, const glm::mat4 &projection, std::vector<uint32_t> &out) const {
+    out.clear();
+    if(cells_.empty()) return;
+    const glm::vec4 clip = projection * glm::vec4(viewPos, 1.0f);
+    const float depth = -viewPos.z;
+    if(depth <= 0.0f) return;
+    auto tile = [](float ndc, int tiles){ return std::clamp((int)((ndc * 0.5f + 0.5f) * tiles), 0, tiles - 1); };
+    const int x = tile(clip.x / clip.w, kTilesX), y = tile(clip.y / clip.w, kTilesY);
+    const int s = std::clamp((int)(std::log(std::max(depth, 1e-4f)) * depthScale_ + depthBias_), 0, kSlices - 1);
+    const size_t cell = (size_t(s) * kTilesY + y) * kTilesX + x;
+    for(uint32_t i = 0; i < cells_[2 * cell + 1]; ++i) out.push_back(visible_[indices_[cells_[2 * cell] + i]]);
+}
+
+void ClusteredLights::upload(){
+    GlState &gl = GlState::shared();
+    const bool created = buffers_[0] == 0;
+    if(created){
+        glGenBuffers(3, buffers_);
+        glGenTextures(3, textures_);
+    }
+
+    data_.resize(visible_.size() * 2);
+    for(size_t v = 0; v < visible_.size(); ++v){
+        const PointLight &l = lights_[visible_[v]];
+        data_[2 * v] = glm::vec4(l.position, l.radius);
+        data_[2 * v + 1] = glm::vec4(l.color, 0.0f);
+    }
+
+    const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+    const GLint units[3] = {kDataUnit, kCellsUnit, kIndexUnit};
+    const void *sources[3] = {data_.data(), cells_.data(), indices_.data()};
+    const size_t sizes[3] = {data_.size() * sizeof(glm::vec4), cells_.size() * sizeof(uint32_t),
+                             indices_.size() * sizeof(uint16_t)};
+    for(int i = 0; i < 3; ++i){
+        // a fresh store every frame, the GPU may still read last frame's; never empty
+        gl.bindBuffer(GL_TEXTURE_BUFFER, buffers_[i]);
+        glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)std::max<size_t>(sizes[i], 16), nullptr, GL_STREAM_DRAW);
+        if(sizes[i]) glBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr)sizes[i], sources[i]);
+        gl.bindTexture(units[i], GL_TEXTURE_BUFFER, textures_[i]);
+        if(created) glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers_[i]);
+    }
+
+    GLint viewport[4] = {0, 0, 1, 1};
+    gl.getViewport(viewport);
+    LightsBlock block;
+    const float sx = kTilesX / (float)std::max(viewport[2], 1), sy = kTilesY / (float)std::max(viewport[3], 1);
+    block.tileScale = glm::vec4(sx, sy, -viewport[0] * sx, -viewport[1] * sy);
+    block.depth = glm::vec4(depthScale_, depthBias_, 0.0f, 0.0f);
+    block.grid = glm::uvec4(kTilesX, kTilesY, kSlices, (unsigned)visible_.size());
+    FrameUniforms::shared().push(kLightsBinding, &block, sizeof(block));
+}
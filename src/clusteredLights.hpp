@@ -0,0 +1,95 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Point lights for clustered forward shading.
+//
+// The view frustum is cut into a kTilesX x kTilesY x kSlices grid of froxels:
+// screen tiles times depth slices spaced exponentially from near to far.
+// build() puts every light into the froxels its sphere touches and uploads
+// three texture buffers for fragment.glsl:
+//   data     RGBA32F, two texels per visible light: world position + radius,
+//            colour (intensity included)
+//   cells    RG32UI per froxel: first entry in indices, light count
+//   indices  R16UI, the lights of each froxel, froxel after froxel
+// A fragment walks the list of its own froxel, so its cost follows the light
+// density around it, not the number of lights in the scene.
+//
+// Assignment: lights go to view space and through the frustum four at a time
+// (SSE), then every slice sorts its lights into tiles as one ThreadPool job.
+class ClusteredLights {
+public:
+    static constexpr int kTilesX = 16, kTilesY = 9, kSlices = 24;
+    static constexpr size_t kCells = size_t(kTilesX) * kTilesY * kSlices;
+    // indices are 16-bit; lights past this many are ignored
+    static constexpr size_t kMaxLights = 65536;
+    // the Lights uniform block and the texture units of the three buffers
+    static constexpr GLuint kLightsBinding = 3;
+    static constexpr GLint kDataUnit = 2, kCellsUnit = 3, kIndexUnit = 4;
+
+    struct PointLight {
+        glm::vec3 position;     // world space
+        float radius;           // nothing lit past it
+        glm::vec3 color;
+    };
+
+    ClusteredLights() = default;
+    ~ClusteredLights();
+    ClusteredLights(const ClusteredLights&) = delete;
+    ClusteredLights& operator=(const ClusteredLights&) = delete;
+
+    // edited freely between builds
+    std::vector<PointLight> &lights() { return lights_; }
+    const std::vector<PointLight> &lights() const { return lights_; }
+
+    // every frame after FrameUniforms::beginFrame: assigns the lights for this
+    // view, uploads the buffers, pushes the Lights block and binds the textures.
+    // projection is a GL perspective matrix, the grid covers the current viewport
+    void build(const glm::mat4 &view, const glm::mat4 &projection);
+    // the CPU half of build(): assignment only, no GL, nothing uploaded
+    void assign(const glm::mat4 &view, const glm::mat4 &projection);
+    // drops the GL objects; needs the context if any were created
+    void clear();
+
+    // of the last build
+    size_t visibleLights() const { return visible_.size(); }
+    size_t indexCount() const { return indices_.size(); }
+    // lights (indices into lights(), ascending) of the froxel a view-space point
+    // falls in, found the way fragment.glsl finds them; for self-checks
+    void lightsAt(const glm::vec3 &viewPos, const glm::mat4 &projection, std::vector<uint32_t> &out) const;
+
+private:
+    // a light's tiles within one slice, inclusive
+    struct Rect { uint16_t light; uint8_t x0, x1, y0, y1; };
+    struct Slice {
+        std::vector<Rect> rects;
+        std::vector<uint32_t> counts;       // per tile
+        std::vector<uint16_t> indices;      // tile after tile
+    };
+
+    void cullLights(const glm::mat4 &view, const glm::mat4 &projection);
+    void assignSlice(int s, const glm::mat4 &projection);
+    void upload();
+
+    std::vector<PointLight> lights_;
+
+    // visible lights: original index, view-space centre + radius, slice range
+    std::vector<uint32_t> visible_;
+    std::vector<glm::vec4> viewSpace_;
+    std::vector<uint8_t> firstSlice_, lastSlice_;
+    float sliceDepth_[kSlices + 1] = {};
+    float depthScale_{0.0f}, depthBias_{0.0f};  // slice = log(depth) * scale + bias
+    // visible lights bucketed by slice (a light sits in every slice it spans)
+    std::vector<uint32_t> sliceStart_, sliceLights_;
+    Slice slices_[kSlices];
+
+    std::vector<uint32_t> cells_;           // two per froxel
+    std::vector<uint16_t> indices_;
+    std::vector<glm::vec4> data_;
+
+    GLuint buffers_[3] = {0, 0, 0};         // data, cells, indices
+    GLuint textures_[3] = {0, 0, 0};
+};
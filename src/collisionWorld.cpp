@@ -0,0 +1,275 @@
+#include "collisionWorld.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+
+glm::vec3 transformPoint(const glm::mat4 &m, const glm::vec3 &p){
+    return glm::vec3(m * glm::vec4(p, 1.0f));
+}
+
+glm::vec3 transformDir(const glm::mat4 &m, const glm::vec3 &d){
+    return glm::vec3(m * glm::vec4(d, 0.0f));
+}
+
+glm::vec3 closestPointOnSegment(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b){
+    const glm::vec3 ab = b - a;
+    const float len2 = glm::dot(ab, ab);
+    if(len2 <= 0.0f) return a;
+    return a + ab * glm::clamp(glm::dot(p - a, ab) / len2, 0.0f, 1.0f);
+}
+
+// The point of the segment to test against the triangle as a sphere: where the
+// segment's line crosses the triangle's plane, pulled onto the triangle and
+// back onto the segment. Exact for the cases a walking capsule runs into
+// (floors, walls, edges), and much cheaper than a full segment/triangle distance.
+glm::vec3 capsuleReference(const glm::vec3 &a, const glm::vec3 &b,
+                           const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2){
+    const glm::vec3 n = glm::cross(v1 - v0, v2 - v0);
+    const glm::vec3 dir = b - a;
+    const float denom = glm::dot(n, dir);
+    glm::vec3 onPlane;
+    if(std::fabs(denom) > 1e-12f){
+        const float t = glm::clamp(glm::dot(n, v0 - a) / denom, 0.0f, 1.0f);
+        onPlane = a + dir * t;
+    }else{
+        onPlane = a;
+    }
+    return closestPointOnSegment(closestPointOnTriangle(onPlane, v0, v1, v2), a, b);
+}
+
+} // namespace
+
+CollisionWorld::CollisionWorld(float cellSize) : cellSize_(cellSize > 0.0f ? cellSize : 4.0f) {}
+
+CollisionWorld::Handle CollisionWorld::add(const Bvh *bvh, const glm::mat4 &transform){
+    Handle h;
+    if(!freeList_.empty()){
+        h = freeList_.back();
+        freeList_.pop_back();
+    }else{
+        h = static_cast<Handle>(entries_.size());
+        entries_.emplace_back();
+    }
+    entries_[h].bvh = bvh;
+    ++liveCount_;
+    setTransform(h, transform);
+    return h;
+}
+
+void CollisionWorld::remove(Handle h){
+    if(h >= entries_.size() || !entries_[h].bvh) return;
+    erase(h);
+    entries_[h] = Entry();
+    freeList_.push_back(h);
+    --liveCount_;
+    updateBounds();
+}
+
+void CollisionWorld::setTransform(Handle h, const glm::mat4 &transform){
+    if(h >= entries_.size() || !entries_[h].bvh) return;
+    Entry &e = entries_[h];
+    if(e.bvh->empty()){
+        // nothing to collide with, but the handle stays valid
+        erase(h);
+        e.toWorld = transform;
+        e.toLocal = glm::inverse(transform);
+        e.bmin = e.bmax = glm::vec3(transform[3]);
+        growBounds(e);
+        return;
+    }
+    erase(h);
+    e.toWorld = transform;
+    e.toLocal = glm::inverse(transform);
+
+    // world bounds of the transformed local box
+    const glm::vec3 lo = e.bvh->boundsMin(), hi = e.bvh->boundsMax();
+    e.bmin = glm::vec3(FLT_MAX);
+    e.bmax = glm::vec3(-FLT_MAX);
+    for(int i = 0; i < 8; ++i){
+        const glm::vec3 corner((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z);
+        const glm::vec3 p = transformPoint(transform, corner);
+        e.bmin = glm::min(e.bmin, p);
+        e.bmax = glm::max(e.bmax, p);
+    }
+    insert(h);
+    growBounds(e);
+}
+
+void CollisionWorld::clear(){
+    entries_.clear();
+    freeList_.clear();
+    grid_.clear();
+    large_.clear();
+    liveCount_ = 0;
+    boundsMin_ = boundsMax_ = glm::vec3(0.0f);
+}
+
+glm::ivec3 CollisionWorld::cellOf(const glm::vec3 &p) const {
+    const glm::vec3 c = glm::floor(p / cellSize_);
+    return glm::ivec3(static_cast<int>(c.x), static_cast<int>(c.y), static_cast<int>(c.z));
+}
+
+uint64_t CollisionWorld::cellKey(int x, int y, int z){
+    // 21 bits per axis is ±1M cells, plenty for any cell size we'd use
+    auto bits = [](int v){ return static_cast<uint64_t>(static_cast<uint32_t>(v) & 0x1fffffu); };
+    return bits(x) | (bits(y) << 21) | (bits(z) << 42);
+}
+
+void CollisionWorld::insert(Handle h){
+    Entry &e = entries_[h];
+    e.cellMin = cellOf(e.bmin);
+    e.cellMax = cellOf(e.bmax);
+    const glm::ivec3 span = e.cellMax - e.cellMin + glm::ivec3(1);
+    if(static_cast<int64_t>(span.x) * span.y * span.z > kMaxCells){
+        large_.push_back(h);
+        return;
+    }
+    for(int z = e.cellMin.z; z <= e.cellMax.z; ++z)
+        for(int y = e.cellMin.y; y <= e.cellMax.y; ++y)
+            for(int x = e.cellMin.x; x <= e.cellMax.x; ++x)
+                grid_[cellKey(x, y, z)].push_back(h);
+}
+
+void CollisionWorld::erase(Handle h){
+    auto it = std::find(large_.begin(), large_.end(), h);
+    if(it != large_.end()){
+        large_.erase(it);
+        return;
+    }
+    const Entry &e = entries_[h];
+    for(int z = e.cellMin.z; z <= e.cellMax.z; ++z)
+        for(int y = e.cellMin.y; y <= e.cellMax.y; ++y)
+            for(int x = e.cellMin.x; x <= e.cellMax.x; ++x){
+                auto cell = grid_.find(cellKey(x, y, z));
+                if(cell == grid_.end()) continue;
+                auto &list = cell->second;
+                list.erase(std::remove(list.begin(), list.end(), h), list.end());
+                if(list.empty()) grid_.erase(cell);
+            }
+}
+
+void CollisionWorld::growBounds(const Entry &e){
+    // the only mesh: its box, whatever was there before
+    boundsMin_ = liveCount_ == 1 ? e.bmin : glm::min(boundsMin_, e.bmin);
+    boundsMax_ = liveCount_ == 1 ? e.bmax : glm::max(boundsMax_, e.bmax);
+}
+
+void CollisionWorld::updateBounds(){
+    bool first = true;
+    for(const Entry &e : entries_){
+        if(!e.bvh) continue;
+        boundsMin_ = first ? e.bmin : glm::min(boundsMin_, e.bmin);
+        boundsMax_ = first ? e.bmax : glm::max(boundsMax_, e.bmax);
+        first = false;
+    }
+    if(first) boundsMin_ = boundsMax_ = glm::vec3(0.0f);
+}
+
+void CollisionWorld::gather(const glm::vec3 &bmin, const glm::vec3 &bmax, std::vector<Handle> &out) const {
+    out.clear();
+    auto touches = [&](Handle h){
+        const Entry &e = entries_[h];
+        return e.bmin.x <= bmax.x && e.bmax.x >= bmin.x && e.bmin.y <= bmax.y && e.bmax.y >= bmin.y &&
+               e.bmin.z <= bmax.z && e.bmax.z >= bmin.z;
+    };
+    for(Handle h : large_) if(touches(h)) out.push_back(h);
+
+    const glm::ivec3 lo = cellOf(bmin), hi = cellOf(bmax);
+    const size_t cells = static_cast<size_t>(hi.x - lo.x + 1) * (hi.y - lo.y + 1) * (hi.z - lo.z + 1);
+    if(cells > grid_.size()){
+        // a box this big is cheaper to answer by walking the occupied cells
+        for(const auto &cell : grid_)
+            for(Handle h : cell.second) if(touches(h)) out.push_back(h);
+    }else{
+        for(int z = lo.z; z <= hi.z; ++z)
+            for(int y = lo.y; y <= hi.y; ++y)
+                for(int x = lo.x; x <= hi.x; ++x){
+                    auto cell = grid_.find(cellKey(x, y, z));
+                    if(cell == grid_.end()) continue;
+                    for(Handle h : cell->second) if(touches(h)) out.push_back(h);
+                }
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void CollisionWorld::collectTriangles(const glm::vec3 &bmin, const glm::vec3 &bmax, std::vector<glm::vec3> &out) const {
+    gather(bmin, bmax, candidates_);
+    for(Handle h : candidates_){
+        const Entry &e = entries_[h];
+        // local box of the world box: transform its corners
+        glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX);
+        for(int i = 0; i < 8; ++i){
+            const glm::vec3 corner((i & 1) ? bmax.x : bmin.x, (i & 2) ? bmax.y : bmin.y, (i & 4) ? bmax.z : bmin.z);
+            const glm::vec3 p = transformPoint(e.toLocal, corner);
+            lmin = glm::min(lmin, p);
+            lmax = glm::max(lmax, p);
+        }
+        triangleIds_.clear();
+        e.bvh->overlapAabbCoarse(lmin, lmax, triangleIds_);
+        for(uint32_t id : triangleIds_){
+            glm::vec3 v0, v1, v2;
+            e.bvh->triangle(id, v0, v1, v2);
+            out.push_back(transformPoint(e.toWorld, v0));
+            out.push_back(transformPoint(e.toWorld, v1));
+            out.push_back(transformPoint(e.toWorld, v2));
+        }
+    }
+}
+
+void CollisionWorld::capsuleContacts(const glm::vec3 &a, const glm::vec3 &b, float radius,
+                                     std::vector<Contact> &out) const {
+    const glm::vec3 r(radius);
+    triangles_.clear();
+    collectTriangles(glm::min(a, b) - r, glm::max(a, b) + r, triangles_);
+    capsuleContacts(triangles_, a, b, radius, out);
+}
+
+void CollisionWorld::capsuleContacts(const std::vector<glm::vec3> &triangles, const glm::vec3 &a, const glm::vec3 &b,
+                                     float radius, std::vector<Contact> &out){
+    const glm::vec3 bmin = glm::min(a, b) - glm::vec3(radius), bmax = glm::max(a, b) + glm::vec3(radius);
+    for(size_t i = 0; i + 2 < triangles.size(); i += 3){
+        const glm::vec3 &v0 = triangles[i], &v1 = triangles[i + 1], &v2 = triangles[i + 2];
+        const glm::vec3 tmin = glm::min(v0, glm::min(v1, v2)), tmax = glm::max(v0, glm::max(v1, v2));
+        if(tmin.x > bmax.x || tmax.x < bmin.x || tmin.y > bmax.y || tmax.y < bmin.y ||
+           tmin.z > bmax.z || tmax.z < bmin.z) continue;
+
+        const glm::vec3 center = capsuleReference(a, b, v0, v1, v2);
+        const glm::vec3 p = closestPointOnTriangle(center, v0, v1, v2);
+        const glm::vec3 d = center - p;
+        const float dist2 = glm::dot(d, d);
+        if(dist2 >= radius * radius) continue;
+
+        const float dist = std::sqrt(dist2);
+        glm::vec3 face = glm::cross(v1 - v0, v2 - v0);
+        const float len = glm::length(face);
+        face = len > 0.0f ? face / len : glm::vec3(0.0f, 1.0f, 0.0f);
+        if(dist > 1e-6f){
+            const glm::vec3 n = d / dist;
+            out.push_back({p, n, radius - dist, std::fabs(glm::dot(n, face)) < 0.999f});
+        }else{
+            // the segment goes through the triangle: push out of whichever side the bottom is on
+            out.push_back({p, glm::dot(face, a - p) < 0.0f ? -face : face, radius, false});
+        }
+    }
+}
+
+bool CollisionWorld::raycast(const glm::vec3 &origin, const glm::vec3 &dir, float maxT, BvhHit &hit) const {
+    const glm::vec3 end = origin + dir * maxT;
+    gather(glm::min(origin, end), glm::max(origin, end), candidates_);
+
+    bool found = false;
+    for(Handle h : candidates_){
+        const Entry &e = entries_[h];
+        BvhHit local;
+        // rigid transform: t means the same thing in both spaces
+        if(!e.bvh->raycast(transformPoint(e.toLocal, origin), transformDir(e.toLocal, dir), maxT, local)) continue;
+        maxT = local.t;
+        hit = local;
+        hit.normal = glm::normalize(transformDir(e.toWorld, local.normal));
+        found = true;
+    }
+    return found;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "bvh.hpp"
+
+// Static collision geometry: meshes (their Bvh) placed with rigid transforms.
+// Broadphase is a uniform grid over the world-space bounds of each mesh, so a
+// query only looks at the meshes near it however many there are; inside a
+// mesh its Bvh does the rest. Bvhs are not owned and must outlive the world.
+class CollisionWorld {
+public:
+    using Handle = uint32_t;
+
+    struct Contact {
+        glm::vec3 point;        // on the surface
+        glm::vec3 normal;       // out of the surface, towards the query shape
+        float depth;            // penetration along normal
+        bool edge;              // closest point is on an edge or corner, not inside the face
+    };
+
+    explicit CollisionWorld(float cellSize = 4.0f);
+
+    // transform: rotation + translation only, the query radius isn't rescaled
+    Handle add(const Bvh *bvh, const glm::mat4 &transform = glm::mat4(1.0f));
+    void remove(Handle h);
+    void setTransform(Handle h, const glm::mat4 &transform);
+    void clear();
+
+    bool empty() const { return liveCount_ == 0; }
+    // box around every mesh; add() and setTransform() only grow it, so a mesh
+    // moved inwards leaves it loose until the next remove() rescans
+    glm::vec3 boundsMin() const { return boundsMin_; }
+    glm::vec3 boundsMax() const { return boundsMax_; }
+
+    // every triangle closer than radius to the segment a-b, one contact each
+    void capsuleContacts(const glm::vec3 &a, const glm::vec3 &b, float radius, std::vector<Contact> &out) const;
+    // World-space triangles (3 vertices each) whose bounds touch the box. A
+    // character resolving in a few iterations collects its neighbourhood once
+    // and runs the static capsuleContacts below against it.
+    void collectTriangles(const glm::vec3 &bmin, const glm::vec3 &bmax, std::vector<glm::vec3> &out) const;
+    static void capsuleContacts(const std::vector<glm::vec3> &triangles, const glm::vec3 &a, const glm::vec3 &b,
+                                float radius, std::vector<Contact> &out);
+    bool raycast(const glm::vec3 &origin, const glm::vec3 &dir, float maxT, BvhHit &hit) const;
+
+private:
+    struct Entry {
+        const Bvh *bvh = nullptr;       // nullptr = free slot
+        glm::mat4 toWorld{1.0f}, toLocal{1.0f};
+        glm::vec3 bmin{0.0f}, bmax{0.0f};
+        glm::ivec3 cellMin{0}, cellMax{0};
+    };
+    // meshes spanning more cells than this go to large_ instead of the grid
+    static constexpr int kMaxCells = 64;
+
+    glm::ivec3 cellOf(const glm::vec3 &p) const;
+    static uint64_t cellKey(int x, int y, int z);
+    void insert(Handle h);
+    void erase(Handle h);
+    void growBounds(const Entry &e);
+    void updateBounds();
+    // handles of the meshes whose bounds touch the box, no duplicates
+    void gather(const glm::vec3 &bmin, const glm::vec3 &bmax, std::vector<Handle> &out) const;
+
+    float cellSize_;
+    std::vector<Entry> entries_;
+    std::vector<Handle> freeList_;
+    std::unordered_map<uint64_t, std::vector<Handle>> grid_;
+    std::vector<Handle> large_;
+    size_t liveCount_ = 0;
+    glm::vec3 boundsMin_{0.0f}, boundsMax_{0.0f};
+
+    // scratch for queries; the world is queried from the main thread only
+    mutable std::vector<Handle> candidates_;
+    mutable std::vector<uint32_t> triangleIds_;
+    mutable std::vector<glm::vec3> triangles_;
+};
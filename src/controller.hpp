@@ -9,6 +9,10 @@ public:
     void init(float spd);
     void controlFree(const bool* keyboardState, glm::mat4& view, double delta, float mouseX, float mouseY);
 
+    // camera after the last controlFree(), for interpolating between updates
+    glm::vec3 getEye() const { return position; }
+    glm::vec3 getFront() const { return front; }
+
 private:
     float speed = 5.0f;
     float sensitivity = 10.0f;
@@ -1,5 +1,7 @@
 #include "defaultController.hpp"
 #include <SDL3/SDL.h>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include "defines.hpp"
 
@@ -40,34 +42,174 @@ void DController::controlFree(const bool* keyboardState, glm::mat4& view, double
 
     if (glm::length(moveDir) > 0.0f) {
         moveDir = glm::normalize(moveDir);
-        position += moveDir * speed * dt;
         if (bobEnabled)
             bobTimer += dt * bobFrequency * glm::length(moveDir);
     }
 
-    if (keyboardState[KEY_SPACE] && !isJumping) {
-        isJumping = true;
-        velocityY = jumpSpeed;
-    }
+    if (world) {
+        if (keyboardState[KEY_SPACE] && grounded) {
+            grounded = false;
+            velocityY = jumpSpeed;
+        }
+        moveWithCollision(moveDir * speed * dt, dt);
+    } else {
+        position += moveDir * speed * dt;
 
-    if (isJumping) {
-        velocityY += gravity * dt;
-        position.y += velocityY * dt;
-    }
+        if (keyboardState[KEY_SPACE] && !isJumping) {
+            isJumping = true;
+            velocityY = jumpSpeed;
+        }
 
-    float baseEye = floorY + eyeHeight;
-    if (position.y <= baseEye) {
-        position.y = baseEye;
-        isJumping = false;
-        velocityY = 0.0f;
+        if (isJumping) {
+            velocityY += gravity * dt;
+            position.y += velocityY * dt;
+        }
+
+        float baseEye = floorY + eyeHeight;
+        if (position.y <= baseEye) {
+            position.y = baseEye;
+            isJumping = false;
+            velocityY = 0.0f;
+        }
     }
 
     float bobOffset = 0.0f;
     if (bobEnabled && glm::length(moveDir) > 0.0f)
         bobOffset = sin(bobTimer * glm::two_pi<float>()) * bobAmplitude;
 
-    glm::vec3 eyePos = position;
-    eyePos.y += bobOffset;
+    eye = position;
+    eye.y += bobOffset;
+
+    view = glm::lookAt(eye, eye + front, up);
+}
+
+void DController::setCollisionWorld(const CollisionWorld* w)
+{
+    world = (w && !w->empty()) ? w : nullptr;
+    nearbyValid = false;
+    velocityY = 0.0f;
+    isJumping = false;
+    grounded = false;
+    if (world) placeOnGround(spawn);
+}
+
+void DController::placeOnGround(glm::vec3 pos)
+{
+    // drop straight down from above the world; with nothing below, fall from the top
+    const float top = world->boundsMax().y + eyeHeight;
+    BvhHit hit;
+    if (world->raycast(glm::vec3(pos.x, top, pos.z), glm::vec3(0.0f, -1.0f, 0.0f), top - world->boundsMin().y + 1.0f, hit))
+        pos.y = top - hit.t + eyeHeight;
+    else
+        pos.y = top;
+    position = pos;
+    resolve(position);
+}
+
+void DController::collectNearby(const glm::vec3& pos)
+{
+    // capsule bounds plus a margin; pushes within the margin reuse the same triangles
+    constexpr float kMargin = 0.1f;
+    const glm::vec3 d = glm::abs(pos - nearbyCenter);
+    if (nearbyValid && std::max(d.x, std::max(d.y, d.z)) < kMargin) return;
+    const float reach = radius + 2.0f * kMargin;
+    nearby.clear();
+    world->collectTriangles(glm::vec3(pos.x - reach, pos.y - eyeHeight - 2.0f * kMargin, pos.z - reach),
+                            glm::vec3(pos.x + reach, pos.y + headroom + 2.0f * kMargin, pos.z + reach), nearby);
+    nearbyCenter = pos;
+    nearbyValid = true;
+}
+
+bool DController::resolve(glm::vec3& pos)
+{
+    // a resting contact keeps this much overlap, so standing still stays grounded
+    constexpr float kSkin = 0.001f;
+    bool supported = false;
 
-    view = glm::lookAt(eyePos, eyePos + front, up);
+    for (int iteration = 0; iteration < 4; ++iteration) {
+        collectNearby(pos);
+        const float feet = pos.y - eyeHeight;
+        const glm::vec3 bottom(pos.x, feet + radius, pos.z);
+        const glm::vec3 top(pos.x, std::max(feet + eyeHeight + headroom - radius, feet + radius), pos.z);
+        contacts.clear();
+        CollisionWorld::capsuleContacts(nearby, bottom, top, radius, contacts);
+
+        // Walkable faces hold the capsule up, and so do edges under the bottom
+        // sphere up to stepHeight: running into a kerb lifts the capsule onto it
+        // instead of stopping it. Everything else pushes back along its normal.
+        auto supports = [&](const CollisionWorld::Contact& c) {
+            return c.normal.y >= minGroundY || (c.edge && c.normal.y > 0.0f && c.point.y <= feet + stepHeight);
+        };
+
+        // deepest first, one at a time: pushing out of one often clears the others
+        const CollisionWorld::Contact* deepest = nullptr;
+        for (const auto& c : contacts) {
+            if (supports(c)) supported = true;
+            if (c.depth > kSkin && (!deepest || c.depth > deepest->depth)) deepest = &c;
+        }
+        if (!deepest) break;
+
+        const CollisionWorld::Contact& c = *deepest;
+        if (supports(c)) {
+            // straight up, so standing on a slope doesn't slide down it
+            if (c.edge) {
+                const glm::vec3 center = c.point + c.normal * (radius - c.depth);
+                const glm::vec2 h(center.x - c.point.x, center.z - c.point.z);
+                const float r = radius - kSkin;
+                pos.y += std::sqrt(std::max(r * r - glm::dot(h, h), 0.0f)) - (center.y - c.point.y);
+            } else {
+                pos.y += (c.depth - kSkin) / c.normal.y;
+            }
+            if (velocityY < 0.0f) velocityY = 0.0f;
+        } else {
+            pos += c.normal * (c.depth - kSkin);
+            if (c.normal.y < -minGroundY && velocityY > 0.0f) velocityY = 0.0f;   // ceiling
+        }
+    }
+    return supported;
+}
+
+bool DController::groundBelow(const glm::vec3& pos, float maxDrop, float& groundY) const
+{
+    // from the centre of the bottom sphere, so a floor the capsule already touches is found too
+    const glm::vec3 from(pos.x, pos.y - eyeHeight + radius, pos.z);
+    BvhHit hit;
+    if (!world->raycast(from, glm::vec3(0.0f, -1.0f, 0.0f), radius + maxDrop, hit) || hit.normal.y < minGroundY)
+        return false;
+    groundY = from.y - hit.t;
+    return true;
+}
+
+void DController::moveWithCollision(const glm::vec3& horizontal, float dt)
+{
+    const bool wasGrounded = grounded;
+    if (!grounded) velocityY += gravity * dt;
+
+    const glm::vec3 delta = horizontal + glm::vec3(0.0f, velocityY * dt, 0.0f);
+    // sub-steps no longer than half the radius, so thin walls can't be skipped
+    const int steps = std::clamp(static_cast<int>(std::ceil(glm::length(delta) / (radius * 0.5f))), 1, 16);
+    const glm::vec3 stepDelta = delta / static_cast<float>(steps);
+
+    grounded = false;
+    for (int i = 0; i < steps; ++i) {
+        position += stepDelta;
+        grounded = resolve(position) || grounded;
+    }
+
+    // walking down stairs or a slope: stay on the ground instead of launching off it
+    if (wasGrounded && !grounded && velocityY <= 0.0f) {
+        float groundY = 0.0f;
+        if (groundBelow(position, snapDistance, groundY)) {
+            position.y = groundY + eyeHeight;
+            resolve(position);
+            grounded = true;
+        }
+    }
+    if (grounded) velocityY = 0.0f;
+
+    // fell out of the world
+    if (position.y < world->boundsMin().y - 20.0f) {
+        velocityY = 0.0f;
+        placeOnGround(spawn);
+    }
 }
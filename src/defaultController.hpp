@@ -3,13 +3,31 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <SDL3/SDL.h>
+#include <vector>
+#include "collisionWorld.hpp"
 
 class DController {
 public:
     void init(float spd);
     void controlFree(const bool* keyboardState, glm::mat4& view, double delta, float mouseX, float mouseY);
 
+    // walk on the world's meshes as a capsule instead of the floorY plane;
+    // nullptr goes back to the plane. Drops the player onto the ground below
+    void setCollisionWorld(const CollisionWorld* world);
+
+    // camera after the last controlFree(), for interpolating between updates
+    glm::vec3 getEye() const { return eye; }
+    glm::vec3 getFront() const { return front; }
+
 private:
+    // push the capsule standing at pos (eye height) out of the world; true if it stands on something
+    bool resolve(glm::vec3& pos);
+    void moveWithCollision(const glm::vec3& horizontal, float dt);
+    // walkable surface at most maxDrop under the feet
+    bool groundBelow(const glm::vec3& pos, float maxDrop, float& groundY) const;
+    void placeOnGround(glm::vec3 pos);
+    void collectNearby(const glm::vec3& pos);
+
     float speed = 5.0f;
     float sensitivity = 10.0f;
     float pitch = 0.0f;
@@ -21,6 +39,7 @@ private:
     glm::vec3 front     = {0.0f, 0.0f, -1.0f};
     glm::vec3 up        = {0.0f, 1.0f, 0.0f};
     glm::vec3 direction = {0.0f, 0.0f, 0.0f};
+    glm::vec3 eye       = {0.0f, 0.01f, 3.0f};   // position + head bob
 
     bool  bobEnabled    = true;
     float bobAmplitude  = 0.03f;
@@ -34,4 +53,18 @@ private:
     float velocityY = 0.0f;
     float jumpSpeed = 4.5f;
     float gravity   = -9.81f;
+
+    // capsule from the feet to a bit above the eyes
+    const CollisionWorld* world = nullptr;
+    float radius       = 0.3f;
+    float headroom     = 0.1f;
+    float stepHeight   = 0.3f;      // edges up to here are climbed; no higher than radius
+    float snapDistance = 0.2f;
+    float minGroundY   = 0.64f;     // cos of the steepest walkable slope (~50 deg)
+    bool  grounded     = false;
+    glm::vec3 spawn    = {0.0f, 0.01f, 3.0f};
+    std::vector<CollisionWorld::Contact> contacts;
+    std::vector<glm::vec3> nearby;  // world triangles around nearbyCenter
+    glm::vec3 nearbyCenter{0.0f};
+    bool nearbyValid = false;
 };
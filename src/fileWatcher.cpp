@@ -0,0 +1,59 @@
+#include "fileWatcher.hpp"
+#include <algorithm>
+#include <filesystem>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+FileWatcher::~FileWatcher() { clear(); }
+
+bool FileWatcher::watch(const std::string &path) {
+#ifdef __linux__
+    if (fd_ < 0) fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0) return false;
+    const fs::path p(path);
+    const std::string dir = p.has_parent_path() ? p.parent_path().string() : ".";
+    // one watch descriptor per directory, inotify hands the same one back anyway
+    const int wd = inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) return false;
+    entries_.push_back({wd, dir, p.filename().string(), path});
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+std::vector<std::string> FileWatcher::poll() {
+    std::vector<std::string> changed;
+#ifdef __linux__
+    if (fd_ < 0) return changed;
+    alignas(inotify_event) char buf[4096];
+    for (;;) {
+        const ssize_t n = read(fd_, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (ssize_t off = 0; off < n;) {
+            const inotify_event *e = reinterpret_cast<const inotify_event *>(buf + off);
+            off += sizeof(inotify_event) + e->len;
+            if (!e->len) continue;
+            for (const Entry &entry : entries_)
+                if (entry.wd == e->wd && entry.name == e->name &&
+                    std::find(changed.begin(), changed.end(), entry.path) == changed.end())
+                    changed.push_back(entry.path);
+        }
+    }
+#endif
+    return changed;
+}
+
+void FileWatcher::clear() {
+#ifdef __linux__
+    if (fd_ >= 0) close(fd_);
+#endif
+    fd_ = -1;
+    entries_.clear();
+}
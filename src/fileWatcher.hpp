@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Change notifications for a handful of files (inotify, Linux only; elsewhere
+// nothing is ever reported). Whole directories are watched, so editors that
+// save by writing a temp file and renaming it over the original still count.
+class FileWatcher {
+public:
+    FileWatcher() = default;
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    bool watch(const std::string &path);
+    // paths (as passed to watch) written since the last call; never blocks
+    std::vector<std::string> poll();
+    void clear();
+
+private:
+    struct Entry { int wd; std::string dir, name, path; };
+    int fd_{-1};
+    std::vector<Entry> entries_;
+};
@@ -0,0 +1,89 @@
+#include "frameScheduler.hpp"
+#include <algorithm>
+#include <cstdio>
+
+void FrameScheduler::setMode(Mode mode, double targetFps) {
+    if (targetFps > 0.0) targetFps_ = targetFps;
+    mode_ = mode;
+    if (mode_ == Mode::VSync && !SDL_GL_SetSwapInterval(1)) {
+        // no vsync on this driver/window system; pace ourselves instead
+        mode_ = Mode::TargetFps;
+    }
+    if (mode_ != Mode::VSync) SDL_GL_SetSwapInterval(0);
+    deadline_ = 0.0;
+}
+
+void FrameScheduler::setTickRate(double hz) {
+    if (hz > 0.0) tickDt_ = 1.0 / hz;
+}
+
+double FrameScheduler::now() const {
+    static const double freq = static_cast<double>(SDL_GetPerformanceFrequency());
+    return static_cast<double>(SDL_GetPerformanceCounter()) / freq;
+}
+
+void FrameScheduler::beginFrame() {
+    const double t = now();
+    if (frameStart_ < 0.0) frameStart_ = t;
+    frameDelta_ = t - frameStart_;
+    frameStart_ = t;
+
+    if (frameDelta_ > 0.0) {
+        frameTimes_[samples_ % kHistory] = frameDelta_ * 1000.0;
+        ++samples_;
+    }
+    accumulator_ += std::min(frameDelta_, kMaxFrameDelta);
+}
+
+bool FrameScheduler::tick() {
+    if (accumulator_ < tickDt_) return false;
+    accumulator_ -= tickDt_;
+    return true;
+}
+
+void FrameScheduler::endFrame() {
+    const double t = now();
+    if (samples_ > 0) workTimes_[(samples_ - 1) % kHistory] = (t - frameStart_) * 1000.0;
+
+    if (mode_ != Mode::TargetFps) return;
+    const double period = 1.0 / targetFps_;
+    // deadlines advance by whole periods so rounding doesn't drift the rate;
+    // after a long frame start over instead of rushing to catch up
+    deadline_ = (deadline_ <= 0.0 || t - deadline_ > period) ? frameStart_ + period : deadline_ + period;
+    waitUntil(deadline_);
+}
+
+void FrameScheduler::waitUntil(double deadline) const {
+    double remaining = deadline - now();
+    if (remaining > kSpinMargin)
+        SDL_DelayNS(static_cast<Uint64>((remaining - kSpinMargin) * 1e9));
+    while (now() < deadline) {}
+}
+
+double FrameScheduler::percentile(const std::vector<double> &ring, size_t count, double p) {
+    count = std::min(count, ring.size());
+    if (count == 0) return 0.0;
+    std::vector<double> v(ring.begin(), ring.begin() + count);
+    size_t k = static_cast<size_t>(std::clamp(p, 0.0, 100.0) / 100.0 * (count - 1) + 0.5);
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+double FrameScheduler::frameTimePercentile(double p) const {
+    return percentile(frameTimes_, samples_, p);
+}
+
+double FrameScheduler::workTimePercentile(double p) const {
+    return percentile(workTimes_, samples_, p);
+}
+
+std::string FrameScheduler::summary() const {
+    static const char* names[] = { "uncapped", "vsync", "target" };
+    char buf[160];
+    std::snprintf(buf, sizeof(buf), "%s%s frame p50 %.2f p95 %.2f p99 %.2f ms, work p99 %.2f ms",
+                  names[static_cast<int>(mode_)],
+                  mode_ == Mode::TargetFps ? (" " + std::to_string(static_cast<int>(targetFps_))).c_str() : "",
+                  frameTimePercentile(50), frameTimePercentile(95), frameTimePercentile(99),
+                  workTimePercentile(99));
+    return buf;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <SDL3/SDL.h>
+#include <string>
+#include <vector>
+
+// Paces the main loop and drives a fixed-timestep simulation.
+//
+//   scheduler.beginFrame();
+//   while (scheduler.tick()) simulate(scheduler.tickDt());
+//   render(scheduler.alpha());      // blend previous/current sim state
+//   SDL_GL_SwapWindow(...);
+//   scheduler.endFrame();           // waits in TargetFps mode
+//
+// TargetFps sleeps until ~spinMargin before the deadline and spins the rest,
+// since SDL_DelayNS alone overshoots by up to a scheduler quantum.
+class FrameScheduler {
+public:
+    enum class Mode { Uncapped, VSync, TargetFps };
+
+    void setMode(Mode mode, double targetFps = 0.0);
+    Mode mode() const { return mode_; }
+    double targetFps() const { return targetFps_; }
+
+    void setTickRate(double hz);
+    double tickDt() const { return tickDt_; }
+
+    void beginFrame();
+    // true while another fixed step is due; consumes it
+    bool tick();
+    // how far rendering is between the last two ticks, [0, 1)
+    double alpha() const { return accumulator_ / tickDt_; }
+    void endFrame();
+
+    // last frame's start-to-start time, seconds
+    double frameDelta() const { return frameDelta_; }
+
+    // over the last kHistory frames, milliseconds; p in [0, 100]
+    double frameTimePercentile(double p) const;
+    double workTimePercentile(double p) const;
+    std::string summary() const;
+
+private:
+    static constexpr size_t kHistory = 512;
+    static constexpr double kMaxFrameDelta = 0.25;   // don't spiral after a hitch
+    static constexpr double kSpinMargin = 0.002;
+
+    double now() const;
+    void waitUntil(double deadline) const;
+    static double percentile(const std::vector<double> &ring, size_t count, double p);
+
+    Mode mode_ = Mode::VSync;
+    double targetFps_ = 60.0;
+    double tickDt_ = 1.0 / 60.0;
+
+    double frameStart_ = -1.0;
+    double deadline_ = 0.0;
+    double frameDelta_ = 0.0;
+    double accumulator_ = 0.0;
+
+    std::vector<double> frameTimes_ = std::vector<double>(kHistory, 0.0);
+    std::vector<double> workTimes_ = std::vector<double>(kHistory, 0.0);
+    size_t samples_ = 0;
+};
@@ -0,0 +1,83 @@
+#include "frameUniforms.hpp"
+#include "glState.hpp"
+#include <cstring>
+
+FrameUniforms& FrameUniforms::shared() {
+    static FrameUniforms uniforms;
+    return uniforms;
+}
+
+void FrameUniforms::init() {
+    GLint align = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    align_ = static_cast<size_t>(align > 0 ? align : 256);
+
+    const GLsizeiptr size = static_cast<GLsizeiptr>(kRegionSize * kFramesInFlight);
+    glGenBuffers(1, &buffer_);
+    GlState::shared().bindBuffer(GL_UNIFORM_BUFFER, buffer_);
+    if (GLEW_ARB_buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+        mapped_ = static_cast<char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags));
+    }
+    if (!mapped_) glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+}
+
+void FrameUniforms::setLight(const glm::vec3 &dir, const glm::vec3 &ambient) {
+    frame_.lightDir = glm::vec4(dir, 0.0f);
+    frame_.ambient = glm::vec4(ambient, 1.0f);
+}
+
+void FrameUniforms::beginFrame(const glm::mat4 &view, const glm::mat4 &projection) {
+    if (!buffer_) init();
+    region_ = (region_ + 1) % kFramesInFlight;
+    offset_ = 0;
+    // the GPU may still read this region from kFramesInFlight frames ago
+    if (GLsync &fence = fences_[region_]) {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    frame_.view = view;
+    frame_.projection = projection;
+    frame_.viewProj = projection * view;
+    push(kFrameBinding, &frame_, sizeof(frame_));
+}
+
+bool FrameUniforms::push(GLuint binding, const void *data, size_t size) {
+    if (!buffer_ || offset_ + size > kRegionSize) return false;
+    const size_t at = region_ * kRegionSize + offset_;
+    GlState &gl = GlState::shared();
+    if (mapped_) std::memcpy(mapped_ + at, data, size);
+    else {
+        gl.bindBuffer(GL_UNIFORM_BUFFER, buffer_);
+        glBufferSubData(GL_UNIFORM_BUFFER, static_cast<GLintptr>(at), static_cast<GLsizeiptr>(size), data);
+    }
+    gl.bindBufferRange(GL_UNIFORM_BUFFER, binding, buffer_, static_cast<GLintptr>(at), static_cast<GLsizeiptr>(size));
+    offset_ = (offset_ + size + align_ - 1) / align_ * align_;
+    return true;
+}
+
+void FrameUniforms::endFrame() {
+    if (!buffer_) return;
+    if (fences_[region_]) glDeleteSync(fences_[region_]);
+    fences_[region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void FrameUniforms::clear() {
+    for (GLsync &fence : fences_) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (buffer_) {
+        if (mapped_) {
+            GlState::shared().bindBuffer(GL_UNIFORM_BUFFER, buffer_);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+        glDeleteBuffers(1, &buffer_);
+        GlState::shared().invalidate();
+    }
+    buffer_ = 0;
+    mapped_ = nullptr;
+    region_ = offset_ = 0;
+}
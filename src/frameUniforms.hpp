@@ -0,0 +1,52 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+
+// Uniform blocks of the scene shaders, streamed through one ring buffer of
+// kFramesInFlight regions. beginFrame() waits until the GPU is done with the
+// region it is about to overwrite, writes the Frame block (binding
+// kFrameBinding) and binds it; push() appends per-object blocks after it.
+// With ARB_buffer_storage the ring is persistently mapped and written with
+// memcpy, otherwise every block is one glBufferSubData.
+// Needs a current context from the first beginFrame() until clear().
+class FrameUniforms {
+public:
+    static constexpr GLuint kFrameBinding = 0;
+    static constexpr GLuint kObjectBinding = 2;
+
+    // std140 layout of the Frame block in vertex.glsl / fragment.glsl
+    struct FrameBlock {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 viewProj;
+        glm::vec4 lightDir;     // xyz, towards the scene
+        glm::vec4 ambient;      // rgb
+    };
+
+    static FrameUniforms& shared();
+
+    void setLight(const glm::vec3 &dir, const glm::vec3 &ambient);
+    void beginFrame(const glm::mat4 &view, const glm::mat4 &projection);
+    // copies the block into this frame's region and binds it to binding;
+    // false (nothing bound) when the region is full
+    bool push(GLuint binding, const void *data, size_t size);
+    void endFrame();
+    void clear();
+
+    const FrameBlock &frame() const { return frame_; }
+
+private:
+    static constexpr size_t kFramesInFlight = 3;
+    static constexpr size_t kRegionSize = 64 * 1024;
+
+    void init();
+
+    FrameBlock frame_{glm::mat4(1.0f), glm::mat4(1.0f), glm::mat4(1.0f),
+                      glm::vec4(0.5f, -1.0f, 0.3f, 0.0f), glm::vec4(0.12f, 0.12f, 0.12f, 1.0f)};
+    GLuint buffer_{0};
+    char *mapped_{nullptr};                 // persistent mapping, null on the fallback path
+    size_t align_{256};
+    size_t region_{0}, offset_{0};
+    GLsync fences_[kFramesInFlight] = {};
+};
@@ -0,0 +1,118 @@
+#include "frustum.hpp"
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FW_FRUSTUM_SSE 1
+#endif
+
+Frustum::Frustum(const glm::mat4 &clip){
+    // Gribb/Hartmann: rows of the clip matrix, GL depth range [-1, 1]
+    auto row = [&](int i){ return glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]); };
+    const glm::vec4 r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+    planes[0] = r3 + r0;    // left
+    planes[1] = r3 - r0;    // right
+    planes[2] = r3 + r1;    // bottom
+    planes[3] = r3 - r1;    // top
+    planes[4] = r3 + r2;    // near
+    planes[5] = r3 - r2;    // far
+    // only signs are compared, but normalized planes keep far-away boxes out of float trouble
+    for(glm::vec4 &p : planes){
+        const float len = glm::length(glm::vec3(p));
+        if(len > 0.0f) p /= len;
+    }
+}
+
+bool Frustum::intersects(const glm::vec3 &bmin, const glm::vec3 &bmax) const {
+    const glm::vec3 c = (bmin + bmax) * 0.5f, e = (bmax - bmin) * 0.5f;
+    for(const glm::vec4 &p : planes){
+        const float d = p.x * c.x + p.y * c.y + p.z * c.z + p.w;
+        const float r = std::fabs(p.x) * e.x + std::fabs(p.y) * e.y + std::fabs(p.z) * e.z;
+        if(d + r < 0.0f) return false;
+    }
+    return true;
+}
+
+void CullBoxes::clear(){
+    blocks_.clear();
+    count_ = 0;
+}
+
+void CullBoxes::add(const glm::vec3 &bmin, const glm::vec3 &bmax){
+    const size_t lane = count_ & 3;
+    if(lane == 0){
+        // unused lanes: an inverted box, outside of every plane
+        Block b;
+        for(int i = 0; i < 4; ++i){
+            b.cx[i] = b.cy[i] = b.cz[i] = 0.0f;
+            b.ex[i] = b.ey[i] = b.ez[i] = -1e30f;
+        }
+        blocks_.push_back(b);
+    }
+    ++count_;
+    set(count_ - 1, bmin, bmax);
+}
+
+void CullBoxes::set(size_t i, const glm::vec3 &bmin, const glm::vec3 &bmax){
+    Block &b = blocks_[i >> 2];
+    const size_t lane = i & 3;
+    const glm::vec3 c = (bmin + bmax) * 0.5f, e = (bmax - bmin) * 0.5f;
+    b.cx[lane] = c.x; b.cy[lane] = c.y; b.cz[lane] = c.z;
+    b.ex[lane] = e.x; b.ey[lane] = e.y; b.ez[lane] = e.z;
+}
+
+void CullBoxes::removeLast(){
+    if(count_ == 0) return;
+    --count_;
+    const size_t lane = count_ & 3;
+    if(lane == 0){
+        blocks_.pop_back();
+        return;
+    }
+    Block &b = blocks_.back();
+    b.cx[lane] = b.cy[lane] = b.cz[lane] = 0.0f;
+    b.ex[lane] = b.ey[lane] = b.ez[lane] = -1e30f;
+}
+
+void CullBoxes::cull(const Frustum &frustum, std::vector<uint8_t> &visible) const {
+    visible.resize(blocks_.size() * 4);
+#ifdef FW_FRUSTUM_SSE
+    __m128 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+    for(int i = 0; i < 6; ++i){
+        const glm::vec4 &p = frustum.planes[i];
+        px[i] = _mm_set1_ps(p.x); py[i] = _mm_set1_ps(p.y); pz[i] = _mm_set1_ps(p.z); pw[i] = _mm_set1_ps(p.w);
+        ax[i] = _mm_set1_ps(std::fabs(p.x)); ay[i] = _mm_set1_ps(std::fabs(p.y)); az[i] = _mm_set1_ps(std::fabs(p.z));
+    }
+    const __m128 zero = _mm_setzero_ps();
+    for(size_t k = 0; k < blocks_.size(); ++k){
+        const Block &b = blocks_[k];
+        const __m128 cx = _mm_load_ps(b.cx), cy = _mm_load_ps(b.cy), cz = _mm_load_ps(b.cz);
+        const __m128 ex = _mm_load_ps(b.ex), ey = _mm_load_ps(b.ey), ez = _mm_load_ps(b.ez);
+        __m128 outside = _mm_setzero_ps();
+        for(int i = 0; i < 6; ++i){
+            // signed distance of the centre plus the box's projected radius
+            __m128 d = _mm_add_ps(_mm_mul_ps(cx, px[i]), _mm_mul_ps(cy, py[i]));
+            d = _mm_add_ps(d, _mm_add_ps(_mm_mul_ps(cz, pz[i]), pw[i]));
+            __m128 r = _mm_add_ps(_mm_mul_ps(ex, ax[i]), _mm_mul_ps(ey, ay[i]));
+            r = _mm_add_ps(r, _mm_mul_ps(ez, az[i]));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), zero));
+        }
+        const int mask = _mm_movemask_ps(outside);
+        for(int lane = 0; lane < 4; ++lane) visible[k * 4 + lane] = !(mask & (1 << lane));
+    }
+#else
+    for(size_t k = 0; k < blocks_.size(); ++k){
+        const Block &b = blocks_[k];
+        for(int lane = 0; lane < 4; ++lane){
+            bool inside = true;
+            for(const glm::vec4 &p : frustum.planes){
+                const float d = p.x * b.cx[lane] + p.y * b.cy[lane] + p.z * b.cz[lane] + p.w;
+                const float r = std::fabs(p.x) * b.ex[lane] + std::fabs(p.y) * b.ey[lane] + std::fabs(p.z) * b.ez[lane];
+                if(d + r < 0.0f){ inside = false; break; }
+            }
+            visible[k * 4 + lane] = inside;
+        }
+    }
+#endif
+    visible.resize(count_);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// View frustum as six planes (inside: dot(plane.xyz, p) + plane.w >= 0),
+// pulled out of a clip matrix. Given projection * view * model the planes are
+// in model space, so boxes are tested where they were baked, untransformed.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    explicit Frustum(const glm::mat4 &clip);
+    // conservative: true for a box that straddles a plane or sits outside near a corner
+    bool intersects(const glm::vec3 &bmin, const glm::vec3 &bmax) const;
+};
+
+// Boxes stored as centre/half-extent in blocks of four (SoA), so one SSE pass
+// tests four of them against a plane. Falls back to scalar code without SSE.
+class CullBoxes {
+public:
+    void clear();
+    void add(const glm::vec3 &bmin, const glm::vec3 &bmax);
+    // replace box i < size() in place, for sets that move
+    void set(size_t i, const glm::vec3 &bmin, const glm::vec3 &bmax);
+    void removeLast();
+    size_t size() const { return count_; }
+
+    // visible[i] = box i intersects the frustum; resized to size()
+    void cull(const Frustum &frustum, std::vector<uint8_t> &visible) const;
+
+private:
+    struct alignas(16) Block {
+        float cx[4], cy[4], cz[4];
+        float ex[4], ey[4], ez[4];
+    };
+    std::vector<Block> blocks_;
+    size_t count_ = 0;
+};
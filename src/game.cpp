@@ -11,11 +11,52 @@
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/trigonometric.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
 #include <string>
 #include "defines.hpp"
+#include "textureStreamer.hpp"
+#include "renderStats.hpp"
+#include "frameUniforms.hpp"
+#include "glState.hpp"
+#include "profiler.hpp"
 #include <stdexcept>
 #include <tiny_obj_loader.h>
 
+void Game::setTracePath(const std::string& path)
+{
+    tracePath_ = path;
+}
+
+void Game::setRecordPath(const std::string& path)
+{
+    cameraRecord_.open(path);
+    if (!cameraRecord_) logger.error("Failed to open camera record file!");
+}
+
+bool Game::setOcclusionMode(const std::string& mode)
+{
+    if (mode != "off" && mode != "cpu" && mode != "gpu" && mode != "auto") return false;
+    occlusionMode_ = mode;
+    return true;
+}
+
+bool Game::setTextureFormat(const std::string& format)
+{
+    if (format != "source" && format != "rgba8" && format != "bc" && format != "bc7") return false;
+    textureFormat_ = format;
+    return true;
+}
+
+bool Game::setTextureBinding(const std::string& binding)
+{
+    if (binding != "separate" && binding != "array" && binding != "bindless" && binding != "auto") return false;
+    textureBinding_ = binding;
+    return true;
+}
+
 void Game::run()
 {
     init();
@@ -27,21 +68,35 @@ void Game::init()
 {
     createWindow();
     initGLEW();
+    Profiler::shared().initGpu();
     initRender();
     matrixSetup();
     controller.init(2.0f);
     dController.init(2.0f);
+    dController.setCollisionWorld(&world);
+
+    scheduler.setMode(FrameScheduler::Mode::VSync, 60.0);
+    scheduler.setTickRate(60.0);
+    // settle both simulation states so the first frame has something to interpolate
+    const bool* keyboardState = SDL_GetKeyboardState(NULL);
+    updateController(keyboardState, 0.0);
+    updateController(keyboardState, 0.0);
     SDL_SetWindowRelativeMouseMode(window_, true);
 }
 
 void Game::mainLoop()
 {
-    Uint64 prev = SDL_GetPerformanceCounter();
-    const double freq = static_cast<double>(SDL_GetPerformanceFrequency());
     short count = 1000;
 
     while (running_)
     {
+        RenderStats& stats = RenderStats::frame();
+        stats.reset();
+        scheduler.beginFrame();
+        Profiler& profiler = Profiler::shared();
+        profiler.beginFrame();
+
+        profiler.beginZone("events");
         while (SDL_PollEvent(&event_))
         {
             if (event_.type == SDL_EVENT_QUIT)
@@ -52,39 +107,94 @@ void Game::mainLoop()
 
             if (event_.type == SDL_EVENT_MOUSE_MOTION)
             {
-                mouseX = event_.motion.xrel;
-                mouseY = event_.motion.yrel;
+                mouseX += event_.motion.xrel;
+                mouseY += event_.motion.yrel;
+            }
+
+            if (event_.type == SDL_EVENT_KEY_DOWN && !event_.key.repeat)
+            {
+                if (event_.key.scancode == KEY_F1) scheduler.setMode(FrameScheduler::Mode::Uncapped);
+                if (event_.key.scancode == KEY_F2) scheduler.setMode(FrameScheduler::Mode::VSync);
+                if (event_.key.scancode == KEY_F3) scheduler.setMode(FrameScheduler::Mode::TargetFps);
+                if (event_.key.scancode == KEY_F12)
+                    profiler.exportChromeTrace(tracePath_.empty() ? "flame_world_trace.json" : tracePath_);
             }
         }
+        profiler.endZone();
 
-        Uint64 now = SDL_GetPerformanceCounter();
-        double delta = (now - prev) / freq;
-        prev = now;
+        // frame boundary: nothing is bound, swap in edited shaders
+        if (shaders.reloadChanged()) home.setShaders(&shaders);
 
         const bool* keyboardState = SDL_GetKeyboardState(NULL);
         if (keyboardState[KEY_ESCAPE]) running_ = false;
         if (keyboardState[KEY_0]) controllerType = 0;
         if (keyboardState[KEY_1]) controllerType = 1;
 
-        if (controllerType == 0)
-            dController.controlFree(reinterpret_cast<const bool*>(keyboardState), view, static_cast<float>(delta), mouseX, mouseY);
-        else
-            controller.controlFree(reinterpret_cast<const bool*>(keyboardState), view, static_cast<float>(delta), mouseX, mouseY);
+        // simulation runs at a fixed rate, mouse motion goes to the first tick of the frame
+        while (scheduler.tick())
+        {
+            PROFILE_ZONE("controller update");
+            updateController(keyboardState, scheduler.tickDt());
+            mouseX = 0; mouseY = 0;
+        }
 
-        acceptMatrix();
+        // render between the last two simulation states
+        const float alpha = static_cast<float>(scheduler.alpha());
+        const glm::vec3 eye = glm::mix(prevEye, currEye, alpha);
+        const glm::vec3 front = glm::normalize(glm::mix(prevFront, currFront, alpha));
+        view = glm::lookAt(eye, eye + front, glm::vec3(0.0f, 1.0f, 0.0f));
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        {
+            PROFILE_ZONE("acceptMatrix");
+            acceptMatrix();
+        }
 
-        home.render(projection, view);
+        const bool sceneChanged = syncScene();
+        updateLights(static_cast<double>(SDL_GetTicksNS()) * 1e-9);
+        lights.build(view, projection);
+
+        {
+            // finish whatever textures the decode threads have ready
+            PROFILE_ZONE("texture uploads");
+            TextureStreamer::shared().update();
+        }
+
+        {
+            PROFILE_ZONE("shadows");
+            PROFILE_GPU_ZONE("shadows");
+            renderShadows(sceneChanged);
+        }
 
-        SDL_GL_SwapWindow(window_);
-        SDL_Delay(16);
+        {
+            PROFILE_ZONE("Model::render");
+            PROFILE_GPU_ZONE("scene");
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            home.render(projection, view);
+            home.renderInstances(projection, view);
+            FrameUniforms::shared().endFrame();
+        }
+
+        {
+            PROFILE_ZONE("swap");
+            SDL_GL_SwapWindow(window_);
+        }
+        profiler.endFrame();
+        scheduler.endFrame();
 
-        mouseX = 0; mouseY = 0;
         if (count < 700)
         {
-            int fps = delta > 0.0 ? static_cast<int>(1.0 / delta) : 0;
-            std::string fpsString = "Flame World: DEV (" + std::to_string(fps) + ')';
+            double p50 = scheduler.frameTimePercentile(50);
+            int fps = p50 > 0.0 ? static_cast<int>(1000.0 / p50) : 0;
+            std::string fpsString = "Flame World: DEV (" + std::to_string(fps) + ") " + scheduler.summary() +
+                ", draw calls: " + std::to_string(stats.drawCalls) + " (" + std::to_string(stats.draws) +
+                " draws), state changes: " + std::to_string(stats.stateChanges) + " (" +
+                std::to_string(stats.stateChangesSkipped) + " skipped)" +
+                ", clusters: " + std::to_string(stats.clustersVisible) + " visible / " +
+                std::to_string(stats.clustersCulled) + " culled / " + std::to_string(stats.clustersOccluded) +
+                " occluded, lights: " + std::to_string(stats.lightsVisible) + " visible";
+            if (home.instanceCount())
+                fpsString += ", instances: " + std::to_string(stats.instancesVisible) + " visible / " +
+                             std::to_string(stats.instancesCulled) + " culled";
             SDL_SetWindowTitle(window_, fpsString.c_str());
             count = 1000;
         }
@@ -92,16 +202,209 @@ void Game::mainLoop()
     }
 }
 
+void Game::updateController(const bool* keyboardState, double dt)
+{
+    prevEye = currEye;
+    prevFront = currFront;
+
+    if (controllerType == 0)
+    {
+        dController.controlFree(keyboardState, view, dt, mouseX, mouseY);
+        currEye = dController.getEye();
+        currFront = dController.getFront();
+    }
+    else
+    {
+        controller.controlFree(keyboardState, view, dt, mouseX, mouseY);
+        currEye = controller.getEye();
+        currFront = controller.getFront();
+    }
+
+    if (cameraRecord_.is_open() && dt > 0.0)
+        cameraRecord_ << currEye.x << ' ' << currEye.y << ' ' << currEye.z << ' '
+                      << currFront.x << ' ' << currFront.y << ' ' << currFront.z << '\n';
+}
+
+int Game::runBenchmark(const BenchOptions& options)
+{
+    windowWidth_ = options.width;
+    windowHeight_ = options.height;
+
+    // no display server: SDL's offscreen driver still gives us a GL context (EGL, e.g. llvmpipe)
+    if (!SDL_getenv("DISPLAY") && !SDL_getenv("WAYLAND_DISPLAY"))
+        SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+
+    createWindow(true);
+    initGLEW();
+    initRender();
+    matrixSetup();
+    SDL_GL_SetSwapInterval(0);
+
+    // the default framebuffer of a hidden window may be undefined, render into our own
+    GLuint fbo = 0, rbo[2] = {0, 0};
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(2, rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, windowWidth_, windowHeight_);
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, windowWidth_, windowHeight_);
+    GlState::shared().bindFramebuffer(fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbo[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        logger.error("Benchmark framebuffer is incomplete!");
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(2, rbo);
+        cleanUp();
+        return 1;
+    }
+    GlState::shared().viewport(0, 0, windowWidth_, windowHeight_);
+
+    CameraPath path;
+    if (options.pathFile.empty() || !path.load(options.pathFile))
+        path.makeOrbit(home.boundsMin(), home.boundsMax());
+
+    // every run measures the same, fully textured scene
+    while (TextureStreamer::shared().pending() > 0)
+    {
+        TextureStreamer::shared().update(~size_t(0));
+        SDL_Delay(1);
+    }
+
+    BenchResult result;
+    result.width = windowWidth_;
+    result.height = windowHeight_;
+    if (const GLubyte* renderer = glGetString(GL_RENDERER))
+        result.renderer = reinterpret_cast<const char*>(renderer);
+    switch (home.occlusion())
+    {
+    case Model::Occlusion::Off: result.occlusion = "off"; break;
+    case Model::Occlusion::Cpu: result.occlusion = "cpu"; break;
+    case Model::Occlusion::Gpu: result.occlusion = "gpu"; break;
+    }
+    result.vertexFormat = home.vertexFormat() == Model::VertexFormat::Packed ? "packed" : "float";
+    result.meshBytes = home.gpuBytes();
+    switch (TextureStreamer::shared().format())
+    {
+    case TextureFormat::Source: result.textureFormat = "source"; break;
+    case TextureFormat::Rgba8: result.textureFormat = "rgba8"; break;
+    case TextureFormat::Bc: result.textureFormat = "bc"; break;
+    case TextureFormat::Bc7: result.textureFormat = "bc7"; break;
+    }
+    result.textureBytes = TextureStreamer::shared().residentBytes();
+    switch (TextureStreamer::shared().binding())
+    {
+    case TextureBinding::Separate: result.textureBinding = "separate"; break;
+    case TextureBinding::Arrays: result.textureBinding = "array"; break;
+    case TextureBinding::Bindless: result.textureBinding = "bindless"; break;
+    }
+    result.instances = home.instanceCount();
+    result.lights = lights.lights().size();
+    result.shadowSize = shadows.ready() ? shadowSize_ : 0;
+    result.frameMs.reserve(options.frames);
+
+    const int total = options.warmupFrames + options.frames;
+    const double freq = static_cast<double>(SDL_GetPerformanceFrequency());
+    for (int i = 0; i < total; ++i)
+    {
+        RenderStats& stats = RenderStats::frame();
+        stats.reset();
+        const Uint64 start = SDL_GetPerformanceCounter();
+
+        // warmup frames walk the start of the path too, so caches see the same data
+        glm::vec3 eye, front;
+        path.sample(static_cast<float>(std::max(i - options.warmupFrames, 0)) / options.frames, eye, front);
+        view = glm::lookAt(eye, eye + front, glm::vec3(0.0f, 1.0f, 0.0f));
+        acceptMatrix();
+        const bool sceneChanged = syncScene();
+        updateLights(i / 60.0);
+        lights.build(view, projection);
+        renderShadows(sceneChanged);
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        home.render(projection, view);
+        home.renderInstances(projection, view);
+        FrameUniforms::shared().endFrame();
+        // no swap to pace us, so wait for the GPU explicitly or we'd only time command submission
+        glFinish();
+
+        const double ms = static_cast<double>(SDL_GetPerformanceCounter() - start) * 1000.0 / freq;
+        if (i < options.warmupFrames) continue;
+        result.frameMs.push_back(ms);
+        result.drawCalls += stats.drawCalls;
+        result.draws += stats.draws;
+        result.stateChanges += stats.stateChanges;
+        result.stateChangesSkipped += stats.stateChangesSkipped;
+        result.textureBinds += stats.textureBinds;
+        result.triangles += stats.triangles;
+        result.clustersVisible += stats.clustersVisible;
+        result.clustersCulled += stats.clustersCulled;
+        result.clustersOccluded += stats.clustersOccluded;
+        result.instancesVisible += stats.instancesVisible;
+        result.instanceBytes += stats.instanceBytes;
+        result.lightsVisible += stats.lightsVisible;
+        result.lightIndices += stats.lightIndices;
+        result.shadowCascades += stats.shadowCascades;
+    }
+    if (options.frames > 0)
+    {
+        result.drawCalls /= options.frames;
+        result.draws /= options.frames;
+        result.stateChanges /= options.frames;
+        result.stateChangesSkipped /= options.frames;
+        result.textureBinds /= options.frames;
+        result.triangles /= options.frames;
+        result.clustersVisible /= options.frames;
+        result.clustersCulled /= options.frames;
+        result.clustersOccluded /= options.frames;
+        result.instancesVisible /= options.frames;
+        result.instanceBytes /= options.frames;
+        result.lightsVisible /= options.frames;
+        result.lightIndices /= options.frames;
+        result.shadowCascades /= options.frames;
+    }
+
+    GlState::shared().bindFramebuffer(0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(2, rbo);
+    cleanUp();
+
+    if (options.outFile.empty())
+    {
+        writeBenchReport(std::cout, result);
+        return 0;
+    }
+    std::ofstream ofs(options.outFile);
+    writeBenchReport(ofs, result);
+    if (!ofs)
+    {
+        std::cerr << "Failed to write benchmark report: " << options.outFile << "\n";
+        return 1;
+    }
+    std::cout << "[*] Wrote benchmark report " << options.outFile << "\n";
+    return 0;
+}
+
 void Game::cleanUp()
 {
+    if (!tracePath_.empty()) Profiler::shared().exportChromeTrace(tracePath_);
+    Profiler::shared().shutdownGpu();
+    dController.setCollisionWorld(nullptr);
+    world.clear();
     home.destroy();
+    lights.clear();
+    shadows.destroy();
+    shaders.clear();
+    FrameUniforms::shared().clear();
+    TextureStreamer::shared().clear();
     SDL_SetWindowRelativeMouseMode(window_, false);
     if (glContext_) SDL_GL_DestroyContext(glContext_), glContext_ = nullptr;
     if (window_) SDL_DestroyWindow(window_), window_ = nullptr;
     if (SDL_INIT_STATUS_INITIALIZED) SDL_Quit();
 }
 
-void Game::createWindow()
+void Game::createWindow(bool hidden)
 {
     if (!SDL_Init(SDL_INIT_VIDEO))
     {
@@ -118,7 +421,7 @@ void Game::createWindow()
         "Flame World: Dev",
         windowWidth_,
         windowHeight_,
-        SDL_WINDOW_OPENGL);
+        SDL_WINDOW_OPENGL | (hidden ? SDL_WINDOW_HIDDEN : 0));
     if (!window_)
     {
         logger.error("Failed to create the window!");
@@ -151,36 +454,170 @@ void Game::initGLEW()
 
 void Game::initRender()
 {
-    shader.loadSources("vertex.glsl", "fragment.glsl");
-    shader.compile();
-    shader.link();
+    Shader::setBinaryCacheDir(shaderCacheDir_);
+    shaders.load("vertex.glsl", "fragment.glsl", Model::shaderDefines());
 
-    glEnable(GL_DEPTH_TEST);
+    GlState::shared().setEnabled(GL_DEPTH_TEST, true);
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 
-    home.init("./assets/casa.obj");
-    home.setProgram(shader.getID());
+    // before init(): the model's textures are requested from there
+    TextureFormat textures = textureFormat_ == "source" ? TextureFormat::Source :
+                             textureFormat_ == "rgba8" ? TextureFormat::Rgba8 :
+                             textureFormat_ == "bc7" ? TextureFormat::Bc7 : TextureFormat::Bc;
+    if ((textures == TextureFormat::Bc && !GLEW_EXT_texture_compression_s3tc) ||
+        (textures == TextureFormat::Bc7 && !GLEW_ARB_texture_compression_bptc))
+    {
+        logger.message("Compressed texture format not supported by the driver, baking RGBA8");
+        textures = TextureFormat::Rgba8;
+    }
+    TextureStreamer::shared().setFormat(textures);
+
+    // a bindless handle arrives through a flat varying, so it may differ inside one
+    // wavefront: only auto-picked where the driver allows that (NV_gpu_shader5).
+    // Per-draw layers and handles need gl_DrawIDARB, and growing arrays glCopyImageSubData
+    const bool perDraw = GLEW_ARB_shader_draw_parameters;
+    const bool bindless = perDraw && GLEW_ARB_bindless_texture;
+    const bool arrays = perDraw && GLEW_ARB_copy_image;
+    std::string binding = textureBinding_;
+    if (binding == "auto")
+        binding = bindless && GLEW_NV_gpu_shader5 ? "bindless" : arrays ? "array" : "separate";
+    if ((binding == "bindless" && !bindless) || (binding == "array" && !arrays))
+    {
+        logger.message(("Texture binding \"" + binding + "\" not supported by the driver, binding separately").c_str());
+        binding = "separate";
+    }
+    TextureStreamer::shared().setBinding(binding == "bindless" ? TextureBinding::Bindless :
+                                         binding == "array" ? TextureBinding::Arrays : TextureBinding::Separate);
+
+    home.init("./assets/casa.obj", true, packedVertices_ ? Model::VertexFormat::Packed : Model::VertexFormat::Float);
+    home.setShaders(&shaders);
+
+    // a GPU Hi-Z pass on llvmpipe costs as much as the scene, rasterize occluders ourselves there
+    std::string mode = occlusionMode_;
+    if (mode == "auto")
+    {
+        const GLubyte* renderer = glGetString(GL_RENDERER);
+        std::string name = renderer ? reinterpret_cast<const char*>(renderer) : "";
+        bool software = name.find("llvmpipe") != std::string::npos || name.find("softpipe") != std::string::npos ||
+                        name.find("SwiftShader") != std::string::npos;
+        mode = software ? "cpu" : "gpu";
+    }
+    home.setOcclusion(mode == "gpu" ? Model::Occlusion::Gpu :
+                      mode == "cpu" ? Model::Occlusion::Cpu : Model::Occlusion::Off);
+    homeNode = scene.create(home.transform());
+
+    // square grid in xz with the original in cell 0, a quarter of the extent between neighbours;
+    // the copies are children of the house and follow it
+    std::vector<SceneGraph::Node> copies;
+    if (instanceCount_ > 0)
+    {
+        const glm::vec3 extent = home.boundsMax() - home.boundsMin();
+        const float stepX = extent.x * 1.25f, stepZ = extent.z * 1.25f;
+        const int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(instanceCount_ + 1))));
+        for (int cell = 1; cell <= instanceCount_; ++cell)
+        {
+            const SceneGraph::Node node = scene.create(glm::translate(glm::mat4(1.0f),
+                glm::vec3((cell % side) * stepX, 0.0f, (cell / side) * stepZ)), homeNode);
+            if (instanceOfNode.size() <= node) instanceOfNode.resize(node + 1, InstanceBuffer::kInvalid);
+            instanceOfNode[node] = home.addInstance(glm::mat4(1.0f));
+            copies.push_back(node);
+        }
+    }
+    syncScene();
+
+    // the fires spread over the house and its copies
+    glm::vec3 lo = home.boundsMin(), hi = home.boundsMax();
+    for (SceneGraph::Node node : copies)
+    {
+        lo = glm::min(lo, glm::vec3(scene.world(node) * glm::vec4(home.boundsMin(), 1.0f)));
+        hi = glm::max(hi, glm::vec3(scene.world(node) * glm::vec4(home.boundsMax(), 1.0f)));
+    }
+    placeLights(lo, hi);
+
+    // the house and its copies cast and receive; a failed init leaves the scene unshadowed
+    if (shadowSize_ > 0 && shadows.init(shadowSize_)) shadows.setSceneBounds(lo, hi);
+
+    if (home.bvh())
+    {
+        world.add(home.bvh(), home.transform());
+        for (SceneGraph::Node node : copies) world.add(home.bvh(), scene.world(node));
+    }
 }
 
-void Game::matrixSetup()
+void Game::placeLights(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
 {
-    model = glm::mat4(1.0f);
+    // fixed seed: every run, and every benchmark, sees the same fires
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const glm::vec3 extent = home.boundsMax() - home.boundsMin();
+    const glm::vec3 margin = (boundsMax - boundsMin) * 0.1f;
+    const float radius = 0.25f * std::max(extent.x, extent.z);
+    fires.clear();
+    std::vector<ClusteredLights::PointLight>& points = lights.lights();
+    points.clear();
+    for (int i = 0; i < lightCount_; ++i)
+    {
+        const glm::vec3 position(boundsMin.x - margin.x + unit(rng) * (boundsMax.x - boundsMin.x + 2.0f * margin.x),
+                                 boundsMin.y + unit(rng) * 0.5f * (boundsMax.y - boundsMin.y),
+                                 boundsMin.z - margin.z + unit(rng) * (boundsMax.z - boundsMin.z + 2.0f * margin.z));
+        // deep red to yellow
+        const glm::vec3 color = glm::mix(glm::vec3(1.0f, 0.3f, 0.05f), glm::vec3(1.0f, 0.75f, 0.3f), unit(rng)) * 1.5f;
+        fires.push_back({color, unit(rng) * 6.2831853f});
+        points.push_back({position, radius * (0.6f + 0.8f * unit(rng)), color});
+    }
+}
+
+void Game::updateLights(double seconds)
+{
+    std::vector<ClusteredLights::PointLight>& points = lights.lights();
+    const float t = static_cast<float>(seconds);
+    for (size_t i = 0; i < fires.size() && i < points.size(); ++i)
+    {
+        const float phase = fires[i].phase;
+        const float flicker = 0.75f + 0.15f * std::sin(t * 9.1f + phase) + 0.1f * std::sin(t * 23.7f + 1.7f * phase);
+        points[i].color = fires[i].color * flicker;
+    }
+}
 
+bool Game::syncScene()
+{
+    PROFILE_ZONE("scene update");
+    if (!scene.update()) return false;
+    for (SceneGraph::Node node : scene.changed())
+    {
+        if (node == homeNode) home.setTransform(scene.world(node));
+        else if (node < instanceOfNode.size() && instanceOfNode[node] != InstanceBuffer::kInvalid)
+            home.setInstanceTransform(instanceOfNode[node], scene.world(node));
+    }
+    return true;
+}
+
+void Game::renderShadows(bool sceneChanged)
+{
+    // casters that moved may shadow any cascade; nothing moving -> the cached layers stay
+    if (sceneChanged) shadows.invalidate();
+    const uint32_t redraw = shadows.update(view, projection, glm::vec3(FrameUniforms::shared().frame().lightDir));
+    for (int c = 0; c < ShadowCascades::kCascades; ++c)
+    {
+        if (!(redraw & (1u << c))) continue;
+        shadows.beginCascade(c);
+        home.renderShadow(shadows, c);
+        shadows.endCascade();
+    }
+    // every frame, shadows or not: the scene shaders read the Shadows block
+    shadows.bind();
+}
+
+void Game::matrixSetup()
+{
     projection = glm::perspective(
         glm::radians(45.0f),
         static_cast<float>(windowWidth_) / static_cast<float>(windowHeight_),
         0.1f, 100.0f);
-
-    MVP = projection * view * model;
-
-    MVP_LOC = glGetUniformLocation(shader.getID(), "MVP");
 }
 
 void Game::acceptMatrix()
 {
-    MVP = projection * view * model;
-
-    shader.use();
-    glUniformMatrix4fv(MVP_LOC, 1, GL_FALSE, glm::value_ptr(MVP));
-
+    // the Frame block for every scene shader; models push their own matrices after it
+    FrameUniforms::shared().beginFrame(view, projection);
 }
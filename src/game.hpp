@@ -6,17 +6,51 @@
 #include <GL/glew.h>
 #include "logger.hpp"
 #include "model.hpp"
-#include "shader.hpp"
+#include "clusteredLights.hpp"
+#include "shadowCascades.hpp"
+#include "sceneGraph.hpp"
+#include "shaderVariants.hpp"
 #include "controller.hpp"
 #include "defaultController.hpp"
+#include "frameScheduler.hpp"
+#include "benchmark.hpp"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <tiny_obj_loader.h>
+#include <fstream>
+#include <string>
 
 class Game
 {
 public:
     void run();
+    // Chrome trace of the last frames is written here at exit (and on F12)
+    void setTracePath(const std::string& path);
+    // every simulation tick appends "eye front" here, replayable with --bench-path
+    void setRecordPath(const std::string& path);
+    // "off", "cpu", "gpu" or "auto" (cpu on software renderers); false if unknown
+    bool setOcclusionMode(const std::string& mode);
+    // 16-byte quantized vertices instead of 32-byte float ones; before run()
+    void setPackedVertices(bool packed) { packedVertices_ = packed; }
+    // copies of the house on a grid around the original, drawn instanced; before run()
+    void setInstanceCount(int count) { instanceCount_ = count; }
+    // flickering fire point lights scattered over the scene; before run()
+    void setLightCount(int count) { lightCount_ = count; }
+    // side of a cascaded shadow map layer in texels, 0 = no shadows; before run()
+    void setShadowSize(int size) { shadowSize_ = size; }
+    // "source", "rgba8", "bc" or "bc7": what textures are baked into (texture_cache/ next
+    // to the images); bc/bc7 fall back to rgba8 without driver support. false if unknown
+    bool setTextureFormat(const std::string& format);
+    // "separate", "array", "bindless" or "auto" (bindless where divergent handles are
+    // safe, arrays with ARB_copy_image, else separate): how materials reach the shader
+    // (TextureBinding). Unsupported choices fall back. false if unknown
+    bool setTextureBinding(const std::string& binding);
+    // linked shader programs are cached here between runs; empty = always compile
+    void setShaderCacheDir(const std::string& dir) { shaderCacheDir_ = dir; }
+
+    // Headless render benchmark: hidden window, offscreen FBO, scripted camera.
+    // Returns a process exit code.
+    int runBenchmark(const BenchOptions& options);
 
 private:
     int windowWidth_ = 900;
@@ -25,6 +59,16 @@ private:
     SDL_GLContext glContext_ = nullptr;
     SDL_Event event_;
     bool running_ = true;
+    std::string tracePath_;
+    std::ofstream cameraRecord_;
+    std::string occlusionMode_ = "auto";
+    bool packedVertices_ = false;
+    int instanceCount_ = 0;
+    int lightCount_ = 256;
+    int shadowSize_ = 2048;
+    std::string shaderCacheDir_ = "shader_cache";
+    std::string textureFormat_ = "bc";
+    std::string textureBinding_ = "auto";
 
     Logger logger;
 
@@ -32,18 +76,15 @@ private:
     void mainLoop();
     void cleanUp();
 
-    void createWindow();
+    void createWindow(bool hidden = false);
     void initGLEW();
     void initRender();
 
-    Shader shader;
-    glm::mat4 MVP = glm::mat4(1.0f);
-    glm::mat4 model = glm::mat4(1.0f);
+    // vertex.glsl/fragment.glsl, one program per combination of Model::Variant* bits
+    ShaderVariants shaders;
     glm::mat4 view = glm::mat4(1.0f);
     glm::mat4 projection = glm::mat4(1.0f);
 
-    GLuint MVP_LOC     = 0;
-
     void matrixSetup();
     void acceptMatrix();
 
@@ -54,6 +95,31 @@ private:
     float mouseX = 0.0f;
     float mouseY = 0.0f;
 
+    // F1 uncapped, F2 vsync, F3 fixed target rate
+    FrameScheduler scheduler;
+    glm::vec3 prevEye{0.0f}, currEye{0.0f};
+    glm::vec3 prevFront{0.0f, 0.0f, -1.0f}, currFront{0.0f, 0.0f, -1.0f};
+    void updateController(const bool* keyboardState, double dt);
+
     Model home;
+    // the house and its copies; changed world matrices go to the Model in syncScene()
+    SceneGraph scene;
+    SceneGraph::Node homeNode = SceneGraph::kNone;
+    std::vector<Model::InstanceHandle> instanceOfNode; // by node, kInvalid for the house
+    // true if any world matrix changed
+    bool syncScene();
+    // static geometry DController walks on
+    CollisionWorld world;
+
+    // fires: lights.lights()[i] flickers around fires[i].color
+    struct Fire { glm::vec3 color; float phase; };
+    std::vector<Fire> fires;
+    ClusteredLights lights;
+    void placeLights(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+    void updateLights(double seconds);
+
+    // sun shadows; a cascade is drawn again only when update() asks for it
+    ShadowCascades shadows;
+    void renderShadows(bool sceneChanged);
 
 };
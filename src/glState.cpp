@@ -0,0 +1,216 @@
+#include "glState.hpp"
+#include "renderStats.hpp"
+
+GlState& GlState::shared() {
+    static GlState state;
+    return state;
+}
+
+bool GlState::change(GLuint &shadow, GLuint value) {
+    RenderStats &stats = RenderStats::frame();
+    if (shadow == value) {
+        ++stats.stateChangesSkipped;
+        return false;
+    }
+    shadow = value;
+    ++stats.stateChanges;
+    return true;
+}
+
+int GlState::textureSlot(GLenum target) {
+    switch (target) {
+    case GL_TEXTURE_2D: return 0;
+    case GL_TEXTURE_2D_ARRAY: return 1;
+    case GL_TEXTURE_BUFFER: return 2;
+    default: return -1;
+    }
+}
+
+int GlState::bufferSlot(GLenum target) {
+    switch (target) {
+    case GL_ARRAY_BUFFER: return 0;
+    case GL_UNIFORM_BUFFER: return 1;
+    case GL_PIXEL_UNPACK_BUFFER: return 2;
+    case GL_TEXTURE_BUFFER: return 3;
+    case GL_TRANSFORM_FEEDBACK_BUFFER: return 4;
+    default: return -1;
+    }
+}
+
+void GlState::useProgram(GLuint program) {
+    if (change(program_, program)) glUseProgram(program);
+}
+
+void GlState::bindVertexArray(GLuint vao) {
+    if (change(vao_, vao)) glBindVertexArray(vao);
+}
+
+void GlState::activeTexture(GLuint unit) {
+    if (activeUnit_ != unit) {
+        activeUnit_ = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+void GlState::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+    const int slot = textureSlot(target);
+    if (slot < 0 || unit >= kUnits) {
+        activeTexture(unit);
+        glBindTexture(target, texture);
+        ++RenderStats::frame().stateChanges;
+        ++RenderStats::frame().textureBinds;
+        return;
+    }
+    if (!change(textures_[unit][slot], texture)) return;
+    activeTexture(unit);
+    glBindTexture(target, texture);
+    ++RenderStats::frame().textureBinds;
+}
+
+void GlState::bindBuffer(GLenum target, GLuint buffer) {
+    const int slot = bufferSlot(target);
+    if (slot < 0) {
+        glBindBuffer(target, buffer);
+        ++RenderStats::frame().stateChanges;
+        return;
+    }
+    if (change(buffers_[slot], buffer)) glBindBuffer(target, buffer);
+}
+
+void GlState::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+    Range *ranges = target == GL_UNIFORM_BUFFER ? uniformRanges_ :
+                    target == GL_TRANSFORM_FEEDBACK_BUFFER ? feedbackRanges_ : nullptr;
+    const size_t count = target == GL_UNIFORM_BUFFER ? kIndexed : 4;
+    RenderStats &stats = RenderStats::frame();
+    if (ranges && index < count) {
+        Range &r = ranges[index];
+        if (r.buffer == buffer && r.offset == offset && r.size == size) {
+            ++stats.stateChangesSkipped;
+            return;
+        }
+        r = {buffer, offset, size};
+    }
+    ++stats.stateChanges;
+    glBindBufferRange(target, index, buffer, offset, size);
+    // the generic binding point follows
+    const int slot = bufferSlot(target);
+    if (slot >= 0) buffers_[slot] = buffer;
+}
+
+void GlState::bindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+    Range *ranges = target == GL_UNIFORM_BUFFER ? uniformRanges_ :
+                    target == GL_TRANSFORM_FEEDBACK_BUFFER ? feedbackRanges_ : nullptr;
+    const size_t count = target == GL_UNIFORM_BUFFER ? kIndexed : 4;
+    RenderStats &stats = RenderStats::frame();
+    // size -1 marks the whole buffer
+    if (ranges && index < count) {
+        Range &r = ranges[index];
+        if (r.buffer == buffer && r.offset == 0 && r.size == -1) {
+            ++stats.stateChangesSkipped;
+            return;
+        }
+        r = {buffer, 0, -1};
+    }
+    ++stats.stateChanges;
+    glBindBufferBase(target, index, buffer);
+    const int slot = bufferSlot(target);
+    if (slot >= 0) buffers_[slot] = buffer;
+}
+
+void GlState::bindFramebuffer(GLuint fbo) {
+    if (change(fbo_, fbo)) glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+void GlState::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    RenderStats &stats = RenderStats::frame();
+    if (viewportKnown_ && viewport_[0] == x && viewport_[1] == y && viewport_[2] == width && viewport_[3] == height) {
+        ++stats.stateChangesSkipped;
+        return;
+    }
+    viewport_[0] = x;
+    viewport_[1] = y;
+    viewport_[2] = width;
+    viewport_[3] = height;
+    viewportKnown_ = true;
+    ++stats.stateChanges;
+    glViewport(x, y, width, height);
+}
+
+void GlState::setEnabled(GLenum cap, bool enabled) {
+    int slot = -1;
+    switch (cap) {
+    case GL_DEPTH_TEST: slot = 0; break;
+    case GL_BLEND: slot = 1; break;
+    case GL_CULL_FACE: slot = 2; break;
+    case GL_RASTERIZER_DISCARD: slot = 3; break;
+    default: break;
+    }
+    if (slot >= 0 && !change(caps_[slot], enabled ? 1u : 0u)) return;
+    if (slot < 0) ++RenderStats::frame().stateChanges;
+    if (enabled) glEnable(cap);
+    else glDisable(cap);
+}
+
+void GlState::depthFunc(GLenum func) {
+    if (change(depthFunc_, func)) glDepthFunc(func);
+}
+
+void GlState::depthMask(bool write) {
+    if (change(depthMask_, write ? 1u : 0u)) glDepthMask(write ? GL_TRUE : GL_FALSE);
+}
+
+GLuint GlState::program() {
+    if (program_ == kUnknown) {
+        GLint current = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+        program_ = static_cast<GLuint>(current);
+    }
+    return program_;
+}
+
+GLuint GlState::framebuffer() {
+    if (fbo_ == kUnknown) {
+        GLint current = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &current);
+        fbo_ = static_cast<GLuint>(current);
+    }
+    return fbo_;
+}
+
+GLenum GlState::depthFunction() {
+    if (depthFunc_ == kUnknown) {
+        GLint current = GL_LESS;
+        glGetIntegerv(GL_DEPTH_FUNC, &current);
+        depthFunc_ = static_cast<GLuint>(current);
+    }
+    return depthFunc_;
+}
+
+bool GlState::depthWrites() {
+    if (depthMask_ == kUnknown) {
+        GLboolean current = GL_TRUE;
+        glGetBooleanv(GL_DEPTH_WRITEMASK, &current);
+        depthMask_ = current ? 1u : 0u;
+    }
+    return depthMask_ != 0;
+}
+
+void GlState::getViewport(GLint out[4]) {
+    if (!viewportKnown_) {
+        glGetIntegerv(GL_VIEWPORT, viewport_);
+        viewportKnown_ = true;
+    }
+    for (int i = 0; i < 4; ++i) out[i] = viewport_[i];
+}
+
+void GlState::invalidate() {
+    program_ = vao_ = fbo_ = activeUnit_ = kUnknown;
+    for (auto &unit : textures_)
+        for (GLuint &t : unit) t = kUnknown;
+    for (GLuint &b : buffers_) b = kUnknown;
+    for (Range &r : uniformRanges_) r = {kUnknown, 0, 0};
+    for (Range &r : feedbackRanges_) r = {kUnknown, 0, 0};
+    viewportKnown_ = false;
+    for (GLuint &c : caps_) c = kUnknown;
+    depthFunc_ = depthMask_ = kUnknown;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstddef>
+
+// Shadow of the GL bindings the renderer touches. A call that matches the
+// shadow is dropped and counted in RenderStats::stateChangesSkipped, the rest
+// go to GL and count as RenderStats::stateChanges.
+// Everything that draws goes through it. Code that changes these bindings
+// behind its back, or deletes GL objects (a new object may reuse the name),
+// calls invalidate(); the next call of each kind then reaches GL again.
+class GlState {
+public:
+    static GlState& shared();
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    // glActiveTexture only when the unit differs; targets other than 2D,
+    // 2D array and buffer textures are passed through
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+    // GL_ELEMENT_ARRAY_BUFFER belongs to the VAO and is always passed through
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void bindFramebuffer(GLuint fbo);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    // GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_RASTERIZER_DISCARD; others pass through
+    void setEnabled(GLenum cap, bool enabled);
+    void depthFunc(GLenum func);
+    void depthMask(bool write);
+
+    // current values, asked from GL when unknown
+    GLuint program();
+    GLuint framebuffer();
+    GLenum depthFunction();
+    bool depthWrites();
+    void getViewport(GLint out[4]);
+
+    void invalidate();
+
+private:
+    static constexpr GLuint kUnknown = ~0u;
+    static constexpr size_t kUnits = 16;
+    static constexpr size_t kIndexed = 16;
+
+    GlState() { invalidate(); }
+    // true if GL has to be called; counts the change either way
+    bool change(GLuint &shadow, GLuint value);
+    static int textureSlot(GLenum target);
+    static int bufferSlot(GLenum target);
+    void activeTexture(GLuint unit);
+
+    GLuint program_, vao_, fbo_, activeUnit_;
+    GLuint textures_[kUnits][3];
+    GLuint buffers_[5];
+    struct Range { GLuint buffer; GLintptr offset; GLsizeiptr size; };
+    Range uniformRanges_[kIndexed], feedbackRanges_[4];
+    GLint viewport_[4];
+    bool viewportKnown_;
+    GLuint caps_[4];                        // 0 / 1 / kUnknown
+    GLuint depthFunc_, depthMask_;
+};
@@ -0,0 +1,272 @@
+#include "gpuOcclusion.hpp"
+#include "glState.hpp"
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+GpuOcclusion::~GpuOcclusion(){
+    destroy();
+}
+
+bool GpuOcclusion::init(){
+    destroy();
+    try {
+        depth_.loadSources("hiz_depth_vertex.glsl", "hiz_depth_fragment.glsl");
+        depth_.compile();
+        depth_.link();
+        reduce_.loadSources("hiz_reduce_vertex.glsl", "hiz_reduce_fragment.glsl");
+        reduce_.compile();
+        reduce_.link();
+        test_.loadSources("hiz_test_vertex.glsl", "hiz_depth_fragment.glsl");
+        test_.setFeedbackVaryings({"vVisible"});
+        test_.compile();
+        test_.link();
+        box_.loadSources("hiz_box_vertex.glsl", "hiz_depth_fragment.glsl");
+        box_.compile();
+        box_.link();
+    } catch (const std::exception &e) {
+        std::cerr << "Hi-Z occlusion unavailable: " << e.what() << "\n";
+        depth_ = Shader();
+        reduce_ = Shader();
+        test_ = Shader();
+        box_ = Shader();
+        return false;
+    }
+    locDepthMVP_ = glGetUniformLocation(depth_.getID(), "MVP");
+    locReduceSrcSize_ = glGetUniformLocation(reduce_.getID(), "uSrcSize");
+    locTestMVP_ = glGetUniformLocation(test_.getID(), "MVP");
+    locTestSize_ = glGetUniformLocation(test_.getID(), "uSize");
+    locTestLevels_ = glGetUniformLocation(test_.getID(), "uLevels");
+    locBoxMVP_ = glGetUniformLocation(box_.getID(), "MVP");
+    locBoxMin_ = glGetUniformLocation(box_.getID(), "uMin");
+    locBoxMax_ = glGetUniformLocation(box_.getID(), "uMax");
+    GlState &gl = GlState::shared();
+    gl.useProgram(reduce_.getID());
+    glUniform1i(glGetUniformLocation(reduce_.getID(), "uDepth"), 0);
+    gl.useProgram(test_.getID());
+    glUniform1i(glGetUniformLocation(test_.getID(), "uHiZ"), 0);
+
+    glGenFramebuffers(1, &fbo_);
+    glGenVertexArrays(1, &emptyVao_);
+    glGenBuffers(1, &boxVbo_);
+    glGenBuffers(kFrames, feedback_);
+
+    // MeshCluster as is: bmin at location 0, bmax at location 1
+    glGenVertexArrays(1, &boxVao_);
+    gl.bindVertexArray(boxVao_);
+    gl.bindBuffer(GL_ARRAY_BUFFER, boxVbo_);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshCluster), (void*)offsetof(MeshCluster, bmin));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshCluster), (void*)offsetof(MeshCluster, bmax));
+    return true;
+}
+
+void GpuOcclusion::destroy(){
+    if(hiZ_){ glDeleteTextures(1, &hiZ_); hiZ_ = 0; }
+    if(fbo_){ glDeleteFramebuffers(1, &fbo_); fbo_ = 0; }
+    if(emptyVao_){ glDeleteVertexArrays(1, &emptyVao_); emptyVao_ = 0; }
+    if(boxVao_){ glDeleteVertexArrays(1, &boxVao_); boxVao_ = 0; }
+    if(boxVbo_){ glDeleteBuffers(1, &boxVbo_); boxVbo_ = 0; }
+    dropResults();
+    if(feedback_[0]){ glDeleteBuffers(kFrames, feedback_); std::fill(feedback_, feedback_ + kFrames, 0u); }
+    if(depth_.getID()) depth_ = Shader();
+    if(reduce_.getID()) reduce_ = Shader();
+    if(test_.getID()) test_ = Shader();
+    if(box_.getID()) box_ = Shader();
+    if(!queries_.empty()){ glDeleteQueries((GLsizei)queries_.size(), queries_.data()); queries_.clear(); }
+    boxQueries_.clear();
+    width_ = height_ = levels_ = 0;
+    boxCount_ = 0;
+    GlState::shared().invalidate();
+}
+
+void GpuOcclusion::setBoxes(const std::vector<MeshCluster> &clusters){
+    if(!ready()) return;
+    boxCount_ = clusters.size();
+    GlState &gl = GlState::shared();
+    gl.bindBuffer(GL_ARRAY_BUFFER, boxVbo_);
+    glBufferData(GL_ARRAY_BUFFER, clusters.size() * sizeof(MeshCluster), clusters.data(), GL_STATIC_DRAW);
+    // results in flight were for the old boxes
+    dropResults();
+    for(GLuint buffer : feedback_){
+        gl.bindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffer);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, std::max<size_t>(clusters.size(), 1) * sizeof(GLuint), nullptr, GL_STREAM_READ);
+    }
+}
+
+void GpuOcclusion::dropResults(){
+    for(GLsync &fence : fences_){
+        if(fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+    next_ = 0;
+}
+
+void GpuOcclusion::resize(int width, int height){
+    if(width == width_ && height == height_) return;
+    width_ = width;
+    height_ = height;
+    levels_ = 1;
+    while((width >> levels_) > 0 || (height >> levels_) > 0) ++levels_;
+
+    GlState &gl = GlState::shared();
+    if(hiZ_){
+        glDeleteTextures(1, &hiZ_);
+        gl.invalidate();
+    }
+    glGenTextures(1, &hiZ_);
+    gl.bindTexture(0, GL_TEXTURE_2D, hiZ_);
+    for(int level = 0; level < levels_; ++level)
+        glTexImage2D(GL_TEXTURE_2D, level, GL_DEPTH_COMPONENT32F, std::max(width >> level, 1), std::max(height >> level, 1),
+                     0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_ - 1);
+}
+
+void GpuOcclusion::beginOccluders(int width, int height, const glm::mat4 &mvp){
+    // from the shadow, no round trip to the driver once it is known
+    GlState &gl = GlState::shared();
+    prevFbo_ = gl.framebuffer();
+    gl.getViewport(prevViewport_);
+    prevProgram_ = gl.program();
+    prevDepthFunc_ = gl.depthFunction();
+
+    resize(std::max(width, 1), std::max(height, 1));
+    gl.bindFramebuffer(fbo_);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, hiZ_, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    gl.viewport(0, 0, width_, height_);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    gl.useProgram(depth_.getID());
+    if(locDepthMVP_ >= 0) glUniformMatrix4fv(locDepthMVP_, 1, GL_FALSE, glm::value_ptr(mvp));
+}
+
+void GpuOcclusion::endOccluders(){
+    // depth writes need the test on; ALWAYS lets every level overwrite the stale one
+    GlState &gl = GlState::shared();
+    gl.depthFunc(GL_ALWAYS);
+    gl.useProgram(reduce_.getID());
+    gl.bindVertexArray(emptyVao_);
+    gl.bindTexture(0, GL_TEXTURE_2D, hiZ_);
+    for(int level = 1; level < levels_; ++level){
+        // sample only the previous level while rendering into this one, no feedback loop
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, hiZ_, level);
+        gl.viewport(0, 0, std::max(width_ >> level, 1), std::max(height_ >> level, 1));
+        if(locReduceSrcSize_ >= 0)
+            glUniform2i(locReduceSrcSize_, std::max(width_ >> (level - 1), 1), std::max(height_ >> (level - 1), 1));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_ - 1);
+    gl.depthFunc(prevDepthFunc_);
+
+    gl.bindFramebuffer(prevFbo_);
+    gl.viewport(prevViewport_[0], prevViewport_[1], prevViewport_[2], prevViewport_[3]);
+    gl.useProgram(prevProgram_);
+}
+
+void GpuOcclusion::test(const glm::mat4 &mvp, std::vector<uint8_t> &mask){
+    if(!ready() || boxCount_ == 0 || mask.size() != boxCount_) return;
+
+    GlState &gl = GlState::shared();
+    // the newest results the GPU has finished; older ones are stale once it is read
+    bool have = false;
+    for(int age = 1; age < kFrames && !have; ++age){
+        const int slot = (next_ - age + kFrames) % kFrames;
+        if(!fences_[slot]) continue;
+        const GLenum status = glClientWaitSync(fences_[slot], 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+        results_.resize(boxCount_);
+        // skipped indexed binds leave the generic point alone, name it explicitly
+        gl.bindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, feedback_[slot]);
+        glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, boxCount_ * sizeof(GLuint), results_.data());
+        for(int older = age; older < kFrames; ++older){
+            GLsync &fence = fences_[(next_ - older + kFrames) % kFrames];
+            if(fence) glDeleteSync(fence);
+            fence = nullptr;
+        }
+        have = true;
+    }
+
+    // this frame's test, read back by a later one
+    gl.useProgram(test_.getID());
+    if(locTestMVP_ >= 0) glUniformMatrix4fv(locTestMVP_, 1, GL_FALSE, glm::value_ptr(mvp));
+    if(locTestSize_ >= 0) glUniform2i(locTestSize_, width_, height_);
+    if(locTestLevels_ >= 0) glUniform1i(locTestLevels_, levels_);
+    gl.bindTexture(0, GL_TEXTURE_2D, hiZ_);
+    gl.bindVertexArray(boxVao_);
+
+    gl.setEnabled(GL_RASTERIZER_DISCARD, true);
+    gl.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, feedback_[next_]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)boxCount_);
+    glEndTransformFeedback();
+    gl.setEnabled(GL_RASTERIZER_DISCARD, false);
+    if(fences_[next_]) glDeleteSync(fences_[next_]);
+    fences_[next_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    next_ = (next_ + 1) % kFrames;
+
+    // nothing back yet (first frames, new boxes): nothing is culled by occlusion;
+    // what the old results clear still gets queryBoxes() this frame
+    if(!have) return;
+    for(size_t i = 0; i < boxCount_; ++i) if(!results_[i]) mask[i] = 0;
+}
+
+void GpuOcclusion::queryBoxes(const glm::mat4 &mvp, const std::vector<MeshCluster> &boxes){
+    boxQueries_.assign(boxes.size(), 0);
+    if(!ready() || !hiZ_ || boxes.empty()) return;
+    if(queries_.size() < boxes.size()){
+        const size_t first = queries_.size();
+        queries_.resize(boxes.size());
+        glGenQueries((GLsizei)(boxes.size() - first), queries_.data() + first);
+    }
+
+    GlState &gl = GlState::shared();
+    const GLuint prevFbo = gl.framebuffer(), prevProgram = gl.program();
+    const GLenum prevDepthFunc = gl.depthFunction();
+    const bool prevDepthWrites = gl.depthWrites();
+    GLint prevViewport[4];
+    gl.getViewport(prevViewport);
+
+    // level 0 is the occluder depth itself; faces on or in front of it count, nothing is written
+    gl.bindFramebuffer(fbo_);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, hiZ_, 0);
+    gl.viewport(0, 0, width_, height_);
+    gl.depthFunc(GL_LEQUAL);
+    gl.depthMask(false);
+    gl.useProgram(box_.getID());
+    if(locBoxMVP_ >= 0) glUniformMatrix4fv(locBoxMVP_, 1, GL_FALSE, glm::value_ptr(mvp));
+    gl.bindVertexArray(emptyVao_);
+    for(size_t i = 0; i < boxes.size(); ++i){
+        const MeshCluster &b = boxes[i];
+        // the camera may be inside: no faces to test, the box stays without a query
+        bool crossesNear = false;
+        for(int c = 0; c < 8 && !crossesNear; ++c){
+            const glm::vec4 clip = mvp * glm::vec4((c & 1) ? b.bmax.x : b.bmin.x, (c & 2) ? b.bmax.y : b.bmin.y,
+                                                   (c & 4) ? b.bmax.z : b.bmin.z, 1.0f);
+            crossesNear = clip.z < -clip.w || clip.w <= 1e-6f;
+        }
+        if(crossesNear) continue;
+        if(locBoxMin_ >= 0) glUniform3fv(locBoxMin_, 1, glm::value_ptr(b.bmin));
+        if(locBoxMax_ >= 0) glUniform3fv(locBoxMax_, 1, glm::value_ptr(b.bmax));
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, queries_[i]);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        boxQueries_[i] = queries_[i];
+    }
+    gl.depthMask(prevDepthWrites);
+    gl.depthFunc(prevDepthFunc);
+    gl.bindFramebuffer(prevFbo);
+    gl.viewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+    gl.useProgram(prevProgram);
+}
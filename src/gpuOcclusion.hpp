@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "mesh.hpp"
+#include "shader.hpp"
+
+// GPU occlusion culling on GL 3.3: occluders go into a depth-only target,
+// fragment passes reduce it into a max-depth mip pyramid (Hi-Z), and one point
+// per cluster is tested against it in a vertex shader with the results captured
+// by transform feedback. Without compute or indirect draws the results come
+// back to the CPU, but never in the frame that produced them: every test()
+// writes one of kFrames feedback buffers behind a fence and reads the newest
+// buffer the GPU has already finished, so nothing waits for the GPU.
+//
+// Those results are a frame or two old, so they only pick what is drawn up
+// front (and becomes next frame's occluders). A cluster they turn down is not
+// dropped: queryBoxes() draws its bounds against this frame's occluder depth
+// inside an occlusion query, and the caller draws it under
+// glBeginConditionalRender. The GPU skips what is still hidden, and a cluster
+// coming out from behind an occluder shows up in the same frame.
+//
+// Usage per frame:
+//   beginOccluders(w, h, mvp); <draw occluders, depth only>; endOccluders();
+//   test(mvp, mask); queryBoxes(mvp, <bounds of what test() cleared>);
+//   <draw mask>; per box: glBeginConditionalRender(query(i), GL_QUERY_WAIT); <draw>; glEndConditionalRender();
+class GpuOcclusion {
+public:
+    GpuOcclusion() = default;
+    ~GpuOcclusion();
+    GpuOcclusion(const GpuOcclusion&) = delete;
+    GpuOcclusion& operator=(const GpuOcclusion&) = delete;
+
+    // compiles the hiz_* shaders; false (and the reason on stderr) if they don't build
+    bool init();
+    void destroy();
+    bool ready() const { return boxVao_ != 0; }
+
+    // cluster bounds, tested in this order
+    void setBoxes(const std::vector<MeshCluster> &clusters);
+
+    // binds the Hi-Z target (width x height) and the depth program with mvp set;
+    // the caller then draws occluders with its own VAO (position at location 0)
+    void beginOccluders(int width, int height, const glm::mat4 &mvp);
+    // restores the caller's framebuffer, viewport and program, builds the pyramid
+    void endOccluders();
+    // clears mask[i] of every masked cluster the pyramid hides
+    void test(const glm::mat4 &mvp, std::vector<uint8_t> &mask);
+    // this frame's test for what test() cleared: each box's faces against the
+    // occluder depth in a GL_ANY_SAMPLES_PASSED query; after endOccluders()
+    void queryBoxes(const glm::mat4 &mvp, const std::vector<MeshCluster> &boxes);
+    // query of box i for glBeginConditionalRender; 0 = draw it anyway (crosses the near plane)
+    GLuint query(size_t i) const { return i < boxQueries_.size() ? boxQueries_[i] : 0; }
+
+private:
+    void resize(int width, int height);
+
+    Shader depth_, reduce_, test_, box_;
+    GLint locDepthMVP_{-1}, locReduceSrcSize_{-1}, locTestMVP_{-1}, locTestSize_{-1}, locTestLevels_{-1};
+    GLint locBoxMVP_{-1}, locBoxMin_{-1}, locBoxMax_{-1};
+
+    GLuint fbo_{0}, hiZ_{0}, emptyVao_{0};
+    GLuint boxVao_{0}, boxVbo_{0};
+    int width_{0}, height_{0}, levels_{0};
+    size_t boxCount_{0};
+
+    // feedback ring: a fence is set while the buffer holds results not read yet
+    static constexpr int kFrames = 3;
+    GLuint feedback_[kFrames]{};
+    GLsync fences_[kFrames]{};
+    int next_{0};
+    void dropResults();
+
+    // caller state saved by beginOccluders()
+    GLuint prevFbo_{0}, prevProgram_{0};
+    GLenum prevDepthFunc_{GL_LESS};
+    GLint prevViewport_[4]{};
+    std::vector<GLuint> results_;
+    // query objects, grown to the most boxes seen; boxQueries_ per box of the last queryBoxes()
+    std::vector<GLuint> queries_, boxQueries_;
+};
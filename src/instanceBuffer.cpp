@@ -0,0 +1,174 @@
+#include "instanceBuffer.hpp"
+#include "glState.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+
+// dirty slots closer than this are sent in one glBufferSubData, gap included
+constexpr uint32_t kMergeGap = 16;
+
+// orthogonal basis vectors of one length, up to float noise
+bool isRigid(const glm::mat4 &m){
+    const glm::vec3 x(m[0]), y(m[1]), z(m[2]);
+    const float xx = glm::dot(x, x), yy = glm::dot(y, y), zz = glm::dot(z, z);
+    const float eps = 1e-4f * std::max(xx, std::max(yy, zz));
+    return std::abs(xx - yy) <= eps && std::abs(xx - zz) <= eps && std::abs(glm::dot(x, y)) <= eps &&
+           std::abs(glm::dot(x, z)) <= eps && std::abs(glm::dot(y, z)) <= eps;
+}
+
+} // namespace
+
+InstanceBuffer::~InstanceBuffer(){ clear(); }
+
+void InstanceBuffer::setBounds(const glm::vec3 &bmin, const glm::vec3 &bmax){
+    localMin_ = bmin;
+    localMax_ = bmax;
+    for(size_t slot = 0; slot < instances_.size(); ++slot) place(slot, instances_[slot].transform);
+}
+
+InstanceBuffer::Handle InstanceBuffer::add(const glm::mat4 &transform){
+    Handle h;
+    if(!freeHandles_.empty()){
+        h = freeHandles_.back();
+        freeHandles_.pop_back();
+    }else{
+        h = static_cast<Handle>(slotOf_.size());
+        slotOf_.push_back(kInvalid);
+    }
+    const size_t slot = instances_.size();
+    slotOf_[h] = static_cast<uint32_t>(slot);
+    handleOf_.push_back(h);
+    instances_.emplace_back();
+    worldMin_.emplace_back(0.0f);
+    worldMax_.emplace_back(0.0f);
+    boxes_.add(glm::vec3(0.0f), glm::vec3(0.0f));
+    dirty_.push_back(0);
+    rigid_.push_back(1);
+    place(slot, transform);
+    return h;
+}
+
+void InstanceBuffer::set(Handle h, const glm::mat4 &transform){
+    if(!valid(h)) return;
+    place(slotOf_[h], transform);
+}
+
+void InstanceBuffer::remove(Handle h){
+    if(!valid(h)) return;
+    const size_t slot = slotOf_[h], last = instances_.size() - 1;
+    if(slot != last){
+        // the last instance fills the hole, its handle follows it
+        const Handle moved = handleOf_[last];
+        handleOf_[slot] = moved;
+        slotOf_[moved] = static_cast<uint32_t>(slot);
+        place(slot, instances_[last].transform);
+    }
+    if(!rigid_[last]) --nonRigid_;
+    slotOf_[h] = kInvalid;
+    freeHandles_.push_back(h);
+    instances_.pop_back();
+    worldMin_.pop_back();
+    worldMax_.pop_back();
+    handleOf_.pop_back();
+    dirty_.pop_back();
+    rigid_.pop_back();
+    boxes_.removeLast();
+}
+
+void InstanceBuffer::clear(){
+    instances_.clear();
+    worldMin_.clear();
+    worldMax_.clear();
+    handleOf_.clear();
+    slotOf_.clear();
+    freeHandles_.clear();
+    boxes_.clear();
+    dirty_.clear();
+    dirtySlots_.clear();
+    rigid_.clear();
+    nonRigid_ = 0;
+    if(buffer_){
+        glDeleteTextures(1, &texture_);
+        glDeleteBuffers(1, &buffer_);
+        texture_ = buffer_ = 0;
+        GlState::shared().invalidate();
+    }
+    capacity_ = 0;
+}
+
+void InstanceBuffer::place(size_t slot, const glm::mat4 &transform){
+    static_assert(sizeof(Instance) == 7 * sizeof(glm::vec4), "vertex.glsl fetches seven texels per copy");
+    instances_[slot].transform = transform;
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for(int i = 0; i < 8; ++i){
+        const glm::vec3 corner((i & 1) ? localMax_.x : localMin_.x, (i & 2) ? localMax_.y : localMin_.y,
+                               (i & 4) ? localMax_.z : localMin_.z);
+        const glm::vec3 p(transform * glm::vec4(corner, 1.0f));
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    worldMin_[slot] = lo;
+    worldMax_[slot] = hi;
+    boxes_.set(slot, lo, hi);
+    const uint8_t rigid = isRigid(transform) ? 1 : 0;
+    if(rigid != rigid_[slot]){
+        if(rigid) --nonRigid_; else ++nonRigid_;
+        rigid_[slot] = rigid;
+    }
+    // a rigid copy's own mat3 does, the shader normalizes the scale away
+    const glm::mat3 normalMatrix = rigid ? glm::mat3(transform) : glm::transpose(glm::inverse(glm::mat3(transform)));
+    for(int c = 0; c < 3; ++c) instances_[slot].normalMatrix[c] = glm::vec4(normalMatrix[c], 0.0f);
+    markDirty(slot);
+}
+
+void InstanceBuffer::markDirty(size_t slot){
+    if(dirty_[slot]) return;
+    dirty_[slot] = 1;
+    dirtySlots_.push_back(static_cast<uint32_t>(slot));
+}
+
+size_t InstanceBuffer::sync(){
+    if(!buffer_){
+        glGenBuffers(1, &buffer_);
+        glGenTextures(1, &texture_);
+    }
+
+    size_t bytes = 0;
+    if(instances_.size() > capacity_){
+        // grow by doubling and send everything, the old store is gone
+        capacity_ = std::max<size_t>(instances_.size(), capacity_ * 2);
+        GlState &gl = GlState::shared();
+        gl.bindBuffer(GL_TEXTURE_BUFFER, buffer_);
+        glBufferData(GL_TEXTURE_BUFFER, capacity_ * sizeof(Instance), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, instances_.size() * sizeof(Instance), instances_.data());
+        gl.bindTexture(0, GL_TEXTURE_BUFFER, texture_);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer_);
+        bytes = instances_.size() * sizeof(Instance);
+        for(uint32_t slot : dirtySlots_) if(slot < dirty_.size()) dirty_[slot] = 0;
+        dirtySlots_.clear();
+        return bytes;
+    }
+    if(dirtySlots_.empty()) return 0;
+
+    std::sort(dirtySlots_.begin(), dirtySlots_.end());
+    GlState::shared().bindBuffer(GL_TEXTURE_BUFFER, buffer_);
+    size_t i = 0;
+    while(i < dirtySlots_.size()){
+        // removed slots past the end were dirty too, they're just dropped
+        if(dirtySlots_[i] >= instances_.size()){ ++i; continue; }
+        const uint32_t first = dirtySlots_[i];
+        uint32_t last = first;
+        dirty_[first] = 0;
+        for(++i; i < dirtySlots_.size() && dirtySlots_[i] < instances_.size() && dirtySlots_[i] - last <= kMergeGap; ++i){
+            last = dirtySlots_[i];
+            dirty_[last] = 0;
+        }
+        const size_t count = last - first + 1;
+        glBufferSubData(GL_TEXTURE_BUFFER, first * sizeof(Instance), count * sizeof(Instance), &instances_[first]);
+        bytes += count * sizeof(Instance);
+    }
+    dirtySlots_.clear();
+    return bytes;
+}
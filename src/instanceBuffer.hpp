@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "frustum.hpp"
+
+// Transforms of the copies of one mesh, for instanced drawing.
+// Handles stay valid until removed; the transforms themselves sit densely
+// packed (remove moves the last one into the hole), mirrored in a texture
+// buffer (RGBA32F) that the vertex shader fetches from: seven texels per copy,
+// the matrix and then the columns of its normal matrix, computed here once per
+// set() instead of an inverse per vertex.
+// Only the slots touched since the last sync() are uploaded, in coalesced runs.
+// World-space bounds of every copy are kept in a CullBoxes in slot order.
+class InstanceBuffer {
+public:
+    using Handle = uint32_t;
+    static constexpr Handle kInvalid = ~0u;
+
+    InstanceBuffer() = default;
+    ~InstanceBuffer();
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // local bounds of the mesh; every box is recomputed
+    void setBounds(const glm::vec3 &bmin, const glm::vec3 &bmax);
+
+    Handle add(const glm::mat4 &transform);
+    void set(Handle h, const glm::mat4 &transform);
+    void remove(Handle h);
+    // drops the instances and the GL objects; needs the context if any were created
+    void clear();
+
+    bool valid(Handle h) const { return h < slotOf_.size() && slotOf_[h] != kInvalid; }
+    size_t size() const { return instances_.size(); }
+    bool empty() const { return instances_.empty(); }
+
+    // dense, in slot order
+    const glm::mat4 &transform(size_t slot) const { return instances_[slot].transform; }
+    const glm::vec3 &worldMin(size_t slot) const { return worldMin_[slot]; }
+    const glm::vec3 &worldMax(size_t slot) const { return worldMax_[slot]; }
+    const CullBoxes &boxes() const { return boxes_; }
+    // every transform is rotation, uniform scale and translation: normals need no inverse
+    bool rigid() const { return nonRigid_ == 0; }
+
+    // uploads the dirty slots; returns the number of bytes sent
+    size_t sync();
+    GLuint texture() const { return texture_; }
+
+private:
+    void place(size_t slot, const glm::mat4 &transform);
+    void markDirty(size_t slot);
+
+    glm::vec3 localMin_{0.0f}, localMax_{0.0f};
+
+    // one copy as the shaders read it
+    struct Instance {
+        glm::mat4 transform;
+        glm::vec4 normalMatrix[3];          // columns of transpose(inverse(mat3)), w unused
+    };
+    std::vector<Instance> instances_;
+    std::vector<glm::vec3> worldMin_, worldMax_;
+    std::vector<Handle> handleOf_;          // slot -> handle
+    std::vector<uint32_t> slotOf_;          // handle -> slot, kInvalid when free
+    std::vector<Handle> freeHandles_;
+    CullBoxes boxes_;
+    std::vector<uint8_t> rigid_;            // per slot
+    size_t nonRigid_{0};
+
+    std::vector<uint8_t> dirty_;            // per slot
+    std::vector<uint32_t> dirtySlots_;
+    GLuint buffer_{0}, texture_{0};
+    size_t capacity_{0};                    // copies the GL buffer holds
+};
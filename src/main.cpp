@@ -1,14 +1,126 @@
 #include "game.hpp"
+#include "benchmark.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <exception>
 #include <iostream>
+#include <string>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 
-int main()
+// the whole argument as a decimal int; std::stoi would throw on "abc" and take "12abc"
+static bool parseInt(const char* text, int& value)
 {
+    const char* end = text + std::strlen(text);
+    const auto result = std::from_chars(text, end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+int main(int argc, char** argv)
+{
+    // ./flame_world.run --bench-import [path.obj] [iterations]
+    if (argc > 1 && std::string(argv[1]) == "--bench-import")
+    {
+        std::string path = argc > 2 ? argv[2] : "./assets/casa.obj";
+        int iterations = 5;
+        if (argc > 3 && !parseInt(argv[3], iterations))
+        {
+            std::cerr << "Bad --bench-import iteration count: " << argv[3] << " (expected a number)\n";
+            return 1;
+        }
+        return runImportBenchmark(path, iterations);
+    }
+
+    // ./flame_world.run --self-test
+    if (argc > 1 && std::string(argv[1]) == "--self-test") return runSelfTest();
+
+    // ./flame_world.run --bench [--frames N] [--bench-path cam.txt] [--bench-out report.json]
+    // --occlusion off|cpu|gpu|auto, --packed-vertices, --instances N, --lights N, --shadow-size N (0 = off),
+    // --shader-cache DIR / --no-shader-cache, --texture-format source|rgba8|bc|bc7 and
+    // --texture-binding separate|array|bindless|auto apply to both the game and the benchmark
     Game game;
+    bool bench = false;
+    BenchOptions benchOptions;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--bench") bench = true;
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            int frames = 0;
+            if (!parseInt(argv[++i], frames))
+            {
+                std::cerr << "Bad --frames: " << argv[i] << " (expected a number)\n";
+                return 1;
+            }
+            benchOptions.frames = std::max(1, frames);
+        }
+        else if (arg == "--bench-path" && i + 1 < argc) benchOptions.pathFile = argv[++i];
+        else if (arg == "--bench-out" && i + 1 < argc) benchOptions.outFile = argv[++i];
+        else if (arg == "--record-path" && i + 1 < argc) game.setRecordPath(argv[++i]);
+        else if (arg == "--trace" && i + 1 < argc) game.setTracePath(argv[++i]);
+        else if (arg == "--packed-vertices") game.setPackedVertices(true);
+        else if (arg == "--shader-cache" && i + 1 < argc) game.setShaderCacheDir(argv[++i]);
+        else if (arg == "--no-shader-cache") game.setShaderCacheDir("");
+        else if (arg == "--instances" && i + 1 < argc)
+        {
+            int instances = 0;
+            if (!parseInt(argv[++i], instances))
+            {
+                std::cerr << "Bad --instances: " << argv[i] << " (expected a number)\n";
+                return 1;
+            }
+            game.setInstanceCount(std::max(0, instances));
+        }
+        else if (arg == "--lights" && i + 1 < argc)
+        {
+            int lights = 0;
+            if (!parseInt(argv[++i], lights))
+            {
+                std::cerr << "Bad --lights: " << argv[i] << " (expected a number)\n";
+                return 1;
+            }
+            game.setLightCount(std::min(std::max(0, lights), static_cast<int>(ClusteredLights::kMaxLights)));
+        }
+        else if (arg == "--shadow-size" && i + 1 < argc)
+        {
+            int size = 0;
+            if (!parseInt(argv[++i], size))
+            {
+                std::cerr << "Bad --shadow-size: " << argv[i] << " (expected a number, 0 = off)\n";
+                return 1;
+            }
+            game.setShadowSize(std::max(0, size));
+        }
+        else if (arg == "--texture-format" && i + 1 < argc)
+        {
+            if (!game.setTextureFormat(argv[++i]))
+            {
+                std::cerr << "Unknown --texture-format: " << argv[i] << " (source, rgba8, bc, bc7)\n";
+                return 1;
+            }
+        }
+        else if (arg == "--texture-binding" && i + 1 < argc)
+        {
+            if (!game.setTextureBinding(argv[++i]))
+            {
+                std::cerr << "Unknown --texture-binding: " << argv[i] << " (separate, array, bindless, auto)\n";
+                return 1;
+            }
+        }
+        else if (arg == "--occlusion" && i + 1 < argc)
+        {
+            if (!game.setOcclusionMode(argv[++i]))
+            {
+                std::cerr << "Unknown --occlusion mode: " << argv[i] << " (off, cpu, gpu, auto)\n";
+                return 1;
+            }
+        }
+    }
 
     try {
+        if (bench) return game.runBenchmark(benchOptions);
         game.run();
     } catch (std::exception& error_)
     {
@@ -17,4 +129,4 @@ int main()
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// CPU-side mesh as produced by the OBJ importer and stored in the mesh cache.
+// No GL here, so the importer and the cache can run (and be benchmarked)
+// without a context.
+
+struct MeshVertex {
+    glm::vec3 pos;
+    glm::vec3 normal;
+    glm::vec2 uv;
+};
+
+// one draw range per material; texPath is already resolved against the .obj dir
+struct MeshRange {
+    size_t start, count;
+    glm::vec3 color;
+    std::string texPath;
+};
+
+// spatially coherent run of triangles inside one range, the unit the renderer culls;
+// start/count are in indices like MeshRange, bounds are in model space
+struct MeshCluster {
+    uint32_t start, count;
+    glm::vec3 bmin, bmax;
+};
+
+struct MeshSpan {
+    uint32_t start, count;
+};
+
+// simplified level of the whole mesh: the same vertices, its own indices
+// after the full-resolution ones in MeshData::indices
+struct MeshLod {
+    float error = 0.0f;                 // how far (model units) the surface may stray from the original
+    std::vector<MeshSpan> ranges;       // per material, parallel to MeshData::ranges
+    std::vector<MeshCluster> clusters;  // sorted by start
+};
+
+struct MeshData {
+    std::vector<MeshVertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<MeshRange> ranges;
+    std::vector<MeshCluster> clusters;  // sorted by start, cover every range
+    std::vector<MeshLod> lods;          // coarser and coarser, empty if the mesh doesn't simplify
+};
+
+// indices of the full-resolution level; LOD indices follow them in the same buffer
+inline size_t baseIndexCount(const std::vector<MeshRange> &ranges){
+    size_t end = 0;
+    for(const auto &r : ranges) end = end > r.start + r.count ? end : r.start + r.count;
+    return end;
+}
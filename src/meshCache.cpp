@@ -0,0 +1,262 @@
+#include "meshCache.hpp"
+#include "cacheFile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kMagic[4] = {'F','W','M','C'};
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t vertexStride;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t rangeCount;
+    uint32_t clusterCount;
+    uint32_t lodCount;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t rangeOffset;
+    uint64_t clusterOffset;
+    uint64_t lodOffset;
+    uint64_t stringOffset;
+    uint64_t fileSize;
+};
+
+struct Range {
+    uint64_t start, count;
+    float color[3];
+    uint32_t texPathOffset, texPathLength;
+};
+
+struct Lod {
+    float error;
+    uint32_t firstCluster, clusterCount;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(MeshCluster) == 32, "MeshCluster is stored as is");
+static_assert(sizeof(MeshSpan) == 8, "MeshSpan is stored as is");
+
+inline uint64_t align16(uint64_t v) { return (v + 15) & ~uint64_t(15); }
+
+} // namespace
+
+MeshCache::~MeshCache() {
+    close();
+}
+
+std::string MeshCache::pathFor(const std::string& objPath) {
+    return fs::path(objPath).replace_extension(".fwmesh").string();
+}
+
+uint64_t MeshCache::hashSource(const std::string& objPath) {
+    MappedFile obj(objPath);
+    if (!obj.isOpen()) return 0;
+
+    uint64_t h = fnv1a(kFnvOffset, obj.data(), obj.size());
+
+    // fold in every "mtllib a.mtl [b.mtl ...]", materials change the baked ranges too
+    const fs::path base = fs::path(objPath).parent_path();
+    const char* p = obj.data();
+    const char* end = p + obj.size();
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        if (eol - p > 7 && std::memcmp(p, "mtllib", 6) == 0 && (p[6] == ' ' || p[6] == '\t')) {
+            std::istringstream names(std::string(p + 7, eol));
+            std::string name;
+            while (names >> name) {
+                MappedFile mtl((base / name).string());
+                h = fnv1a(h, name.data(), name.size());
+                if (mtl.isOpen()) h = fnv1a(h, mtl.data(), mtl.size());
+            }
+        }
+        p = eol + 1;
+    }
+    return h ? h : 1;
+}
+
+bool MeshCache::open(const std::string& cachePath, uint64_t sourceHash) {
+    close();
+    if (!file_.open(cachePath)) return false;
+
+    const char* base = file_.data();
+    const size_t size = file_.size();
+    if (size < sizeof(Header)) { close(); return false; }
+
+    Header hdr;
+    std::memcpy(&hdr, base, sizeof(hdr));
+    if (std::memcmp(hdr.magic, kMagic, 4) != 0 ||
+        hdr.version != kVersion ||
+        hdr.vertexStride != sizeof(MeshVertex) ||
+        hdr.fileSize != size)
+    {
+        close();
+        return false;
+    }
+    if (hdr.sourceHash != sourceHash) {
+        std::cout << "[*] Mesh cache is stale: " << cachePath << "\n";
+        close();
+        return false;
+    }
+    if (hdr.vertexOffset + uint64_t(hdr.vertexCount) * sizeof(MeshVertex) > size ||
+        hdr.indexOffset + uint64_t(hdr.indexCount) * sizeof(unsigned int) > size ||
+        hdr.rangeOffset + uint64_t(hdr.rangeCount) * sizeof(Range) > size ||
+        hdr.clusterOffset + uint64_t(hdr.clusterCount) * sizeof(MeshCluster) > size ||
+        hdr.lodOffset + uint64_t(hdr.lodCount) * (sizeof(Lod) + uint64_t(hdr.rangeCount) * sizeof(MeshSpan)) > size ||
+        hdr.stringOffset > size)
+    {
+        close();
+        return false;
+    }
+
+    // the index check below and then glBufferData stream through all of it;
+    // advice values are not flags, one call each
+    madvise(const_cast<char*>(base), size, MADV_SEQUENTIAL);
+    madvise(const_cast<char*>(base), size, MADV_WILLNEED);
+
+    vertices_ = reinterpret_cast<const MeshVertex*>(base + hdr.vertexOffset);
+    indices_ = reinterpret_cast<const unsigned int*>(base + hdr.indexOffset);
+    clusters_ = reinterpret_cast<const MeshCluster*>(base + hdr.clusterOffset);
+    vertexCount_ = hdr.vertexCount;
+    indexCount_ = hdr.indexCount;
+    clusterCount_ = hdr.clusterCount;
+    // an index past the vertices would have the GPU read outside the buffer
+    unsigned int maxIndex = 0;
+    for (uint32_t i = 0; i < hdr.indexCount; ++i) maxIndex = std::max(maxIndex, indices_[i]);
+    if (hdr.indexCount && maxIndex >= hdr.vertexCount) {
+        close();
+        return false;
+    }
+    for (size_t i = 0; i < clusterCount_; ++i) {
+        if (uint64_t(clusters_[i].start) + clusters_[i].count > hdr.indexCount) {
+            close();
+            return false;
+        }
+    }
+
+    lods_.resize(hdr.lodCount);
+    size_t baseClusters = hdr.clusterCount;
+    const char* spans = base + hdr.lodOffset + uint64_t(hdr.lodCount) * sizeof(Lod);
+    for (uint32_t i = 0; i < hdr.lodCount; ++i) {
+        Lod l;
+        std::memcpy(&l, base + hdr.lodOffset + i * sizeof(Lod), sizeof(l));
+        if (uint64_t(l.firstCluster) + l.clusterCount > hdr.clusterCount) {
+            close();
+            return false;
+        }
+        baseClusters = std::min<size_t>(baseClusters, l.firstCluster);
+        MeshLod& lod = lods_[i];
+        lod.error = l.error;
+        lod.clusters.assign(clusters_ + l.firstCluster, clusters_ + l.firstCluster + l.clusterCount);
+        lod.ranges.resize(hdr.rangeCount);
+        std::memcpy(lod.ranges.data(), spans + uint64_t(i) * hdr.rangeCount * sizeof(MeshSpan),
+                    hdr.rangeCount * sizeof(MeshSpan));
+        for (const MeshSpan& span : lod.ranges) {
+            if (uint64_t(span.start) + span.count > hdr.indexCount) {
+                close();
+                return false;
+            }
+        }
+    }
+    // the base level's clusters are the ones in front of every LOD's
+    clusterCount_ = baseClusters;
+
+    ranges_.resize(hdr.rangeCount);
+    for (uint32_t i = 0; i < hdr.rangeCount; ++i) {
+        Range r;
+        std::memcpy(&r, base + hdr.rangeOffset + i * sizeof(Range), sizeof(r));
+        // start and count are read from the file: compare without a sum that could wrap
+        if (hdr.stringOffset + r.texPathOffset + r.texPathLength > size ||
+            r.start > hdr.indexCount || r.count > hdr.indexCount - r.start)
+        {
+            close();
+            return false;
+        }
+        MeshRange& mr = ranges_[i];
+        mr.start = r.start;
+        mr.count = r.count;
+        mr.color = glm::vec3(r.color[0], r.color[1], r.color[2]);
+        mr.texPath.assign(base + hdr.stringOffset + r.texPathOffset, r.texPathLength);
+    }
+
+    return true;
+}
+
+void MeshCache::close() {
+    file_.close();
+    vertices_ = nullptr;
+    indices_ = nullptr;
+    clusters_ = nullptr;
+    vertexCount_ = indexCount_ = clusterCount_ = 0;
+    ranges_.clear();
+    lods_.clear();
+}
+
+bool MeshCache::write(const std::string& cachePath, uint64_t sourceHash, const MeshData& mesh) {
+    std::string strings;
+    std::vector<Range> ranges(mesh.ranges.size());
+    for (size_t i = 0; i < mesh.ranges.size(); ++i) {
+        const MeshRange& mr = mesh.ranges[i];
+        Range& r = ranges[i];
+        r.start = mr.start;
+        r.count = mr.count;
+        r.color[0] = mr.color.x; r.color[1] = mr.color.y; r.color[2] = mr.color.z;
+        r.texPathOffset = static_cast<uint32_t>(strings.size());
+        r.texPathLength = static_cast<uint32_t>(mr.texPath.size());
+        strings += mr.texPath;
+    }
+
+    // every level's clusters in one block, base level first
+    std::vector<MeshCluster> clusters(mesh.clusters);
+    std::vector<Lod> lods(mesh.lods.size());
+    std::vector<MeshSpan> spans(mesh.lods.size() * ranges.size(), MeshSpan{0, 0});
+    for (size_t i = 0; i < mesh.lods.size(); ++i) {
+        const MeshLod& ml = mesh.lods[i];
+        Lod& l = lods[i];
+        l.error = ml.error;
+        l.firstCluster = static_cast<uint32_t>(clusters.size());
+        l.clusterCount = static_cast<uint32_t>(ml.clusters.size());
+        l.reserved = 0;
+        clusters.insert(clusters.end(), ml.clusters.begin(), ml.clusters.end());
+        std::copy_n(ml.ranges.begin(), std::min(ml.ranges.size(), ranges.size()), spans.begin() + i * ranges.size());
+    }
+
+    Header hdr{};
+    std::memcpy(hdr.magic, kMagic, 4);
+    hdr.version = kVersion;
+    hdr.sourceHash = sourceHash;
+    hdr.vertexStride = sizeof(MeshVertex);
+    hdr.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+    hdr.indexCount = static_cast<uint32_t>(mesh.indices.size());
+    hdr.rangeCount = static_cast<uint32_t>(ranges.size());
+    hdr.clusterCount = static_cast<uint32_t>(clusters.size());
+    hdr.lodCount = static_cast<uint32_t>(lods.size());
+    hdr.vertexOffset = align16(sizeof(Header));
+    hdr.indexOffset = align16(hdr.vertexOffset + mesh.vertices.size() * sizeof(MeshVertex));
+    hdr.rangeOffset = align16(hdr.indexOffset + mesh.indices.size() * sizeof(unsigned int));
+    hdr.clusterOffset = align16(hdr.rangeOffset + ranges.size() * sizeof(Range));
+    hdr.lodOffset = align16(hdr.clusterOffset + clusters.size() * sizeof(MeshCluster));
+    hdr.stringOffset = align16(hdr.lodOffset + lods.size() * sizeof(Lod) + spans.size() * sizeof(MeshSpan));
+    hdr.fileSize = hdr.stringOffset + strings.size();
+
+    return writeFileAtomically(cachePath, [&](std::ostream& os) {
+        writeAt(os, 0, &hdr, sizeof(hdr));
+        writeAt(os, hdr.vertexOffset, mesh.vertices.data(), mesh.vertices.size() * sizeof(MeshVertex));
+        writeAt(os, hdr.indexOffset, mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+        writeAt(os, hdr.rangeOffset, ranges.data(), ranges.size() * sizeof(Range));
+        writeAt(os, hdr.clusterOffset, clusters.data(), clusters.size() * sizeof(MeshCluster));
+        writeAt(os, hdr.lodOffset, lods.data(), lods.size() * sizeof(Lod));
+        writeAt(os, hdr.lodOffset + lods.size() * sizeof(Lod), spans.data(), spans.size() * sizeof(MeshSpan));
+        writeAt(os, hdr.stringOffset, strings.data(), strings.size());
+    });
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+#include "mappedFile.hpp"
+
+// Baked binary mesh next to the source asset (casa.obj -> casa.fwmesh).
+//
+// Layout (native endianness, every block 16-byte aligned):
+//   Header | MeshVertex[vertexCount] | uint32[indexCount] | Range[rangeCount] |
+//   MeshCluster[clusterCount] | Lod[lodCount] MeshSpan[lodCount * rangeCount] | strings
+// Clusters of the base level come first, each LOD names its own slice after them.
+// The header carries a hash of the .obj and every mtllib it references;
+// a mismatch (or a different version / vertex layout) means the file is stale.
+class MeshCache {
+public:
+    static constexpr uint32_t kVersion = 6;
+
+    MeshCache() = default;
+    ~MeshCache();
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator=(const MeshCache&) = delete;
+
+    // mmap the cache and validate it against sourceHash; false if missing or stale
+    bool open(const std::string &cachePath, uint64_t sourceHash);
+    void close();
+
+    // views into the mapping, valid until close()
+    const MeshVertex* vertices() const { return vertices_; }
+    size_t vertexCount() const { return vertexCount_; }
+    const unsigned int* indices() const { return indices_; }
+    size_t indexCount() const { return indexCount_; }
+    const std::vector<MeshRange>& ranges() const { return ranges_; }
+    // base level only
+    const MeshCluster* clusters() const { return clusters_; }
+    size_t clusterCount() const { return clusterCount_; }
+    const std::vector<MeshLod>& lods() const { return lods_; }
+
+    static bool write(const std::string &cachePath, uint64_t sourceHash, const MeshData &mesh);
+
+    static std::string pathFor(const std::string &objPath);
+    // word-wise FNV-1a over the .obj and its material libraries; 0 if the .obj can't be read
+    static uint64_t hashSource(const std::string &objPath);
+
+private:
+    MappedFile file_;
+
+    const MeshVertex* vertices_{nullptr};
+    const unsigned int* indices_{nullptr};
+    const MeshCluster* clusters_{nullptr};
+    size_t vertexCount_{0}, indexCount_{0}, clusterCount_{0};
+    std::vector<MeshRange> ranges_;
+    std::vector<MeshLod> lods_;
+};
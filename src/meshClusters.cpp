@@ -0,0 +1,96 @@
+#include "meshClusters.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <numeric>
+
+namespace {
+
+struct Span { size_t begin, end; };
+
+// clusters of one range, written into its own slice of the index buffer
+void clusterRange(MeshData &mesh, size_t start, size_t count, size_t maxTriangles, std::vector<MeshCluster> &out){
+    const size_t tris = count / 3;
+    if(tris == 0) return;
+    unsigned int *idx = mesh.indices.data() + start;
+    const std::vector<MeshVertex> &verts = mesh.vertices;
+
+    std::vector<glm::vec3> centroid(tris);
+    for(size_t t = 0; t < tris; ++t)
+        centroid[t] = (verts[idx[3*t]].pos + verts[idx[3*t+1]].pos + verts[idx[3*t+2]].pos) * (1.0f / 3.0f);
+
+    std::vector<uint32_t> order(tris);
+    std::iota(order.begin(), order.end(), 0u);
+
+    // depth first, left half first, so leaves come out in spatial order
+    std::vector<Span> stack{{0, tris}}, leaves;
+    while(!stack.empty()){
+        const Span s = stack.back();
+        stack.pop_back();
+        if(s.end - s.begin <= maxTriangles){
+            leaves.push_back(s);
+            continue;
+        }
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        for(size_t i = s.begin; i < s.end; ++i){
+            lo = glm::min(lo, centroid[order[i]]);
+            hi = glm::max(hi, centroid[order[i]]);
+        }
+        const glm::vec3 extent = hi - lo;
+        const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        const size_t mid = s.begin + (s.end - s.begin) / 2;
+        // ties broken by id, so the split doesn't depend on the input order
+        std::nth_element(order.begin() + s.begin, order.begin() + mid, order.begin() + s.end,
+                         [&](uint32_t a, uint32_t b){
+                             const float ca = centroid[a][axis], cb = centroid[b][axis];
+                             return ca < cb || (ca == cb && a < b);
+                         });
+        stack.push_back({mid, s.end});
+        stack.push_back({s.begin, mid});
+    }
+
+    std::vector<unsigned int> source(idx, idx + tris * 3);
+    size_t cursor = 0;
+    for(const Span &s : leaves){
+        // keep the importer's order inside a cluster, it's the one the vertices were numbered in
+        std::sort(order.begin() + s.begin, order.begin() + s.end);
+        MeshCluster c;
+        c.start = static_cast<uint32_t>(start + cursor * 3);
+        c.count = static_cast<uint32_t>((s.end - s.begin) * 3);
+        c.bmin = glm::vec3(FLT_MAX);
+        c.bmax = glm::vec3(-FLT_MAX);
+        for(size_t i = s.begin; i < s.end; ++i, ++cursor){
+            for(int k = 0; k < 3; ++k){
+                const unsigned int v = source[order[i] * 3 + k];
+                idx[cursor * 3 + k] = v;
+                c.bmin = glm::min(c.bmin, verts[v].pos);
+                c.bmax = glm::max(c.bmax, verts[v].pos);
+            }
+        }
+        out.push_back(c);
+    }
+}
+
+} // namespace
+
+void buildClusters(MeshData &mesh, size_t maxTriangles, bool parallel){
+    maxTriangles = std::max<size_t>(maxTriangles, 1);
+    // every level's ranges own disjoint slices of the index buffer
+    struct Job { size_t start, count; std::vector<MeshCluster> *out; };
+    std::vector<Job> jobs;
+    for(const MeshRange &r : mesh.ranges) jobs.push_back({r.start, r.count, &mesh.clusters});
+    for(MeshLod &lod : mesh.lods)
+        for(const MeshSpan &r : lod.ranges) jobs.push_back({r.start, r.count, &lod.clusters});
+
+    std::vector<std::vector<MeshCluster>> perJob(jobs.size());
+    auto run = [&](size_t j){ clusterRange(mesh, jobs[j].start, jobs[j].count, maxTriangles, perJob[j]); };
+    if(parallel) ThreadPool::shared().parallelFor(jobs.size(), run);
+    else for(size_t j = 0; j < jobs.size(); ++j) run(j);
+
+    mesh.clusters.clear();
+    for(MeshLod &lod : mesh.lods) lod.clusters.clear();
+    for(size_t j = 0; j < jobs.size(); ++j) jobs[j].out->insert(jobs[j].out->end(), perJob[j].begin(), perJob[j].end());
+    auto byStart = [](const MeshCluster &a, const MeshCluster &b){ return a.start < b.start; };
+    std::sort(mesh.clusters.begin(), mesh.clusters.end(), byStart);
+    for(MeshLod &lod : mesh.lods) std::sort(lod.clusters.begin(), lod.clusters.end(), byStart);
+}
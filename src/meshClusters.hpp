@@ -0,0 +1,10 @@
+#pragma once
+#include <cstddef>
+#include "mesh.hpp"
+
+// Split every range of the mesh (and of each LOD) into clusters of at most maxTriangles
+// spatially close triangles (median splits along the longest centroid axis)
+// and reorder the range's triangles so each cluster is contiguous. Ranges keep
+// their start/count; the result is deterministic, parallel or not.
+constexpr size_t kClusterTriangles = 256;
+void buildClusters(MeshData &mesh, size_t maxTriangles = kClusterTriangles, bool parallel = true);
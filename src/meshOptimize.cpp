@@ -0,0 +1,204 @@
+#include "meshOptimize.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+// Tipsify over one cluster's triangles: fan around a vertex, then continue from
+// the neighbour of the fan that will still be in the cache (or has few triangles
+// left), falling back to recently touched vertices on a dead end
+void tipsify(unsigned int *idx, size_t tris, unsigned cacheSize){
+    if(tris < 2) return;
+
+    // local numbering, the cluster only touches a few hundred vertices
+    std::vector<unsigned int> globalOf;
+    std::vector<uint32_t> local(tris * 3);
+    {
+        std::vector<std::pair<unsigned int, uint32_t>> sorted(tris * 3);
+        for(uint32_t i = 0; i < tris * 3; ++i) sorted[i] = {idx[i], i};
+        std::sort(sorted.begin(), sorted.end());
+        for(size_t i = 0; i < sorted.size(); ++i){
+            if(i == 0 || sorted[i].first != sorted[i - 1].first) globalOf.push_back(sorted[i].first);
+            local[sorted[i].second] = static_cast<uint32_t>(globalOf.size() - 1);
+        }
+    }
+    const size_t n = globalOf.size();
+
+    std::vector<uint32_t> adjStart(n + 1, 0), adj(tris * 3), live(n, 0);
+    for(uint32_t v : local) ++adjStart[v + 1];
+    std::partial_sum(adjStart.begin(), adjStart.end(), adjStart.begin());
+    std::vector<uint32_t> fill(adjStart.begin(), adjStart.end() - 1);
+    for(uint32_t i = 0; i < tris * 3; ++i) adj[fill[local[i]]++] = i / 3;
+    for(uint32_t v = 0; v < n; ++v) live[v] = adjStart[v + 1] - adjStart[v];
+
+    // a vertex is in the cache while time - stamp <= cacheSize
+    std::vector<uint32_t> stamp(n, 0), candidates, deadEnd;
+    std::vector<uint8_t> emitted(tris, 0);
+    std::vector<unsigned int> out;
+    out.reserve(tris * 3);
+    uint32_t time = cacheSize + 1, scan = 0;
+    int64_t fan = 0;
+
+    while(fan >= 0){
+        candidates.clear();
+        for(uint32_t i = adjStart[fan]; i < adjStart[fan + 1]; ++i){
+            const uint32_t t = adj[i];
+            if(emitted[t]) continue;
+            emitted[t] = 1;
+            for(int k = 0; k < 3; ++k){
+                const uint32_t v = local[t * 3 + k];
+                out.push_back(globalOf[v]);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if(time - stamp[v] > cacheSize) stamp[v] = time++;
+            }
+        }
+
+        // the candidate that stays in the cache longest once its triangles are out
+        fan = -1;
+        int64_t best = -1;
+        for(uint32_t v : candidates){
+            if(!live[v]) continue;
+            int64_t priority = 0;
+            if(time - stamp[v] + 2 * live[v] <= cacheSize) priority = time - stamp[v];
+            if(priority > best){
+                best = priority;
+                fan = v;
+            }
+        }
+        if(fan >= 0) continue;
+        while(!deadEnd.empty()){
+            const uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if(live[v]){ fan = v; break; }
+        }
+        if(fan >= 0) continue;
+        while(scan < n && !live[scan]) ++scan;
+        if(scan < n) fan = scan;
+    }
+    std::copy(out.begin(), out.end(), idx);
+}
+
+// clusters of one range (sorted by start, covering it) reordered outside-in,
+// their indices moved along; each one then tipsified
+void optimizeRange(MeshData &mesh, MeshCluster *clusters, size_t count, const glm::vec3 &center){
+    if(count == 0) return;
+    unsigned int *idx = mesh.indices.data();
+    const std::vector<MeshVertex> &verts = mesh.vertices;
+
+    if(count > 1){
+        // Sander's overdraw order: how far out the cluster sits along its own mean normal
+        std::vector<float> key(count);
+        for(size_t c = 0; c < count; ++c){
+            glm::vec3 normal(0.0f), centroid(0.0f);
+            float area = 0.0f;
+            for(uint32_t i = clusters[c].start; i + 2 < clusters[c].start + clusters[c].count; i += 3){
+                const glm::vec3 &a = verts[idx[i]].pos, &b = verts[idx[i + 1]].pos, &d = verts[idx[i + 2]].pos;
+                const glm::vec3 n = glm::cross(b - a, d - a);
+                const float len = glm::length(n);
+                normal += n;
+                centroid += (a + b + d) * (len / 3.0f);
+                area += len;
+            }
+            const float len = glm::length(normal);
+            key[c] = (area > 0.0f && len > 0.0f) ? glm::dot(centroid / area - center, normal / len) : 0.0f;
+        }
+        std::vector<uint32_t> order(count);
+        std::iota(order.begin(), order.end(), 0u);
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){ return key[a] > key[b]; });
+
+        const uint32_t start = clusters[0].start;
+        std::vector<unsigned int> source(idx + start, idx + clusters[count - 1].start + clusters[count - 1].count);
+        std::vector<MeshCluster> moved(count);
+        uint32_t cursor = start;
+        for(size_t i = 0; i < count; ++i){
+            MeshCluster c = clusters[order[i]];
+            std::copy_n(source.begin() + (c.start - start), c.count, idx + cursor);
+            c.start = cursor;
+            cursor += c.count;
+            moved[i] = c;
+        }
+        std::copy(moved.begin(), moved.end(), clusters);
+    }
+
+    for(size_t c = 0; c < count; ++c) tipsify(idx + clusters[c].start, clusters[c].count / 3, kVertexCacheSize);
+}
+
+// the clusters (sorted by start) that fall inside [start, start + count)
+std::pair<size_t, size_t> clustersOf(const std::vector<MeshCluster> &clusters, size_t start, size_t count){
+    auto first = std::lower_bound(clusters.begin(), clusters.end(), start,
+                                  [](const MeshCluster &c, size_t s){ return c.start < s; });
+    auto last = first;
+    while(last != clusters.end() && last->start < start + count) ++last;
+    return {size_t(first - clusters.begin()), size_t(last - first)};
+}
+
+} // namespace
+
+VertexCacheStats analyzeVertexCache(const unsigned int *indices, size_t indexCount, size_t vertexCount,
+                                    unsigned cacheSize){
+    VertexCacheStats stats;
+    if(indexCount < 3) return stats;
+    // FIFO by miss count: a vertex is cached while fewer than cacheSize misses followed its own
+    std::vector<size_t> missedAt(vertexCount, 0);
+    size_t misses = 0, used = 0;
+    for(size_t i = 0; i < indexCount; ++i){
+        const unsigned int v = indices[i];
+        if(v >= vertexCount) continue;
+        if(missedAt[v] == 0) ++used;
+        if(missedAt[v] != 0 && misses - missedAt[v] < cacheSize) continue;
+        missedAt[v] = ++misses;
+    }
+    stats.acmr = double(misses) / double(indexCount / 3);
+    stats.atvr = used ? double(misses) / double(used) : 0.0;
+    return stats;
+}
+
+void optimizeMesh(MeshData &mesh, bool parallel, MeshOptimizeReport *report){
+    const size_t baseIndices = baseIndexCount(mesh.ranges);
+    if(report) report->before = analyzeVertexCache(mesh.indices.data(), baseIndices, mesh.vertices.size());
+    if(mesh.vertices.empty() || mesh.indices.empty()){
+        if(report) report->after = report->before;
+        return;
+    }
+
+    glm::vec3 lo = mesh.vertices[0].pos, hi = lo;
+    for(const MeshVertex &v : mesh.vertices){
+        lo = glm::min(lo, v.pos);
+        hi = glm::max(hi, v.pos);
+    }
+    const glm::vec3 center = (lo + hi) * 0.5f;
+
+    // one job per range of every level, each owns its slice of indices and clusters
+    struct Job { MeshCluster *clusters; size_t count; };
+    std::vector<Job> jobs;
+    auto addJobs = [&](std::vector<MeshCluster> &clusters, size_t start, size_t count){
+        const auto span = clustersOf(clusters, start, count);
+        if(span.second) jobs.push_back({clusters.data() + span.first, span.second});
+    };
+    for(const MeshRange &r : mesh.ranges) addJobs(mesh.clusters, r.start, r.count);
+    for(MeshLod &lod : mesh.lods)
+        for(const MeshSpan &s : lod.ranges) addJobs(lod.clusters, s.start, s.count);
+
+    auto run = [&](size_t j){ optimizeRange(mesh, jobs[j].clusters, jobs[j].count, center); };
+    if(parallel) ThreadPool::shared().parallelFor(jobs.size(), run);
+    else for(size_t j = 0; j < jobs.size(); ++j) run(j);
+
+    // vertices in the order the index buffer first reaches them; the LODs only
+    // reuse base vertices, anything unreferenced goes last
+    const uint32_t kUnused = ~0u;
+    std::vector<uint32_t> remap(mesh.vertices.size(), kUnused);
+    uint32_t next = 0;
+    for(unsigned int &i : mesh.indices){
+        if(remap[i] == kUnused) remap[i] = next++;
+        i = remap[i];
+    }
+    for(uint32_t &r : remap) if(r == kUnused) r = next++;
+    std::vector<MeshVertex> vertices(mesh.vertices.size());
+    for(size_t v = 0; v < remap.size(); ++v) vertices[remap[v]] = mesh.vertices[v];
+    mesh.vertices.swap(vertices);
+
+    if(report) report->after = analyzeVertexCache(mesh.indices.data(), baseIndices, mesh.vertices.size());
+}
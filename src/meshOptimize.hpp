@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include "mesh.hpp"
+
+// Draw-order optimization of a clustered mesh, in place:
+//  - clusters of every range are reordered outside-in (clusters facing away from
+//    the mesh centre first), so the ones likely to occlude draw early and the
+//    rest of the range fails the depth test instead of shading (overdraw);
+//  - triangles inside each cluster are reordered with Tipsify (Sander et al.)
+//    for the post-transform vertex cache;
+//  - vertices are renumbered in first-use order for vertex fetch locality.
+// Clusters stay contiguous and sorted by start, ranges and LOD spans keep their
+// start/count. Deterministic, parallel or not.
+constexpr unsigned kVertexCacheSize = 16;
+
+// post-transform cache misses per triangle (ACMR, 0.5 is ideal for a grid, 3 the
+// worst) and per referenced vertex (ATVR, 1 is ideal), for a FIFO of cacheSize
+struct VertexCacheStats {
+    double acmr = 0.0;
+    double atvr = 0.0;
+};
+VertexCacheStats analyzeVertexCache(const unsigned int *indices, size_t indexCount, size_t vertexCount,
+                                    unsigned cacheSize = kVertexCacheSize);
+
+// full-resolution level before and after optimizeMesh
+struct MeshOptimizeReport {
+    VertexCacheStats before, after;
+};
+void optimizeMesh(MeshData &mesh, bool parallel = true, MeshOptimizeReport *report = nullptr);
@@ -0,0 +1,405 @@
+#include "meshSimplify.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+
+// error never exceeds this fraction of the mesh diagonal, whatever the target
+constexpr float kMaxRelativeError = 0.05f;
+// a level has to drop at least this share of the previous one's triangles
+constexpr float kMinReduction = 0.15f;
+// constrained edges weigh this much more than the faces around them
+constexpr double kEdgeWeight = 10.0;
+
+struct Quadric {
+    // upper triangle of the symmetric 4x4 matrix, and the weight summed into it
+    double xx = 0, xy = 0, xz = 0, xw = 0, yy = 0, yz = 0, yw = 0, zz = 0, zw = 0, ww = 0, w = 0;
+
+    void addPlane(double a, double b, double c, double d, double weight){
+        xx += weight * a * a; xy += weight * a * b; xz += weight * a * c; xw += weight * a * d;
+        yy += weight * b * b; yz += weight * b * c; yw += weight * b * d;
+        zz += weight * c * c; zw += weight * c * d; ww += weight * d * d;
+        w += weight;
+    }
+    void add(const Quadric &q){
+        xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw; yy += q.yy; yz += q.yz; yw += q.yw;
+        zz += q.zz; zw += q.zw; ww += q.ww; w += q.w;
+    }
+    // RMS distance of p to the planes
+    float error(const glm::vec3 &p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        const double e = xx * x * x + 2 * xy * x * y + 2 * xz * x * z + 2 * xw * x + yy * y * y + 2 * yz * y * z +
+                         2 * yw * y + zz * z * z + 2 * zw * z + ww;
+        return w > 0 ? static_cast<float>(std::sqrt(std::max(e, 0.0) / w)) : 0.0f;
+    }
+};
+
+enum Kind : uint8_t { Manifold, Seam, Locked };
+constexpr uint32_t kNone = ~0u;
+
+struct Tri {
+    uint32_t range;         // material range the triangle belongs to
+    uint32_t vertex[3];     // original vertex of each corner
+    uint32_t pos[3];        // current welded position
+    uint32_t origin[3];     // welded position the corner started at
+};
+
+struct Collapse {
+    uint32_t from, to;
+    float error;
+};
+
+// one simplified level: indices per material range
+struct Level {
+    std::vector<std::vector<unsigned int>> ranges;
+    float error;
+};
+
+class Simplifier {
+public:
+    Simplifier(const MeshData &mesh, float errorLimit, bool parallel)
+        : mesh_(mesh), errorLimit_(errorLimit), parallel_(parallel) {
+        load();
+        classify();
+        buildQuadrics();
+    }
+
+    // next level with at most target triangles, or as close as the error limit allows
+    void simplify(size_t target, Level &out){
+        while(alive_ > target && pass(target)) {}
+        out.ranges.assign(mesh_.ranges.size(), {});
+        emit(out.ranges);
+        out.error = maxError_;
+    }
+    size_t triangles() const { return alive_; }
+
+private:
+    // positions welded across normal/UV splits; copies_ remembers who sat on each
+    void load(){
+        std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+        std::vector<uint32_t> weld(mesh_.vertices.size());
+        for(uint32_t v = 0; v < mesh_.vertices.size(); ++v){
+            const glm::vec3 &p = mesh_.vertices[v].pos;
+            uint32_t bits[3];
+            std::memcpy(bits, &p, sizeof(bits));
+            const uint64_t h = (uint64_t(bits[0]) * 73856093u) ^ (uint64_t(bits[1]) * 19349663u) ^ (uint64_t(bits[2]) * 83492791u);
+            auto &bucket = buckets[h];
+            uint32_t id = kNone;
+            for(uint32_t candidate : bucket)
+                if(points_[candidate] == p){ id = candidate; break; }
+            if(id == kNone){
+                id = static_cast<uint32_t>(points_.size());
+                points_.push_back(p);
+                copies_.emplace_back();
+                bucket.push_back(id);
+            }
+            weld[v] = id;
+            copies_[id].push_back(v);
+        }
+
+        for(uint32_t r = 0; r < mesh_.ranges.size(); ++r){
+            const MeshRange &range = mesh_.ranges[r];
+            const unsigned int *idx = mesh_.indices.data() + range.start;
+            for(size_t t = 0; t + 2 < range.count; t += 3){
+                Tri tri;
+                tri.range = r;
+                for(int k = 0; k < 3; ++k){
+                    tri.vertex[k] = idx[t + k];
+                    tri.pos[k] = tri.origin[k] = weld[idx[t + k]];
+                }
+                // welding can make a triangle degenerate; it's invisible anyway
+                if(tri.pos[0] == tri.pos[1] || tri.pos[1] == tri.pos[2] || tri.pos[0] == tri.pos[2]) continue;
+                tris_.push_back(tri);
+            }
+        }
+        alive_ = tris_.size();
+        triAlive_.assign(tris_.size(), 1);
+    }
+
+    static uint64_t edgeKey(uint32_t a, uint32_t b){
+        return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+    }
+
+    uint32_t vertexAt(const Tri &t, uint32_t pos) const {
+        for(int k = 0; k < 3; ++k) if(t.pos[k] == pos) return t.vertex[k];
+        return kNone;
+    }
+
+    void classify(){
+        struct Edge { uint32_t count, tri; bool seam; };
+        std::unordered_map<uint64_t, Edge> edges;
+        for(uint32_t t = 0; t < tris_.size(); ++t){
+            const Tri &tri = tris_[t];
+            for(int k = 0; k < 3; ++k){
+                const uint32_t a = tri.pos[k], b = tri.pos[(k + 1) % 3];
+                auto it = edges.emplace(edgeKey(a, b), Edge{1, t, false});
+                if(it.second) continue;
+                Edge &e = it.first->second;
+                ++e.count;
+                // the two sides differ in material or see different UVs along the edge: a seam
+                const Tri &other = tris_[e.tri];
+                if(other.range != tri.range) e.seam = true;
+                for(uint32_t p : {a, b}){
+                    const glm::vec2 d = mesh_.vertices[vertexAt(tri, p)].uv - mesh_.vertices[vertexAt(other, p)].uv;
+                    if(std::fabs(d.x) > 1e-6f || std::fabs(d.y) > 1e-6f) e.seam = true;
+                }
+            }
+        }
+
+        const size_t n = points_.size();
+        kind_.assign(n, Manifold);
+        slots_.assign(n, {kNone, kNone});
+        std::vector<uint32_t> degree(n, 0);
+        for(const auto &it : edges){
+            const uint32_t a = static_cast<uint32_t>(it.first >> 32), b = static_cast<uint32_t>(it.first);
+            const Edge &e = it.second;
+            if(e.count > 2){
+                kind_[a] = kind_[b] = Locked;
+                continue;
+            }
+            if(e.count == 2 && !e.seam) continue;
+            constrained_.push_back({a, b, e.tri});
+            if(degree[a] < 2) slots_[a][degree[a]] = b;
+            if(degree[b] < 2) slots_[b][degree[b]] = a;
+            ++degree[a];
+            ++degree[b];
+        }
+        // sorted so the quadrics don't depend on the hash map's order
+        std::sort(constrained_.begin(), constrained_.end(),
+                  [](const std::array<uint32_t, 3> &x, const std::array<uint32_t, 3> &y){ return x < y; });
+        for(size_t v = 0; v < n; ++v){
+            if(kind_[v] == Locked || degree[v] == 0) continue;
+            // a seam vertex has one neighbour along the seam on each side, anything else is a corner
+            kind_[v] = (degree[v] == 2 && slots_[v][0] != slots_[v][1]) ? Seam : Locked;
+        }
+    }
+
+    glm::vec3 normalOf(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c) const {
+        return glm::cross(b - a, c - a);
+    }
+
+    void buildQuadrics(){
+        quadrics_.assign(points_.size(), Quadric());
+        for(const Tri &t : tris_){
+            const glm::vec3 &p0 = points_[t.pos[0]];
+            glm::vec3 n = normalOf(p0, points_[t.pos[1]], points_[t.pos[2]]);
+            const float len = glm::length(n);
+            if(len <= 0.0f) continue;
+            n /= len;
+            const double d = -glm::dot(n, p0);
+            for(int k = 0; k < 3; ++k) quadrics_[t.pos[k]].addPlane(n.x, n.y, n.z, d, len * 0.5);
+        }
+        // planes through constrained edges, perpendicular to their face: sliding off the seam costs
+        for(const auto &e : constrained_){
+            const Tri &t = tris_[e[2]];
+            const glm::vec3 &pa = points_[e[0]], &pb = points_[e[1]];
+            const glm::vec3 n = normalOf(points_[t.pos[0]], points_[t.pos[1]], points_[t.pos[2]]);
+            const glm::vec3 edge = pb - pa;
+            glm::vec3 side = glm::cross(edge, n);
+            const float len = glm::length(side), edgeLen = glm::length(edge);
+            if(len <= 0.0f) continue;
+            side /= len;
+            const double d = -glm::dot(side, pa);
+            const double weight = kEdgeWeight * edgeLen * edgeLen;
+            quadrics_[e[0]].addPlane(side.x, side.y, side.z, d, weight);
+            quadrics_[e[1]].addPlane(side.x, side.y, side.z, d, weight);
+        }
+    }
+
+    bool canCollapse(uint32_t from, uint32_t to) const {
+        if(kind_[from] == Manifold) return true;
+        if(kind_[from] == Seam) return slots_[from][0] == to || slots_[from][1] == to;
+        return false;
+    }
+
+    // one round of non-overlapping collapses, cheapest first; false if nothing collapsed
+    bool pass(size_t target){
+        const size_t n = points_.size();
+        candidates_.clear();
+        for(uint32_t t = 0; t < tris_.size(); ++t){
+            if(!triAlive_[t]) continue;
+            const Tri &tri = tris_[t];
+            for(int k = 0; k < 3; ++k){
+                const uint32_t a = tri.pos[k], b = tri.pos[(k + 1) % 3];
+                if(canCollapse(a, b)) candidates_.push_back({a, b, 0.0f});
+                if(canCollapse(b, a)) candidates_.push_back({b, a, 0.0f});
+            }
+        }
+        std::sort(candidates_.begin(), candidates_.end(),
+                  [](const Collapse &x, const Collapse &y){ return x.from != y.from ? x.from < y.from : x.to < y.to; });
+        candidates_.erase(std::unique(candidates_.begin(), candidates_.end(),
+                                      [](const Collapse &x, const Collapse &y){ return x.from == y.from && x.to == y.to; }),
+                          candidates_.end());
+        // the only part that's worth spreading: every other step is a linear sweep
+        const size_t slices = parallel_ ? std::min<size_t>(ThreadPool::shared().size() + 1, candidates_.size() / 4096 + 1) : 1;
+        auto evaluate = [&](size_t s){
+            const size_t begin = candidates_.size() * s / slices, end = candidates_.size() * (s + 1) / slices;
+            for(size_t i = begin; i < end; ++i)
+                candidates_[i].error = quadrics_[candidates_[i].from].error(points_[candidates_[i].to]);
+        };
+        if(slices > 1) ThreadPool::shared().parallelFor(slices, evaluate);
+        else evaluate(0);
+        std::stable_sort(candidates_.begin(), candidates_.end(),
+                         [](const Collapse &x, const Collapse &y){ return x.error < y.error; });
+
+        // triangles around every position
+        adjacencyStart_.assign(n + 1, 0);
+        for(uint32_t t = 0; t < tris_.size(); ++t)
+            if(triAlive_[t]) for(uint32_t p : tris_[t].pos) ++adjacencyStart_[p + 1];
+        std::partial_sum(adjacencyStart_.begin(), adjacencyStart_.end(), adjacencyStart_.begin());
+        adjacency_.resize(adjacencyStart_[n]);
+        std::vector<uint32_t> fill(adjacencyStart_.begin(), adjacencyStart_.end() - 1);
+        for(uint32_t t = 0; t < tris_.size(); ++t)
+            if(triAlive_[t]) for(uint32_t p : tris_[t].pos) adjacency_[fill[p]++] = t;
+
+        // the cheapest collapses that would reach the target set this pass's bar, so
+        // neighbours locked early don't push it onto expensive ones
+        const size_t needed = std::min(candidates_.size(), (alive_ - target + 1) / 2);
+        const float passLimit = needed ? std::min(errorLimit_, candidates_[needed - 1].error * 1.5f + 1e-7f) : errorLimit_;
+
+        remap_.resize(n);
+        std::iota(remap_.begin(), remap_.end(), 0u);
+        locked_.assign(n, 0);
+        size_t collapsed = 0;
+        for(const Collapse &c : candidates_){
+            if(alive_ <= target || c.error > passLimit) break;
+            if(locked_[c.from] || locked_[c.to] || !canCollapse(c.from, c.to)) continue;
+
+            size_t removed = 0;
+            if(!checkFlips(c.from, c.to, removed)) continue;
+
+            remap_[c.from] = c.to;
+            quadrics_[c.to].add(quadrics_[c.from]);
+            locked_[c.from] = locked_[c.to] = 1;
+            alive_ -= removed;
+            maxError_ = std::max(maxError_, c.error);
+            if(kind_[c.from] == Seam) relink(c.from, c.to);
+            ++collapsed;
+        }
+
+        for(uint32_t t = 0; t < tris_.size(); ++t){
+            if(!triAlive_[t]) continue;
+            Tri &tri = tris_[t];
+            for(uint32_t &p : tri.pos) p = remap_[p];
+            if(tri.pos[0] == tri.pos[1] || tri.pos[1] == tri.pos[2] || tri.pos[0] == tri.pos[2]) triAlive_[t] = 0;
+        }
+        return collapsed > 0;
+    }
+
+    // moving from onto to must not turn any remaining triangle around
+    bool checkFlips(uint32_t from, uint32_t to, size_t &removed) const {
+        for(uint32_t i = adjacencyStart_[from]; i < adjacencyStart_[from + 1]; ++i){
+            const Tri &tri = tris_[adjacency_[i]];
+            uint32_t p[3];
+            for(int k = 0; k < 3; ++k) p[k] = remap_[tri.pos[k]];
+            if(p[0] == to || p[1] == to || p[2] == to){
+                ++removed;
+                continue;
+            }
+            if(p[0] == p[1] || p[1] == p[2] || p[0] == p[2]) continue;
+            const glm::vec3 before = normalOf(points_[p[0]], points_[p[1]], points_[p[2]]);
+            for(uint32_t &q : p) if(q == from) q = to;
+            const glm::vec3 after = normalOf(points_[p[0]], points_[p[1]], points_[p[2]]);
+            if(glm::dot(before, after) <= 0.0f) return false;
+        }
+        return removed > 0;
+    }
+
+    // from left its seam: its neighbours along it now link to each other
+    void relink(uint32_t from, uint32_t to){
+        const uint32_t other = slots_[from][0] == to ? slots_[from][1] : slots_[from][0];
+        auto replace = [this](uint32_t v, uint32_t oldNeighbour, uint32_t newNeighbour){
+            if(kind_[v] != Seam) return;
+            for(uint32_t &s : slots_[v]) if(s == oldNeighbour){ s = newNeighbour; break; }
+            // the seam shrank to a single edge between the two
+            if(slots_[v][0] == slots_[v][1]) kind_[v] = Locked;
+        };
+        replace(to, from, other);
+        replace(other, from, to);
+    }
+
+    // the current triangles, each corner on the vertex at its new position that best matches the old one
+    void emit(std::vector<std::vector<unsigned int>> &ranges) const {
+        for(uint32_t t = 0; t < tris_.size(); ++t){
+            if(!triAlive_[t]) continue;
+            const Tri &tri = tris_[t];
+            std::vector<unsigned int> &out = ranges[tri.range];
+            for(int k = 0; k < 3; ++k){
+                if(tri.pos[k] == tri.origin[k]){
+                    out.push_back(tri.vertex[k]);
+                    continue;
+                }
+                const MeshVertex &want = mesh_.vertices[tri.vertex[k]];
+                uint32_t best = kNone;
+                float bestScore = 0.0f;
+                for(uint32_t v : copies_[tri.pos[k]]){
+                    const MeshVertex &have = mesh_.vertices[v];
+                    // could be a vertex only another material uses, that's fine: same buffer
+                    const glm::vec2 duv = have.uv - want.uv;
+                    // the same side of a UV seam first, then the closest normal
+                    const float score = glm::dot(duv, duv) * 100.0f + (1.0f - glm::dot(have.normal, want.normal));
+                    if(best == kNone || score < bestScore){ best = v; bestScore = score; }
+                }
+                out.push_back(best);
+            }
+        }
+    }
+
+    const MeshData &mesh_;
+    const float errorLimit_;
+    const bool parallel_;
+
+    std::vector<glm::vec3> points_;
+    std::vector<std::vector<uint32_t>> copies_;     // welded position -> vertices sitting on it
+    std::vector<Tri> tris_;
+    std::vector<uint8_t> triAlive_;
+    size_t alive_ = 0;
+
+    std::vector<uint8_t> kind_;
+    std::vector<std::array<uint32_t, 2>> slots_;    // seam vertices: neighbours along the seam
+    std::vector<std::array<uint32_t, 3>> constrained_; // a, b, one triangle on the edge
+    std::vector<Quadric> quadrics_;
+    float maxError_ = 0.0f;
+
+    // per pass scratch
+    std::vector<Collapse> candidates_;
+    std::vector<uint32_t> adjacencyStart_, adjacency_, remap_;
+    std::vector<uint8_t> locked_;
+};
+
+} // namespace
+
+void buildLods(MeshData &mesh, bool parallel){
+    mesh.lods.clear();
+    if(mesh.vertices.empty() || mesh.ranges.empty()) return;
+
+    glm::vec3 lo = mesh.vertices[0].pos, hi = lo;
+    for(const MeshVertex &v : mesh.vertices){
+        lo = glm::min(lo, v.pos);
+        hi = glm::max(hi, v.pos);
+    }
+    Simplifier simplifier(mesh, glm::length(hi - lo) * kMaxRelativeError, parallel);
+
+    const size_t full = simplifier.triangles();
+    size_t previous = baseIndexCount(mesh.ranges) / 3;
+    for(size_t level = 1; level <= kMaxLods; ++level){
+        Level next;
+        simplifier.simplify(full >> level, next);
+        const size_t tris = simplifier.triangles();
+        if(tris > previous * (1.0f - kMinReduction)) continue;
+
+        MeshLod lod;
+        lod.error = next.error;
+        for(const std::vector<unsigned int> &idx : next.ranges){
+            lod.ranges.push_back({static_cast<uint32_t>(mesh.indices.size()), static_cast<uint32_t>(idx.size())});
+            mesh.indices.insert(mesh.indices.end(), idx.begin(), idx.end());
+        }
+        mesh.lods.push_back(std::move(lod));
+        previous = tris;
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include "mesh.hpp"
+
+// LOD chain by quadric error metrics (Garland-Heckbert) with half-edge
+// collapses: a vertex only ever moves onto a neighbour, so every level reuses
+// the original vertices and only adds indices (appended to mesh.indices,
+// described by mesh.lods). Levels aim at 1/2, 1/4, ... of the triangles; a
+// level that doesn't shrink noticeably is dropped.
+//
+// The whole mesh is simplified at once, over positions welded across
+// normal/UV splits, so one error bound holds for every material. Material
+// borders, open borders and UV seams are constrained: their vertices only
+// slide along them. Each level keeps one span per range; clusters of the new
+// levels are left to buildClusters().
+constexpr size_t kMaxLods = 4;
+void buildLods(MeshData &mesh, bool parallel = true);
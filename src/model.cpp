@@ -1,310 +1,891 @@
 #include "model.hpp"
-#include <tiny_obj_loader.h>
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb/stb_image.h>
+#include "objImporter.hpp"
+#include "meshCache.hpp"
+#include "textureStreamer.hpp"
+#include "renderStats.hpp"
+#include "profiler.hpp"
+#include "vertexFormat.hpp"
+#include "frameUniforms.hpp"
+#include "glState.hpp"
+#include "clusteredLights.hpp"
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <unordered_map>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
 #include <iostream>
-#include <filesystem>
+#include <map>
+#include <tuple>
 
-namespace fs = std::filesystem;
+// binding point of the Materials uniform block
+static constexpr GLuint kMaterialBinding = 1;
+// must match the array size in fragment.glsl
+static constexpr size_t kMaxBatchDraws = 256;
+// one Materials entry in std140: vec4 colour + uvec4 texture
+static constexpr size_t kMaterialBytes = 32;
+// software occlusion buffer width, height follows the viewport's aspect
+static constexpr int kSoftwareOcclusionWidth = 320;
+// a coarser LOD is taken once its error is this far under the threshold, so a
+// model sitting right at a switching distance doesn't flip every frame
+static constexpr float kLodHysteresis = 0.75f;
+// per-instance attribute: the instance's slot in the transform texture buffer
+static constexpr GLuint kInstanceAttrib = 3;
+static constexpr GLint kInstanceTextureUnit = 1;
+
+// world units per model unit, the longest axis
+static float maxScale(const glm::mat4 &transform){
+    return std::max(glm::length(glm::vec3(transform[0])),
+                    std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+}
+
+// model units -> pixels at the point of the world box closest to the eye
+// (perspective: projection[1][1] = cot(fovy / 2)); inside the box -> FLT_MAX
+static float pixelsPerUnit(const glm::mat4 &transform, const glm::vec3 &worldMin, const glm::vec3 &worldMax,
+                           const glm::vec3 &eye, const glm::mat4 &projection, int viewportHeight){
+    const float dist = glm::length(glm::clamp(eye, worldMin, worldMax) - eye);
+    if(dist <= 0.0f) return FLT_MAX;
+    return maxScale(transform) * projection[1][1] * viewportHeight * 0.5f / dist;
+}
 
 Model::Model() {}
 Model::~Model(){ destroy(); }
 
-bool Model::init(const std::string &objPath){
+bool Model::init(const std::string &objPath, bool buildBvh, VertexFormat format){
     destroy();
-    if(!loadObj(objPath)) return false;
+    vertexFormat_ = format;
+
+    const std::string cachePath = MeshCache::pathFor(objPath);
+    const uint64_t sourceHash = MeshCache::hashSource(objPath);
+
+    // fast path: map the baked mesh and hand it straight to GL
+    MeshCache cache;
+    if(sourceHash && cache.open(cachePath, sourceHash)){
+        upload(cache.vertices(), cache.vertexCount(), cache.indices(), cache.indexCount());
+        indexCount_ = baseIndexCount(cache.ranges());
+        if(buildBvh) bvh_.build(cache.vertices(), cache.vertexCount(), cache.indices(), indexCount_);
+        loadMaterials(cache.ranges());
+        loadLods(cache.clusters(), cache.clusterCount(), cache.lods());
+        instances_.setBounds(boundsMin_, boundsMax_);
+        std::cout << "[*] Loaded mesh cache " << cachePath << "\n";
+        return true;
+    }
+
+    MeshData mesh;
+    MeshOptimizeReport report;
+    if(!importObj(objPath, mesh, true, &report)) return false;
+    std::cout << "[*] Vertex cache ACMR " << report.before.acmr << " -> " << report.after.acmr
+              << ", ATVR " << report.before.atvr << " -> " << report.after.atvr << "\n";
+    if(sourceHash && MeshCache::write(cachePath, sourceHash, mesh))
+        std::cout << "[*] Baked mesh cache " << cachePath << "\n";
+
+    upload(mesh.vertices.data(), mesh.vertices.size(), mesh.indices.data(), mesh.indices.size());
+    indexCount_ = baseIndexCount(mesh.ranges);
+    if(buildBvh) bvh_.build(mesh.vertices.data(), mesh.vertices.size(), mesh.indices.data(), indexCount_);
+    loadMaterials(mesh.ranges);
+    loadLods(mesh.clusters.data(), mesh.clusters.size(), mesh.lods);
+    instances_.setBounds(boundsMin_, boundsMax_);
+    return true;
+}
+
+void Model::upload(const Vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount){
+    boundsMin_ = boundsMax_ = vertexCount ? vertices[0].pos : glm::vec3(0.0f);
+    for(size_t i = 1; i < vertexCount; ++i){
+        boundsMin_ = glm::min(boundsMin_, vertices[i].pos);
+        boundsMax_ = glm::max(boundsMax_, vertices[i].pos);
+    }
 
     // create GPU buffers
     glGenVertexArrays(1, &vao_);
     glGenBuffers(1, &vbo_);
     glGenBuffers(1, &ibo_);
 
-    glBindVertexArray(vao_);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-    glBufferData(GL_ARRAY_BUFFER, vertices_.size()*sizeof(Vertex), vertices_.data(), GL_STATIC_DRAW);
-
+    GlState &gl = GlState::shared();
+    gl.bindVertexArray(vao_);
+    gl.bindBuffer(GL_ARRAY_BUFFER, vbo_);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_.size()*sizeof(unsigned int), indices_.data(), GL_STATIC_DRAW);
 
     // layout: position@0, normal@1, uv@2
-    GLsizei stride = sizeof(Vertex);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,stride,(void*)offsetof(Vertex,pos));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,stride,(void*)offsetof(Vertex,normal));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2,2,GL_FLOAT,GL_FALSE,stride,(void*)offsetof(Vertex,uv));
+    std::vector<PackedVertex> packed;
+    if(vertexFormat_ == VertexFormat::Packed){
+        packVertices(vertices, vertexCount, boundsMin_, boundsMax_, packed);
+        glBufferData(GL_ARRAY_BUFFER, packed.size()*sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
+        gpuBytes_ = packed.size()*sizeof(PackedVertex);
+        GLsizei stride = sizeof(PackedVertex);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0,3,GL_UNSIGNED_SHORT,GL_TRUE,stride,(void*)offsetof(PackedVertex,pos));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1,2,GL_SHORT,GL_TRUE,stride,(void*)offsetof(PackedVertex,normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2,2,GL_HALF_FLOAT,GL_FALSE,stride,(void*)offsetof(PackedVertex,uv));
+        posOffset_ = boundsMin_;
+        posScale_ = boundsMax_ - boundsMin_;
+    }else{
+        glBufferData(GL_ARRAY_BUFFER, vertexCount*sizeof(Vertex), vertices, GL_STATIC_DRAW);
+        gpuBytes_ = vertexCount*sizeof(Vertex);
+        GLsizei stride = sizeof(Vertex);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,stride,(void*)offsetof(Vertex,pos));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,stride,(void*)offsetof(Vertex,normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2,2,GL_FLOAT,GL_FALSE,stride,(void*)offsetof(Vertex,uv));
+        posOffset_ = glm::vec3(0.0f);
+        posScale_ = glm::vec3(1.0f);
+    }
+    dequant_ = glm::scale(glm::translate(glm::mat4(1.0f), posOffset_), posScale_);
+    // enabled by renderInstances() only, plain draws see the constant 0
+    glVertexAttribDivisor(kInstanceAttrib, 1);
 
-    glBindVertexArray(0);
+    // no primitive restart anywhere, so all 65536 values are usable
+    if(vertexCount <= 65536){
+        std::vector<uint16_t> shorts(indices, indices + indexCount);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount*sizeof(uint16_t), shorts.data(), GL_STATIC_DRAW);
+        indexType_ = GL_UNSIGNED_SHORT;
+        indexSize_ = sizeof(uint16_t);
+    }else{
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount*sizeof(unsigned int), indices, GL_STATIC_DRAW);
+        indexType_ = GL_UNSIGNED_INT;
+        indexSize_ = sizeof(unsigned int);
+    }
+    gpuBytes_ += indexCount*indexSize_;
 
-    indexCount_ = indices_.size();
+    indexCount_ = indexCount;
 
-    // free CPU-side vectors if you want (keeps memory small)
-    vertices_.clear(); vertices_.shrink_to_fit();
-    indices_.clear(); indices_.shrink_to_fit();
+    // depth passes read positions only: a third (Float) or half (Packed) of the bytes per vertex
+    glGenVertexArrays(1, &shadowVao_);
+    glGenBuffers(1, &shadowVbo_);
+    gl.bindVertexArray(shadowVao_);
+    gl.bindBuffer(GL_ARRAY_BUFFER, shadowVbo_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+    if(vertexFormat_ == VertexFormat::Packed){
+        std::vector<uint16_t> quantized(packed.size() * 4);
+        for(size_t i = 0; i < packed.size(); ++i) std::memcpy(&quantized[i * 4], packed[i].pos, 4 * sizeof(uint16_t));
+        glBufferData(GL_ARRAY_BUFFER, quantized.size()*sizeof(uint16_t), quantized.data(), GL_STATIC_DRAW);
+        gpuBytes_ += quantized.size()*sizeof(uint16_t);
+        glVertexAttribPointer(0,3,GL_UNSIGNED_SHORT,GL_TRUE,4*sizeof(uint16_t),(void*)0);
+    }else{
+        std::vector<glm::vec3> positions(vertexCount);
+        for(size_t i = 0; i < vertexCount; ++i) positions[i] = vertices[i].pos;
+        glBufferData(GL_ARRAY_BUFFER, positions.size()*sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+        gpuBytes_ += positions.size()*sizeof(glm::vec3);
+        glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(glm::vec3),(void*)0);
+    }
+    glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(kInstanceAttrib, 1);
 
-    return true;
+    gl.bindVertexArray(0);
+}
+
+void Model::loadMaterials(const std::vector<MeshRange> &ranges){
+    materials_.clear();
+    materials_.reserve(ranges.size());
+    for(const auto &r : ranges){
+        MatRange mr;
+        mr.start = r.start; mr.count = r.count; mr.color = r.color;
+        // decoded in the background; drawn with mr.color until it's resident
+        mr.texID = r.texPath.empty() ? 0 : TextureStreamer::shared().request(r.texPath);
+        mr.useTex = (mr.texID != 0);
+        materials_.push_back(mr);
+    }
+}
+
+void Model::loadLods(const MeshCluster *clusters, size_t count, const std::vector<MeshLod> &lods){
+    lods_.clear();
+    lods_.resize(1 + lods.size());
+    Lod &base = lods_[0];
+    base.error = 0.0f;
+    base.clusters.assign(clusters, clusters + count);
+    // nothing baked (empty mesh): one cluster over everything, never culled wrongly
+    if(base.clusters.empty() && indexCount_) base.clusters.push_back({0, (uint32_t)indexCount_, boundsMin_, boundsMax_});
+    for(size_t i = 0; i < lods.size(); ++i){
+        Lod &l = lods_[i + 1];
+        l.error = lods[i].error;
+        l.spans = lods[i].ranges;
+        l.clusters = lods[i].clusters;
+    }
+    for(Lod &l : lods_){
+        l.boxes.clear();
+        for(const auto &c : l.clusters) l.boxes.add(c.bmin, c.bmax);
+    }
+    lod_ = 0;
+    visible_.assign(base.clusters.size(), 1);
+    drawsDirty_ = true;
+    if(gpuOcclusion_.ready()) gpuOcclusion_.setBoxes(base.clusters);
 }
 
 void Model::destroy(){
     if(ibo_){ glDeleteBuffers(1,&ibo_); ibo_=0; }
     if(vbo_){ glDeleteBuffers(1,&vbo_); vbo_=0; }
     if(vao_){ glDeleteVertexArrays(1,&vao_); vao_=0; }
-    for(auto &m: materials_){ if(m.texID) glDeleteTextures(1, &m.texID); }
+    for(auto &m: materials_){ if(m.texID) TextureStreamer::shared().release(m.texID); }
     materials_.clear();
-    program_ = 0;
+    if(materialUbo_){ glDeleteBuffers(1,&materialUbo_); materialUbo_=0; }
+    if(lateUbo_){ glDeleteBuffers(1,&lateUbo_); lateUbo_=0; }
+    if(instanceUbo_){ glDeleteBuffers(1,&instanceUbo_); instanceUbo_=0; }
+    if(instanceIdVbo_){ glDeleteBuffers(1,&instanceIdVbo_); instanceIdVbo_=0; }
+    if(shadowVbo_){ glDeleteBuffers(1,&shadowVbo_); shadowVbo_=0; }
+    if(shadowIdVbo_){ glDeleteBuffers(1,&shadowIdVbo_); shadowIdVbo_=0; }
+    if(shadowVao_){ glDeleteVertexArrays(1,&shadowVao_); shadowVao_=0; }
+    instances_.clear();
+    instanceLod_.clear();
+    instanceDrawsDirty_ = true;
+    batches_.clear();
+    lateBatches_.clear();
+    lateBoxes_.clear();
+    late_.clear();
+    lateDirty_ = true;
+    lods_.clear();
+    lod_ = 0;
+    visible_.clear();
+    std::vector<glm::vec3>().swap(positions_);
+    std::vector<unsigned int>().swap(indices_);
+    gpuOcclusion_.destroy();
+    // the names above may come back for new objects
+    GlState::shared().invalidate();
+    occlusion_ = Occlusion::Off;
+    batchesDirty_ = drawsDirty_ = true;
+    texturesPending_ = 0;
+    bvh_.clear();
+    gpuBytes_ = 0;
     modelMat_ = glm::mat4(1.0f);
 }
 
 void Model::translate(const glm::vec3 &t){ modelMat_ = glm::translate(modelMat_, t); }
 void Model::rotate(float angleRadians, const glm::vec3 &axis){ modelMat_ = glm::rotate(modelMat_, angleRadians, axis); }
 void Model::scale(const glm::vec3 &s){ modelMat_ = glm::scale(modelMat_, s); }
-void Model::setProgram(GLuint program){
-    program_ = program;
-    ensureProgramUniforms();
+void Model::setShaders(ShaderVariants *shaders){
+    shaders_ = shaders;
+    for(auto &p : programs_) p = Program{};
 }
 void Model::setColor(const glm::vec3 &color){
-    if(materials_.empty()) materials_.push_back({0,0,0,color,false});
+    if(materials_.empty()) materials_.push_back({0,0,indexCount_,color,false});
     else materials_[0].color = color;
+    batchesDirty_ = true;
+}
+
+void Model::setOcclusion(Occlusion mode){
+    if(mode == Occlusion::Gpu && !gpuOcclusion_.ready()){
+        if(gpuOcclusion_.init()){ if(!lods_.empty()) gpuOcclusion_.setBoxes(lods_[lod_].clusters); }
+        else mode = Occlusion::Cpu;
+    }
+    if(mode != Occlusion::Gpu) gpuOcclusion_.destroy();
+    // only the software rasterizer reads the mesh on the CPU
+    if(mode == Occlusion::Cpu && positions_.empty() && valid()) readOccluderMesh();
+    if(mode != Occlusion::Cpu){
+        std::vector<glm::vec3>().swap(positions_);
+        std::vector<unsigned int>().swap(indices_);
+    }
+    occlusion_ = mode;
+    // everything is an occluder for the first frame
+    visible_.assign(lods_.empty() ? 0 : lods_[lod_].clusters.size(), 1);
+    drawsDirty_ = true;
+    // the second phase is the Gpu path's own
+    lateBatches_.clear();
+    lateBoxes_.clear();
+    late_.clear();
+    lateDirty_ = true;
 }
 
-void Model::ensureProgramUniforms(){
-    if(!program_) return;
-    loc_MVP_ = glGetUniformLocation(program_, "MVP");
-    loc_model_ = glGetUniformLocation(program_, "model");
-    loc_uAlbedo_ = glGetUniformLocation(program_, "uAlbedo");
-    loc_uUseTex_ = glGetUniformLocation(program_, "uUseTex");
-    loc_uColor_ = glGetUniformLocation(program_, "uColor");
-    loc_uLightDir_ = glGetUniformLocation(program_, "uLightDir");
-    loc_uAmbient_ = glGetUniformLocation(program_, "uAmbient");
-    // bind sampler to unit 0 once
-    glUseProgram(program_);
-    if(loc_uAlbedo_>=0) glUniform1i(loc_uAlbedo_, 0);
-    glUseProgram(0);
+void Model::readOccluderMesh(){
+    // back from the position stream and the IBO, every level's indices included
+    GlState &gl = GlState::shared();
+    GLint bytes = 0;
+    gl.bindBuffer(GL_COPY_READ_BUFFER, shadowVbo_);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &bytes);
+    if(vertexFormat_ == VertexFormat::Packed){
+        // the same decoding as dequant_, so both occlusion paths see the same occluders
+        std::vector<uint16_t> quantized((size_t)bytes / sizeof(uint16_t));
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, bytes, quantized.data());
+        positions_.resize(quantized.size() / 4);
+        for(size_t i = 0; i < positions_.size(); ++i)
+            positions_[i] = posOffset_ + glm::vec3(quantized[i*4], quantized[i*4+1], quantized[i*4+2]) / 65535.0f * posScale_;
+    }else{
+        positions_.resize((size_t)bytes / sizeof(glm::vec3));
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, bytes, positions_.data());
+    }
+    gl.bindBuffer(GL_COPY_READ_BUFFER, ibo_);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &bytes);
+    indices_.resize((size_t)bytes / indexSize_);
+    if(indexType_ == GL_UNSIGNED_SHORT){
+        std::vector<uint16_t> shorts(indices_.size());
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, bytes, shorts.data());
+        std::copy(shorts.begin(), shorts.end(), indices_.begin());
+    }else glGetBufferSubData(GL_COPY_READ_BUFFER, 0, bytes, indices_.data());
 }
 
-void Model::render(const glm::mat4 &projection, const glm::mat4 &view){
-    if(!valid() || program_==0) return;
-    glm::mat4 MVP = projection * view * modelMat_;
-    glUseProgram(program_);
-    if(loc_MVP_>=0) glUniformMatrix4fv(loc_MVP_, 1, GL_FALSE, glm::value_ptr(MVP));
-    if(loc_model_>=0) glUniformMatrix4fv(loc_model_,1,GL_FALSE,glm::value_ptr(modelMat_));
-
-    // default light/uniforms (можно менять извне)
-    if(loc_uLightDir_>=0) glUniform3f(loc_uLightDir_, 0.5f, -1.0f, 0.3f);
-    if(loc_uAmbient_>=0) glUniform3f(loc_uAmbient_, 0.12f,0.12f,0.12f);
-
-    glBindVertexArray(vao_);
-    // если несколько материалов — отрисовываем диапазонами
-    if(materials_.empty()){
-        glDrawElements(GL_TRIANGLES, (GLsizei)indexCount_, GL_UNSIGNED_INT, 0);
-    } else {
-        size_t offset = 0;
-        for(const auto &m : materials_){
-            if(m.useTex && m.texID){
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, m.texID);
-                if(loc_uUseTex_>=0) glUniform1i(loc_uUseTex_, 1);
-            } else {
-                if(loc_uUseTex_>=0) glUniform1i(loc_uUseTex_, 0);
-                if(loc_uColor_>=0) glUniform3fv(loc_uColor_, 1, glm::value_ptr(m.color));
+const Model::Program &Model::program(uint32_t variant){
+    Program &p = programs_[variant];
+    if(p.id || !shaders_) return p;
+    p.id = shaders_->program(variant);
+    if(!p.id) return p;
+    p.loc_uDrawBase = glGetUniformLocation(p.id, "uDrawBase");
+    // samplers and block bindings never change, set them once
+    GlState::shared().useProgram(p.id);
+    GLint loc = glGetUniformLocation(p.id, "uAlbedo");
+    if(loc>=0) glUniform1i(loc, 0);
+    const std::pair<const char*, GLint> samplers[] = {{"uInstances", kInstanceTextureUnit},
+                                                      {"uLightData", ClusteredLights::kDataUnit},
+                                                      {"uLightCells", ClusteredLights::kCellsUnit},
+                                                      {"uLightIndices", ClusteredLights::kIndexUnit},
+                                                      {"uShadowMap", ShadowCascades::kShadowUnit}};
+    for(const auto &s : samplers){
+        loc = glGetUniformLocation(p.id, s.first);
+        if(loc>=0) glUniform1i(loc, s.second);
+    }
+    const std::pair<const char*, GLuint> blocks[] = {{"Frame", FrameUniforms::kFrameBinding},
+                                                     {"Object", FrameUniforms::kObjectBinding},
+                                                     {"Materials", kMaterialBinding},
+                                                     {"Lights", ClusteredLights::kLightsBinding},
+                                                     {"Shadows", ShadowCascades::kShadowBinding}};
+    for(const auto &b : blocks){
+        GLuint block = glGetUniformBlockIndex(p.id, b.first);
+        if(block != GL_INVALID_INDEX) glUniformBlockBinding(p.id, block, b.second);
+    }
+    return p;
+}
+
+bool Model::pushObject(const glm::mat4 &model, const glm::mat4 &mvp){
+    // std140 layout of the Object block in vertex.glsl
+    struct ObjectBlock {
+        glm::mat4 model, mvp;
+        glm::mat4 normalMatrix;             // mat3 in the upper left, a mat4 keeps std140 simple
+        glm::vec4 posOffset, posScale;      // PACKED_VERTEX decoding, identity for Float
+    } block;
+    block.model = model;
+    block.mvp = mvp;
+    // once per draw here instead of inverse(model) for every vertex
+    block.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+    block.posOffset = glm::vec4(posOffset_, 0.0f);
+    block.posScale = glm::vec4(posScale_, 0.0f);
+    return FrameUniforms::shared().push(FrameUniforms::kObjectBinding, &block, sizeof(block));
+}
+
+void Model::rebuildBatches(){
+    batchesDirty_ = false;
+    drawsDirty_ = instanceDrawsDirty_ = lateDirty_ = true;
+    texturesPending_ = 0;
+
+    // without gl_DrawIDARB every draw in a batch reads entry 0, so the material joins the key
+    const bool perDrawMaterial = GLEW_ARB_shader_draw_parameters;
+    const TextureStreamer &textures = TextureStreamer::shared();
+    texturesGeneration_ = textures.generation();
+
+    std::vector<MatRange> ranges = materials_;
+    if(ranges.empty()) ranges.push_back({0, 0, indexCount_, glm::vec3(0.8f), false});
+
+    // where each range samples from; a texture still streaming draws its colour
+    std::vector<Sampling> samplings(ranges.size());
+    std::vector<DrawMaterial> rangeMaterials(ranges.size());
+    for(size_t r = 0; r < ranges.size(); ++r){
+        const MatRange &m = ranges[r];
+        DrawMaterial &material = rangeMaterials[r];
+        material.color = glm::vec4(m.color, 1.0f);
+        std::fill(material.texture, material.texture + 4, 0u);
+        if(!m.useTex) continue;
+        const TextureStreamer::Slot slot = textures.slot(m.texID);
+        Sampling &sampling = samplings[r];
+        if(slot.handle){
+            sampling.variant = VariantTextured | VariantBindless;
+            material.texture[0] = (uint32_t)slot.handle;
+            material.texture[1] = (uint32_t)(slot.handle >> 32);
+        }else if(slot.texture){
+            sampling.target = slot.target;
+            sampling.texture = slot.texture;
+            sampling.variant = VariantTextured;
+            if(slot.target == GL_TEXTURE_2D_ARRAY){
+                sampling.variant |= VariantTextureArray;
+                material.texture[0] = slot.layer;
             }
-            glDrawElements(GL_TRIANGLES, (GLsizei)m.count, GL_UNSIGNED_INT, (void*)(offset * sizeof(unsigned int)));
-            offset += m.count;
+        }else if(m.count){
+            ++texturesPending_;
+        }
+    }
+
+    using Key = std::tuple<uint32_t, GLuint, float, float, float, uint32_t, uint32_t>;
+    for(size_t level = 0; level < lods_.size(); ++level){
+        Lod &lod = lods_[level];
+        lod.groups.clear();
+        // ordered: untextured first, then by what is sampled, so render() switches variants at most once each
+        std::map<Key, BatchGroup> groups;
+        for(size_t r = 0; r < ranges.size(); ++r){
+            const MatRange &m = ranges[r];
+            // a coarser level keeps its own span of every range
+            size_t start = m.start, count = m.count;
+            if(level){
+                if(r >= lod.spans.size()) continue;
+                start = lod.spans[r].start;
+                count = lod.spans[r].count;
+            }
+            if(count == 0) continue;
+            const Sampling &sampling = samplings[r];
+            const DrawMaterial &material = rangeMaterials[r];
+            // a plain texture reads nothing per draw
+            const bool keyMaterial = !perDrawMaterial && sampling.variant != VariantTextured;
+            const Key key = keyMaterial ? Key(sampling.variant, sampling.texture, material.color.x, material.color.y,
+                                              material.color.z, material.texture[0], material.texture[1])
+                                        : Key(sampling.variant, sampling.texture, 0.0f, 0.0f, 0.0f, 0u, 0u);
+            BatchGroup &g = groups[key];
+            g.sampling = sampling;
+            // the clusters of a range sit inside it, back to back
+            const auto &clusters = lod.clusters;
+            auto first = std::lower_bound(clusters.begin(), clusters.end(), start,
+                                          [](const MeshCluster &c, size_t s){ return c.start < s; });
+            for(auto c = first; c != clusters.end() && c->start < start + count; ++c)
+                g.members.push_back({(uint32_t)(c - clusters.begin()), material});
+        }
+
+        for(auto &g : groups){
+            auto &members = g.second.members;
+            std::sort(members.begin(), members.end(),
+                      [](const GroupMember &a, const GroupMember &b){ return a.cluster < b.cluster; });
+            lod.groups.push_back(std::move(g.second));
         }
-        glBindTexture(GL_TEXTURE_2D, 0);
     }
-    glBindVertexArray(0);
-    glUseProgram(0);
 }
 
-bool Model::loadObj(const std::string &path){
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> mats;
-    std::string warn, err;
-    fs::path p(path);
-    fs::path base = p.parent_path();
+size_t Model::pickLod(size_t current, float pixelsPerUnit) const {
+    auto pixels = [&](size_t level){ return lods_[level].error * pixelsPerUnit; };
+    // finer at once when the current level shows, coarser only with a margin
+    while(current > 0 && pixels(current) > lodPixels_) --current;
+    while(current + 1 < lods_.size() && pixels(current + 1) <= lodPixels_ * kLodHysteresis) ++current;
+    return current;
+}
 
-    if(!tinyobj::LoadObj(&attrib, &shapes, &mats, &warn, &err, path.c_str())){
-        std::cerr << "tinyobj load error: " << warn << " " << err << "\n";
-        return false;
+bool Model::selectLod(const glm::mat4 &projection, const glm::mat4 &view, int viewportHeight){
+    if(lods_.size() < 2) return false;
+    size_t lod = 0;
+    if(lodPixels_ > 0.0f){
+        // nearest point of the world-space bounds to the eye; inside them -> full detail
+        const glm::vec3 eye(glm::inverse(view)[3]);
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        for(int i = 0; i < 8; ++i){
+            const glm::vec3 corner((i & 1) ? boundsMax_.x : boundsMin_.x, (i & 2) ? boundsMax_.y : boundsMin_.y,
+                                   (i & 4) ? boundsMax_.z : boundsMin_.z);
+            const glm::vec3 p(modelMat_ * glm::vec4(corner, 1.0f));
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        lod = pickLod(lod_, pixelsPerUnit(modelMat_, lo, hi, eye, projection, viewportHeight));
     }
+    if(lod == lod_) return false;
 
-    // map material name -> texture id and ranges
-    materials_.clear();
-    struct Key{ int vi, ni, ti; };
-    struct KeyHash{ size_t operator()(Key const&k) const noexcept { return (k.vi*73856093u) ^ (k.ni*19349663u) ^ (k.ti*83492791u); } };
-    struct KeyEq{ bool operator()(Key const&a, Key const&b) const noexcept { return a.vi==b.vi && a.ni==b.ni && a.ti==b.ti; } };
-
-    std::unordered_map<Key, unsigned int, KeyHash, KeyEq> vertCache;
-    std::unordered_map<int, size_t> matStartIndex; // material id -> start index offset in indices_
-    std::vector<int> faceMat; // per face material id
-
-    // Preprocess faces' material ids
-    for(const auto &shape : shapes){
-        for(size_t f=0; f<shape.mesh.material_ids.size(); ++f) faceMat.push_back(shape.mesh.material_ids[f]);
-    }
-
-    // iterate shapes and faces, build unique vertices + indices and material ranges
-    size_t globalFaceIdx = 0;
-    for(const auto &shape : shapes){
-        size_t idx_off = 0;
-        for(size_t f = 0; f < shape.mesh.num_face_vertices.size(); ++f){
-            int fv = shape.mesh.num_face_vertices[f];
-            int matId = shape.mesh.material_ids[f]; // could be -1
-            if(matStartIndex.find(matId) == matStartIndex.end()){
-                matStartIndex[matId] = indices_.size();
-                // create new material record
-                MatRange mr;
-                mr.texID = 0; mr.start = 0; mr.count = 0; mr.color = glm::vec3(0.8f,0.8f,0.8f); mr.useTex = false;
-                // if matId valid, set color and texture path
-                if(matId >= 0 && matId < (int)mats.size()){
-                    auto &mt = mats[matId];
-                    mr.color = glm::vec3(mt.diffuse[0], mt.diffuse[1], mt.diffuse[2]);
-                    if(!mt.diffuse_texname.empty()){
-                        fs::path texPath = base / mt.diffuse_texname;
-                        if(fs::exists(texPath)){
-                            mr.texID = loadTextureFromFile(texPath.string());
-                            mr.useTex = (mr.texID != 0);
-                        } else {
-                            // try relative without base
-                            if(fs::exists(mt.diffuse_texname)){
-                                mr.texID = loadTextureFromFile(mt.diffuse_texname);
-                                mr.useTex = (mr.texID != 0);
-                            } else {
-                                std::cerr << "Texture not found: " << mt.diffuse_texname << "\n";
-                            }
-                        }
-                    }
-                }
-                materials_.push_back(mr);
-            }
+    lod_ = lod;
+    // last frame's visibility means nothing for other clusters: all of them occlude once
+    visible_.assign(lods_[lod_].clusters.size(), 1);
+    if(gpuOcclusion_.ready()) gpuOcclusion_.setBoxes(lods_[lod_].clusters);
+    lateDirty_ = true;
+    return true;
+}
+
+bool Model::cullClusters(const glm::mat4 &mvp){
+    std::vector<uint8_t> &mask = visibleScratch_;
+    lods_[lod_].boxes.cull(Frustum(mvp), mask);
+    size_t inFrustum = 0;
+    for(uint8_t v : mask) inFrustum += v;
+    if(occlusion_ != Occlusion::Off) cullOccluded(mvp, mask);
+    size_t visible = 0;
+    for(uint8_t v : mask) visible += v;
+
+    RenderStats &stats = RenderStats::frame();
+    stats.clustersVisible += visible;
+    stats.clustersCulled += mask.size() - inFrustum;
+    stats.clustersOccluded += inFrustum - visible;
+
+    if(mask == visible_) return false;
+    visible_.swap(mask);
+    return true;
+}
+
+void Model::cullOccluded(const glm::mat4 &mvp, std::vector<uint8_t> &mask){
+    PROFILE_ZONE("occlusion");
+    // occluders: what was drawn last frame and is still in the frustum
+    occluders_.resize(mask.size());
+    for(size_t i = 0; i < mask.size(); ++i) occluders_[i] = mask[i] && visible_[i];
+
+    GLint viewport[4] = {0, 0, 1, 1};
+    GlState::shared().getViewport(viewport);
+    const int width = std::max(viewport[2], 1), height = std::max(viewport[3], 1);
+
+    const std::vector<MeshCluster> &clusters = lods_[lod_].clusters;
+    if(occlusion_ == Occlusion::Cpu){
+        softwareOcclusion_.begin(kSoftwareOcclusionWidth, std::max(1, kSoftwareOcclusionWidth * height / width));
+        softwareOcclusion_.rasterize(mvp, positions_.data(), indices_.data(), clusters, occluders_);
+        softwareOcclusion_.buildPyramid();
+        softwareOcclusion_.test(mvp, clusters, mask);
+        return;
+    }
+
+    // depth of the occluders at half resolution, neighbouring clusters glued into one draw
+    const size_t indexCount = glueClusters(clusters, &occluders_, occluderCounts_, occluderOffsets_);
+    // the depth shader reads raw attributes: dequantization goes into its matrix
+    gpuOcclusion_.beginOccluders(std::max(width / 2, 1), std::max(height / 2, 1), mvp * dequant_);
+    if(!occluderCounts_.empty()){
+        GlState::shared().bindVertexArray(vao_);
+        glMultiDrawElements(GL_TRIANGLES, occluderCounts_.data(), indexType_, occluderOffsets_.data(),
+                            (GLsizei)occluderCounts_.size());
+        RenderStats &stats = RenderStats::frame();
+        ++stats.drawCalls;
+        stats.draws += occluderCounts_.size();
+        stats.triangles += indexCount / 3;
+    }
+    gpuOcclusion_.endOccluders();
+
+    // the old results only pick what is drawn up front (and occludes next frame);
+    // what they turn down gets this frame's depth in a query and is drawn under it
+    lateScratch_ = mask;
+    gpuOcclusion_.test(mvp, mask);
+    for(size_t i = 0; i < mask.size(); ++i) if(mask[i]) lateScratch_[i] = 0;
+    if(lateDirty_ || lateScratch_ != late_){
+        late_.swap(lateScratch_);
+        buildLateDraws();
+    }
+    gpuOcclusion_.queryBoxes(mvp, lateBoxes_);
+}
+
+size_t Model::glueClusters(const std::vector<MeshCluster> &clusters, const std::vector<uint8_t> *mask,
+                           std::vector<GLsizei> &counts, std::vector<const void*> &offsets) const {
+    counts.clear();
+    offsets.clear();
+    size_t end = 0, indexCount = 0;
+    for(size_t i = 0; i < clusters.size(); ++i){
+        if(mask && !(*mask)[i]) continue;
+        const MeshCluster &c = clusters[i];
+        if(!counts.empty() && end == c.start) counts.back() += (GLsizei)c.count;
+        else{
+            counts.push_back((GLsizei)c.count);
+            offsets.push_back((const void*)(c.start * indexSize_));
+        }
+        end = c.start + c.count;
+        indexCount += c.count;
+    }
+    return indexCount;
+}
 
-            for(int v = 0; v < fv; ++v){
-                tinyobj::index_t idx = shape.mesh.indices[idx_off + v];
-                Key key{ idx.vertex_index, idx.normal_index, idx.texcoord_index };
-                auto it = vertCache.find(key);
-                unsigned int vi;
-                if(it != vertCache.end()){
-                    vi = it->second;
-                } else {
-                    Vertex vert{};
-                    if(key.vi >= 0){
-                        vert.pos = {
-                            attrib.vertices[3*key.vi+0],
-                            attrib.vertices[3*key.vi+1],
-                            attrib.vertices[3*key.vi+2]
-                        };
-                    }
-                    if(key.ni >= 0){
-                        vert.normal = {
-                            attrib.normals[3*key.ni+0],
-                            attrib.normals[3*key.ni+1],
-                            attrib.normals[3*key.ni+2]
-                        };
-                    } else vert.normal = glm::vec3(0.0f);
-                    if(key.ti >= 0){
-                        vert.uv = {
-                            attrib.texcoords[2*key.ti+0],
-                            attrib.texcoords[2*key.ti+1]
-                        };
-                    } else vert.uv = glm::vec2(0.0f,0.0f);
-
-                    vi = (unsigned int)vertices_.size();
-                    vertices_.push_back(vert);
-                    vertCache.emplace(key, vi);
-                }
-                indices_.push_back(vi);
+static bool sameMaterial(const glm::vec4 &color, const uint32_t *texture, const glm::vec4 &otherColor,
+                         const uint32_t *otherTexture){
+    return color == otherColor && std::memcmp(texture, otherTexture, 4 * sizeof(uint32_t)) == 0;
+}
+
+void Model::appendBatches(const Lod &lod, const std::vector<uint8_t> *visible, size_t alignEntries, size_t maxDraws,
+                          std::vector<DrawBatch> &out, std::vector<DrawMaterial> &materials) const {
+    struct Draw { size_t start, count; DrawMaterial material; };
+    std::vector<Draw> merged;
+    for(const auto &g : lod.groups){
+        // glue visible clusters that continue each other in the index buffer; a plain
+        // texture ignores the per-draw entry, everything else needs the same one
+        const bool anyMaterial = g.sampling.variant == VariantTextured;
+        merged.clear();
+        for(const auto &member : g.members){
+            if(visible && !(*visible)[member.cluster]) continue;
+            const MeshCluster &c = lod.clusters[member.cluster];
+            if(!merged.empty() && merged.back().start + merged.back().count == c.start &&
+               (anyMaterial || sameMaterial(merged.back().material.color, merged.back().material.texture,
+                                            member.material.color, member.material.texture)))
+                merged.back().count += c.count;
+            else merged.push_back({c.start, c.count, member.material});
+        }
+
+        for(size_t first = 0; first < merged.size(); first += maxDraws){
+            DrawBatch b;
+            b.sampling = g.sampling;
+            b.indexCount = 0;
+            materials.resize((materials.size() + alignEntries - 1) / alignEntries * alignEntries);
+            b.uboOffset = (GLintptr)(materials.size() * sizeof(DrawMaterial));
+            for(size_t i = first; i < std::min(merged.size(), first + maxDraws); ++i){
+                b.counts.push_back((GLsizei)merged[i].count);
+                b.offsets.push_back((const void*)(merged[i].start * indexSize_));
+                b.indexCount += merged[i].count;
+                materials.push_back(merged[i].material);
             }
-            idx_off += fv;
-            ++globalFaceIdx;
+            out.push_back(std::move(b));
         }
     }
+}
+
+void Model::uploadMaterials(GLuint &ubo, std::vector<DrawMaterial> &materials){
+    static_assert(sizeof(DrawMaterial) == kMaterialBytes, "DrawMaterial must match the std140 layout");
+    // every bound range spans the whole block, so leave room after the last batch
+    materials.resize(materials.size() + kMaxBatchDraws);
+    if(!ubo) glGenBuffers(1, &ubo);
+    GlState::shared().bindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, materials.size()*sizeof(DrawMaterial), materials.data(), GL_DYNAMIC_DRAW);
+}
 
-    // finalize material ranges: count = next_start - start
-    // matStartIndex keyed by matId but materials_ vector order corresponds to first-seen matId insertion order.
-    // Build ordered ranges by iterating matStartIndex in insertion order via materials_ vector:
-    // We stored materials_ in insertion order; but need to compute counts by scanning indices_ and faces again.
-    // Simpler: compute counts by mapping matId->count
-    std::unordered_map<int, size_t> matCounts;
-    size_t idx_off2 = 0;
-    for(const auto &shape : shapes){
-        for(size_t f=0; f<shape.mesh.num_face_vertices.size(); ++f){
-            int fv = shape.mesh.num_face_vertices[f];
-            int matId = shape.mesh.material_ids[f];
-            matCounts[matId] += fv;
-            idx_off2 += fv;
+// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT in Materials entries
+static size_t uniformAlignEntries(){
+    GLint align = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    return std::max<size_t>(1, (size_t)align / kMaterialBytes);
+}
+
+void Model::buildDraws(){
+    batches_.clear();
+    drawsDirty_ = false;
+    drawMaterials_.clear();
+    appendBatches(lods_[lod_], &visible_, uniformAlignEntries(), kMaxBatchDraws, batches_, drawMaterials_);
+    uploadMaterials(materialUbo_, drawMaterials_);
+}
+
+void Model::buildLateDraws(){
+    lateDirty_ = false;
+    lateBatches_.clear();
+    lateBoxes_.clear();
+    lateMaterials_.clear();
+    const Lod &lod = lods_[lod_];
+    appendBatches(lod, &late_, uniformAlignEntries(), 1, lateBatches_, lateMaterials_);
+    if(lateBatches_.empty()) return;
+    uploadMaterials(lateUbo_, lateMaterials_);
+    // a draw glues neighbouring clusters: its box holds the ones starting inside it
+    for(const auto &b : lateBatches_){
+        MeshCluster box;
+        box.start = (uint32_t)((size_t)b.offsets[0] / indexSize_);
+        box.count = (uint32_t)b.counts[0];
+        box.bmin = glm::vec3(FLT_MAX);
+        box.bmax = glm::vec3(-FLT_MAX);
+        auto it = std::lower_bound(lod.clusters.begin(), lod.clusters.end(), box.start,
+                                   [](const MeshCluster &c, uint32_t start){ return c.start < start; });
+        for(; it != lod.clusters.end() && it->start < box.start + box.count; ++it){
+            box.bmin = glm::min(box.bmin, it->bmin);
+            box.bmax = glm::max(box.bmax, it->bmax);
         }
+        lateBoxes_.push_back(box);
+    }
+}
+
+void Model::buildInstanceDraws(){
+    instanceDrawsDirty_ = false;
+    instanceMaterials_.clear();
+    // instances are culled whole, so every level draws all of its clusters
+    const size_t alignEntries = uniformAlignEntries();
+    for(Lod &lod : lods_){
+        lod.instanceBatches.clear();
+        appendBatches(lod, nullptr, alignEntries, kMaxBatchDraws, lod.instanceBatches, instanceMaterials_);
+    }
+    uploadMaterials(instanceUbo_, instanceMaterials_);
+}
+
+void Model::refreshTextures(){
+    // a texture became resident, or an array grew and moved its layers -> regroup
+    const TextureStreamer &textures = TextureStreamer::shared();
+    if(textures.generation() != texturesGeneration_) batchesDirty_ = true;
+    if(!texturesPending_) return;
+    size_t pending = 0;
+    for(const auto &m : materials_) if(m.useTex && !textures.resident(m.texID)) ++pending;
+    if(pending != texturesPending_) batchesDirty_ = true;
+}
+
+void Model::render(const glm::mat4 &projection, const glm::mat4 &view){
+    if(!valid() || !shaders_) return;
+    glm::mat4 MVP = projection * view * modelMat_;
+
+    refreshTextures();
+    if(batchesDirty_) rebuildBatches();
+    GLint viewport[4] = {0, 0, 1, 1};
+    GlState::shared().getViewport(viewport);
+    if(selectLod(projection, view, viewport[3])) drawsDirty_ = true;
+    // before our program is bound: the occlusion passes use their own
+    if(cullClusters(MVP)) drawsDirty_ = true;
+    if(drawsDirty_) buildDraws();
+
+    // untextured batches come first, so at most one program switch
+    const uint32_t base = vertexFormat_ == VertexFormat::Packed ? VariantPacked : 0;
+    if(!pushObject(modelMat_, MVP)) return;
+
+    // binds go through GlState: what is already current (the VAO, the program and
+    // textures of a previous model, the Materials range) never reaches GL
+    GlState &gl = GlState::shared();
+    RenderStats &stats = RenderStats::frame();
+    gl.bindVertexArray(vao_);
+    for(const auto &b : batches_){
+        const Program &p = program(base | b.sampling.variant);
+        if(!p.id) continue;
+        gl.useProgram(p.id);
+        gl.bindBufferRange(GL_UNIFORM_BUFFER, kMaterialBinding, materialUbo_, b.uboOffset,
+                           kMaxBatchDraws * sizeof(DrawMaterial));
+        if(b.sampling.texture) gl.bindTexture(0, b.sampling.target, b.sampling.texture);
+        glMultiDrawElements(GL_TRIANGLES, b.counts.data(), indexType_, b.offsets.data(), (GLsizei)b.counts.size());
+        ++stats.drawCalls;
+        stats.draws += b.counts.size();
+        stats.triangles += b.indexCount / 3;
+    }
+
+    // Gpu second phase: the GPU drops what this frame's query of the box found hidden.
+    // One draw per batch, its material is entry 0 of the bound range
+    for(size_t i = 0; i < lateBatches_.size(); ++i){
+        const DrawBatch &b = lateBatches_[i];
+        const Program &p = program(base | b.sampling.variant);
+        if(!p.id) continue;
+        gl.useProgram(p.id);
+        gl.bindBufferRange(GL_UNIFORM_BUFFER, kMaterialBinding, lateUbo_, b.uboOffset,
+                           kMaxBatchDraws * sizeof(DrawMaterial));
+        if(b.sampling.texture) gl.bindTexture(0, b.sampling.target, b.sampling.texture);
+        const GLuint query = gpuOcclusion_.query(i);
+        if(query) glBeginConditionalRender(query, GL_QUERY_WAIT);
+        glDrawElements(GL_TRIANGLES, b.counts[0], indexType_, b.offsets[0]);
+        if(query) glEndConditionalRender();
+        ++stats.drawCalls;
+        ++stats.draws;
+        stats.triangles += b.indexCount / 3;
+    }
+}
+
+Model::InstanceHandle Model::addInstance(const glm::mat4 &transform){ return instances_.add(transform); }
+void Model::setInstanceTransform(InstanceHandle h, const glm::mat4 &transform){ instances_.set(h, transform); }
+void Model::removeInstance(InstanceHandle h){ instances_.remove(h); }
+
+void Model::renderInstances(const glm::mat4 &projection, const glm::mat4 &view){
+    if(!valid() || !shaders_ || instances_.empty()) return;
+    PROFILE_ZONE("instances");
+    RenderStats &stats = RenderStats::frame();
+
+    refreshTextures();
+    if(batchesDirty_) rebuildBatches();
+    if(instanceDrawsDirty_) buildInstanceDraws();
+    stats.instanceBytes += instances_.sync();
+
+    // whole copies against the frustum, then a level each from its projected size
+    const glm::mat4 viewProj = projection * view;
+    const size_t count = instances_.size();
+    instances_.boxes().cull(Frustum(viewProj), instanceVisible_);
+    if(instanceLod_.size() != count) instanceLod_.resize(count, 0);
+    GLint viewport[4] = {0, 0, 1, 1};
+    GlState::shared().getViewport(viewport);
+    const glm::vec3 eye(glm::inverse(view)[3]);
+    lodInstances_.assign(lods_.size() + 1, 0);
+    for(size_t i = 0; i < count; ++i){
+        if(!instanceVisible_[i]) continue;
+        size_t lod = 0;
+        if(lods_.size() > 1 && lodPixels_ > 0.0f)
+            lod = pickLod(instanceLod_[i], pixelsPerUnit(instances_.transform(i), instances_.worldMin(i),
+                                                         instances_.worldMax(i), eye, projection, viewport[3]));
+        instanceLod_[i] = (uint8_t)lod;
+        ++lodInstances_[lod + 1];
+    }
+
+    // counting sort of the visible slots by level: each level is one contiguous run
+    for(size_t l = 1; l < lodInstances_.size(); ++l) lodInstances_[l] += lodInstances_[l - 1];
+    const size_t visible = lodInstances_.back();
+    stats.instancesVisible += visible;
+    stats.instancesCulled += count - visible;
+    if(!visible) return;
+    instanceIds_.resize(visible);
+    {
+        std::vector<size_t> cursor(lodInstances_.begin(), lodInstances_.end() - 1);
+        for(size_t i = 0; i < count; ++i)
+            if(instanceVisible_[i]) instanceIds_[cursor[instanceLod_[i]]++] = (uint32_t)i;
     }
-    // Now rebuild materials_ in same insertion order as matStartIndex (which used map find earlier).
-    // To keep it simple, clear and rebuild in order of matCounts keys:
-    std::vector<MatRange> rebuilt;
-    rebuilt.reserve(matCounts.size());
-    for(auto &p : matStartIndex){
-        int matId = p.first;
-        MatRange mr = {};
-        mr.start = p.second;
-        mr.count = matCounts[matId];
-        mr.useTex = false; mr.texID = 0; mr.color = glm::vec3(0.8f);
-        if(matId >=0 && matId < (int)mats.size()){
-            auto &mt = mats[matId];
-            mr.color = glm::vec3(mt.diffuse[0], mt.diffuse[1], mt.diffuse[2]);
-            if(!mt.diffuse_texname.empty()){
-                fs::path texPath = base / mt.diffuse_texname;
-                if(fs::exists(texPath)){
-                    mr.texID = loadTextureFromFile(texPath.string());
-                    mr.useTex = (mr.texID != 0);
-                }
+    GlState &gl = GlState::shared();
+    if(!instanceIdVbo_) glGenBuffers(1, &instanceIdVbo_);
+    gl.bindBuffer(GL_ARRAY_BUFFER, instanceIdVbo_);
+    glBufferData(GL_ARRAY_BUFFER, visible * sizeof(uint32_t), instanceIds_.data(), GL_STREAM_DRAW);
+
+    // all rigid: the normal matrix is mat3 of the copy's own, the precomputed one is not fetched
+    const uint32_t base = VariantInstanced | (vertexFormat_ == VertexFormat::Packed ? VariantPacked : 0) |
+                          (instances_.rigid() ? VariantRigid : 0);
+    // the copies' matrices come from the texture buffer, the block only carries the decoding
+    if(!pushObject(glm::mat4(1.0f), viewProj)) return;
+    gl.bindTexture(kInstanceTextureUnit, GL_TEXTURE_BUFFER, instances_.texture());
+
+    gl.bindVertexArray(vao_);
+    glEnableVertexAttribArray(kInstanceAttrib);
+    for(size_t level = 0; level < lods_.size(); ++level){
+        const size_t first = lodInstances_[level];
+        const GLsizei instances = (GLsizei)(lodInstances_[level + 1] - first);
+        if(!instances) continue;
+        // no base instance in 3.3: the level's run of ids is picked by the attribute offset
+        // (instanceIdVbo_ is still the GL_ARRAY_BUFFER binding)
+        glVertexAttribIPointer(kInstanceAttrib, 1, GL_UNSIGNED_INT, sizeof(uint32_t),
+                               (void*)(first * sizeof(uint32_t)));
+        ++stats.stateChanges;
+        for(const auto &b : lods_[level].instanceBatches){
+            const Program &p = program(base | b.sampling.variant);
+            if(!p.id) continue;
+            gl.useProgram(p.id);
+            gl.bindBufferRange(GL_UNIFORM_BUFFER, kMaterialBinding, instanceUbo_, b.uboOffset,
+                               kMaxBatchDraws * sizeof(DrawMaterial));
+            if(b.sampling.texture) gl.bindTexture(0, b.sampling.target, b.sampling.texture);
+            // no multi-draw for instancing in 3.3: one call per draw, its material picked by uDrawBase
+            for(size_t d = 0; d < b.counts.size(); ++d){
+                if(p.loc_uDrawBase>=0) glUniform1i(p.loc_uDrawBase, (GLint)d);
+                glDrawElementsInstanced(GL_TRIANGLES, b.counts[d], indexType_, b.offsets[d], instances);
+                ++stats.drawCalls;
+                ++stats.draws;
+                stats.triangles += (size_t)b.counts[d] / 3 * instances;
             }
+            stats.stateChanges += b.counts.size();
         }
-        rebuilt.push_back(mr);
-    }
-    // if no materials discovered, create a default single range covering all
-    if(rebuilt.empty()){
-        MatRange mr; mr.start = 0; mr.count = indices_.size(); mr.texID = 0; mr.useTex = false; mr.color = glm::vec3(0.8f);
-        rebuilt.push_back(mr);
-    }
-    materials_.swap(rebuilt);
-
-    // If normals are missing, generate simple per-triangle normals
-    bool hasNormals = false;
-    for(const auto &v : vertices_) if(glm::length(v.normal) > 0.0f){ hasNormals = true; break; }
-    if(!hasNormals){
-        for(size_t i=0;i+2<indices_.size();i+=3){
-            Vertex &a = vertices_[indices_[i+0]];
-            Vertex &b = vertices_[indices_[i+1]];
-            Vertex &c = vertices_[indices_[i+2]];
-            glm::vec3 n = glm::cross(b.pos - a.pos, c.pos - a.pos);
-            a.normal += n; b.normal += n; c.normal += n;
+    }
+    glDisableVertexAttribArray(kInstanceAttrib);
+}
+
+void Model::renderShadow(ShadowCascades &shadows, int cascade){
+    if(!valid() || lods_.empty()) return;
+    PROFILE_ZONE("shadow casters");
+    RenderStats &stats = RenderStats::frame();
+    const glm::mat4 &viewProj = shadows.viewProj(cascade);
+    // orthographic: a shadow texel is the same size everywhere in the cascade
+    const float texelsPerUnit = 1.0f / shadows.texelSize(cascade);
+    GlState &gl = GlState::shared();
+    gl.bindVertexArray(shadowVao_);
+
+    // the model itself: its clusters in the cascade's box, whatever material they have
+    {
+        const Lod &lod = lods_[pickLod(0, maxScale(modelMat_) * texelsPerUnit)];
+        const glm::mat4 mvp = viewProj * modelMat_;
+        lod.boxes.cull(Frustum(mvp), shadowMask_);
+        const size_t indexCount = glueClusters(lod.clusters, &shadowMask_, shadowCounts_, shadowOffsets_);
+        if(!shadowCounts_.empty()){
+            shadows.setTransform(mvp * dequant_);
+            glMultiDrawElements(GL_TRIANGLES, shadowCounts_.data(), indexType_, shadowOffsets_.data(),
+                                (GLsizei)shadowCounts_.size());
+            ++stats.drawCalls;
+            stats.draws += shadowCounts_.size();
+            stats.triangles += indexCount / 3;
         }
-        for(auto &v : vertices_) v.normal = glm::normalize(v.normal);
     }
+    if(instances_.empty()) return;
 
-    return true;
-}
+    // copies in the cascade's box, bucketed by level as in renderInstances()
+    stats.instanceBytes += instances_.sync();
+    const size_t count = instances_.size();
+    instances_.boxes().cull(Frustum(viewProj), shadowMask_);
+    shadowLod_.resize(count);
+    shadowLodInstances_.assign(lods_.size() + 1, 0);
+    for(size_t i = 0; i < count; ++i){
+        if(!shadowMask_[i]) continue;
+        shadowLod_[i] = (uint8_t)pickLod(0, maxScale(instances_.transform(i)) * texelsPerUnit);
+        ++shadowLodInstances_[shadowLod_[i] + 1];
+    }
+    for(size_t l = 1; l < shadowLodInstances_.size(); ++l) shadowLodInstances_[l] += shadowLodInstances_[l - 1];
+    const size_t visible = shadowLodInstances_.back();
+    if(!visible) return;
+    shadowIds_.resize(visible);
+    {
+        std::vector<size_t> cursor(shadowLodInstances_.begin(), shadowLodInstances_.end() - 1);
+        for(size_t i = 0; i < count; ++i)
+            if(shadowMask_[i]) shadowIds_[cursor[shadowLod_[i]]++] = (uint32_t)i;
+    }
+    if(!shadowIdVbo_) glGenBuffers(1, &shadowIdVbo_);
+    gl.bindBuffer(GL_ARRAY_BUFFER, shadowIdVbo_);
+    glBufferData(GL_ARRAY_BUFFER, visible * sizeof(uint32_t), shadowIds_.data(), GL_STREAM_DRAW);
 
-GLuint Model::loadTextureFromFile(const std::string &path){
-    int w,h,channels;
-    stbi_set_flip_vertically_on_load(1);
-    unsigned char *data = stbi_load(path.c_str(), &w, &h, &channels, 4);
-    if(!data){
-        std::cerr << "Failed to load texture: " << path << "\n";
-        return 0;
-    }
-    GLuint tex=0;
-    glGenTextures(1,&tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA8,w,h,0,GL_RGBA,GL_UNSIGNED_BYTE,data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
-    glBindTexture(GL_TEXTURE_2D,0);
-    stbi_image_free(data);
-    return tex;
+    shadows.setInstancedTransform(viewProj, dequant_, kInstanceTextureUnit);
+    gl.bindTexture(kInstanceTextureUnit, GL_TEXTURE_BUFFER, instances_.texture());
+    glEnableVertexAttribArray(kInstanceAttrib);
+    for(size_t level = 0; level < lods_.size(); ++level){
+        const size_t first = shadowLodInstances_[level];
+        const GLsizei instances = (GLsizei)(shadowLodInstances_[level + 1] - first);
+        if(!instances) continue;
+        glVertexAttribIPointer(kInstanceAttrib, 1, GL_UNSIGNED_INT, sizeof(uint32_t),
+                               (void*)(first * sizeof(uint32_t)));
+        ++stats.stateChanges;
+        // every cluster of the level: usually one run, as the level is contiguous
+        const size_t indexCount = glueClusters(lods_[level].clusters, nullptr, shadowCounts_, shadowOffsets_);
+        for(size_t d = 0; d < shadowCounts_.size(); ++d)
+            glDrawElementsInstanced(GL_TRIANGLES, shadowCounts_[d], indexType_, shadowOffsets_[d], instances);
+        stats.drawCalls += shadowCounts_.size();
+        stats.draws += shadowCounts_.size();
+        stats.triangles += indexCount / 3 * instances;
+    }
+    glDisableVertexAttribArray(kInstanceAttrib);
 }
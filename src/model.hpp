@@ -3,64 +3,265 @@
 #include <vector>
 #include <glm/glm.hpp>
 #include <GL/glew.h>
+#include "mesh.hpp"
+#include "bvh.hpp"
+#include "frustum.hpp"
+#include "gpuOcclusion.hpp"
+#include "instanceBuffer.hpp"
+#include "shadowCascades.hpp"
+#include "shaderVariants.hpp"
+#include "softwareOcclusion.hpp"
 
 class Model {
 public:
+    // Окклюзия: кластеры, видимые в прошлом кадре, рисуются в Hi-Z, остальные
+    // проверяются по нему. Gpu — проход глубины + пирамида на GPU, Cpu — софтверный растр.
+    // Результаты Gpu приходят на кадр-два позже: отброшенное ими рисуется вторым проходом
+    // под glBeginConditionalRender по запросу окклюзии своей коробки в этом кадре
+    enum class Occlusion { Off, Cpu, Gpu };
+    // Формат вершин в VBO: Float — MeshVertex как есть (32 байта), Packed — PackedVertex
+    // (16 байт, позиции квантованы по AABB, см. vertexFormat.hpp)
+    enum class VertexFormat { Float, Packed };
+    // Биты ключа ShaderVariants, в порядке shaderDefines(): программа под каждую
+    // комбинацию вместо ветвлений в шейдере. Rigid — у всех инстансов поворот и
+    // равномерный масштаб, нормаль трансформируется mat3 самой копии, без чтения
+    // готовой матрицы нормалей из буфера инстансов.
+    // TextureArray/Bindless дополняют Textured: слой массива или bindless handle
+    // приходят на каждый draw из блока Materials (см. TextureBinding)
+    static constexpr uint32_t VariantTextured = 1, VariantPacked = 2, VariantInstanced = 4, VariantRigid = 8,
+                              VariantTextureArray = 16, VariantBindless = 32;
+    static std::vector<std::string> shaderDefines() {
+        return {"TEXTURED", "PACKED_VERTEX", "INSTANCED", "RIGID", "TEXTURE_ARRAY", "BINDLESS"};
+    }
+
     Model();
     ~Model();
 
     // Инициализация: путь к .obj (автоматически ищет .mtl и текстуры рядом)
+    // Берёт запечённый .fwmesh рядом с .obj, если он свежий, иначе импортирует и запекает
+    // buildBvh: заодно собрать BVH по треугольникам для raycast/коллизий, см. bvh()
+    // Индексы 16-битные, если вершин меньше 65536, при любом формате
     // Возвращает true при успехе
-    bool init(const std::string &objPath);
+    bool init(const std::string &objPath, bool buildBvh = false, VertexFormat format = VertexFormat::Float);
 
     // Трансформации (накопительные)
     void translate(const glm::vec3 &t);
     void rotate(float angleRadians, const glm::vec3 &axis);
     void scale(const glm::vec3 &s);
+    const glm::mat4 &transform() const { return modelMat_; }
+    // заменяет накопленную матрицу целиком (например, мировой матрицей из SceneGraph)
+    void setTransform(const glm::mat4 &m) { modelMat_ = m; }
 
-    // Установить шейдерную программу (программа должна иметь uniforms: MVP, model,
-    // uAlbedo (sampler2D), uUseTex (int), uColor, uLightDir, uAmbient)
-    void setProgram(GLuint program);
+    // Варианты шейдера (загруженные с shaderDefines()); блоки Frame (FrameUniforms,
+    // кадр начат через beginFrame), Object (пишет Model), Materials, Lights и буферы
+    // ламп (ClusteredLights::build за кадр), Shadows и uShadowMap (ShadowCascades::bind);
+    // uAlbedo (sampler2D, sampler2DArray при TEXTURE_ARRAY), uInstances/uDrawBase для INSTANCED.
+    // Варианты компилируются при первом использовании, время жизни — у вызывающего
+    void setShaders(ShaderVariants *shaders);
 
     // Рендер — использует текущие projection/view заданные глобально извне через setPV
+    // Диапазоны сгруппированы в батчи: один glMultiDrawElements на текстуру, а с массивами
+    // текстур или bindless — на массив / на все текстурированные диапазоны сразу
+    // Кластеры вне фрустума (AABB против плоскостей MVP) и закрытые (см. setOcclusion) в батчи не попадают
+    // Уровень детализации выбирается по экранной ошибке: самый грубый, чья ошибка < lodPixels пикселя
     void render(const glm::mat4 &projection, const glm::mat4 &view);
 
+    // Копии модели (инстансы) со своими трансформациями, после init(). Рисуются
+    // renderInstances(): отсечение по фрустуму и LOD на копию, затем один
+    // glDrawElementsInstanced на диапазон материала и уровень, сколько бы копий ни было.
+    // modelMat_ к инстансам не применяется, их матрица — полная model
+    using InstanceHandle = InstanceBuffer::Handle;
+    InstanceHandle addInstance(const glm::mat4 &transform);
+    void setInstanceTransform(InstanceHandle h, const glm::mat4 &transform);
+    void removeInstance(InstanceHandle h);
+    size_t instanceCount() const { return instances_.size(); }
+    // вариант INSTANCED читает матрицы из uInstances (samplerBuffer), слот — атрибут 3
+    void renderInstances(const glm::mat4 &projection, const glm::mat4 &view);
+
+    // Глубина модели и всех инстансов в каскад тени, между beginCascade/endCascade.
+    // Только позиции (свой VBO без нормалей и UV), материалы не важны: кластеры в
+    // коробке каскада склеиваются в один glMultiDrawElements, инстансы — один
+    // glDrawElementsInstanced на уровень. LOD — самый грубый, чья ошибка меньше texel'а каскада
+    void renderShadow(ShadowCascades &shadows, int cascade);
+
     // Освободить GPU ресурсы
     void destroy();
 
     // Удобства
     bool valid() const { return vao_ != 0; }
+    // AABB вершин в пространстве модели (без modelMat_)
+    const glm::vec3 &boundsMin() const { return boundsMin_; }
+    const glm::vec3 &boundsMax() const { return boundsMax_; }
+    // nullptr если init() был без buildBvh; координаты модели, как и bounds
+    const Bvh *bvh() const { return bvh_.empty() ? nullptr : &bvh_; }
     void setColor(const glm::vec3 &color);
+    // нужен текущий GL контекст; Gpu без hiz_*.glsl откатывается на Cpu
+    void setOcclusion(Occlusion mode);
+    Occlusion occlusion() const { return occlusion_; }
+    // допустимая экранная ошибка LOD в пикселях; 0 = всегда полное разрешение
+    void setLodThreshold(float pixels) { lodPixels_ = pixels; }
+    VertexFormat vertexFormat() const { return vertexFormat_; }
+    // VBO + IBO (и поток позиций для теней) в байтах
+    size_t gpuBytes() const { return gpuBytes_; }
+    // 0 = полное разрешение, дальше всё грубее
+    size_t lod() const { return lod_; }
+    size_t lodCount() const { return lods_.size(); }
 
 private:
-    struct Vertex {
-        glm::vec3 pos;
-        glm::vec3 normal;
-        glm::vec2 uv;
-    };
+    using Vertex = MeshVertex;
 
     // internal helpers
-    bool loadObj(const std::string &path);
-    GLuint loadTextureFromFile(const std::string &path);
-    void ensureProgramUniforms();
+    void upload(const Vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount);
+    void loadMaterials(const std::vector<MeshRange> &ranges);
+    void loadLods(const MeshCluster *clusters, size_t count, const std::vector<MeshLod> &lods);
+    // positions_ (model space) and indices_ from shadowVbo_ and ibo_
+    void readOccluderMesh();
+    // compiled on first use; locations of the uniforms this class sets
+    struct Program {
+        GLuint id{0};
+        GLint loc_uDrawBase{-1};
+    };
+    const Program &program(uint32_t variant);
+    // per-draw matrices and vertex decoding into the frame's uniform ring, bound to Object
+    bool pushObject(const glm::mat4 &model, const glm::mat4 &mvp);
+    void rebuildBatches();
+    // true if the set of visible clusters changed since the last call
+    bool cullClusters(const glm::mat4 &mvp);
+    // clears the clusters of mask hidden behind the ones visible last frame
+    void cullOccluded(const glm::mat4 &mvp, std::vector<uint8_t> &mask);
+    void buildDraws();
+    void buildLateDraws();
+    // picks lod_ for this frame's projected size; true if it changed
+    bool selectLod(const glm::mat4 &projection, const glm::mat4 &view, int viewportHeight);
+    // from current, the level whose error fits the threshold at this many pixels per model unit
+    size_t pickLod(size_t current, float pixelsPerUnit) const;
+    void refreshTextures();
+    void buildInstanceDraws();
+    // neighbouring clusters of mask (all when null) glued into runs; returns their index count
+    size_t glueClusters(const std::vector<MeshCluster> &clusters, const std::vector<uint8_t> *mask,
+                        std::vector<GLsizei> &counts, std::vector<const void*> &offsets) const;
 
     // GPU
     GLuint vao_{0}, vbo_{0}, ibo_{0};
-    size_t indexCount_{0};
+    size_t indexCount_{0};                  // full-resolution level; the LODs' indices follow
+    VertexFormat vertexFormat_{VertexFormat::Float};
+    GLenum indexType_{GL_UNSIGNED_INT};
+    size_t indexSize_{sizeof(unsigned int)};
+    size_t gpuBytes_{0};
+    // Packed: model space = posOffset_ + attribute * posScale_, dequant_ is the same as a matrix
+    glm::vec3 posOffset_{0.0f}, posScale_{1.0f};
+    glm::mat4 dequant_{1.0f};
+    glm::vec3 boundsMin_{0.0f}, boundsMax_{0.0f};
+    Bvh bvh_;
 
     // materials: for each range store texture id (0 if none) and index range
     struct MatRange { GLuint texID; size_t start, count; glm::vec3 color; bool useTex; };
     std::vector<MatRange> materials_;
 
-    // CPU-side storage (only during init)
-    std::vector<Vertex> vertices_;
+    // std140 element of the Materials block in fragment.glsl
+    struct DrawMaterial {
+        glm::vec4 color;
+        uint32_t texture[4];                // array layer in x, or the bindless handle in xy
+    };
+    // what a batch samples: variant 0 = material colour; VariantTextured binds texture
+    // to unit 0, with VariantTextureArray the layer and with VariantBindless the handle
+    // (nothing bound) come per draw
+    struct Sampling {
+        uint32_t variant{0};
+        GLenum target{GL_TEXTURE_2D};
+        GLuint texture{0};
+    };
+
+    // clusters grouped by what they sample (and by material when the driver has no
+    // gl_DrawIDARB), rebuilt when a texture becomes resident or moves
+    struct GroupMember { uint32_t cluster; DrawMaterial material; };
+    struct BatchGroup {
+        Sampling sampling;
+        std::vector<GroupMember> members;   // sorted by start
+    };
+
+    // visible clusters of a group, neighbours in the index buffer glued together;
+    // every batch is one glMultiDrawElements, its per-draw materials sit in materialUbo_.
+    // Rebuilt whenever visibility changes. Instanced batches are the same over all
+    // clusters, drawn one glDrawElementsInstanced per draw with materials in instanceUbo_
+    struct DrawBatch {
+        Sampling sampling;
+        std::vector<GLsizei> counts;
+        std::vector<const void*> offsets;
+        GLintptr uboOffset;
+        size_t indexCount;
+    };
+
+    // one level of detail: culling units sorted by start, boxes holds their bounds in
+    // the same order. Level 0 is the full mesh, the rest index the same VBO
+    struct Lod {
+        float error;                        // model units, 0 for level 0
+        std::vector<MeshSpan> spans;        // per material; level 0 uses materials_ itself
+        std::vector<MeshCluster> clusters;
+        CullBoxes boxes;
+        std::vector<BatchGroup> groups;
+        std::vector<DrawBatch> instanceBatches;
+    };
+    // batches of a level's clusters (all of them when visible is null), at most maxDraws
+    // draws each, materials appended
+    void appendBatches(const Lod &lod, const std::vector<uint8_t> *visible, size_t alignEntries, size_t maxDraws,
+                       std::vector<DrawBatch> &out, std::vector<DrawMaterial> &materials) const;
+    void uploadMaterials(GLuint &ubo, std::vector<DrawMaterial> &materials);
+    std::vector<Lod> lods_;
+    size_t lod_{0};
+    float lodPixels_{1.0f};
+    // visibility of lods_[lod_].clusters
+    std::vector<uint8_t> visible_, visibleScratch_, occluders_;
+
+    // occlusion: the software path rasterizes from CPU copies of positions and indices,
+    // read back from the GPU buffers when Cpu is selected and dropped for the other modes
+    Occlusion occlusion_{Occlusion::Off};
+    SoftwareOcclusion softwareOcclusion_;
+    GpuOcclusion gpuOcclusion_;
+    std::vector<glm::vec3> positions_;
     std::vector<unsigned int> indices_;
+    std::vector<GLsizei> occluderCounts_;
+    std::vector<const void*> occluderOffsets_;
+    // Gpu, second phase: clusters in the frustum the old results turned down, one draw
+    // per batch with its bounds in lateBoxes_, drawn after batches_ under conditional
+    // render on this frame's query of the box. Rebuilt when that set changes
+    std::vector<uint8_t> late_, lateScratch_;
+    std::vector<DrawBatch> lateBatches_;
+    std::vector<MeshCluster> lateBoxes_;
+    std::vector<DrawMaterial> lateMaterials_;
+    GLuint lateUbo_{0};
+    bool lateDirty_{true};
+
+    std::vector<DrawBatch> batches_;
+    GLuint materialUbo_{0};
+    bool batchesDirty_{true};
+    bool drawsDirty_{true};
+    std::vector<DrawMaterial> drawMaterials_;
+    size_t texturesPending_{0};             // textured ranges still drawn with their colour
+    uint32_t texturesGeneration_{0};        // TextureStreamer::generation() of the batches
+
+    // instancing: visible instances' slots bucketed by LOD go to instanceIdVbo_ (attribute 3)
+    InstanceBuffer instances_;
+    std::vector<uint8_t> instanceVisible_, instanceLod_;
+    std::vector<uint32_t> instanceIds_;
+    std::vector<size_t> lodInstances_;
+    GLuint instanceIdVbo_{0}, instanceUbo_{0};
+    bool instanceDrawsDirty_{true};
+    std::vector<DrawMaterial> instanceMaterials_;
+
+    // shadow casters: positions only (float3, or the quantized ushort4 of Packed) over
+    // the same IBO; instance slots of a cascade bucketed by LOD in shadowIdVbo_
+    GLuint shadowVao_{0}, shadowVbo_{0}, shadowIdVbo_{0};
+    std::vector<uint8_t> shadowMask_, shadowLod_;
+    std::vector<uint32_t> shadowIds_;
+    std::vector<size_t> shadowLodInstances_;
+    std::vector<GLsizei> shadowCounts_;
+    std::vector<const void*> shadowOffsets_;
 
     // transform
     glm::mat4 modelMat_{1.0f};
 
-    // shader program + uniform locations
-    GLuint program_{0};
-    GLint loc_MVP_{-1}, loc_model_{-1}, loc_uAlbedo_{-1}, loc_uUseTex_{-1},
-          loc_uColor_{-1}, loc_uLightDir_{-1}, loc_uAmbient_{-1};
+    // shader variants, indexed by Variant* bits
+    ShaderVariants *shaders_{nullptr};
+    Program programs_[64];
 };
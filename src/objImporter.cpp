@@ -0,0 +1,403 @@
+#include "objImporter.hpp"
+#include "mappedFile.hpp"
+#include "meshClusters.hpp"
+#include "meshSimplify.hpp"
+#include "threadPool.hpp"
+#include <tiny_obj_loader.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <iostream>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Key{ int vi, ni, ti; };
+struct KeyHash{ size_t operator()(Key const&k) const noexcept { return (k.vi*73856093u) ^ (k.ni*19349663u) ^ (k.ti*83492791u); } };
+struct KeyEq{ bool operator()(Key const&a, Key const&b) const noexcept { return a.vi==b.vi && a.ni==b.ni && a.ti==b.ti; } };
+
+// parse result of one line-aligned slice of the file
+struct Chunk {
+    const char *begin = nullptr, *end = nullptr;
+    std::vector<float> v, vn, vt;         // 3, 3 and 2 floats per element
+    std::vector<Key> corners;             // 3 per triangle
+    std::vector<int> triMtl;              // per triangle: index into usemtl, -1 = active before this chunk
+    std::vector<std::string> usemtl;
+    std::vector<std::string> mtllibs;     // raw "mtllib" arguments, may hold several names
+    // corners with negative (relative) indices, stored chunk-local until the bases are known
+    std::vector<std::pair<size_t, int>> relative; // corner, mask of components (1 v, 2 vt, 4 vn)
+    const char *errorAt = nullptr;        // start of the offending line
+};
+
+inline bool isBlank(char c){ return c==' ' || c=='\t' || c=='\r'; }
+inline const char* skipBlank(const char *p, const char *e){ while(p<e && isBlank(*p)) ++p; return p; }
+inline const char* skipToken(const char *p, const char *e){ while(p<e && !isBlank(*p)) ++p; return p; }
+
+const char* parseFloat(const char *p, const char *e, float &out){
+    p = skipBlank(p, e);
+    if(p<e && *p=='+') ++p;
+    auto r = std::from_chars(p, e, out);
+    if(r.ec != std::errc()){ out = 0.0f; return skipToken(p, e); }
+    return r.ptr;
+}
+
+void parseFloats(const char *p, const char *e, int n, std::vector<float> &dst){
+    for(int i=0;i<n;++i){ float f; p = parseFloat(p, e, f); dst.push_back(f); }
+}
+
+// one "v", "v/vt", "v//vn" or "v/vt/vn" token; count = elements seen so far in this chunk
+bool parseCorner(const char *&p, const char *e, const size_t count[3], Key &key, int &relMask){
+    int *out[3] = { &key.vi, &key.ti, &key.ni };
+    key = { -1, -1, -1 };
+    relMask = 0;
+    for(int c=0; c<3; ++c){
+        if(p<e && !isBlank(*p) && *p!='/'){
+            int v = 0;
+            auto r = std::from_chars(p, e, v);
+            if(r.ec != std::errc() || v == 0) return false;
+            p = r.ptr;
+            if(v > 0) *out[c] = v - 1;
+            else { *out[c] = (int)count[c] + v; relMask |= 1 << c; }
+        }
+        if(p<e && *p=='/') ++p; else break;
+    }
+    return p>=e || isBlank(*p);
+}
+
+void parseChunk(Chunk &ch){
+    std::vector<Key> poly;
+    std::vector<int> polyRel;
+    int curMtl = -1;
+    for(const char *p = ch.begin; p < ch.end;){
+        const char *eol = static_cast<const char*>(memchr(p, '\n', ch.end - p));
+        if(!eol) eol = ch.end;
+        const char *s = skipBlank(p, eol);
+        const char *kwEnd = skipToken(s, eol);
+        const size_t kw = kwEnd - s;
+        const char *args = kwEnd;
+        p = eol + 1;
+        if(kw == 0 || *s == '#') continue;
+
+        if(kw==1 && s[0]=='v') parseFloats(args, eol, 3, ch.v);
+        else if(kw==2 && s[0]=='v' && s[1]=='n') parseFloats(args, eol, 3, ch.vn);
+        else if(kw==2 && s[0]=='v' && s[1]=='t') parseFloats(args, eol, 2, ch.vt);
+        else if(kw==1 && s[0]=='f'){
+            const size_t count[3] = { ch.v.size()/3, ch.vt.size()/2, ch.vn.size()/3 };
+            poly.clear(); polyRel.clear();
+            for(const char *q = skipBlank(args, eol); q < eol; q = skipBlank(q, eol)){
+                Key key; int rel;
+                if(!parseCorner(q, eol, count, key, rel)){
+                    ch.errorAt = s;
+                    return;
+                }
+                poly.push_back(key); polyRel.push_back(rel);
+            }
+            // fan triangulation: (0, i, i+1)
+            for(size_t i = 1; i + 1 < poly.size(); ++i){
+                const size_t tri[3] = { 0, i, i+1 };
+                for(size_t c : tri){
+                    if(polyRel[c]) ch.relative.emplace_back(ch.corners.size(), polyRel[c]);
+                    ch.corners.push_back(poly[c]);
+                }
+                ch.triMtl.push_back(curMtl);
+            }
+        }
+        else if(kw==6 && std::memcmp(s, "usemtl", 6)==0){
+            const char *n = skipBlank(args, eol);
+            ch.usemtl.emplace_back(n, skipToken(n, eol));
+            curMtl = (int)ch.usemtl.size() - 1;
+        }
+        else if(kw==6 && std::memcmp(s, "mtllib", 6)==0){
+            ch.mtllibs.emplace_back(args, eol);
+        }
+        // o, g, s, l, p and anything unknown don't affect the triangle mesh
+    }
+}
+
+// load the first file of an "mtllib" line that opens, like tinyobj does
+void loadMtllib(const fs::path &base, const std::string &names, std::map<std::string,int> &matMap,
+                std::vector<tinyobj::material_t> &mats){
+    std::istringstream ss(names);
+    std::string name;
+    while(ss >> name){
+        std::ifstream ifs(base / name);
+        if(!ifs) continue;
+        std::string warn, err;
+        tinyobj::LoadMtl(&matMap, &mats, &ifs, &warn, &err);
+        if(!err.empty()) std::cerr << "mtl load error: " << err << "\n";
+        return;
+    }
+    std::cerr << "Material library not found: " << names << "\n";
+}
+
+std::string resolveTexture(const fs::path &base, const std::string &name){
+    if(name.empty()) return {};
+    fs::path texPath = base / name;
+    if(fs::exists(texPath)) return texPath.string();
+    // try relative without base
+    if(fs::exists(name)) return name;
+    std::cerr << "Texture not found: " << name << "\n";
+    return {};
+}
+
+struct Attribs {
+    std::vector<float> v, vn, vt;
+    MeshVertex vertex(const Key &key) const {
+        MeshVertex vert{};
+        if(key.vi >= 0) vert.pos = { v[3*key.vi+0], v[3*key.vi+1], v[3*key.vi+2] };
+        if(key.ni >= 0) vert.normal = { vn[3*key.ni+0], vn[3*key.ni+1], vn[3*key.ni+2] };
+        else vert.normal = glm::vec3(0.0f);
+        if(key.ti >= 0) vert.uv = { vt[2*key.ti+0], vt[2*key.ti+1] };
+        else vert.uv = glm::vec2(0.0f,0.0f);
+        return vert;
+    }
+};
+
+void dedupSerial(const std::vector<Key> &corners, const Attribs &attr, MeshData &out){
+    std::unordered_map<Key, unsigned int, KeyHash, KeyEq> vertCache;
+    out.indices.resize(corners.size());
+    for(size_t c = 0; c < corners.size(); ++c){
+        auto it = vertCache.find(corners[c]);
+        unsigned int vi;
+        if(it != vertCache.end()){
+            vi = it->second;
+        } else {
+            vi = (unsigned int)out.vertices.size();
+            out.vertices.push_back(attr.vertex(corners[c]));
+            vertCache.emplace(corners[c], vi);
+        }
+        out.indices[c] = vi;
+    }
+}
+
+// Same numbering as dedupSerial: a vertex is created by the first corner that uses its key.
+//  1. every slice of corners sorts its corner ids into per-shard lists (by key hash)
+//  2. every shard walks its lists in slice order, so the first insert of a key is its
+//     earliest corner; first[c] = that corner
+//  3. prefix sum over "first[c] == c" gives the vertex ids
+void dedupParallel(const std::vector<Key> &corners, const Attribs &attr, MeshData &out, ThreadPool &pool){
+    constexpr unsigned kShardBits = 6;
+    constexpr size_t kShards = size_t(1) << kShardBits;
+    const size_t n = corners.size();
+    const size_t slices = std::min<size_t>(pool.size() + 1, std::max<size_t>(n / 4096, 1));
+    auto sliceBegin = [&](size_t s){ return n * s / slices; };
+
+    std::vector<std::vector<std::vector<uint32_t>>> lists(slices, std::vector<std::vector<uint32_t>>(kShards));
+    pool.parallelFor(slices, [&](size_t s){
+        auto &mine = lists[s];
+        for(size_t c = sliceBegin(s); c < sliceBegin(s+1); ++c){
+            uint64_t h = KeyHash()(corners[c]) * 0x9E3779B97F4A7C15ull;
+            mine[h >> (64 - kShardBits)].push_back((uint32_t)c);
+        }
+    });
+
+    std::vector<uint32_t> first(n);
+    pool.parallelFor(kShards, [&](size_t shard){
+        std::unordered_map<Key, uint32_t, KeyHash, KeyEq> table;
+        size_t total = 0;
+        for(size_t s = 0; s < slices; ++s) total += lists[s][shard].size();
+        table.reserve(total / 2);
+        for(size_t s = 0; s < slices; ++s)
+            for(uint32_t c : lists[s][shard])
+                first[c] = table.try_emplace(corners[c], c).first->second;
+    });
+    lists.clear();
+
+    std::vector<uint32_t> sliceNew(slices + 1, 0);
+    pool.parallelFor(slices, [&](size_t s){
+        uint32_t count = 0;
+        for(size_t c = sliceBegin(s); c < sliceBegin(s+1); ++c) count += first[c] == c;
+        sliceNew[s+1] = count;
+    });
+    for(size_t s = 0; s < slices; ++s) sliceNew[s+1] += sliceNew[s];
+
+    std::vector<uint32_t> vertexOf(n);
+    out.vertices.resize(sliceNew[slices]);
+    pool.parallelFor(slices, [&](size_t s){
+        uint32_t next = sliceNew[s];
+        for(size_t c = sliceBegin(s); c < sliceBegin(s+1); ++c){
+            if(first[c] != c) continue;
+            vertexOf[c] = next;
+            out.vertices[next++] = attr.vertex(corners[c]);
+        }
+    });
+
+    out.indices.resize(n);
+    pool.parallelFor(slices, [&](size_t s){
+        for(size_t c = sliceBegin(s); c < sliceBegin(s+1); ++c) out.indices[c] = vertexOf[first[c]];
+    });
+}
+
+// material ranges + normal fallback; shared by both paths
+void finalize(const std::vector<int> &triMaterial, const std::vector<tinyobj::material_t> &mats,
+              const fs::path &base, MeshData &out){
+    // usemtl switches back and forth, so faces of one material are scattered over the file.
+    // Counting sort of the triangles by material id, stable within a material:
+    // bucket 0 is "no material", then the ids in .mtl order
+    const size_t buckets = mats.size() + 1;
+    auto bucketOf = [&](int matId){ return (matId >= 0 && matId < (int)mats.size()) ? size_t(matId) + 1 : 0; };
+    std::vector<size_t> start(buckets + 1, 0);
+    for(int matId : triMaterial) start[bucketOf(matId) + 1] += 3;
+    for(size_t b = 0; b < buckets; ++b) start[b + 1] += start[b];
+
+    std::vector<unsigned int> sorted(out.indices.size());
+    std::vector<size_t> next(start.begin(), start.end() - 1);
+    for(size_t t = 0; t < triMaterial.size(); ++t){
+        size_t &at = next[bucketOf(triMaterial[t])];
+        std::copy(out.indices.begin() + 3*t, out.indices.begin() + 3*t + 3, sorted.begin() + at);
+        at += 3;
+    }
+    out.indices.swap(sorted);
+
+    // one contiguous range per material that has faces, each texture resolved once
+    std::vector<MeshRange> &ranges = out.ranges;
+    for(size_t b = 0; b < buckets; ++b){
+        if(start[b + 1] == start[b]) continue;
+        MeshRange mr{};
+        mr.start = start[b];
+        mr.count = start[b + 1] - start[b];
+        mr.color = glm::vec3(0.8f);
+        if(b > 0){
+            auto &mt = mats[b - 1];
+            mr.color = glm::vec3(mt.diffuse[0], mt.diffuse[1], mt.diffuse[2]);
+            mr.texPath = resolveTexture(base, mt.diffuse_texname);
+        }
+        ranges.push_back(mr);
+    }
+    // if no materials discovered, create a default single range covering all
+    if(ranges.empty()){
+        MeshRange mr{}; mr.start = 0; mr.count = out.indices.size(); mr.color = glm::vec3(0.8f);
+        ranges.push_back(mr);
+    }
+
+    // If normals are missing, generate simple per-triangle normals
+    auto &vertices = out.vertices;
+    auto &indices = out.indices;
+    bool hasNormals = false;
+    for(const auto &v : vertices) if(glm::length(v.normal) > 0.0f){ hasNormals = true; break; }
+    if(!hasNormals){
+        for(size_t i=0;i+2<indices.size();i+=3){
+            MeshVertex &a = vertices[indices[i+0]];
+            MeshVertex &b = vertices[indices[i+1]];
+            MeshVertex &c = vertices[indices[i+2]];
+            glm::vec3 n = glm::cross(b.pos - a.pos, c.pos - a.pos);
+            a.normal += n; b.normal += n; c.normal += n;
+        }
+        for(auto &v : vertices) v.normal = glm::normalize(v.normal);
+    }
+}
+
+} // namespace
+
+bool importObj(const std::string &path, MeshData &out, bool parallel, MeshOptimizeReport *report){
+    out = MeshData{};
+    MappedFile file(path);
+    if(!file.isOpen()){
+        std::cerr << "OBJ load error: cannot open " << path << "\n";
+        return false;
+    }
+    const fs::path base = fs::path(path).parent_path();
+    ThreadPool &pool = ThreadPool::shared();
+
+    // line-aligned chunks, a few per worker so uneven lines still balance
+    std::vector<Chunk> chunks;
+    const char *data = file.data(), *end = data + file.size();
+    size_t chunkCount = 1;
+    if(parallel) chunkCount = std::max<size_t>(1, std::min<size_t>((pool.size() + 1) * 4, file.size() / (64 * 1024)));
+    for(size_t i = 0; i < chunkCount && data < end; ++i){
+        const char *stop = (i + 1 == chunkCount) ? end : data + (end - data) / (chunkCount - i);
+        if(stop < end){
+            stop = static_cast<const char*>(memchr(stop, '\n', end - stop));
+            stop = stop ? stop + 1 : end;
+        }
+        Chunk ch; ch.begin = data; ch.end = stop;
+        chunks.push_back(std::move(ch));
+        data = stop;
+    }
+    if(parallel){
+        pool.parallelFor(chunks.size(), [&](size_t i){ parseChunk(chunks[i]); });
+    } else {
+        for(auto &ch : chunks) parseChunk(ch);
+    }
+    for(const auto &ch : chunks){
+        if(!ch.errorAt) continue;
+        size_t line = 1 + std::count(file.data(), ch.errorAt, '\n');
+        std::cerr << "OBJ parse error: bad face at " << path << ":" << line << "\n";
+        return false;
+    }
+
+    // materials: load every library, then map each chunk's usemtl names to ids
+    std::map<std::string,int> matMap;
+    std::vector<tinyobj::material_t> mats;
+    for(const auto &ch : chunks)
+        for(const auto &names : ch.mtllibs) loadMtllib(base, names, matMap, mats);
+
+    // global element offsets per chunk
+    std::vector<size_t> vBase(chunks.size()+1,0), vtBase(chunks.size()+1,0), vnBase(chunks.size()+1,0);
+    std::vector<size_t> cornerBase(chunks.size()+1,0), inheritedMtl(chunks.size(),0);
+    std::vector<std::vector<int>> mtlIds(chunks.size());
+    int active = -1;
+    for(size_t i = 0; i < chunks.size(); ++i){
+        const Chunk &ch = chunks[i];
+        vBase[i+1] = vBase[i] + ch.v.size()/3;
+        vtBase[i+1] = vtBase[i] + ch.vt.size()/2;
+        vnBase[i+1] = vnBase[i] + ch.vn.size()/3;
+        cornerBase[i+1] = cornerBase[i] + ch.corners.size();
+        inheritedMtl[i] = active;
+        for(const auto &name : ch.usemtl){
+            auto it = matMap.find(name);
+            mtlIds[i].push_back(it != matMap.end() ? it->second : -1);
+        }
+        if(!mtlIds[i].empty()) active = mtlIds[i].back();
+    }
+
+    Attribs attr;
+    attr.v.resize(vBase.back()*3); attr.vt.resize(vtBase.back()*2); attr.vn.resize(vnBase.back()*3);
+    std::vector<Key> corners(cornerBase.back());
+    std::vector<int> triMaterial(cornerBase.back()/3);
+    std::vector<char> bad(chunks.size(), 0);
+
+    auto gather = [&](size_t i){
+        Chunk &ch = chunks[i];
+        std::copy(ch.v.begin(), ch.v.end(), attr.v.begin() + vBase[i]*3);
+        std::copy(ch.vt.begin(), ch.vt.end(), attr.vt.begin() + vtBase[i]*2);
+        std::copy(ch.vn.begin(), ch.vn.end(), attr.vn.begin() + vnBase[i]*3);
+        for(auto &r : ch.relative){
+            Key &k = ch.corners[r.first];
+            if(r.second & 1) k.vi += (int)vBase[i];
+            if(r.second & 2) k.ti += (int)vtBase[i];
+            if(r.second & 4) k.ni += (int)vnBase[i];
+        }
+        const int vCount = (int)vBase.back(), vtCount = (int)vtBase.back(), vnCount = (int)vnBase.back();
+        for(const Key &k : ch.corners){
+            if(k.vi < 0 || k.vi >= vCount || k.ti < -1 || k.ti >= vtCount || k.ni < -1 || k.ni >= vnCount)
+                bad[i] = 1;
+        }
+        std::copy(ch.corners.begin(), ch.corners.end(), corners.begin() + cornerBase[i]);
+        for(size_t t = 0; t < ch.triMtl.size(); ++t)
+            triMaterial[cornerBase[i]/3 + t] = ch.triMtl[t] < 0 ? inheritedMtl[i] : mtlIds[i][ch.triMtl[t]];
+        ch = Chunk{};
+    };
+    if(parallel) pool.parallelFor(chunks.size(), gather);
+    else for(size_t i = 0; i < chunks.size(); ++i) gather(i);
+
+    if(std::find(bad.begin(), bad.end(), 1) != bad.end()){
+        std::cerr << "OBJ load error: face index out of range in " << path << "\n";
+        return false;
+    }
+
+    if(parallel) dedupParallel(corners, attr, out, pool);
+    else dedupSerial(corners, attr, out);
+
+    finalize(triMaterial, mats, base, out);
+    buildLods(out, parallel);
+    buildClusters(out, kClusterTriangles, parallel);
+    optimizeMesh(out, parallel, report);
+    return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+#include "mesh.hpp"
+#include "meshOptimize.hpp"
+
+// Parse a Wavefront .obj (+ .mtl) into a deduplicated, indexed mesh.
+// Polygons are fan-triangulated, vertices are numbered in first-use order,
+// simplified LODs are appended (meshSimplify.hpp), the triangles of every
+// range are grouped into clusters (meshClusters.hpp) and the whole thing is
+// put in draw order for the vertex cache and overdraw (meshOptimize.hpp).
+//
+// parallel: split the file into line-aligned chunks, parse them on the shared
+// ThreadPool and dedup through a sharded table. The result is byte-identical
+// to the serial path, which runs the same parser over one chunk.
+//
+// report: vertex cache figures of the full-resolution level before/after the last step.
+// Returns false and prints the reason on failure.
+bool importObj(const std::string &path, MeshData &out, bool parallel = true, MeshOptimizeReport *report = nullptr);
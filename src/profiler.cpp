@@ -0,0 +1,158 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+Profiler& Profiler::shared() {
+    static Profiler profiler;
+    return profiler;
+}
+
+double Profiler::nowUs() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch_).count();
+}
+
+void Profiler::initGpu() {
+    gpu_ = true;
+}
+
+void Profiler::shutdownGpu() {
+    for (const auto& p : pending_) freeQueries_.push_back(p.query);
+    pending_.clear();
+    if (!freeQueries_.empty())
+        glDeleteQueries(static_cast<GLsizei>(freeQueries_.size()), freeQueries_.data());
+    freeQueries_.clear();
+    gpu_ = false;
+    gpuZoneOpen_ = false;
+    gpuDepth_ = 0;
+}
+
+void Profiler::beginFrame() {
+    if (inFrame_) endFrame();
+    ++frameIndex_;
+    Frame& f = current();
+    f.index = frameIndex_;
+    f.startUs = nowUs();
+    f.durUs = 0.0;
+    f.zones.clear();
+    open_.clear();
+    inFrame_ = true;
+    collectGpu();
+}
+
+void Profiler::endFrame() {
+    if (!inFrame_) return;
+    while (!open_.empty()) endZone();
+    Frame& f = current();
+    f.durUs = nowUs() - f.startUs;
+    inFrame_ = false;
+}
+
+void Profiler::beginZone(const char* name) {
+    if (!inFrame_) return;
+    Frame& f = current();
+    f.zones.push_back({name, nowUs(), 0.0, false});
+    open_.push_back(f.zones.size() - 1);
+}
+
+void Profiler::endZone() {
+    if (!inFrame_ || open_.empty()) return;
+    Zone& z = current().zones[open_.back()];
+    z.durUs = nowUs() - z.startUs;
+    open_.pop_back();
+}
+
+void Profiler::beginGpuZone(const char* name) {
+    ++gpuDepth_;
+    if (!gpu_ || !inFrame_ || gpuZoneOpen_) return;
+
+    GLuint query = 0;
+    if (!freeQueries_.empty()) {
+        query = freeQueries_.back();
+        freeQueries_.pop_back();
+    } else {
+        glGenQueries(1, &query);
+    }
+    Frame& f = current();
+    f.zones.push_back({name, nowUs(), -1.0, true});
+    pending_.push_back({query, frameIndex_, f.zones.size() - 1});
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    gpuZoneOpen_ = true;
+}
+
+void Profiler::endGpuZone() {
+    if (gpuDepth_ == 0) return;
+    if (--gpuDepth_ > 0 || !gpuZoneOpen_) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    gpuZoneOpen_ = false;
+}
+
+void Profiler::collectGpu() {
+    // frames still being recorded by the GPU stay pending; nothing here blocks
+    size_t kept = 0;
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        PendingQuery p = pending_[i];
+        const bool open = gpuZoneOpen_ && i + 1 == pending_.size();
+        GLint available = 0;
+        if (!open) glGetQueryObjectiv(p.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            pending_[kept++] = p;
+            continue;
+        }
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(p.query, GL_QUERY_RESULT, &ns);
+        freeQueries_.push_back(p.query);
+
+        // the frame may have been recycled if the GPU fell that far behind
+        Frame& f = frames_[p.frame % kFrames];
+        if (f.index == p.frame && p.zone < f.zones.size())
+            f.zones[p.zone].durUs = static_cast<double>(ns) / 1000.0;
+    }
+    pending_.resize(kept);
+}
+
+bool Profiler::exportChromeTrace(const std::string& path) const {
+    std::ofstream ofs(path);
+    if (!ofs) {
+        std::cerr << "Failed to write trace: " << path << "\n";
+        return false;
+    }
+
+    // oldest frame first; the one being recorded right now is left out
+    const uint64_t last = inFrame_ ? frameIndex_ - 1 : frameIndex_;
+    const uint64_t first = last >= kFrames ? last - kFrames + 1 : 1;
+
+    char buf[256];
+    bool comma = false;
+    auto event = [&](const char* name, int tid, double ts, double dur) {
+        // zone names are string literals from our own code, no escaping needed
+        std::snprintf(buf, sizeof(buf),
+                      "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                      comma ? "," : "", name, tid == 2 ? "gpu" : "cpu", tid, ts, dur);
+        ofs << buf;
+        comma = true;
+    };
+
+    ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    ofs << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},";
+    ofs << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+    comma = true;
+    for (uint64_t i = first; i <= last && last > 0; ++i) {
+        const Frame& f = frames_[i % kFrames];
+        if (f.index != i) continue;
+        event("frame", 1, f.startUs, f.durUs);
+        for (const Zone& z : f.zones) {
+            if (z.durUs < 0.0) continue;   // GPU result never arrived
+            event(z.name, z.gpu ? 2 : 1, z.startUs, z.durUs);
+        }
+    }
+    ofs << "\n]}\n";
+
+    if (!ofs) {
+        std::cerr << "Failed to write trace: " << path << "\n";
+        return false;
+    }
+    std::cout << "[*] Wrote trace " << path << "\n";
+    return true;
+}
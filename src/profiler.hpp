@@ -0,0 +1,85 @@
+#pragma once
+#include <GL/glew.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scoped CPU/GPU zones over a ring buffer of the last kFrames frames,
+// exported as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+//   { PROFILE_ZONE("swap"); SDL_GL_SwapWindow(w); }
+//   { PROFILE_GPU_ZONE("scene"); model.render(...); }
+//
+// GPU zones are GL_TIME_ELAPSED queries, which can't nest: a GPU zone opened
+// inside another one is ignored. Results are read back a few frames later,
+// and only once GL_QUERY_RESULT_AVAILABLE says so, so the CPU never waits.
+class Profiler {
+public:
+    static constexpr size_t kFrames = 300;
+
+    static Profiler& shared();
+
+    // needs a current GL context; without it only CPU zones are recorded
+    void initGpu();
+    void shutdownGpu();
+
+    void beginFrame();
+    void endFrame();
+
+    void beginZone(const char* name);
+    void endZone();
+    void beginGpuZone(const char* name);
+    void endGpuZone();
+
+    bool exportChromeTrace(const std::string& path) const;
+
+private:
+    struct Zone {
+        const char* name;
+        double startUs;
+        double durUs;       // < 0 while a GPU result is outstanding
+        bool gpu;
+    };
+    struct Frame {
+        uint64_t index = 0;
+        double startUs = 0.0, durUs = 0.0;
+        std::vector<Zone> zones;
+    };
+    struct PendingQuery {
+        GLuint query;
+        uint64_t frame;
+        size_t zone;
+    };
+
+    double nowUs() const;
+    Frame& current() { return frames_[frameIndex_ % kFrames]; }
+    void collectGpu();
+
+    std::chrono::steady_clock::time_point epoch_ = std::chrono::steady_clock::now();
+    std::vector<Frame> frames_ = std::vector<Frame>(kFrames);
+    uint64_t frameIndex_ = 0;
+    bool inFrame_ = false;
+    std::vector<size_t> open_;          // CPU zone stack, indices into current().zones
+
+    bool gpu_ = false;
+    bool gpuZoneOpen_ = false;
+    size_t gpuDepth_ = 0;               // nesting, including ignored zones
+    std::vector<GLuint> freeQueries_;
+    std::vector<PendingQuery> pending_;
+};
+
+struct ProfileZone {
+    explicit ProfileZone(const char* name) { Profiler::shared().beginZone(name); }
+    ~ProfileZone() { Profiler::shared().endZone(); }
+};
+
+struct GpuProfileZone {
+    explicit GpuProfileZone(const char* name) { Profiler::shared().beginGpuZone(name); }
+    ~GpuProfileZone() { Profiler::shared().endGpuZone(); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone_, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileZone PROFILE_CONCAT(gpuProfileZone_, __LINE__)(name)
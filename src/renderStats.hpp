@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+
+// Per-frame renderer counters; Game resets them at the start of every frame.
+struct RenderStats {
+    size_t drawCalls = 0;     // glDraw* / glMultiDraw* submissions
+    size_t draws = 0;         // individual draws inside those submissions
+    size_t stateChanges = 0;  // program/VAO/texture/buffer binds and uniform uploads
+    size_t stateChangesSkipped = 0; // binds GlState dropped as already current
+    size_t textureBinds = 0;  // glBindTexture calls that reached GL
+    size_t triangles = 0;
+    size_t clustersVisible = 0; // clusters that passed frustum and occlusion culling
+    size_t clustersCulled = 0;  // outside the frustum
+    size_t clustersOccluded = 0;
+    size_t instancesVisible = 0; // Model::renderInstances copies that passed the frustum
+    size_t instancesCulled = 0;
+    size_t instanceBytes = 0;    // transforms uploaded this frame
+    size_t lightsVisible = 0;    // point lights that touch the view frustum
+    size_t lightIndices = 0;     // entries of the per-froxel light lists
+    size_t shadowCascades = 0;   // cascades drawn again, the rest came from the cache
+
+    void reset() { *this = RenderStats{}; }
+
+    static RenderStats& frame() {
+        static RenderStats stats;
+        return stats;
+    }
+};
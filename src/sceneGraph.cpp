@@ -0,0 +1,295 @@
+#include "sceneGraph.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FW_SCENE_SSE 1
+#endif
+
+namespace {
+
+// levels with fewer dirty nodes than this are multiplied on the calling thread
+constexpr size_t kParallelMin = 16384;
+constexpr size_t kChunk = 4096;
+
+} // namespace
+
+glm::mat4 SceneGraph::read(const std::vector<Block> &m, uint32_t slot){
+    const Block &b = m[slot >> 2];
+    const uint32_t lane = slot & 3;
+    glm::mat4 r;
+    for(int e = 0; e < 16; ++e) r[e >> 2][e & 3] = b.e[e][lane];
+    return r;
+}
+
+void SceneGraph::write(std::vector<Block> &m, uint32_t slot, const glm::mat4 &value){
+    Block &b = m[slot >> 2];
+    const uint32_t lane = slot & 3;
+    for(int e = 0; e < 16; ++e) b.e[e][lane] = value[e >> 2][e & 3];
+}
+
+SceneGraph::Node SceneGraph::create(const glm::mat4 &local, Node parent){
+    const uint32_t slot = static_cast<uint32_t>(depth_.size());
+    const uint32_t parentSlot = valid(parent) ? slotOf_[parent] : slot;
+    const uint32_t depth = parentSlot == slot ? 0 : depth_[parentSlot] + 1;
+    Node n;
+    if(!freeNodes_.empty()){
+        n = freeNodes_.back();
+        freeNodes_.pop_back();
+    }else{
+        n = static_cast<Node>(slotOf_.size());
+        slotOf_.push_back(kNone);
+    }
+    // the parent is always in an earlier slot, only the breadth-first order can break
+    if(!depth_.empty() && (depth < depth_.back() || (depth == depth_.back() && parentSlot < parentSlot_.back())))
+        unsorted_ = true;
+    slotOf_[n] = slot;
+    parentSlot_.push_back(parentSlot);
+    depth_.push_back(depth);
+    if((slot & 3) == 0){
+        local_.emplace_back();
+        world_.emplace_back();
+    }
+    write(local_, slot, local);
+    write(world_, slot, local);
+    dirty_.push_back(1);
+    nodeOf_.push_back(n);
+    anyDirty_ = true;
+    firstDirty_ = std::min<size_t>(firstDirty_, slot);
+    return n;
+}
+
+void SceneGraph::destroy(Node n){
+    if(!valid(n)) return;
+    const uint32_t first = slotOf_[n];
+    const size_t count = depth_.size();
+    // parents come first, so one pass finds the subtree and the next compacts in place
+    std::vector<uint8_t> removed(count, 0);
+    removed[first] = 1;
+    for(size_t i = first + 1; i < count; ++i){
+        const uint32_t p = parentSlot_[i];
+        removed[i] = p != i && p >= first && removed[p];
+    }
+    std::vector<uint32_t> newSlot(count, kNone);
+    uint32_t w = 0;
+    for(uint32_t i = 0; i < count; ++i){
+        if(removed[i]){
+            slotOf_[nodeOf_[i]] = kNone;
+            freeNodes_.push_back(nodeOf_[i]);
+            continue;
+        }
+        newSlot[i] = w;
+        const uint32_t p = parentSlot_[i];
+        parentSlot_[w] = p == i ? w : newSlot[p];
+        depth_[w] = depth_[i];
+        write(local_, w, read(local_, i));
+        write(world_, w, read(world_, i));
+        dirty_[w] = dirty_[i];
+        nodeOf_[w] = nodeOf_[i];
+        slotOf_[nodeOf_[w]] = w;
+        ++w;
+    }
+    parentSlot_.resize(w);
+    depth_.resize(w);
+    local_.resize((w + 3) / 4);
+    world_.resize((w + 3) / 4);
+    dirty_.resize(w);
+    nodeOf_.resize(w);
+    // slots before the hole kept their place, the rest only moved down
+    firstDirty_ = std::min<size_t>(firstDirty_, first);
+}
+
+void SceneGraph::clear(){
+    parentSlot_.clear();
+    depth_.clear();
+    local_.clear();
+    world_.clear();
+    dirty_.clear();
+    nodeOf_.clear();
+    slotOf_.clear();
+    freeNodes_.clear();
+    changed_.clear();
+    anyDirty_ = unsorted_ = false;
+    firstDirty_ = SIZE_MAX;
+}
+
+void SceneGraph::setLocal(Node n, const glm::mat4 &local){
+    if(!valid(n)) return;
+    const uint32_t slot = slotOf_[n];
+    write(local_, slot, local);
+    dirty_[slot] = 1;
+    anyDirty_ = true;
+    firstDirty_ = std::min<size_t>(firstDirty_, slot);
+}
+
+SceneGraph::Node SceneGraph::parent(Node n) const {
+    if(!valid(n)) return kNone;
+    const uint32_t slot = slotOf_[n], p = parentSlot_[slot];
+    return p == slot ? kNone : nodeOf_[p];
+}
+
+void SceneGraph::sortByDepth(){
+    // breadth first: the roots in slot order, then the children of every placed
+    // node in turn, so levels come out whole and siblings side by side
+    const size_t count = depth_.size();
+    std::vector<uint32_t> childStart(count + 1, 0), children(count);
+    for(size_t i = 0; i < count; ++i)
+        if(parentSlot_[i] != i) ++childStart[parentSlot_[i] + 1];
+    for(size_t i = 0; i < count; ++i) childStart[i + 1] += childStart[i];
+    {
+        std::vector<uint32_t> cursor(childStart.begin(), childStart.end() - 1);
+        for(uint32_t i = 0; i < count; ++i)
+            if(parentSlot_[i] != i) children[cursor[parentSlot_[i]]++] = i;
+    }
+    std::vector<uint32_t> order;
+    order.reserve(count);
+    for(uint32_t i = 0; i < count; ++i)
+        if(parentSlot_[i] == i) order.push_back(i);
+    for(size_t k = 0; k < order.size(); ++k){
+        const uint32_t s = order[k];
+        order.insert(order.end(), children.begin() + childStart[s], children.begin() + childStart[s + 1]);
+    }
+
+    std::vector<uint32_t> newSlot(count);
+    for(uint32_t k = 0; k < count; ++k) newSlot[order[k]] = k;
+    std::vector<uint32_t> parentSlot(count), depth(count);
+    std::vector<Block> local(local_.size()), world(world_.size());
+    std::vector<uint8_t> dirty(count);
+    std::vector<Node> nodeOf(count);
+    for(uint32_t s = 0; s < count; ++s){
+        const uint32_t i = order[s];
+        parentSlot[s] = newSlot[parentSlot_[i]];
+        depth[s] = depth_[i];
+        write(local, s, read(local_, i));
+        write(world, s, read(world_, i));
+        dirty[s] = dirty_[i];
+        nodeOf[s] = nodeOf_[i];
+        slotOf_[nodeOf_[i]] = s;
+    }
+    parentSlot_.swap(parentSlot);
+    depth_.swap(depth);
+    local_.swap(local);
+    world_.swap(world);
+    dirty_.swap(dirty);
+    nodeOf_.swap(nodeOf);
+    unsorted_ = false;
+    firstDirty_ = 0;
+}
+
+void SceneGraph::multiplyRange(const uint32_t *slots, size_t count){
+#ifdef FW_SCENE_SSE
+    // lane 0 of it is the identity: the parent of a root and of a lane left alone
+    static const Block identity = []{
+        Block b{};
+        for(int e = 0; e < 16; e += 5) b.e[e][0] = 1.0f;
+        return b;
+    }();
+    size_t k = 0;
+    while(k < count){
+        // the dirty slots of one block (slots are ascending), a bit per lane
+        const uint32_t block = slots[k] >> 2;
+        uint32_t mask = 0;
+        for(; k < count && (slots[k] >> 2) == block; ++k) mask |= 1u << (slots[k] & 3);
+        const Block &local = local_[block];
+        Block &out = world_[block];
+
+        // lane l computes slot 4 * block + l: column j of parent * local as four lanes
+        // at once; lanes outside the mask are neither read through nor written
+        const float *src[4];
+        for(uint32_t l = 0; l < 4; ++l){
+            const uint32_t s = block * 4 + l, p = (mask >> l) & 1 ? parentSlot_[s] : s;
+            src[l] = p == s ? &identity.e[0][0] : &world_[p >> 2].e[0][p & 3];
+        }
+        __m128 a[16];
+        if(src[0] == src[1] && src[0] == src[2] && src[0] == src[3]){
+            // siblings: one parent, read once
+            for(int e = 0; e < 16; ++e) a[e] = _mm_set1_ps(src[0][4 * e]);
+        }else{
+            for(int e = 0; e < 16; ++e) a[e] = _mm_setr_ps(src[0][4 * e], src[1][4 * e], src[2][4 * e], src[3][4 * e]);
+        }
+        alignas(16) float r[16][4];
+        for(int j = 0; j < 4; ++j){
+            const __m128 l0 = _mm_load_ps(local.e[4 * j]), l1 = _mm_load_ps(local.e[4 * j + 1]);
+            const __m128 l2 = _mm_load_ps(local.e[4 * j + 2]), l3 = _mm_load_ps(local.e[4 * j + 3]);
+            for(int i = 0; i < 4; ++i){
+                const __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[i], l0), _mm_mul_ps(a[4 + i], l1)),
+                                            _mm_add_ps(_mm_mul_ps(a[8 + i], l2), _mm_mul_ps(a[12 + i], l3)));
+                _mm_store_ps(mask == 0xf ? out.e[4 * j + i] : r[4 * j + i], v);
+            }
+        }
+        if(mask != 0xf){
+            for(uint32_t l = 0; l < 4; ++l)
+                if((mask >> l) & 1)
+                    for(int e = 0; e < 16; ++e) out.e[e][l] = r[e][l];
+        }
+    }
+#else
+    for(size_t k = 0; k < count; ++k){
+        const uint32_t s = slots[k], p = parentSlot_[s];
+        write(world_, s, p == s ? read(local_, s) : read(world_, p) * read(local_, s));
+    }
+#endif
+}
+
+size_t SceneGraph::update(){
+    changed_.clear();
+    if(!anyDirty_) return 0;
+    anyDirty_ = false;
+    if(unsorted_) sortByDepth();
+
+    // the parent's flag is final before the child is reached
+    const size_t first = firstDirty_, total = depth_.size();
+    firstDirty_ = SIZE_MAX;
+    if(first >= total) return 0;
+    dirtySlots_.resize(total - first);
+    levelEnds_.clear();
+    const uint32_t *parents = parentSlot_.data();
+    const uint32_t *depths = depth_.data();
+    uint8_t *dirty = dirty_.data();
+    uint32_t *out = dirtySlots_.data();
+    size_t n = 0;
+    uint32_t level = depths[first];
+    for(size_t i = first; i < total; ++i){
+        // a root is its own parent, no branch for it
+        dirty[i] |= dirty[parents[i]];
+        if(!dirty[i]) continue;
+        if(depths[i] != level){
+            if(n) levelEnds_.push_back(static_cast<uint32_t>(n));
+            level = depths[i];
+        }
+        out[n++] = static_cast<uint32_t>(i);
+    }
+    dirtySlots_.resize(n);
+    levelEnds_.push_back(static_cast<uint32_t>(n));
+
+    // a level only reads the one above it, which is complete by then
+    ThreadPool &pool = ThreadPool::shared();
+    size_t begin = 0;
+    for(uint32_t end : levelEnds_){
+        const size_t count = end - begin;
+        const uint32_t *slots = dirtySlots_.data() + begin;
+        if(count >= kParallelMin && pool.size() > 0){
+            const size_t chunks = std::min<size_t>(pool.size() + 1, (count + kChunk - 1) / kChunk);
+            // chunk borders never split a block: each one is written by one thread
+            auto border = [&](size_t c){
+                size_t b = count * c / chunks;
+                while(b > 0 && b < count && (slots[b] >> 2) == (slots[b - 1] >> 2)) ++b;
+                return b;
+            };
+            pool.parallelFor(chunks, [&](size_t c){
+                const size_t lo = border(c), hi = border(c + 1);
+                multiplyRange(slots + lo, hi - lo);
+            });
+        }else{
+            multiplyRange(slots, count);
+        }
+        begin = end;
+    }
+
+    changed_.resize(n);
+    for(size_t k = 0; k < n; ++k) changed_[k] = nodeOf_[dirtySlots_[k]];
+    std::fill(dirty_.begin() + first, dirty_.end(), 0);
+    return n;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Transform hierarchy as flat arrays (SoA): parent, depth, local and world
+// matrices, one slot per node, slots in breadth-first order (by depth, then by
+// parent) so every parent comes before its children and siblings sit next to
+// each other. update() walks the slots once, marks the subtrees of the nodes
+// touched since the last call and recomputes only those, level by level: nodes
+// of one depth don't depend on each other, so big levels are split over the
+// thread pool. Matrices are stored column-split, four slots per block (element
+// e of every slot in the block side by side), and every block with a dirty slot
+// is multiplied in one SSE pass, a node per lane, clean lanes left alone; the
+// parents of a level are read in order, once per run of siblings.
+// Handles stay valid until destroyed; slots move when the order is rebuilt.
+class SceneGraph {
+public:
+    using Node = uint32_t;
+    static constexpr Node kNone = ~0u;
+
+    // parent must be valid or kNone (a root)
+    Node create(const glm::mat4 &local = glm::mat4(1.0f), Node parent = kNone);
+    // removes the node with its whole subtree; O(size())
+    void destroy(Node n);
+    void clear();
+
+    void setLocal(Node n, const glm::mat4 &local);
+    glm::mat4 local(Node n) const { return read(local_, slotOf_[n]); }
+    // as of the last update()
+    glm::mat4 world(Node n) const { return read(world_, slotOf_[n]); }
+    Node parent(Node n) const;
+
+    bool valid(Node n) const { return n < slotOf_.size() && slotOf_[n] != kNone; }
+    size_t size() const { return depth_.size(); }
+
+    // recomputes the world matrices of dirty nodes and their descendants;
+    // returns how many were recomputed
+    size_t update();
+    // nodes whose world matrix changed in the last update()
+    const std::vector<Node> &changed() const { return changed_; }
+
+private:
+    // slots 4b..4b+3: element e (glm's column-major order) of slot 4b+l is e[e][l]
+    struct alignas(16) Block { float e[16][4]; };
+    static glm::mat4 read(const std::vector<Block> &m, uint32_t slot);
+    static void write(std::vector<Block> &m, uint32_t slot, const glm::mat4 &value);
+
+    void sortByDepth();
+    void multiplyRange(const uint32_t *slots, size_t count);
+
+    // per slot
+    std::vector<uint32_t> parentSlot_;      // a root is its own parent
+    std::vector<uint32_t> depth_;
+    std::vector<Block> local_, world_;      // size() / 4 rounded up
+    std::vector<uint8_t> dirty_;
+    std::vector<Node> nodeOf_;              // slot -> handle
+
+    std::vector<uint32_t> slotOf_;          // handle -> slot, kNone when free
+    std::vector<Node> freeNodes_;
+    bool anyDirty_{false};
+    size_t firstDirty_{SIZE_MAX};           // nothing before it needs a look
+    bool unsorted_{false};                  // a node was appended out of breadth-first order
+
+    // scratch of update(): dirty slots in order, split by depth
+    std::vector<uint32_t> dirtySlots_, levelEnds_;
+    std::vector<Node> changed_;
+};
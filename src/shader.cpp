@@ -1,22 +1,81 @@
 #include "shader.hpp"
+#include "cacheFile.hpp"
+#include "glState.hpp"
 
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
 
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kBinaryMagic[4] = {'F', 'W', 'P', 'B'};
+constexpr uint32_t kBinaryVersion = 1;
+
+struct BinaryHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;    // GLenum from glGetProgramBinary
+    uint32_t length;
+};
+
+// with the length after it, so "ab"+"c" and "a"+"bc" differ
+uint64_t hashString(uint64_t h, const std::string& s) {
+    const uint64_t length = s.size();
+    h = fnv1a(h, s.data(), s.size());
+    return fnv1a(h, &length, sizeof(length));
+}
+
+bool binariesSupported() {
+    if (!GLEW_ARB_get_program_binary) return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+// the next program may get the same name, the cached binding must not match it
+void deleteProgram(GLuint program) {
+    glDeleteProgram(program);
+    GlState::shared().invalidate();
+}
+
+} // namespace
+
+std::string Shader::binaryCacheDir;
+
+void Shader::setBinaryCacheDir(std::string dir) {
+    binaryCacheDir = std::move(dir);
+}
+
 Shader::Shader(const char* vertexPath, const char* fragmentPath) {
     if (vertexPath && fragmentPath) loadSources(vertexPath, fragmentPath);
 }
 
 Shader::~Shader() {
-    if (program) glDeleteProgram(program);
+    if (program) deleteProgram(program);
     deleteShaders();
 }
 
 void Shader::loadSources(const char* vertexPath, const char* fragmentPath) {
     vertexShaderSource = readFileToString(vertexPath);
     fragmentShaderSource = readFileToString(fragmentPath);
+    this->vertexPath = vertexPath;
+    this->fragmentPath = fragmentPath;
+}
+
+void Shader::setFeedbackVaryings(std::vector<std::string> names) {
+    feedbackVaryings = std::move(names);
+}
+
+void Shader::setDefines(std::vector<std::string> names) {
+    defines = std::move(names);
 }
 
 std::string Shader::readFileToString(const char* path) {
@@ -29,14 +88,98 @@ std::string Shader::readFileToString(const char* path) {
     return ss.str();
 }
 
+// defines go right after #version; #line keeps error messages pointing at the file's lines
+std::string Shader::withDefines(const std::string& src) const {
+    if (defines.empty()) return src;
+    size_t eol = src.find('\n');
+    if (src.compare(0, 8, "#version") != 0 || eol == std::string::npos) eol = 0;
+    else ++eol;
+    std::string out = src.substr(0, eol);
+    for (const auto& name : defines) out += "#define " + name + "\n";
+    out += "#line " + std::to_string(eol ? 2 : 1) + "\n";
+    return out + src.substr(eol);
+}
+
+uint64_t Shader::binaryKey() const {
+    uint64_t h = kFnvOffset;
+    h = hashString(h, withDefines(vertexShaderSource));
+    h = hashString(h, withDefines(fragmentShaderSource));
+    for (const auto& name : feedbackVaryings) h = hashString(h, name);
+    // a driver update may change the binary format without telling us
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const GLubyte* str = glGetString(name);
+        h = hashString(h, str ? reinterpret_cast<const char*>(str) : "");
+    }
+    return h;
+}
+
+std::string Shader::binaryPath(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return (fs::path(binaryCacheDir) / name).string();
+}
+
+bool Shader::loadBinary() {
+    if (binaryCacheDir.empty() || !binariesSupported()) return false;
+    const uint64_t key = binaryKey();
+    std::ifstream ifs(binaryPath(key), std::ios::binary);
+    if (!ifs) return false;
+    BinaryHeader hdr;
+    if (!ifs.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) ||
+        std::memcmp(hdr.magic, kBinaryMagic, 4) != 0 || hdr.version != kBinaryVersion || hdr.key != key)
+        return false;
+    std::vector<char> data(hdr.length);
+    if (!ifs.read(data.data(), static_cast<std::streamsize>(data.size()))) return false;
+
+    GLuint binary = glCreateProgram();
+    glProgramBinary(binary, hdr.format, data.data(), static_cast<GLsizei>(data.size()));
+    GLint success = 0;
+    glGetProgramiv(binary, GL_LINK_STATUS, &success);
+    // the driver may refuse its own old binaries, compiling is always the way out
+    if (!success) {
+        glDeleteProgram(binary);
+        return false;
+    }
+    if (program) deleteProgram(program);
+    program = binary;
+    return true;
+}
+
+void Shader::saveBinary() {
+    if (binaryCacheDir.empty() || !binariesSupported()) return;
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    BinaryHeader hdr;
+    std::memcpy(hdr.magic, kBinaryMagic, 4);
+    hdr.version = kBinaryVersion;
+    hdr.key = binaryKey();
+    std::vector<char> data(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, data.data());
+    hdr.format = format;
+    hdr.length = static_cast<uint32_t>(length);
+
+    std::error_code ec;
+    fs::create_directories(binaryCacheDir, ec);
+    writeFileAtomically(binaryPath(hdr.key), [&](std::ostream& os) {
+        os.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        os.write(data.data(), static_cast<std::streamsize>(data.size()));
+    });
+}
+
 void Shader::compile() {
     deleteShaders();
 
     if (vertexShaderSource.empty() || fragmentShaderSource.empty())
         throw std::runtime_error("Shader source is empty. Call loadSources() first.");
 
-    auto compile_one = [](GLenum type, const std::string& src) -> GLuint {
+    linkedFromBinary = loadBinary();
+    if (linkedFromBinary) return;
+
+    auto compile_one = [this](GLenum type, const std::string& source) -> GLuint {
         GLuint s = glCreateShader(type);
+        const std::string src = withDefines(source);
         const char* cstr = src.c_str();
         glShaderSource(s, 1, &cstr, nullptr);
         glCompileShader(s);
@@ -51,17 +194,25 @@ void Shader::compile() {
 }
 
 void Shader::link() {
+    if (linkedFromBinary) return;
     if (!vertexShader || !fragmentShader)
         throw std::runtime_error("Shaders not compiled before linking.");
 
     if (program) {
-        glDeleteProgram(program);
+        deleteProgram(program);
         program = 0;
     }
 
     program = glCreateProgram();
     glAttachShader(program, vertexShader);
     glAttachShader(program, fragmentShader);
+    if (!feedbackVaryings.empty()) {
+        std::vector<const char*> names;
+        for (const auto& name : feedbackVaryings) names.push_back(name.c_str());
+        glTransformFeedbackVaryings(program, static_cast<GLsizei>(names.size()), names.data(), GL_INTERLEAVED_ATTRIBS);
+    }
+    if (!binaryCacheDir.empty() && GLEW_ARB_get_program_binary)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program);
 
     GLint success = 0;
@@ -78,11 +229,30 @@ void Shader::link() {
     }
 
     deleteShaders();
+    saveBinary();
+}
+
+bool Shader::reload() {
+    if (vertexPath.empty() || fragmentPath.empty()) return false;
+    // build on the side: the running program is only replaced by one that linked
+    Shader fresh;
+    try {
+        fresh.loadSources(vertexPath.c_str(), fragmentPath.c_str());
+        fresh.setFeedbackVaryings(feedbackVaryings);
+        fresh.setDefines(defines);
+        fresh.compile();
+        fresh.link();
+    } catch (const std::exception& e) {
+        std::cerr << "Shader reload failed (" << vertexPath << ", " << fragmentPath << "): " << e.what() << "\n";
+        return false;
+    }
+    *this = std::move(fresh);
+    return true;
 }
 
 void Shader::use() const {
     if (!program) throw std::runtime_error("Shader program not linked.");
-    glUseProgram(program);
+    GlState::shared().useProgram(program);
 }
 
 GLuint Shader::getID() const {
@@ -115,25 +285,35 @@ void Shader::checkCompileErrors(GLuint id, const std::string& type) {
 }
 
 Shader::Shader(Shader&& o) noexcept
-    : vertexShaderSource(std::move(o.vertexShaderSource)),
+    : vertexPath(std::move(o.vertexPath)),
+      fragmentPath(std::move(o.fragmentPath)),
+      vertexShaderSource(std::move(o.vertexShaderSource)),
       fragmentShaderSource(std::move(o.fragmentShaderSource)),
+      feedbackVaryings(std::move(o.feedbackVaryings)),
+      defines(std::move(o.defines)),
       vertexShader(o.vertexShader),
       fragmentShader(o.fragmentShader),
-      program(o.program)
+      program(o.program),
+      linkedFromBinary(o.linkedFromBinary)
 {
     o.vertexShader = o.fragmentShader = o.program = 0;
 }
 
 Shader& Shader::operator=(Shader&& o) noexcept {
     if (this != &o) {
-        if (program) glDeleteProgram(program);
+        if (program) deleteProgram(program);
         deleteShaders();
 
+        vertexPath = std::move(o.vertexPath);
+        fragmentPath = std::move(o.fragmentPath);
         vertexShaderSource = std::move(o.vertexShaderSource);
         fragmentShaderSource = std::move(o.fragmentShaderSource);
+        feedbackVaryings = std::move(o.feedbackVaryings);
+        defines = std::move(o.defines);
         vertexShader = o.vertexShader;
         fragmentShader = o.fragmentShader;
         program = o.program;
+        linkedFromBinary = o.linkedFromBinary;
 
         o.vertexShader = o.fragmentShader = o.program = 0;
     }
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <GL/glew.h>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 class Shader
 {
@@ -14,19 +16,45 @@ public:
     Shader& operator=(Shader&&) noexcept;
 
     void loadSources(const char* vertexPath, const char* fragmentPath);
+    // vertex shader outputs captured by transform feedback (interleaved); set before link()
+    void setFeedbackVaryings(std::vector<std::string> names);
+    // "#define NAME" lines inserted after #version of both stages; set before compile()
+    void setDefines(std::vector<std::string> names);
+    // served from the binary cache when it has this program, then link() does nothing
     void compile();
     void link();
     void use() const;
     GLuint getID() const;
+    // re-reads the files given to loadSources and rebuilds the program; on any
+    // error the current one stays, the error goes to stderr and false is returned
+    bool reload();
+    bool fromBinary() const { return linkedFromBinary; }
+
+    // Linked programs are stored here (ARB_get_program_binary), one file per
+    // hash of the sources, defines, feedback varyings and the driver strings.
+    // Empty (the default) = always compile.
+    static void setBinaryCacheDir(std::string dir);
 
 private:
     std::string readFileToString(const char* path);
+    std::string withDefines(const std::string& src) const;
+    uint64_t binaryKey() const;
+    std::string binaryPath(uint64_t key) const;
+    bool loadBinary();
+    void saveBinary();
     void deleteShaders() noexcept;
     void checkCompileErrors(GLuint id, const std::string& type);
 
+    std::string vertexPath;
+    std::string fragmentPath;
     std::string vertexShaderSource;
     std::string fragmentShaderSource;
+    std::vector<std::string> feedbackVaryings;
+    std::vector<std::string> defines;
     GLuint vertexShader = 0;
     GLuint fragmentShader = 0;
     GLuint program = 0;
+    bool linkedFromBinary = false;
+
+    static std::string binaryCacheDir;
 };
@@ -0,0 +1,50 @@
+#include "shaderVariants.hpp"
+#include <iostream>
+#include <stdexcept>
+
+void ShaderVariants::load(const char* vertexPath, const char* fragmentPath, std::vector<std::string> defines) {
+    clear();
+    vertexPath_ = vertexPath;
+    fragmentPath_ = fragmentPath;
+    defines_ = std::move(defines);
+    watcher_.watch(vertexPath_);
+    watcher_.watch(fragmentPath_);
+}
+
+Shader ShaderVariants::build(uint32_t key) const {
+    std::vector<std::string> names;
+    for (size_t bit = 0; bit < defines_.size(); ++bit)
+        if (key & (1u << bit)) names.push_back(defines_[bit]);
+    Shader shader(vertexPath_.c_str(), fragmentPath_.c_str());
+    shader.setDefines(std::move(names));
+    shader.compile();
+    shader.link();
+    return shader;
+}
+
+GLuint ShaderVariants::program(uint32_t key) {
+    if (vertexPath_.empty()) return 0;
+    auto it = programs_.find(key);
+    if (it != programs_.end()) return it->second.getID();
+    return programs_.emplace(key, build(key)).first->second.getID();
+}
+
+bool ShaderVariants::reloadChanged() {
+    if (watcher_.poll().empty() || programs_.empty()) return false;
+    // a half-saved file fails to compile; the old set stays until every variant builds
+    std::map<uint32_t, Shader> fresh;
+    try {
+        for (const auto& entry : programs_) fresh.emplace(entry.first, build(entry.first));
+    } catch (const std::exception& e) {
+        std::cerr << "Shader reload failed (" << vertexPath_ << ", " << fragmentPath_ << "): " << e.what() << "\n";
+        return false;
+    }
+    programs_.swap(fresh);
+    std::cout << "[*] Reloaded " << programs_.size() << " shader variants\n";
+    return true;
+}
+
+void ShaderVariants::clear() {
+    programs_.clear();
+    watcher_.clear();
+}
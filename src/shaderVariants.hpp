@@ -0,0 +1,35 @@
+#pragma once
+
+#include "fileWatcher.hpp"
+#include "shader.hpp"
+#include <GL/glew.h>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Specialized programs of one vertex/fragment pair: bit i of a key adds
+// "#define defines[i]" to both stages. A variant is compiled and linked on
+// first request and kept until clear(); compile errors throw like Shader's.
+// The two source files are watched: reloadChanged() rebuilds every compiled
+// variant after an edit, all of them or none.
+class ShaderVariants
+{
+public:
+    void load(const char* vertexPath, const char* fragmentPath, std::vector<std::string> defines);
+    // 0 before load()
+    GLuint program(uint32_t key);
+    size_t compiled() const { return programs_.size(); }
+    // call between frames; true if the programs were replaced (their ids changed)
+    bool reloadChanged();
+    // deletes the programs, needs the context
+    void clear();
+
+private:
+    Shader build(uint32_t key) const;
+
+    std::string vertexPath_, fragmentPath_;
+    std::vector<std::string> defines_;
+    std::map<uint32_t, Shader> programs_;
+    FileWatcher watcher_;
+};
@@ -0,0 +1,234 @@
+#include "shadowCascades.hpp"
+#include "frameUniforms.hpp"
+#include "glState.hpp"
+#include "renderStats.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+// 0 = uniform splits, 1 = logarithmic; in between keeps the far cascades from
+// getting all the depth and the near one from getting almost none
+static constexpr float kSplitLambda = 0.75f;
+// extra border of every cascade, as a share of the sphere it covers: how far
+// the eye may wander before the cached layer has to be drawn again
+static constexpr float kPadding = 0.25f;
+// depth bias of the caster pass: slope-scaled and constant (glPolygonOffset)
+static constexpr float kSlopeBias = 2.0f, kConstantBias = 4.0f;
+
+ShadowCascades::~ShadowCascades(){
+    destroy();
+}
+
+bool ShadowCascades::init(int size){
+    destroy();
+    try {
+        depth_.loadSources("shadow_depth_vertex.glsl", "hiz_depth_fragment.glsl");
+        depth_.compile();
+        depth_.link();
+        depthInstanced_.loadSources("shadow_depth_vertex.glsl", "hiz_depth_fragment.glsl");
+        depthInstanced_.setDefines({"INSTANCED"});
+        depthInstanced_.compile();
+        depthInstanced_.link();
+    } catch (const std::exception &e) {
+        std::cerr << "Shadows unavailable: " << e.what() << "\n";
+        depth_ = Shader();
+        depthInstanced_ = Shader();
+        return false;
+    }
+    locMVP_ = glGetUniformLocation(depth_.getID(), "MVP");
+    locViewProj_ = glGetUniformLocation(depthInstanced_.getID(), "MVP");
+    locDequant_ = glGetUniformLocation(depthInstanced_.getID(), "uDequant");
+    locInstances_ = glGetUniformLocation(depthInstanced_.getID(), "uInstances");
+
+    // one layer per cascade; compared in the sampler, so one fetch is a 2x2 PCF
+    size_ = std::max(size, 1);
+    GlState &gl = GlState::shared();
+    glGenTextures(1, &texture_);
+    gl.bindTexture(kShadowUnit, GL_TEXTURE_2D_ARRAY, texture_);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size_, size_, kCascades, 0,
+                 GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+
+    // the draw buffer is framebuffer state: set once, the layer changes per cascade
+    const GLuint prevFbo = gl.framebuffer();
+    glGenFramebuffers(1, &fbo_);
+    gl.bindFramebuffer(fbo_);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture_, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    gl.bindFramebuffer(prevFbo);
+    if(!complete){
+        std::cerr << "Shadows unavailable: depth array framebuffer is incomplete\n";
+        destroy();
+        return false;
+    }
+    valid_ = 0;
+    return true;
+}
+
+void ShadowCascades::destroy(){
+    if(fbo_){ glDeleteFramebuffers(1, &fbo_); fbo_ = 0; }
+    if(texture_){ glDeleteTextures(1, &texture_); texture_ = 0; }
+    if(depth_.getID()) depth_ = Shader();
+    if(depthInstanced_.getID()) depthInstanced_ = Shader();
+    size_ = 0;
+    valid_ = 0;
+    projection_ = glm::mat4(0.0f);
+    lightDir_ = glm::vec3(0.0f);
+    GlState::shared().invalidate();
+}
+
+void ShadowCascades::setSceneBounds(const glm::vec3 &bmin, const glm::vec3 &bmax){
+    haveBounds_ = true;
+    boundsMin_ = bmin;
+    boundsMax_ = bmax;
+    valid_ = 0;
+}
+
+void ShadowCascades::fit(const glm::mat4 &projection){
+    projection_ = projection;
+    // near and far of a GL perspective matrix
+    const float n = projection[3][2] / (projection[2][2] - 1.0f);
+    const float f = projection[3][2] / (projection[2][2] + 1.0f);
+    // eye to a corner of the far plane, per unit of view depth
+    const float corner = std::sqrt(1.0f + 1.0f / (projection[0][0] * projection[0][0]) +
+                                   1.0f / (projection[1][1] * projection[1][1]));
+    for(int c = 0; c < kCascades; ++c){
+        const float t = float(c + 1) / kCascades;
+        const float logSplit = n * std::pow(f / n, t);
+        const float uniformSplit = n + (f - n) * t;
+        split_[c] = kSplitLambda * logSplit + (1.0f - kSplitLambda) * uniformSplit;
+        // everything up to the split lies within this distance of the eye, in any direction
+        const float reach = split_[c] * corner;
+        pad_[c] = reach * kPadding;
+        radius_[c] = reach + pad_[c];
+        texel_[c] = 2.0f * radius_[c] / size_;
+    }
+}
+
+uint32_t ShadowCascades::update(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &lightDir){
+    if(!ready() || !haveBounds_) return 0;
+    if(projection != projection_){
+        fit(projection);
+        valid_ = 0;
+    }
+    const glm::vec3 dir = glm::normalize(lightDir);
+    if(dir != lightDir_){
+        lightDir_ = dir;
+        const glm::vec3 up = std::abs(dir.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        lightView_ = glm::lookAt(glm::vec3(0.0f), dir, up);
+        valid_ = 0;
+    }
+    if(!valid_){
+        // every caster and receiver in the scene, whatever the cascade covers across
+        float zMin = FLT_MAX, zMax = -FLT_MAX;
+        for(int i = 0; i < 8; ++i){
+            const glm::vec3 corner((i & 1) ? boundsMax_.x : boundsMin_.x, (i & 2) ? boundsMax_.y : boundsMin_.y,
+                                   (i & 4) ? boundsMax_.z : boundsMin_.z);
+            const float z = (lightView_ * glm::vec4(corner, 1.0f)).z;
+            zMin = std::min(zMin, z);
+            zMax = std::max(zMax, z);
+        }
+        const float margin = std::max(0.01f * (zMax - zMin), 0.01f);
+        zNear_ = -zMax - margin;
+        zFar_ = -zMin + margin;
+    }
+
+    // the eye in light space; a cascade keeps its layer while the eye stays inside its padding
+    const glm::vec4 eyeLight = lightView_ * glm::inverse(view)[3];
+    const glm::vec2 eye(eyeLight.x, eyeLight.y);
+    uint32_t redraw = 0;
+    int recentre = -1;
+    float worst = 0.5f;
+    for(int c = 0; c < kCascades; ++c){
+        const glm::vec2 d = glm::abs(eye - center_[c]);
+        const float drift = std::max(d.x, d.y) / pad_[c];
+        if(!(valid_ & (1u << c)) || drift > 1.0f) redraw |= 1u << c;
+        // half way out: moved early, one cascade a frame, before it has to be
+        else if(drift > worst){
+            worst = drift;
+            recentre = c;
+        }
+    }
+    if(recentre >= 0) redraw |= 1u << recentre;
+
+    const glm::mat4 bias = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)), glm::vec3(0.5f));
+    for(int c = 0; c < kCascades; ++c){
+        if(!(redraw & (1u << c))) continue;
+        // snapped to whole texels: a redrawn layer lines up with the last one, no shimmer
+        center_[c] = glm::floor(eye / texel_[c] + 0.5f) * texel_[c];
+        const float r = radius_[c];
+        viewProj_[c] = glm::ortho(center_[c].x - r, center_[c].x + r, center_[c].y - r, center_[c].y + r,
+                                  zNear_, zFar_) * lightView_;
+        shadowMatrix_[c] = bias * viewProj_[c];
+    }
+    valid_ |= redraw;
+    return redraw;
+}
+
+void ShadowCascades::beginCascade(int cascade){
+    GlState &gl = GlState::shared();
+    prevFbo_ = gl.framebuffer();
+    gl.getViewport(prevViewport_);
+    prevProgram_ = gl.program();
+
+    gl.bindFramebuffer(fbo_);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture_, 0, cascade);
+    gl.viewport(0, 0, size_, size_);
+    gl.depthMask(true);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    // slopes facing away from the light need more bias than flat ground
+    gl.setEnabled(GL_POLYGON_OFFSET_FILL, true);
+    glPolygonOffset(kSlopeBias, kConstantBias);
+    ++RenderStats::frame().shadowCascades;
+}
+
+void ShadowCascades::endCascade(){
+    GlState &gl = GlState::shared();
+    gl.setEnabled(GL_POLYGON_OFFSET_FILL, false);
+    gl.bindFramebuffer(prevFbo_);
+    gl.viewport(prevViewport_[0], prevViewport_[1], prevViewport_[2], prevViewport_[3]);
+    gl.useProgram(prevProgram_);
+}
+
+void ShadowCascades::setTransform(const glm::mat4 &mvp){
+    GlState::shared().useProgram(depth_.getID());
+    if(locMVP_ >= 0) glUniformMatrix4fv(locMVP_, 1, GL_FALSE, glm::value_ptr(mvp));
+}
+
+void ShadowCascades::setInstancedTransform(const glm::mat4 &viewProj, const glm::mat4 &dequant, GLint instanceUnit){
+    GlState::shared().useProgram(depthInstanced_.getID());
+    if(locViewProj_ >= 0) glUniformMatrix4fv(locViewProj_, 1, GL_FALSE, glm::value_ptr(viewProj));
+    if(locDequant_ >= 0) glUniformMatrix4fv(locDequant_, 1, GL_FALSE, glm::value_ptr(dequant));
+    if(locInstances_ >= 0) glUniform1i(locInstances_, instanceUnit);
+}
+
+void ShadowCascades::bind(){
+    // std140 layout of the Shadows block in fragment.glsl
+    struct ShadowBlock {
+        glm::mat4 matrices[kCascades];      // world -> layer uv + depth, all in [0, 1]
+        glm::vec4 splits;                   // far view depth of each cascade
+        glm::vec4 texels;                   // world size of a texel of each cascade
+        glm::vec4 params;                   // cascades (0 = no shadows), 1 / size
+    } block;
+    const bool on = ready() && haveBounds_ && valid_;
+    for(int c = 0; c < kCascades; ++c){
+        block.matrices[c] = on ? shadowMatrix_[c] : glm::mat4(1.0f);
+        block.splits[c] = split_[c];
+        block.texels[c] = texel_[c];
+    }
+    block.params = glm::vec4(on ? float(kCascades) : 0.0f, on ? 1.0f / size_ : 0.0f, 0.0f, 0.0f);
+    FrameUniforms::shared().push(kShadowBinding, &block, sizeof(block));
+    if(texture_) GlState::shared().bindTexture(kShadowUnit, GL_TEXTURE_2D_ARRAY, texture_);
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "shader.hpp"
+
+// Cascaded shadow maps for the directional light, cached between frames.
+//
+// The view depth range of the projection is cut into kCascades slices (a blend
+// of logarithmic and uniform splits). Every cascade is an orthographic view
+// along the light, one layer of a depth texture array, and covers a sphere
+// around the eye that holds its whole slice whatever way the camera looks, so
+// turning never invalidates a cascade. Its square is padded and snapped to its
+// own texels; the cached depth stays usable until the eye drifts past the
+// padding. Depth is fitted to the scene bounds, not the view, so a caster
+// outside the view still shadows what is in it.
+//
+// update() says which layers to draw again: those that lost their coverage,
+// all of them when the light, the projection or the scene (invalidate())
+// changed, and at most one cascade per frame that only wants to recentre.
+// Standing still (or inside the house, where everything is static) costs no
+// shadow draws at all; walking costs about one small cascade now and then.
+//
+// Usage per frame, after FrameUniforms::beginFrame:
+//   mask = update(view, projection, lightDir);
+//   for each bit c of mask: beginCascade(c); <draw casters, depth only>; endCascade();
+//   bind();
+class ShadowCascades {
+public:
+    static constexpr int kCascades = 4;
+    // the Shadows uniform block and the texture unit of the depth array
+    static constexpr GLuint kShadowBinding = 4;
+    static constexpr GLint kShadowUnit = 5;
+
+    ShadowCascades() = default;
+    ~ShadowCascades();
+    ShadowCascades(const ShadowCascades&) = delete;
+    ShadowCascades& operator=(const ShadowCascades&) = delete;
+
+    // size x size per cascade; compiles shadow_depth_vertex.glsl, false (and the
+    // reason on stderr) if it doesn't build
+    bool init(int size = 2048);
+    void destroy();
+    bool ready() const { return fbo_ != 0; }
+
+    // world box of every caster and receiver: the depth range of the cascades
+    void setSceneBounds(const glm::vec3 &bmin, const glm::vec3 &bmax);
+    // casters moved: every cascade is drawn again on the next update()
+    void invalidate() { valid_ = 0; }
+
+    // fits the cascades to this view; returns a bit per cascade to draw again.
+    // projection is a GL perspective matrix, lightDir points towards the scene
+    uint32_t update(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &lightDir);
+
+    // light view-projection of a cascade as of the last update()
+    const glm::mat4 &viewProj(int cascade) const { return viewProj_[cascade]; }
+    // world size of one shadow texel of a cascade
+    float texelSize(int cascade) const { return texel_[cascade]; }
+
+    // binds the cascade's layer as the depth target and clears it; the caller then
+    // picks a depth program with one of the set*Transform() calls and draws with its
+    // own VAO, position at location 0
+    void beginCascade(int cascade);
+    // restores the caller's framebuffer, viewport and program
+    void endCascade();
+    // plain casters: mvp = viewProj(c) * model * dequantization
+    void setTransform(const glm::mat4 &mvp);
+    // instanced casters as in vertex.glsl: slot at location 3, matrices in the texture
+    // buffer bound to instanceUnit; gl_Position = viewProj * instance * dequant * position
+    void setInstancedTransform(const glm::mat4 &viewProj, const glm::mat4 &dequant, GLint instanceUnit);
+
+    // pushes the Shadows block into the frame's uniform ring and binds the
+    // depth array to kShadowUnit; an empty block (no cascades) when not ready
+    void bind();
+
+private:
+    void fit(const glm::mat4 &projection);
+
+    Shader depth_, depthInstanced_;
+    GLint locMVP_{-1}, locViewProj_{-1}, locDequant_{-1}, locInstances_{-1};
+    GLuint fbo_{0}, texture_{0};
+    int size_{0};
+
+    // fit of the splits, redone when the projection changes
+    glm::mat4 projection_{0.0f};
+    float split_[kCascades] = {};           // far view depth of each slice
+    float radius_[kCascades] = {};          // half side of the square, padding included
+    float pad_[kCascades] = {};             // drift allowed before coverage is lost
+    float texel_[kCascades] = {};
+
+    // cached cascades: light basis, snapped centre (light space xy) and depth range
+    bool haveBounds_{false};
+    glm::vec3 boundsMin_{0.0f}, boundsMax_{0.0f};
+    glm::vec3 lightDir_{0.0f};
+    glm::mat4 lightView_{1.0f};
+    glm::vec2 center_[kCascades] = {};
+    float zNear_{0.0f}, zFar_{1.0f};
+    uint32_t valid_{0};                     // bit per cascade whose layer matches its matrix
+    glm::mat4 viewProj_[kCascades];
+    glm::mat4 shadowMatrix_[kCascades];     // viewProj_ with the [-1, 1] -> [0, 1] bias
+
+    // caller state saved by beginCascade()
+    GLuint prevFbo_{0}, prevProgram_{0};
+    GLint prevViewport_[4]{};
+};
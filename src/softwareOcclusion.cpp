@@ -0,0 +1,176 @@
+#include "softwareOcclusion.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <cmath>
+
+void SoftwareOcclusion::begin(int width, int height){
+    width_ = std::max(width, 1);
+    height_ = std::max(height, 1);
+    levels_.resize(1);
+    levels_[0].assign(static_cast<size_t>(width_) * height_, 1.0f);
+    sizes_.assign(1, {width_, height_});
+}
+
+void SoftwareOcclusion::setup(const glm::vec4 clip[3], std::vector<ScreenTri> &out) const {
+    // clip against the near plane (z >= -w); the rest is handled by the screen bounds
+    glm::vec4 poly[4];
+    int n = 0;
+    for(int i = 0; i < 3; ++i){
+        const glm::vec4 &a = clip[i], &b = clip[(i + 1) % 3];
+        const float da = a.z + a.w, db = b.z + b.w;
+        if(da >= 0.0f) poly[n++] = a;
+        if((da >= 0.0f) != (db >= 0.0f)) poly[n++] = a + (b - a) * (da / (da - db));
+    }
+    if(n < 3) return;
+
+    glm::vec3 s[4];
+    for(int i = 0; i < n; ++i){
+        const float invW = 1.0f / std::max(poly[i].w, 1e-6f);
+        s[i] = glm::vec3((poly[i].x * invW * 0.5f + 0.5f) * width_,
+                         (poly[i].y * invW * 0.5f + 0.5f) * height_,
+                         poly[i].z * invW * 0.5f + 0.5f);
+    }
+    for(int k = 1; k + 1 < n; ++k){
+        glm::vec3 a = s[0], b = s[k], c = s[k + 1];
+        if(a.z > 1.0f && b.z > 1.0f && c.z > 1.0f) continue;   // beyond the far plane
+        float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+        if(std::fabs(area) < 1e-8f) continue;
+        if(area < 0.0f){ std::swap(b, c); area = -area; }
+
+        ScreenTri t;
+        t.v[0] = glm::vec2(a.x, a.y); t.v[1] = glm::vec2(b.x, b.y); t.v[2] = glm::vec2(c.x, c.y);
+        t.z0 = a.z;
+        t.dzdx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+        t.dzdy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+        // pixels whose centre can be inside
+        const float minX = std::min(a.x, std::min(b.x, c.x)), maxX = std::max(a.x, std::max(b.x, c.x));
+        const float minY = std::min(a.y, std::min(b.y, c.y)), maxY = std::max(a.y, std::max(b.y, c.y));
+        t.minX = std::max(0, static_cast<int>(std::ceil(minX - 0.5f)));
+        t.maxX = std::min(width_ - 1, static_cast<int>(std::floor(maxX - 0.5f)));
+        t.minY = std::max(0, static_cast<int>(std::ceil(minY - 0.5f)));
+        t.maxY = std::min(height_ - 1, static_cast<int>(std::floor(maxY - 0.5f)));
+        if(t.minX > t.maxX || t.minY > t.maxY) continue;
+        out.push_back(t);
+    }
+}
+
+void SoftwareOcclusion::rasterizeRows(const ScreenTri &t, int rowBegin, int rowEnd){
+    const int y0 = std::max(t.minY, rowBegin), y1 = std::min(t.maxY, rowEnd - 1);
+    if(y0 > y1) return;
+    float *depth = levels_[0].data();
+
+    // edge e: (b - a) x (p - a) >= 0 inside, stepped along the row
+    float ex[3], ey[3], e0[3];
+    const float px = t.minX + 0.5f;
+    for(int e = 0; e < 3; ++e){
+        const glm::vec2 &a = t.v[e], &b = t.v[(e + 1) % 3];
+        ex[e] = -(b.y - a.y);
+        ey[e] = b.x - a.x;
+        e0[e] = (b.x - a.x) * (y0 + 0.5f - a.y) - (b.y - a.y) * (px - a.x);
+    }
+    float zRow = t.z0 + t.dzdx * (px - t.v[0].x) + t.dzdy * (y0 + 0.5f - t.v[0].y);
+
+    for(int y = y0; y <= y1; ++y){
+        float w0 = e0[0], w1 = e0[1], w2 = e0[2], z = zRow;
+        float *row = depth + static_cast<size_t>(y) * width_;
+        for(int x = t.minX; x <= t.maxX; ++x){
+            if(w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f){
+                const float d = std::max(z, 0.0f);
+                if(d < row[x]) row[x] = d;
+            }
+            w0 += ex[0]; w1 += ex[1]; w2 += ex[2];
+            z += t.dzdx;
+        }
+        e0[0] += ey[0]; e0[1] += ey[1]; e0[2] += ey[2];
+        zRow += t.dzdy;
+    }
+}
+
+void SoftwareOcclusion::rasterize(const glm::mat4 &mvp, const glm::vec3 *positions, const unsigned int *indices,
+                                  const std::vector<MeshCluster> &clusters, const std::vector<uint8_t> &mask){
+    ThreadPool &pool = ThreadPool::shared();
+    tris_.resize(clusters.size());
+    pool.parallelFor(clusters.size(), [&](size_t i){
+        std::vector<ScreenTri> &out = tris_[i];
+        out.clear();
+        if(!mask[i]) return;
+        const MeshCluster &c = clusters[i];
+        for(uint32_t k = c.start; k + 2 < c.start + c.count; k += 3){
+            const glm::vec4 clip[3] = {mvp * glm::vec4(positions[indices[k]], 1.0f),
+                                       mvp * glm::vec4(positions[indices[k + 1]], 1.0f),
+                                       mvp * glm::vec4(positions[indices[k + 2]], 1.0f)};
+            setup(clip, out);
+        }
+    });
+
+    // horizontal bands, each owns its rows of the depth buffer
+    const int bands = std::min(height_, static_cast<int>(pool.size() + 1) * 2);
+    pool.parallelFor(static_cast<size_t>(bands), [&](size_t b){
+        const int rowBegin = static_cast<int>(b) * height_ / bands;
+        const int rowEnd = static_cast<int>(b + 1) * height_ / bands;
+        for(const auto &list : tris_)
+            for(const ScreenTri &t : list)
+                if(t.maxY >= rowBegin && t.minY < rowEnd) rasterizeRows(t, rowBegin, rowEnd);
+    });
+}
+
+void SoftwareOcclusion::buildPyramid(){
+    levels_.resize(1);
+    sizes_.resize(1);
+    while(sizes_.back().width > 1 || sizes_.back().height > 1){
+        const Level src = sizes_.back();
+        const Level dst = {(src.width + 1) / 2, (src.height + 1) / 2};
+        std::vector<float> next(static_cast<size_t>(dst.width) * dst.height);
+        const std::vector<float> &prev = levels_.back();
+        for(int y = 0; y < dst.height; ++y){
+            const int sy0 = y * 2, sy1 = std::min(sy0 + 1, src.height - 1);
+            for(int x = 0; x < dst.width; ++x){
+                const int sx0 = x * 2, sx1 = std::min(sx0 + 1, src.width - 1);
+                next[static_cast<size_t>(y) * dst.width + x] =
+                    std::max(std::max(prev[static_cast<size_t>(sy0) * src.width + sx0], prev[static_cast<size_t>(sy0) * src.width + sx1]),
+                             std::max(prev[static_cast<size_t>(sy1) * src.width + sx0], prev[static_cast<size_t>(sy1) * src.width + sx1]));
+            }
+        }
+        levels_.push_back(std::move(next));
+        sizes_.push_back(dst);
+    }
+}
+
+bool SoftwareOcclusion::visible(const glm::mat4 &mvp, const glm::vec3 &bmin, const glm::vec3 &bmax) const {
+    glm::vec2 lo(1e30f), hi(-1e30f);
+    float nearZ = 1e30f;
+    for(int i = 0; i < 8; ++i){
+        const glm::vec3 corner((i & 1) ? bmax.x : bmin.x, (i & 2) ? bmax.y : bmin.y, (i & 4) ? bmax.z : bmin.z);
+        const glm::vec4 clip = mvp * glm::vec4(corner, 1.0f);
+        if(clip.z < -clip.w || clip.w <= 1e-6f) return true;    // crosses the near plane
+        const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        lo = glm::min(lo, glm::vec2(ndc.x, ndc.y));
+        hi = glm::max(hi, glm::vec2(ndc.x, ndc.y));
+        nearZ = std::min(nearZ, ndc.z);
+    }
+    const float x0 = (lo.x * 0.5f + 0.5f) * width_, x1 = (hi.x * 0.5f + 0.5f) * width_;
+    const float y0 = (lo.y * 0.5f + 0.5f) * height_, y1 = (hi.y * 0.5f + 0.5f) * height_;
+    if(x1 < 0.0f || y1 < 0.0f || x0 > width_ || y0 > height_) return false;
+
+    int ix0 = std::max(0, static_cast<int>(std::floor(x0))), ix1 = std::min(width_ - 1, static_cast<int>(std::floor(x1)));
+    int iy0 = std::max(0, static_cast<int>(std::floor(y0))), iy1 = std::min(height_ - 1, static_cast<int>(std::floor(y1)));
+    // coarsest level where the rect is at most 4x4 texels
+    size_t level = 0;
+    while(level + 1 < levels_.size() && ((ix1 >> level) - (ix0 >> level) >= 4 || (iy1 >> level) - (iy0 >> level) >= 4))
+        ++level;
+    ix0 >>= level; ix1 >>= level; iy0 >>= level; iy1 >>= level;
+
+    const float z = nearZ * 0.5f + 0.5f;
+    const std::vector<float> &d = levels_[level];
+    const int w = sizes_[level].width;
+    for(int y = iy0; y <= iy1; ++y)
+        for(int x = ix0; x <= ix1; ++x)
+            if(z <= d[static_cast<size_t>(y) * w + x]) return true;
+    return false;
+}
+
+void SoftwareOcclusion::test(const glm::mat4 &mvp, const std::vector<MeshCluster> &clusters,
+                             std::vector<uint8_t> &mask) const {
+    for(size_t i = 0; i < clusters.size(); ++i)
+        if(mask[i] && !visible(mvp, clusters[i].bmin, clusters[i].bmax)) mask[i] = 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "mesh.hpp"
+
+// CPU occlusion culling: occluder triangles are rasterized into a small depth
+// buffer, reduced into a max-depth (Hi-Z) pyramid, and cluster boxes are
+// tested against it. Needs nothing from GL, so it's what runs on software
+// renderers (llvmpipe) where a GPU Hi-Z pass costs as much as the scene.
+//
+// Depth is sampled at pixel centres like the GPU does, so a gap narrower than
+// one occlusion pixel can hide what is behind it; boxes crossing the near
+// plane always pass.
+class SoftwareOcclusion {
+public:
+    // clear to the far plane; buffer size in pixels
+    void begin(int width, int height);
+    // depth of the masked clusters; mvp maps the positions to clip space
+    void rasterize(const glm::mat4 &mvp, const glm::vec3 *positions, const unsigned int *indices,
+                   const std::vector<MeshCluster> &clusters, const std::vector<uint8_t> &mask);
+    void buildPyramid();
+    // clears mask[i] of every masked cluster the pyramid hides
+    void test(const glm::mat4 &mvp, const std::vector<MeshCluster> &clusters, std::vector<uint8_t> &mask) const;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    // level 0 is the rasterized depth, [0, 1] like the GL depth buffer
+    const std::vector<float> &depth() const { return levels_.front(); }
+
+private:
+    // screen-space triangle, counter-clockwise after setup
+    struct ScreenTri {
+        glm::vec2 v[3];
+        float z0, dzdx, dzdy;   // depth plane through v[0]
+        int minX, maxX, minY, maxY;
+    };
+    struct Level { int width, height; };
+
+    void setup(const glm::vec4 clip[3], std::vector<ScreenTri> &out) const;
+    void rasterizeRows(const ScreenTri &t, int rowBegin, int rowEnd);
+    bool visible(const glm::mat4 &mvp, const glm::vec3 &bmin, const glm::vec3 &bmax) const;
+
+    int width_ = 0, height_ = 0;
+    std::vector<std::vector<float>> levels_{1};
+    std::vector<Level> sizes_;
+    std::vector<std::vector<ScreenTri>> tris_;   // per cluster chunk, filled in parallel
+};
@@ -0,0 +1,280 @@
+#include "textureCache.hpp"
+#include "blockCompression.hpp"
+#include "cacheFile.hpp"
+#include "mappedFile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint8_t kIdentifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+constexpr char kHashKey[] = "fwSourceHash";
+
+// KTX2 header up to the level index; every field little-endian
+struct Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth, pixelHeight, pixelDepth;
+    uint32_t layerCount, faceCount, levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset, dfdByteLength;
+    uint32_t kvdByteOffset, kvdByteLength;
+    uint64_t sgdByteOffset, sgdByteLength;
+};
+static_assert(sizeof(Header) == 80, "KTX2 header is 80 bytes");
+
+struct LevelIndex {
+    uint64_t byteOffset, byteLength, uncompressedByteLength;
+};
+
+// bytes of one 4x4 block, or of one pixel for RGBA8; 0 if unknown
+size_t unitBytes(uint32_t vkFormat) {
+    switch (vkFormat) {
+    case BakedTexture::VkRgba8: return 4;
+    case BakedTexture::VkBc1: return 8;
+    case BakedTexture::VkBc3:
+    case BakedTexture::VkBc7: return 16;
+    default: return 0;
+    }
+}
+
+size_t levelBytes(uint32_t vkFormat, int width, int height) {
+    if (vkFormat == BakedTexture::VkRgba8) return size_t(width) * height * 4;
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * unitBytes(vkFormat);
+}
+
+// box filter; odd edges drop their last row/column like glGenerateMipmap
+void downsample(const std::vector<uint8_t>& src, int width, int height, std::vector<uint8_t>& dst) {
+    const int w = std::max(width / 2, 1), h = std::max(height / 2, 1);
+    dst.resize(size_t(w) * h * 4);
+    for (int y = 0; y < h; ++y) {
+        const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+        for (int x = 0; x < w; ++x) {
+            const int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            for (int c = 0; c < 4; ++c) {
+                const int sum = src[(size_t(y0) * width + x0) * 4 + c] + src[(size_t(y0) * width + x1) * 4 + c] +
+                                src[(size_t(y1) * width + x0) * 4 + c] + src[(size_t(y1) * width + x1) * 4 + c];
+                dst[(size_t(y) * w + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+void put32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+// basic Data Format Descriptor: the colour model and where each channel sits in a block
+std::vector<uint8_t> dataFormatDescriptor(uint32_t vkFormat) {
+    struct Sample { uint32_t offset, length, channel, upper; };
+    uint32_t model = 0, count = 0;
+    uint8_t blockDim = 0;
+    Sample samples[4] = {};
+    switch (vkFormat) {
+    case BakedTexture::VkRgba8:
+        model = 1; // RGBSDA
+        count = 4;
+        samples[0] = {0, 8, 0, 255};
+        samples[1] = {8, 8, 1, 255};
+        samples[2] = {16, 8, 2, 255};
+        samples[3] = {24, 8, 15, 255};
+        break;
+    case BakedTexture::VkBc1:
+        model = 128; blockDim = 3; count = 1;
+        samples[0] = {0, 64, 0, ~0u};
+        break;
+    case BakedTexture::VkBc3:
+        model = 130; blockDim = 3; count = 2;
+        samples[0] = {0, 64, 15, ~0u};
+        samples[1] = {64, 64, 0, ~0u};
+        break;
+    case BakedTexture::VkBc7:
+        model = 134; blockDim = 3; count = 1;
+        samples[0] = {0, 128, 0, ~0u};
+        break;
+    }
+    const uint32_t blockSize = 24 + 16 * count;
+    std::vector<uint8_t> dfd;
+    put32(dfd, 4 + blockSize);
+    put32(dfd, 0);                                  // vendor Khronos, type basic
+    put32(dfd, 2 | (blockSize << 16));              // version 1.3
+    put32(dfd, model | (1u << 8) | (1u << 16));     // BT.709 primaries, linear transfer
+    put32(dfd, blockDim | (blockDim << 8));
+    put32(dfd, static_cast<uint32_t>(unitBytes(vkFormat)));
+    put32(dfd, 0);
+    for (uint32_t i = 0; i < count; ++i) {
+        const Sample& s = samples[i];
+        put32(dfd, s.offset | ((s.length - 1) << 16) | (s.channel << 24));
+        put32(dfd, 0);
+        put32(dfd, 0);
+        put32(dfd, s.upper);
+    }
+    return dfd;
+}
+
+void putKeyValue(std::vector<uint8_t>& out, const std::string& key, const std::string& value) {
+    put32(out, static_cast<uint32_t>(key.size() + 1 + value.size() + 1));
+    out.insert(out.end(), key.begin(), key.end());
+    out.push_back(0);
+    out.insert(out.end(), value.begin(), value.end());
+    out.push_back(0);
+    while (out.size() % 4) out.push_back(0);
+}
+
+} // namespace
+
+void bakeTexture(const uint8_t* rgba, int width, int height, TextureFormat format, BakedTexture& out, bool parallel) {
+    out = BakedTexture{};
+    out.width = width;
+    out.height = height;
+    std::vector<uint8_t> level(rgba, rgba + size_t(width) * height * 4), next;
+
+    BlockFormat blocks = BlockFormat::Bc7;
+    switch (format) {
+    case TextureFormat::Source:
+    case TextureFormat::Rgba8: out.vkFormat = BakedTexture::VkRgba8; break;
+    case TextureFormat::Bc7: out.vkFormat = BakedTexture::VkBc7; break;
+    case TextureFormat::Bc: {
+        bool alpha = false;
+        for (size_t i = 3; i < level.size() && !alpha; i += 4) alpha = level[i] < 255;
+        blocks = alpha ? BlockFormat::Bc3 : BlockFormat::Bc1;
+        out.vkFormat = alpha ? BakedTexture::VkBc3 : BakedTexture::VkBc1;
+        break;
+    }
+    }
+
+    std::vector<uint8_t> encoded;
+    int w = width, h = height;
+    for (;;) {
+        const std::vector<uint8_t>* bytes = &level;
+        if (out.compressed()) {
+            compressImage(blocks, level.data(), w, h, encoded, parallel);
+            bytes = &encoded;
+        }
+        out.levels.push_back({w, h, out.data.size(), bytes->size()});
+        out.data.insert(out.data.end(), bytes->begin(), bytes->end());
+        if (w == 1 && h == 1) break;
+        downsample(level, w, h, next);
+        level.swap(next);
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+    }
+}
+
+std::string TextureCache::pathFor(const std::string& imagePath, TextureFormat format) {
+    const char* suffix = format == TextureFormat::Bc ? ".bc.ktx2" :
+                         format == TextureFormat::Bc7 ? ".bc7.ktx2" : ".rgba8.ktx2";
+    const fs::path source(imagePath);
+    return (source.parent_path() / "texture_cache" / (source.filename().string() + suffix)).string();
+}
+
+uint64_t TextureCache::hashSource(const void* data, size_t size, TextureFormat format) {
+    uint64_t h = fnv1a(kFnvOffset, data, size);
+    const uint32_t tag[2] = {kVersion, static_cast<uint32_t>(format)};
+    h = fnv1a(h, tag, sizeof(tag));
+    return h ? h : 1;
+}
+
+bool TextureCache::read(const std::string& cachePath, uint64_t sourceHash, BakedTexture& out) {
+    MappedFile file(cachePath);
+    if (!file.isOpen() || file.size() < sizeof(Header)) return false;
+    const char* base = file.data();
+    const size_t size = file.size();
+
+    Header hdr;
+    std::memcpy(&hdr, base, sizeof(hdr));
+    if (std::memcmp(hdr.identifier, kIdentifier, 12) != 0 || unitBytes(hdr.vkFormat) == 0 ||
+        hdr.pixelWidth == 0 || hdr.pixelHeight == 0 || hdr.pixelDepth != 0 || hdr.layerCount != 0 ||
+        hdr.faceCount != 1 || hdr.levelCount == 0 || hdr.levelCount > 32 || hdr.supercompressionScheme != 0 ||
+        sizeof(Header) + hdr.levelCount * sizeof(LevelIndex) > size ||
+        uint64_t(hdr.kvdByteOffset) + hdr.kvdByteLength > size)
+        return false;
+
+    // key/value pairs: uint32 length, "key\0value", padded to 4 bytes
+    bool fresh = false;
+    for (uint64_t p = hdr.kvdByteOffset; p + 4 <= uint64_t(hdr.kvdByteOffset) + hdr.kvdByteLength;) {
+        uint32_t length;
+        std::memcpy(&length, base + p, 4);
+        if (p + 4 + length > size) return false;
+        const char* kv = base + p + 4;
+        const size_t keyLength = strnlen(kv, length);
+        if (keyLength + 1 < length && std::strncmp(kv, kHashKey, keyLength) == 0 && keyLength == sizeof(kHashKey) - 1) {
+            char expected[17];
+            std::snprintf(expected, sizeof(expected), "%016llx", static_cast<unsigned long long>(sourceHash));
+            fresh = length - keyLength - 1 >= 16 && std::memcmp(kv + keyLength + 1, expected, 16) == 0;
+        }
+        p += 4 + ((uint64_t(length) + 3) & ~uint64_t(3));
+    }
+    if (!fresh) {
+        std::cout << "[*] Texture cache is stale: " << cachePath << "\n";
+        return false;
+    }
+
+    out = BakedTexture{};
+    out.vkFormat = hdr.vkFormat;
+    out.width = static_cast<int>(hdr.pixelWidth);
+    out.height = static_cast<int>(hdr.pixelHeight);
+    for (uint32_t l = 0; l < hdr.levelCount; ++l) {
+        LevelIndex li;
+        std::memcpy(&li, base + sizeof(Header) + l * sizeof(LevelIndex), sizeof(li));
+        const int w = std::max(out.width >> l, 1), h = std::max(out.height >> l, 1);
+        if (li.byteLength != levelBytes(hdr.vkFormat, w, h) || li.byteOffset + li.byteLength > size) return false;
+        out.levels.push_back({w, h, out.data.size(), static_cast<size_t>(li.byteLength)});
+        out.data.insert(out.data.end(), base + li.byteOffset, base + li.byteOffset + li.byteLength);
+    }
+    return true;
+}
+
+bool TextureCache::write(const std::string& cachePath, uint64_t sourceHash, const BakedTexture& texture) {
+    const size_t levels = texture.levels.size();
+    if (levels == 0 || unitBytes(texture.vkFormat) == 0) return false;
+
+    const std::vector<uint8_t> dfd = dataFormatDescriptor(texture.vkFormat);
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(sourceHash));
+    // keys sorted by byte value; first row in the data is the bottom one
+    std::vector<uint8_t> kvd;
+    putKeyValue(kvd, "KTXorientation", "ru");
+    putKeyValue(kvd, "KTXwriter", "flame_world texture baker");
+    putKeyValue(kvd, kHashKey, hash);
+
+    Header hdr{};
+    std::memcpy(hdr.identifier, kIdentifier, 12);
+    hdr.vkFormat = texture.vkFormat;
+    hdr.typeSize = 1;
+    hdr.pixelWidth = static_cast<uint32_t>(texture.width);
+    hdr.pixelHeight = static_cast<uint32_t>(texture.height);
+    hdr.faceCount = 1;
+    hdr.levelCount = static_cast<uint32_t>(levels);
+    hdr.dfdByteOffset = static_cast<uint32_t>(sizeof(Header) + levels * sizeof(LevelIndex));
+    hdr.dfdByteLength = static_cast<uint32_t>(dfd.size());
+    hdr.kvdByteOffset = hdr.dfdByteOffset + hdr.dfdByteLength;
+    hdr.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+    // mip data goes smallest level first, each aligned to the block size
+    const uint64_t align = std::max<uint64_t>(unitBytes(texture.vkFormat), 4);
+    std::vector<LevelIndex> index(levels);
+    uint64_t offset = hdr.kvdByteOffset + hdr.kvdByteLength;
+    for (size_t l = levels; l-- > 0;) {
+        offset = (offset + align - 1) / align * align;
+        index[l] = {offset, texture.levels[l].size, texture.levels[l].size};
+        offset += texture.levels[l].size;
+    }
+
+    std::error_code ec;
+    fs::create_directories(fs::path(cachePath).parent_path(), ec);
+    return writeFileAtomically(cachePath, [&](std::ostream& os) {
+        writeAt(os, 0, &hdr, sizeof(hdr));
+        writeAt(os, sizeof(hdr), index.data(), index.size() * sizeof(LevelIndex));
+        writeAt(os, hdr.dfdByteOffset, dfd.data(), dfd.size());
+        writeAt(os, hdr.kvdByteOffset, kvd.data(), kvd.size());
+        for (size_t l = levels; l-- > 0;)
+            writeAt(os, index[l].byteOffset, texture.data.data() + texture.levels[l].offset, texture.levels[l].size);
+    });
+}
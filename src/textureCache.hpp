@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What source images are baked into:
+//   Source  nothing baked: decoded at load, RGBA8 + glGenerateMipmap
+//   Rgba8   uncompressed, mip chain precomputed
+//   Bc      BC1 for opaque images, BC3 when any pixel has alpha < 255
+//   Bc7     BC7 for everything
+enum class TextureFormat { Source, Rgba8, Bc, Bc7 };
+
+// An image with its whole mip chain (down to 1x1), rows bottom first as GL
+// wants them, ready for glTexImage2D / glCompressedTexImage2D level by level.
+struct BakedTexture {
+    // VK_FORMAT_* values, what KTX2 stores
+    static constexpr uint32_t VkRgba8 = 37, VkBc1 = 131, VkBc3 = 137, VkBc7 = 145;
+
+    uint32_t vkFormat{0};
+    int width{0}, height{0};
+    struct Level { int width, height; size_t offset, size; };
+    std::vector<Level> levels;              // 0 = full size
+    std::vector<uint8_t> data;              // every level, level 0 first
+
+    bool compressed() const { return vkFormat != VkRgba8; }
+};
+
+// rgba: width * height RGBA8 pixels. format must not be Source
+void bakeTexture(const uint8_t *rgba, int width, int height, TextureFormat format,
+                 BakedTexture &out, bool parallel = true);
+
+// Baked textures as KTX2 files in texture_cache/ next to the source image
+// (assets/wall.jpg -> assets/texture_cache/wall.jpg.bc.ktx2), one per format.
+// The key/value entry fwSourceHash ties a file to the image bytes and baker
+// version it came from; a mismatch means it is stale.
+class TextureCache {
+public:
+    static constexpr uint32_t kVersion = 1;
+
+    static std::string pathFor(const std::string &imagePath, TextureFormat format);
+    // word-wise FNV-1a of the source file, the format and kVersion
+    static uint64_t hashSource(const void *data, size_t size, TextureFormat format);
+
+    // false if missing, stale or not a KTX2 layout written by write()
+    static bool read(const std::string &cachePath, uint64_t sourceHash, BakedTexture &out);
+    static bool write(const std::string &cachePath, uint64_t sourceHash, const BakedTexture &texture);
+};
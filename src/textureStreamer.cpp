@@ -0,0 +1,369 @@
+#include "textureStreamer.hpp"
+#include "glState.hpp"
+#include "mappedFile.hpp"
+#include "threadPool.hpp"
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+
+namespace {
+
+// layers of a new array; it doubles from there up to GL_MAX_ARRAY_TEXTURE_LAYERS
+constexpr GLuint kFirstLayers = 4;
+
+GLenum compressedFormat(uint32_t vkFormat) {
+    switch (vkFormat) {
+    case BakedTexture::VkBc1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BakedTexture::VkBc3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BakedTexture::VkBc7: return GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+    default: return 0;
+    }
+}
+
+// one layer of one level
+size_t levelBytes(uint32_t vkFormat, int width, int height) {
+    if (!compressedFormat(vkFormat)) return size_t(width) * height * 4;
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * (vkFormat == BakedTexture::VkBc1 ? 8 : 16);
+}
+
+void setSampling(GLenum target, GLint maxLevel) {
+    if (maxLevel >= 0) glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, maxLevel);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+}
+
+} // namespace
+
+struct TextureStreamer::Inbox {
+    std::mutex mutex;
+    std::deque<Decoded> done;
+};
+
+TextureStreamer& TextureStreamer::shared() {
+    static TextureStreamer streamer;
+    return streamer;
+}
+
+TextureStreamer::TextureStreamer() : inbox_(std::make_shared<Inbox>()) {}
+
+TextureStreamer::~TextureStreamer() {
+    // GL objects are gone with the context by now, clear() is the owner's job
+}
+
+GLuint TextureStreamer::request(const std::string &path) {
+    auto it = byPath_.find(path);
+    if (it != byPath_.end()) {
+        ++it->second.refs;
+        return it->second.tex;
+    }
+
+    Entry e;
+    glGenTextures(1, &e.tex);
+    e.refs = 1;
+    byPath_.emplace(path, e);
+    byTex_.emplace(e.tex, path);
+    ++pending_;
+
+    std::shared_ptr<Inbox> inbox = inbox_;
+    const TextureFormat format = format_;
+    ThreadPool::shared().submit([inbox, path, format] {
+        Decoded img;
+        img.path = path;
+        decode(path, format, img);
+        std::lock_guard<std::mutex> lock(inbox->mutex);
+        inbox->done.push_back(std::move(img));
+    });
+    return e.tex;
+}
+
+void TextureStreamer::decode(const std::string &path, TextureFormat format, Decoded &img) {
+    MappedFile file(path);
+    if (!file.isOpen() || file.size() == 0) return;
+
+    uint64_t hash = 0;
+    std::string cachePath;
+    if (format != TextureFormat::Source) {
+        hash = TextureCache::hashSource(file.data(), file.size(), format);
+        cachePath = TextureCache::pathFor(path, format);
+        if (TextureCache::read(cachePath, hash, img.image)) return;
+    }
+
+    int width = 0, height = 0, channels = 0;
+    unsigned char *data = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(file.data()),
+                                                static_cast<int>(file.size()), &width, &height, &channels, 4);
+    if (!data) return;
+    // stbi's flip flag is global state, so flip here instead of racing on it
+    const size_t row = size_t(width) * 4;
+    std::vector<uint8_t> pixels(row * height);
+    for (int y = 0; y < height; ++y)
+        std::memcpy(&pixels[row * (height - 1 - y)], data + row * y, row);
+    stbi_image_free(data);
+
+    if (format == TextureFormat::Source) {
+        img.image.vkFormat = BakedTexture::VkRgba8;
+        img.image.width = width;
+        img.image.height = height;
+        img.image.levels.push_back({width, height, 0, pixels.size()});
+        img.image.data = std::move(pixels);
+        img.generateMips = true;
+        return;
+    }
+    bakeTexture(pixels.data(), width, height, format, img.image);
+    TextureCache::write(cachePath, hash, img.image);
+}
+
+void TextureStreamer::release(GLuint tex) {
+    auto t = byTex_.find(tex);
+    if (t == byTex_.end()) return;
+    auto it = byPath_.find(t->second);
+    if (--it->second.refs > 0) return;
+    // a decode still in flight lands in update() and is dropped there
+    Entry &e = it->second;
+    if (!e.resident && pending_ > 0) --pending_;
+    residentBytes_ -= e.bytes;
+    if (e.handle) glMakeTextureHandleNonResidentARB(e.handle);
+    if (e.array >= 0) releaseLayer(e);
+    glDeleteTextures(1, &tex);
+    GlState::shared().invalidate();
+    byPath_.erase(it);
+    byTex_.erase(t);
+}
+
+bool TextureStreamer::resident(GLuint tex) const {
+    auto t = byTex_.find(tex);
+    if (t == byTex_.end()) return false;
+    return byPath_.at(t->second).resident;
+}
+
+TextureStreamer::Slot TextureStreamer::slot(GLuint tex) const {
+    Slot s;
+    auto t = byTex_.find(tex);
+    if (t == byTex_.end()) return s;
+    const Entry &e = byPath_.at(t->second);
+    if (!e.resident) return s;
+    if (e.array >= 0) {
+        s.target = GL_TEXTURE_2D_ARRAY;
+        s.texture = arrays_[e.array].texture;
+        s.layer = e.layer;
+    } else {
+        s.texture = e.tex;
+        s.handle = e.handle;
+    }
+    return s;
+}
+
+void TextureStreamer::update(size_t byteBudget) {
+    size_t spent = 0;
+    for (;;) {
+        Decoded img;
+        {
+            std::lock_guard<std::mutex> lock(inbox_->mutex);
+            if (inbox_->done.empty()) return;
+            const size_t bytes = inbox_->done.front().image.data.size();
+            if (spent > 0 && spent + bytes > byteBudget) return;
+            img = std::move(inbox_->done.front());
+            inbox_->done.pop_front();
+        }
+        spent += img.image.data.size();
+
+        auto it = byPath_.find(img.path);
+        if (it == byPath_.end() || it->second.resident) continue; // released meanwhile
+        --pending_;
+        if (img.image.levels.empty()) {
+            std::cerr << "Failed to load texture: " << img.path << "\n";
+            continue;
+        }
+        // GL-generated mips would have to be rebuilt for every layer, those stay separate
+        if (binding_ == TextureBinding::Arrays && !img.generateMips) uploadToArray(it->second, img);
+        else upload(it->second, img);
+        it->second.resident = true;
+        // a generated chain adds a third on top of level 0
+        it->second.bytes = img.generateMips ? img.image.data.size() * 4 / 3 : img.image.data.size();
+        residentBytes_ += it->second.bytes;
+    }
+}
+
+bool TextureStreamer::stage(const std::vector<uint8_t> &bytes) {
+    if (!pbos_[0]) glGenBuffers(kPboCount, pbos_);
+
+    // round-robin PBOs: by the time one comes around again its last copy has finished
+    GlState &gl = GlState::shared();
+    gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos_[nextPbo_]);
+    nextPbo_ = (nextPbo_ + 1) % kPboCount;
+    const GLsizeiptr size = static_cast<GLsizeiptr>(bytes.size());
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!dst) {
+        gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+    }
+    std::memcpy(dst, bytes.data(), bytes.size());
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    return true;
+}
+
+void TextureStreamer::upload(Entry &e, const Decoded &img) {
+    const std::vector<uint8_t> &pixels = img.image.data;
+    const bool staged = stage(pixels);
+    const GLenum compressed = compressedFormat(img.image.vkFormat);
+
+    GlState &gl = GlState::shared();
+    gl.bindTexture(0, GL_TEXTURE_2D, e.tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    const GLint levels = static_cast<GLint>(img.image.levels.size());
+    for (GLint l = 0; l < levels; ++l) {
+        const BakedTexture::Level &level = img.image.levels[l];
+        // an offset into the PBO, or a pointer when mapping failed
+        const void *src = staged ? reinterpret_cast<const void*>(level.offset) : pixels.data() + level.offset;
+        if (compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D, l, compressed, level.width, level.height, 0,
+                                   static_cast<GLsizei>(level.size), src);
+        else
+            glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, src);
+    }
+    // unpacks from client memory elsewhere must not read the PBO
+    gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (img.generateMips) glGenerateMipmap(GL_TEXTURE_2D);
+    setSampling(GL_TEXTURE_2D, img.generateMips ? -1 : levels - 1);
+
+    // the texture's state is frozen from here on
+    if (binding_ == TextureBinding::Bindless) {
+        e.handle = glGetTextureHandleARB(e.tex);
+        glMakeTextureHandleResidentARB(e.handle);
+    }
+}
+
+bool TextureStreamer::growArray(TextureArray &a) {
+    GLint maxLayers = 256;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    const GLuint capacity = std::min<GLuint>(a.capacity ? a.capacity * 2 : kFirstLayers, static_cast<GLuint>(maxLayers));
+    if (capacity <= a.capacity) return false;
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    GlState &gl = GlState::shared();
+    gl.bindTexture(0, GL_TEXTURE_2D_ARRAY, texture);
+    // storage only: with an unpack buffer bound the null pointer would be an offset into it
+    gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    const GLenum compressed = compressedFormat(a.vkFormat);
+    for (int l = 0; l < a.levels; ++l) {
+        const int w = std::max(a.width >> l, 1), h = std::max(a.height >> l, 1);
+        if (compressed)
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l, compressed, w, h, capacity, 0,
+                                   static_cast<GLsizei>(levelBytes(a.vkFormat, w, h) * capacity), nullptr);
+        else
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGBA8, w, h, capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    setSampling(GL_TEXTURE_2D_ARRAY, a.levels - 1);
+
+    if (a.texture) {
+        // GPU-side copy of the layers handed out so far, the images are long gone from memory
+        for (int l = 0; l < a.levels; ++l) {
+            const int w = std::max(a.width >> l, 1), h = std::max(a.height >> l, 1);
+            glCopyImageSubData(a.texture, GL_TEXTURE_2D_ARRAY, l, 0, 0, 0,
+                               texture, GL_TEXTURE_2D_ARRAY, l, 0, 0, 0, w, h, static_cast<GLsizei>(a.used));
+        }
+        glDeleteTextures(1, &a.texture);
+        gl.invalidate();
+        gl.bindTexture(0, GL_TEXTURE_2D_ARRAY, texture);
+        ++generation_;
+    }
+    a.texture = texture;
+    a.capacity = capacity;
+    return true;
+}
+
+void TextureStreamer::uploadToArray(Entry &e, const Decoded &img) {
+    const BakedTexture &image = img.image;
+    const int levels = static_cast<int>(image.levels.size());
+
+    // a matching array with room, then one that can still grow, else a fresh one
+    auto matches = [&](const TextureArray &a) {
+        return a.texture && a.vkFormat == image.vkFormat && a.width == image.width && a.height == image.height &&
+               a.levels == levels;
+    };
+    int index = -1;
+    for (size_t i = 0; i < arrays_.size() && index < 0; ++i)
+        if (matches(arrays_[i]) && (!arrays_[i].freeLayers.empty() || arrays_[i].used < arrays_[i].capacity))
+            index = static_cast<int>(i);
+    for (size_t i = 0; i < arrays_.size() && index < 0; ++i)
+        if (matches(arrays_[i]) && growArray(arrays_[i])) index = static_cast<int>(i);
+    if (index < 0) {
+        auto unused = std::find_if(arrays_.begin(), arrays_.end(), [](const TextureArray &a) { return !a.texture; });
+        index = static_cast<int>(unused - arrays_.begin());
+        if (unused == arrays_.end()) arrays_.emplace_back();
+        TextureArray &a = arrays_[index];
+        a = TextureArray{};
+        a.vkFormat = image.vkFormat;
+        a.width = image.width;
+        a.height = image.height;
+        a.levels = levels;
+        growArray(a);
+    }
+
+    TextureArray &a = arrays_[index];
+    GLuint layer = a.used;
+    if (!a.freeLayers.empty()) {
+        layer = a.freeLayers.back();
+        a.freeLayers.pop_back();
+    } else {
+        ++a.used;
+    }
+    ++a.live;
+    e.array = index;
+    e.layer = layer;
+
+    const bool staged = stage(image.data);
+    const GLenum compressed = compressedFormat(image.vkFormat);
+    GlState &gl = GlState::shared();
+    gl.bindTexture(0, GL_TEXTURE_2D_ARRAY, a.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (int l = 0; l < levels; ++l) {
+        const BakedTexture::Level &level = image.levels[l];
+        const void *src = staged ? reinterpret_cast<const void*>(level.offset) : image.data.data() + level.offset;
+        if (compressed)
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, static_cast<GLint>(layer), level.width,
+                                      level.height, 1, compressed, static_cast<GLsizei>(level.size), src);
+        else
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, static_cast<GLint>(layer), level.width, level.height, 1,
+                            GL_RGBA, GL_UNSIGNED_BYTE, src);
+    }
+    gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureStreamer::releaseLayer(Entry &e) {
+    TextureArray &a = arrays_[e.array];
+    e.array = -1;
+    if (--a.live > 0) {
+        a.freeLayers.push_back(e.layer);
+        return;
+    }
+    // the last layer went: the slot in arrays_ is free for any format
+    glDeleteTextures(1, &a.texture);
+    a = TextureArray{};
+}
+
+void TextureStreamer::clear() {
+    for (auto &p : byPath_) {
+        if (p.second.handle) glMakeTextureHandleNonResidentARB(p.second.handle);
+        glDeleteTextures(1, &p.second.tex);
+    }
+    for (TextureArray &a : arrays_)
+        if (a.texture) glDeleteTextures(1, &a.texture);
+    arrays_.clear();
+    byPath_.clear();
+    byTex_.clear();
+    pending_ = 0;
+    residentBytes_ = 0;
+    if (pbos_[0]) glDeleteBuffers(kPboCount, pbos_);
+    for (GLuint &pbo : pbos_) pbo = 0;
+    GlState::shared().invalidate();
+    std::lock_guard<std::mutex> lock(inbox_->mutex);
+    inbox_->done.clear();
+}
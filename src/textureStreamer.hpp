@@ -0,0 +1,126 @@
+#pragma once
+#include <GL/glew.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "textureCache.hpp"
+
+// Loads textures off the render thread.
+//
+// request() hands out a GL texture name right away and queues the file for
+// decoding on the shared ThreadPool. update(), called once per frame on the
+// GL thread, uploads finished images through a small ring of pixel unpack
+// buffers until the per-frame byte budget is spent. Until a texture is
+// resident callers draw with their placeholder (material colour) instead.
+//
+// Requests are deduplicated by path across every Model and refcounted.
+//
+// With a baked format (setFormat) the decode job reads the KTX2 from
+// texture_cache/ (textureCache.hpp) and bakes it on a miss: mip chain and
+// BCn blocks come from disk, the GPU gets them with glCompressedTexImage2D.
+//
+// How resident textures reach the shaders (setBinding):
+//   Separate  a GL_TEXTURE_2D each, bound for every batch that samples it
+//   Arrays    baked images of equal format, size and mip count share a
+//             GL_TEXTURE_2D_ARRAY, a layer each; the layer is per-draw data.
+//             Arrays start small and double through glCopyImageSubData
+//             (ARB_copy_image). Source images (GL-built mips) stay separate
+//   Bindless  a GL_TEXTURE_2D each plus a resident ARB_bindless_texture
+//             handle, which the shader takes from per-draw data
+enum class TextureBinding { Separate, Arrays, Bindless };
+
+class TextureStreamer {
+public:
+    static TextureStreamer& shared();
+
+    TextureStreamer();
+    ~TextureStreamer();
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // GL thread only; the format applies to requests made after the call.
+    // The caller checks that the driver takes it
+    void setFormat(TextureFormat format) { format_ = format; }
+    TextureFormat format() const { return format_; }
+    // GL thread only, before the first request(); the caller checks the extensions
+    void setBinding(TextureBinding binding) { binding_ = binding; }
+    TextureBinding binding() const { return binding_; }
+    GLuint request(const std::string &path);
+    void release(GLuint tex);
+    bool resident(GLuint tex) const;
+
+    // where a resident texture is sampled from; texture 0 while it isn't resident.
+    // With Arrays the name request() returned never gets storage of its own
+    struct Slot {
+        GLenum target = GL_TEXTURE_2D;
+        GLuint texture = 0;
+        GLuint layer = 0;           // GL_TEXTURE_2D_ARRAY only
+        GLuint64 handle = 0;        // Bindless only
+    };
+    Slot slot(GLuint tex) const;
+    // bumped when an array grows: the slots of its textures name a new texture
+    uint32_t generation() const { return generation_; }
+
+    // upload decoded images, at least one per call even if it exceeds the budget
+    void update(size_t byteBudget = 8u << 20);
+    // drop every texture and PBO; call while the context is still current
+    void clear();
+
+    size_t pending() const { return pending_; }
+    // GPU memory of the resident textures, mips included
+    size_t residentBytes() const { return residentBytes_; }
+
+private:
+    struct Decoded {
+        std::string path;
+        BakedTexture image;         // no levels on failure
+        bool generateMips = false;  // Source: level 0 only, GL builds the rest
+    };
+    // shared with the decode jobs, so a job finishing late never touches a dead streamer
+    struct Inbox;
+
+    struct Entry {
+        GLuint tex = 0;
+        int refs = 0;
+        bool resident = false;
+        size_t bytes = 0;
+        int array = -1;             // index into arrays_, -1 = its own texture
+        GLuint layer = 0;
+        GLuint64 handle = 0;
+    };
+
+    // one GL_TEXTURE_2D_ARRAY per format, size and mip count (or more once one is full)
+    struct TextureArray {
+        uint32_t vkFormat = 0;
+        int width = 0, height = 0, levels = 0;
+        GLuint texture = 0;         // 0 once every layer is released
+        GLuint capacity = 0, used = 0;  // used: layers ever handed out
+        std::vector<GLuint> freeLayers;
+        size_t live = 0;
+    };
+
+    // worker thread: cache hit, or decode (and bake) the source image
+    static void decode(const std::string &path, TextureFormat format, Decoded &img);
+    void upload(Entry &e, const Decoded &img);
+    // maps the next PBO of the ring and copies the image in; false -> source from client memory
+    bool stage(const std::vector<uint8_t> &bytes);
+    // picks (or makes room for) a layer of a matching array, uploads into it
+    void uploadToArray(Entry &e, const Decoded &img);
+    bool growArray(TextureArray &a);
+    void releaseLayer(Entry &e);
+
+    std::shared_ptr<Inbox> inbox_;
+    std::unordered_map<std::string, Entry> byPath_;
+    std::unordered_map<GLuint, std::string> byTex_;
+    size_t pending_ = 0;
+    size_t residentBytes_ = 0;
+    TextureFormat format_ = TextureFormat::Source;
+    TextureBinding binding_ = TextureBinding::Separate;
+    std::vector<TextureArray> arrays_;
+    uint32_t generation_ = 0;
+
+    static constexpr int kPboCount = 3;
+    GLuint pbos_[kPboCount] = {};
+    int nextPbo_ = 0;
+};
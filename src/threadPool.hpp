@@ -0,0 +1,39 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads fed from one FIFO queue.
+class ThreadPool {
+public:
+    // 0 = one worker per hardware thread, minus the calling one
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // fire and forget; the job must not throw
+    void submit(std::function<void()> job);
+
+    // runs fn(i) for every i in [0, count) and returns when all are done.
+    // The calling thread takes part, so this is safe to call from a worker.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+    // process-wide pool for loaders and other CPU-side work
+    static ThreadPool& shared();
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> jobs_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+};
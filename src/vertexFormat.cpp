@@ -0,0 +1,68 @@
+#include "vertexFormat.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+uint16_t floatToHalf(float value){
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const uint32_t absBits = bits & 0x7fffffffu;
+
+    if(absBits >= 0x7f800000u)                      // inf / nan
+        return static_cast<uint16_t>(sign | 0x7c00u | (absBits > 0x7f800000u ? 0x200u : 0u));
+    if(absBits >= 0x477ff000u)                      // rounds past 65504
+        return static_cast<uint16_t>(sign | 0x7c00u);
+    if(absBits < 0x38800000u){                      // under the smallest normal half: denormal
+        if(absBits < 0x33000000u) return static_cast<uint16_t>(sign);
+        // value / 2^-24 = mantissa (with the implicit bit) >> (126 - exponent)
+        const uint32_t mantissa = (absBits & 0x7fffffu) | 0x800000u;
+        const uint32_t shift = 126u - (absBits >> 23);
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1u), halfway = 1u << (shift - 1u);
+        if(rest > halfway || (rest == halfway && (half & 1u))) ++half;
+        return static_cast<uint16_t>(sign | half);
+    }
+    // rebias the exponent, drop 13 mantissa bits; a carry rolls into the exponent as it should
+    uint32_t half = (absBits - 0x38000000u) >> 13;
+    const uint32_t rest = absBits & 0x1fffu;
+    if(rest > 0x1000u || (rest == 0x1000u && (half & 1u))) ++half;
+    return static_cast<uint16_t>(sign | half);
+}
+
+glm::vec2 octEncode(const glm::vec3 &n){
+    const float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if(l1 <= 0.0f) return glm::vec2(0.0f);
+    glm::vec2 e(n.x / l1, n.y / l1);
+    if(n.z < 0.0f){
+        // lower hemisphere folds over the diagonals
+        const glm::vec2 s(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+        e = glm::vec2((1.0f - std::fabs(e.y)) * s.x, (1.0f - std::fabs(e.x)) * s.y);
+    }
+    return e;
+}
+
+void packVertices(const MeshVertex *vertices, size_t count, const glm::vec3 &bmin, const glm::vec3 &bmax,
+                  std::vector<PackedVertex> &out){
+    out.resize(count);
+    const glm::vec3 extent = bmax - bmin;
+    auto quantize = [](float v, float lo, float size){
+        if(size <= 0.0f) return uint16_t(0);
+        const float q = std::round((v - lo) / size * 65535.0f);
+        return static_cast<uint16_t>(std::min(std::max(q, 0.0f), 65535.0f));
+    };
+    auto snorm = [](float v){
+        return static_cast<int16_t>(std::round(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f));
+    };
+    for(size_t i = 0; i < count; ++i){
+        const MeshVertex &v = vertices[i];
+        PackedVertex &p = out[i];
+        for(int k = 0; k < 3; ++k) p.pos[k] = quantize(v.pos[k], bmin[k], extent[k]);
+        p.pad = 0;
+        const glm::vec2 oct = octEncode(v.normal);
+        p.normal[0] = snorm(oct.x);
+        p.normal[1] = snorm(oct.y);
+        p.uv[0] = floatToHalf(v.uv.x);
+        p.uv[1] = floatToHalf(v.uv.y);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "mesh.hpp"
+
+// Packed GPU layout of MeshVertex, 16 bytes instead of 32:
+//   pos     3 x uint16, normalized against the mesh AABB (pos = bmin + q * (bmax - bmin)),
+//           16 bits over casa.obj's 23 m diagonal are well under a millimetre
+//   normal  2 x snorm16, octahedral encoding
+//   uv      2 x half float
+// vertex.glsl decodes it with uPosOffset/uPosScale in its PACKED_VERTEX variant.
+struct PackedVertex {
+    uint16_t pos[3];
+    uint16_t pad;
+    int16_t normal[2];
+    uint16_t uv[2];
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex is uploaded as is");
+
+void packVertices(const MeshVertex *vertices, size_t count, const glm::vec3 &bmin, const glm::vec3 &bmax,
+                  std::vector<PackedVertex> &out);
+
+// round to nearest even, overflow to infinity, tiny values to denormals/zero
+uint16_t floatToHalf(float value);
+// unit vector -> [-1, 1]^2
+glm::vec2 octEncode(const glm::vec3 &n);
@@ -1,21 +1,91 @@
 #version 330 core
+#extension GL_ARB_shader_draw_parameters : enable
+// варианты (Model::shaderDefines): PACKED_VERTEX, INSTANCED, RIGID; TEXTURED, TEXTURE_ARRAY и
+// BINDLESS только для fragment.glsl
 layout(location = 0) in vec3 inPos;
-layout(location = 1) in vec3 inNormal;
+layout(location = 1) in vec4 inNormal;  // xyz, или октаэдр в xy при PACKED_VERTEX
 layout(location = 2) in vec2 inUV;
 
-uniform mat4 MVP;
-uniform mat4 model;
-
 out vec3 vNormal;
 out vec2 vUV;
 out vec3 vWorldPos;
+flat out int vDrawID;       // index into the Materials block
+
+// раз в кадр, FrameUniforms::FrameBlock; тот же блок в fragment.glsl
+layout(std140) uniform Frame {
+    mat4 uView;
+    mat4 uProjection;
+    mat4 uViewProj;
+    vec4 uLightDir;
+    vec4 uAmbient;
+};
+
+// раз на draw, из кольца FrameUniforms (Model::pushObject)
+layout(std140) uniform Object {
+    mat4 uModel;
+    mat4 uMVP;
+    mat4 uNormalMatrix;     // transpose(inverse(mat3(model))), считается на CPU
+    // распаковка PackedVertex (vertexFormat.hpp): позиция нормирована по AABB модели
+    vec4 uPosOffset;
+    vec4 uPosScale;
+};
+
+#ifdef INSTANCED
+layout(location = 3) in uint inInstance; // слот копии в uInstances
+
+// Model::renderInstances: семь texel'ов RGBA32F на копию — матрица и столбцы
+// её матрицы нормалей, посчитанной в InstanceBuffer один раз на копию
+uniform samplerBuffer uInstances;
+// glDrawElementsInstanced рисует по одному draw, номер цвета приходит отсюда
+uniform int uDrawBase;
+#endif
+
+#ifdef PACKED_VERTEX
+// нормаль в октаэдрической развёртке
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        vec2 s = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * s;
+    }
+    return normalize(n);
+}
+#endif
 
 void main() {
-    vec4 worldPos = model * vec4(inPos, 1.0);
+#ifdef PACKED_VERTEX
+    vec3 pos = uPosOffset.xyz + inPos * uPosScale.xyz;
+    vec3 normal = octDecode(inNormal.xy);
+#else
+    vec3 pos = inPos;
+    vec3 normal = inNormal.xyz;
+#endif
+
+#ifdef INSTANCED
+    int base = int(inInstance) * 7;
+    mat4 M = mat4(texelFetch(uInstances, base), texelFetch(uInstances, base + 1),
+                  texelFetch(uInstances, base + 2), texelFetch(uInstances, base + 3));
+    vec4 worldPos = M * vec4(pos, 1.0);
+#ifdef RIGID
+    mat3 normalMat = mat3(M);   // поворот и равномерный масштаб: normalize ниже снимает масштаб
+#else
+    mat3 normalMat = mat3(texelFetch(uInstances, base + 4).xyz, texelFetch(uInstances, base + 5).xyz,
+                          texelFetch(uInstances, base + 6).xyz);
+#endif
+    vDrawID = uDrawBase;
+    gl_Position = uViewProj * worldPos;
+#else
+    vec4 worldPos = uModel * vec4(pos, 1.0);
+    mat3 normalMat = mat3(uNormalMatrix);
+#ifdef GL_ARB_shader_draw_parameters
+    vDrawID = gl_DrawIDARB;
+#else
+    vDrawID = 0;            // без расширения каждый цвет рисуется отдельным батчем
+#endif
+    gl_Position = uMVP * vec4(pos, 1.0);
+#endif
+
     vWorldPos = worldPos.xyz;
-    // корректная трансформация нормали
-    mat3 normalMat = mat3(transpose(inverse(model)));
-    vNormal = normalize(normalMat * inNormal);
+    vNormal = normalize(normalMat * normal);
     vUV = inUV;
-    gl_Position = MVP * vec4(inPos, 1.0);
 }